@@ -0,0 +1,77 @@
+/*
+ * Helpers shared by the benchmarks.
+ *
+ * TMeasure repeats an operation until at least 'mintime' nanoseconds
+ * have passed and reports the average wall time and the number of X11
+ * requests per operation. The X server is synchronized before and after
+ * the run so that its work is included in the time.
+ */
+
+#ifndef _TOAD_BENCHMARK_HH
+#define _TOAD_BENCHMARK_HH
+
+#define _TOAD_PRIVATE
+
+#include <toad/toad.hh>
+#include <X11/Xlib.h>
+
+#include <iostream>
+#include <stdint.h>
+#include <time.h>
+
+namespace toad {
+
+static int64_t
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+class TMeasure
+{
+    int64_t t0, mintime;
+    unsigned long r0;
+    unsigned n;
+  public:
+    TMeasure(int64_t mintime=200000000LL) {
+      this->mintime = mintime;
+      n = 0;
+      XSync(x11display, False);
+      r0 = XNextRequest(x11display);
+      t0 = now();
+    }
+    //! true while the operation shall be repeated
+    bool more() {
+      if (n>=3 && now()-t0 >= mintime)
+        return false;
+      ++n;
+      return true;
+    }
+    //! print '<name> <args> n=... ns/op=... requests/op=...'
+    void report(const string &name, const string &args) {
+      unsigned long r1 = XNextRequest(x11display);
+      XSync(x11display, False);
+      int64_t t1 = now();
+      cout << name
+           << " " << args
+           << " n=" << n
+           << " ns/op=" << (t1-t0) / n
+           << " requests/op=" << (double)(r1-r0) / n
+           << endl;
+    }
+};
+
+// let the widgets handle the messages created by their setup
+static void
+handleMessages()
+{
+  toad::flush();
+  while(TOADBase::peekMessage())
+    TOADBase::handleMessage();
+}
+
+} // namespace toad
+
+#endif
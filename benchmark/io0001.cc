@@ -0,0 +1,151 @@
+/*
+ * Wakeup latency of the message loop with 1000 idle TIOObserver.
+ *
+ * A child process writes its CLOCK_MONOTONIC time into a pipe once per
+ * millisecond and the observer at the other end measures how long it
+ * took the message loop to call canRead(). The I/O engine is choosen
+ * with --io-engine select|epoll.
+ *
+ * The idle observers use eventfd(2) so that the select engine stays
+ * below FD_SETSIZE.
+ */
+
+#include <toad/toad.hh>
+#include <toad/ioobserver.hh>
+#include <toad/simpletimer.hh>
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+
+using namespace toad;
+
+static const unsigned NOBSERVERS = 1000;
+static const unsigned NSAMPLES   = 2000;
+
+static int64_t
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+class TIdle:
+  public TIOObserver
+{
+  public:
+    TIdle(int fd):TIOObserver(fd) {}
+    void canRead() {
+      uint64_t v;
+      if (read(fd(), &v, sizeof(v))<0)
+        cerr << "unexpected wakeup" << endl;
+    }
+};
+
+class TPing:
+  public TIOObserver
+{
+    vector<int64_t> samples;
+  public:
+    TPing(int fd):TIOObserver(fd) {}
+    void canRead();
+};
+
+void
+TPing::canRead()
+{
+  int64_t sent;
+  while(read(fd(), &sent, sizeof(sent))==sizeof(sent))
+    samples.push_back(now()-sent);
+  if (samples.size() < NSAMPLES)
+    return;
+
+  sort(samples.begin(), samples.end());
+  int64_t sum = 0;
+  for(size_t i=0; i<samples.size(); ++i)
+    sum += samples[i];
+  cout << "io.wakeup"
+       << " engine=" << TOADBase::getIOEngineName()
+       << " observers=" << NOBSERVERS
+       << " n=" << samples.size()
+       << " ns/op=" << sum / (int64_t)samples.size()
+       << " median=" << samples[samples.size()/2]
+       << " p99=" << samples[samples.size()*99/100]
+       << " min=" << samples.front()
+       << endl;
+  setFD(-1);
+  postQuitMessage(0);
+}
+
+// releases the child process once the message loop is running
+class TGo:
+  public TSimpleTimer
+{
+    int _fd;
+  public:
+    TGo(int fd) { _fd = fd; startTimer(0, 1000); }
+    void tick() {
+      if (write(_fd, "g", 1)!=1)
+        cerr << "failed to start writer" << endl;
+      stopTimer();
+    }
+};
+
+int
+main(int argc, char **argv, char **envv)
+{
+  int fd_ping[2], fd_go[2];
+  if (pipe(fd_ping)<0 || pipe(fd_go)<0) {
+    perror("pipe");
+    return 1;
+  }
+
+  pid_t pid = fork();
+  if (pid==0) {
+    close(fd_ping[0]);
+    close(fd_go[1]);
+    char c;
+    if (read(fd_go[0], &c, 1)!=1)
+      _exit(1);
+    for(unsigned i=0; i<NSAMPLES; ++i) {
+      int64_t t = now();
+      if (write(fd_ping[1], &t, sizeof(t))!=sizeof(t))
+        _exit(1);
+      usleep(1000);
+    }
+    _exit(0);
+  }
+  close(fd_ping[1]);
+  close(fd_go[0]);
+
+  toad::initialize(argc, argv, envv); {
+    vector<TIdle*> idle;
+    for(unsigned i=0; i<NOBSERVERS; ++i) {
+      int fd = eventfd(0, EFD_NONBLOCK);
+      if (fd<0) {
+        perror("eventfd");
+        break;
+      }
+      idle.push_back(new TIdle(fd));
+    }
+    TPing ping(fd_ping[0]);
+    TGo start(fd_go[1]);
+    TWindow wnd(NULL, "io0001");
+    toad::mainLoop();
+    for(size_t i=0; i<idle.size(); ++i) {
+      int fd = idle[i]->fd();
+      delete idle[i];
+      close(fd);
+    }
+  } toad::terminate();
+
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * TTextArea::paint with text models of 100 to 100000 lines.
+ *
+ * Measures repainting the whole window at the top and at the end of
+ * the text, which shows whether painting depends on the model size.
+ */
+
+#include "bench.hh"
+#include <toad/textarea.hh>
+
+#include <sstream>
+
+using namespace toad;
+
+int
+main(int argc, char **argv, char **envv)
+{
+  toad::initialize(argc, argv, envv); {
+    TTextModel model;
+    TTextArea *view = new TTextArea(0, "paint0001", &model);
+    view->setSize(640, 480);
+    TWindow::createParentless();
+    TOADBase::bAppIsRunning = true;
+    handleMessages();
+
+    for(unsigned lines=100; lines<=100000; lines*=10) {
+      ostringstream text;
+      for(unsigned i=0; i<lines; ++i)
+        text << "line " << i << ": The quick brown fox jumps over the lazy dog.\n";
+      model.setValue(text.str());
+      handleMessages();
+
+      ostringstream args;
+      args << "lines=" << lines;
+
+      view->setCursor(0, 0);
+      handleMessages();
+      TMeasure top;
+      while(top.more()) {
+        view->invalidateWindow();
+        view->paintNow();
+      }
+      top.report("textarea.paint.top", args.str());
+
+      view->setCursor(0, lines-1);
+      handleMessages();
+      TMeasure bottom;
+      while(bottom.more()) {
+        view->invalidateWindow();
+        view->paintNow();
+      }
+      bottom.report("textarea.paint.bottom", args.str());
+    }
+    delete view;
+  } toad::terminate();
+  return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * TTable::paint with 100 to 100000 rows of four string columns.
+ *
+ * Measures repainting the whole window at the first and the last row.
+ */
+
+#include "bench.hh"
+#include <toad/table.hh>
+
+#include <sstream>
+#include <vector>
+
+using namespace toad;
+
+static const size_t NCOLS = 4;
+
+class TBenchAdapter:
+  public TSimpleTableAdapter
+{
+    vector<string> *cells;
+  public:
+    TBenchAdapter(vector<string> *cells) { this->cells = cells; }
+    size_t getRows() { return cells->size() / NCOLS; }
+    size_t getCols() { return NCOLS; }
+    void tableEvent(TTableEvent &te) {
+      handleString(te, &(*cells)[te.row * NCOLS + te.col]);
+    }
+};
+
+int
+main(int argc, char **argv, char **envv)
+{
+  toad::initialize(argc, argv, envv); {
+    vector<string> cells;
+    TTable *view = new TTable(0, "paint0002");
+    view->setSize(640, 480);
+    view->setRowHeaderRenderer(new TDefaultTableHeaderRenderer);
+    TWindow::createParentless();
+    TOADBase::bAppIsRunning = true;
+    handleMessages();
+
+    for(size_t rows=100; rows<=100000; rows*=10) {
+      cells.clear();
+      for(size_t r=0; r<rows; ++r) {
+        for(size_t c=0; c<NCOLS; ++c) {
+          ostringstream s;
+          s << "cell " << c << ", " << r;
+          cells.push_back(s.str());
+        }
+      }
+      view->setAdapter(new TBenchAdapter(&cells));
+      handleMessages();
+
+      ostringstream args;
+      args << "rows=" << rows << " cols=" << NCOLS;
+
+      view->setCursor(0, 0);
+      handleMessages();
+      TMeasure top;
+      while(top.more()) {
+        view->invalidateWindow();
+        view->paintNow();
+      }
+      top.report("table.paint.top", args.str());
+
+      view->setCursor(0, rows-1);
+      handleMessages();
+      TMeasure bottom;
+      while(bottom.more()) {
+        view->invalidateWindow();
+        view->paintNow();
+      }
+      bottom.report("table.paint.bottom", args.str());
+    }
+    delete view;
+  } toad::terminate();
+  return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * TFigureEditor::paint and findFigureAt with 100 to 100000 figures.
+ *
+ * The figures are placed on a grid 40 pixels apart, so the window shows
+ * about the same number of figures for all model sizes while the model
+ * grows. figureeditor.print.raster paints the same area with TRasterPen,
+ * which needs no X11 requests.
+ */
+
+#include "bench.hh"
+#include <toad/figureeditor.hh>
+#include <toad/figuremodel.hh>
+#include <toad/figure.hh>
+#include <toad/rasterpen.hh>
+
+#include <sstream>
+#include <cstdlib>
+#include <cmath>
+
+using namespace toad;
+
+static void
+fill(TFigureModel &model, unsigned n)
+{
+  unsigned columns = (unsigned)ceil(sqrt((double)n));
+  TFigureVector figures;
+  for(unsigned i=0; i<n; ++i) {
+    TCoord x = (i % columns) * 40 + 5;
+    TCoord y = (i / columns) * 40 + 5;
+    TFigure *f = 0;
+    switch(i%4) {
+      case 0:
+        f = new TFRectangle(x, y, 30, 20);
+        break;
+      case 1:
+        f = new TFCircle(x, y, 30, 30);
+        break;
+      case 2: {
+        TFLine *l = new TFLine();
+        l->addPoint(x, y);
+        l->addPoint(x+30, y+15);
+        l->addPoint(x+10, y+30);
+        f = l;
+      } break;
+      case 3: {
+        ostringstream s;
+        s << i;
+        f = new TFText(x, y, s.str());
+      } break;
+    }
+    figures.push_back(f);
+  }
+  model.add(figures);
+}
+
+int
+main(int argc, char **argv, char **envv)
+{
+  toad::initialize(argc, argv, envv); {
+    TFigureEditor *view = new TFigureEditor(0, "paint0003");
+    view->setSize(640, 480);
+    TWindow::createParentless();
+    TOADBase::bAppIsRunning = true;
+    handleMessages();
+
+    srand(1);
+    for(unsigned n=100; n<=100000; n*=10) {
+      PFigureModel model = new TFigureModel();
+      fill(*model, n);
+      view->setModel(model);
+      handleMessages();
+
+      ostringstream args;
+      args << "figures=" << n;
+
+      TMeasure paint;
+      while(paint.more()) {
+        view->invalidateWindow();
+        view->paintNow();
+      }
+      paint.report("figureeditor.paint", args.str());
+
+      TCoord size = ceil(sqrt((double)n)) * 40;
+      TMeasure find;
+      while(find.more()) {
+        view->findFigureAt(size * rand() / (RAND_MAX+1.0),
+                           size * rand() / (RAND_MAX+1.0));
+      }
+      find.report("figureeditor.findFigureAt", args.str());
+
+      TRasterPen pen(640, 480);
+      TMeasure raster;
+      while(raster.more()) {
+        pen.clear();
+        view->print(pen, model);
+      }
+      raster.report("figureeditor.print.raster", args.str());
+
+      view->setModel(0);
+    }
+    delete view;
+  } toad::terminate();
+  return 0;
+}
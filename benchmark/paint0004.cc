@@ -0,0 +1,68 @@
+/*
+ * THTMLView::adjustPane with documents of 10 to 10000 paragraphs.
+ *
+ * adjustPane only lays out the document again when the width of the
+ * view changed, so the benchmark resets the cached width before each
+ * call.
+ */
+
+#include "bench.hh"
+#include <toad/htmlview.hh>
+
+#include <sstream>
+
+using namespace toad;
+
+class TBenchHTMLView:
+  public THTMLView
+{
+  public:
+    TBenchHTMLView(TWindow *parent, const string &title):
+      THTMLView(parent, title) {}
+    void load(const string &html) {
+      istringstream in(html);
+      parse(in);
+    }
+    void layout() {
+      width = 0;
+      adjustPane();
+    }
+};
+
+int
+main(int argc, char **argv, char **envv)
+{
+  toad::initialize(argc, argv, envv); {
+    TBenchHTMLView *view = new TBenchHTMLView(0, "paint0004");
+    view->setSize(640, 480);
+    TWindow::createParentless();
+    TOADBase::bAppIsRunning = true;
+    handleMessages();
+
+    for(unsigned n=10; n<=10000; n*=10) {
+      ostringstream html;
+      html << "<html><body>\n";
+      for(unsigned i=0; i<n; ++i) {
+        html << "<p>Paragraph " << i << ": The <b>quick</b> brown fox "
+                "jumps over the <a href=\"#" << i << "\">lazy dog</a> "
+                "and keeps on running until the line has to be wrapped "
+                "at least once or twice.\n";
+        if (i%10==0)
+          html << "<ul><li>first item<li>second item</ul>\n";
+      }
+      html << "</body></html>\n";
+      view->load(html.str());
+      handleMessages();
+
+      ostringstream args;
+      args << "paragraphs=" << n;
+
+      TMeasure layout;
+      while(layout.more())
+        view->layout();
+      layout.report("htmlview.adjustPane", args.str());
+    }
+    delete view;
+  } toad::terminate();
+  return 0;
+}
@@ -19,10 +19,17 @@
  */
 
 #include <toad/os.hh>
+#include <toad/config.h>
 
 #ifdef __X11__
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#if defined(HAVE_X11_EXTENSIONS_XSHM_H) && defined(HAVE_LIBXEXT)
+#define HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
 #endif
 
 #define _TOAD_PRIVATE
@@ -38,6 +45,7 @@
 #include <toad/filter_jpeg.hh>
 
 #include <assert.h>
+#include <vector>
 
 using namespace toad;
 
@@ -98,6 +106,132 @@ TBitmap::initialize()
 
 static TBitmapFilter* filter_list = NULL;
 
+// back buffer pool
+//----------------------------------------------------------------------------
+
+/*
+ * Double buffered windows and TFigureEditor need a server side pixmap
+ * for every paint. Instead of creating and freeing one each time, idle
+ * pixmaps are kept in a pool, keyed by depth and size bucket, and reused
+ * across paints and windows.
+ *
+ * The sizes are rounded up to the next of 1, 1.25, 1.5 or 1.75 times a
+ * power of two, so a pixmap is at most 25% larger than needed in each
+ * direction and windows of similar size share their buffers.
+ *
+ * Idle pixmaps remember the window which used them last, so that they
+ * can be dropped when that window is resized or destroyed. When the pool
+ * exceeds its limit, the least recently used pixmaps are freed.
+ */
+
+static size_t backbuffer_limit = 32*1024*1024;
+
+#ifdef __X11__
+namespace {
+
+struct TBackBuffer {
+  Pixmap pixmap;
+  int depth, w, h;
+  const void *owner;
+  unsigned long stamp;
+};
+
+typedef vector<TBackBuffer> TBackBufferPool;
+TBackBufferPool backbuffer_pool;
+size_t backbuffer_bytes = 0;
+unsigned long backbuffer_clock = 0;
+
+int
+backBufferBucket(int v)
+{
+  if (v<=16)
+    return 16;
+  int p = 16;
+  while(p*2 < v)
+    p*=2;
+  // v is in (p, 2p]
+  int step = p/4;
+  return p + ((v - p + step - 1) / step) * step;
+}
+
+size_t
+backBufferSize(const TBackBuffer &b)
+{
+  size_t bpp = b.depth<=8 ? 1 : b.depth<=16 ? 2 : 4;
+  return (size_t)b.w * b.h * bpp;
+}
+
+void
+backBufferFree(TBackBufferPool::iterator p)
+{
+  backbuffer_bytes -= backBufferSize(*p);
+  if (x11display) {
+    TPen::_forgetDrawable(p->pixmap);
+    XFreePixmap(x11display, p->pixmap);
+  }
+  backbuffer_pool.erase(p);
+}
+
+// free the least recently used pixmaps until we're below the limit
+void
+backBufferShrink(size_t limit)
+{
+  while(backbuffer_bytes > limit && !backbuffer_pool.empty()) {
+    TBackBufferPool::iterator oldest = backbuffer_pool.begin();
+    for(TBackBufferPool::iterator p = backbuffer_pool.begin(); p!=backbuffer_pool.end(); ++p) {
+      if (p->stamp < oldest->stamp)
+        oldest = p;
+    }
+    backBufferFree(oldest);
+  }
+}
+
+} // namespace
+#endif
+
+/**
+ * Set the amount of memory in bytes the idle back buffers may occupy in
+ * the X server. The default is 32MB.
+ */
+void
+TBitmap::setBackBufferLimit(size_t bytes)
+{
+  backbuffer_limit = bytes;
+#ifdef __X11__
+  backBufferShrink(backbuffer_limit);
+#endif
+}
+
+size_t
+TBitmap::getBackBufferLimit()
+{
+  return backbuffer_limit;
+}
+
+/**
+ * Free the idle back buffers last used by 'owner', except those which
+ * still fit a size of w x h.
+ *
+ * This is called by TWindow when it is resized or destroyed.
+ */
+void
+TBitmap::invalidateBackBuffers(const void *owner, int w, int h)
+{
+#ifdef __X11__
+  int bw = w<0 ? -1 : backBufferBucket(w);
+  int bh = h<0 ? -1 : backBufferBucket(h);
+  TBackBufferPool::iterator p = backbuffer_pool.begin();
+  while(p!=backbuffer_pool.end()) {
+    if (p->owner==owner && (p->w!=bw || p->h!=bh)) {
+      backBufferFree(p);
+      p = backbuffer_pool.begin();
+    } else {
+      ++p;
+    }
+  }
+#endif
+}
+
 void
 TBitmap::terminate()
 {
@@ -109,6 +243,10 @@ TBitmap::terminate()
     filter_list = filter_list->next;
     delete ptr;
   }
+
+#ifdef __X11__
+  backBufferShrink(0);
+#endif
 }
 
 // AddFilter
@@ -159,6 +297,9 @@ TBitmap::TBitmap()
   modified = false;
 
   mode = TBITMAP_SHOW;
+  backbuffer = false;
+  backbuffer_owner = 0;
+  loading = 0;
 #ifdef __X11__  
   pixmap = 0;
   mask   = 0;
@@ -183,6 +324,9 @@ TBitmap::TBitmap(int w,int h, EBitmapType type)
   width = w;
   height = h;
   zoom = 1;
+  backbuffer = false;
+  backbuffer_owner = 0;
+  loading = 0;
 
   switch(type) {
     case TBITMAP_INDEXED:
@@ -204,6 +348,39 @@ TBitmap::TBitmap(int w,int h, EBitmapType type)
           DefaultDepth(x11display, x11screen)
       );
 #endif
+      break;
+    case TBITMAP_BACKBUFFER:
+      color = NULL;
+      index = NULL;
+      backbuffer = true;
+#ifdef __X11__
+      {
+        int depth = DefaultDepth(x11display, x11screen);
+        pix_width  = backBufferBucket(width);
+        pix_height = backBufferBucket(height);
+        TBackBufferPool::iterator found = backbuffer_pool.end();
+        for(TBackBufferPool::iterator p = backbuffer_pool.begin(); p!=backbuffer_pool.end(); ++p) {
+          if (p->depth==depth && p->w==pix_width && p->h==pix_height &&
+              (found==backbuffer_pool.end() || p->stamp > found->stamp))
+          {
+            found = p;
+          }
+        }
+        if (found!=backbuffer_pool.end()) {
+          pixmap = found->pixmap;
+          backbuffer_bytes -= backBufferSize(*found);
+          backbuffer_pool.erase(found);
+        } else {
+          pixmap = XCreatePixmap(
+              x11display,
+              RootWindow(x11display, x11screen),
+              pix_width, pix_height,
+              depth
+          );
+        }
+      }
+#endif
+      break;
   }
   modified = false;
   mode = TBITMAP_SHOW;
@@ -212,13 +389,29 @@ TBitmap::TBitmap(int w,int h, EBitmapType type)
 TBitmap::~TBitmap()
 {
 //  cout << "destroying bitmap " << this << endl;
+  cancelLoad();
   if (color) delete[] color;
   if (index) delete[] index;
   
 #ifdef __X11__
+  if (backbuffer && pixmap && x11display) {
+    TBackBuffer b;
+    b.pixmap = pixmap;
+    b.depth  = DefaultDepth(x11display, x11screen);
+    b.w      = pix_width;
+    b.h      = pix_height;
+    b.owner  = backbuffer_owner;
+    b.stamp  = ++backbuffer_clock;
+    backbuffer_pool.push_back(b);
+    backbuffer_bytes += backBufferSize(b);
+    backBufferShrink(backbuffer_limit);
+    pixmap = 0;
+  }
   if (x11display) {
-    if (pixmap)
+    if (pixmap) {
+      TPen::_forgetDrawable(pixmap);
       XFreePixmap(x11display, pixmap);
+    }
     if (mask)
       XFreePixmap(x11display, mask);
   }
@@ -358,6 +551,105 @@ void TBitmap::update()
   copy_bitmap_to_pixmap_and_delete_it();
 }
 
+#ifdef __X11__
+static int
+host_byte_order()
+{
+  const int one = 1;
+  return *(const char*)&one ? LSBFirst : MSBFirst;
+}
+
+#ifdef HAVE_XSHM
+/*
+ * Large images are transfered via MIT-SHM instead of the socket. This
+ * requires a local server, which is checked once by attaching a segment
+ * while X errors are trapped.
+ */
+
+// images below this size aren't worth the extra round trip
+static const size_t shm_min_size = 64*1024;
+
+static int shm_usable = -1;
+static bool shm_error;
+
+static int
+shm_error_handler(Display*, XErrorEvent*)
+{
+  shm_error = true;
+  return 0;
+}
+
+static void
+destroy_shm_image(XImage *img, XShmSegmentInfo *shminfo)
+{
+  // the server detaches after it has processed the preceding requests
+  XShmDetach(x11display, shminfo);
+  img->data = 0;
+  XDestroyImage(img);
+  shmdt(shminfo->shmaddr);
+}
+
+static XImage*
+create_shm_image(int w, int h, XShmSegmentInfo *shminfo)
+{
+  if (shm_usable==0)
+    return 0;
+  if (shm_usable<0) {
+    shm_usable = XShmQueryExtension(x11display) &&
+                 ImageByteOrder(x11display)==host_byte_order();
+    if (!shm_usable)
+      return 0;
+  }
+
+  XImage *img = XShmCreateImage(
+    x11display,
+    DefaultVisual(x11display,  DefaultScreen(x11display)),
+    DefaultDepth(x11display, DefaultScreen(x11display)),
+    ZPixmap,
+    NULL,
+    shminfo,
+    w, h
+  );
+  if (!img)
+    return 0;
+  size_t size = (size_t)img->bytes_per_line * h;
+  if (size < shm_min_size) {
+    XDestroyImage(img);
+    return 0;
+  }
+  shminfo->shmid = shmget(IPC_PRIVATE, size, IPC_CREAT|0600);
+  if (shminfo->shmid<0) {
+    XDestroyImage(img);
+    return 0;
+  }
+  shminfo->shmaddr = img->data = (char*)shmat(shminfo->shmid, 0, 0);
+  shminfo->readOnly = True;
+  if (shminfo->shmaddr==(char*)-1) {
+    shmctl(shminfo->shmid, IPC_RMID, 0);
+    img->data = 0;
+    XDestroyImage(img);
+    return 0;
+  }
+
+  shm_error = false;
+  XErrorHandler old = XSetErrorHandler(shm_error_handler);
+  XShmAttach(x11display, shminfo);
+  XSync(x11display, False);
+  XSetErrorHandler(old);
+  // the segment goes away with the last detach
+  shmctl(shminfo->shmid, IPC_RMID, 0);
+  if (shm_error) {
+    shm_usable = 0;
+    shmdt(shminfo->shmaddr);
+    img->data = 0;
+    XDestroyImage(img);
+    return 0;
+  }
+  return img;
+}
+#endif
+#endif
+
 // copy bitmap to pixmap and delete it
 //----------------------------------------------------------------------------
 void TBitmap::copy_bitmap_to_pixmap_and_delete_it()
@@ -368,7 +660,9 @@ void TBitmap::copy_bitmap_to_pixmap_and_delete_it()
 #ifdef __X11__
   // create pixmap with the correct size
   //-------------------------------------
-  if (pixmap && (pix_width!=width*zoom || pix_height!=width*height)) {
+  int w = width*zoom, h = height*zoom;
+  if (pixmap && (pix_width!=w || pix_height!=h)) {
+    TPen::_forgetDrawable(pixmap);
     XFreePixmap(x11display, pixmap);
     pixmap = 0;
   }
@@ -377,43 +671,73 @@ void TBitmap::copy_bitmap_to_pixmap_and_delete_it()
     pixmap = XCreatePixmap(
         x11display,
         RootWindow(x11display, x11screen),
-        width*zoom,height*zoom,
+        w, h,
         DefaultDepth(x11display, x11screen)
       );
+    pix_width = w;
+    pix_height = h;
   }
 
   // create image
   //--------------
-  XImage *img;
-  img = XCreateImage(
-    x11display,
-    DefaultVisual(x11display,  DefaultScreen(x11display)),
-    DefaultDepth(x11display, DefaultScreen(x11display)),
-    ZPixmap,
-    0,
-    NULL,
-    width*zoom,height*zoom,
-    32,
-    0
-  );
-  
+  XImage *img = 0;
+#ifdef HAVE_XSHM
+  XShmSegmentInfo shminfo;
+  img = create_shm_image(w, h, &shminfo);
+#endif
   if (!img) {
-    fprintf(stderr,"toad: (TBitmap.Update) XCreateImage failed\n");
-    exit(1);
+    img = XCreateImage(
+      x11display,
+      DefaultVisual(x11display,  DefaultScreen(x11display)),
+      DefaultDepth(x11display, DefaultScreen(x11display)),
+      ZPixmap,
+      0,
+      NULL,
+      w, h,
+      32,
+      0
+    );
+    if (!img) {
+      fprintf(stderr,"toad: (TBitmap.Update) XCreateImage failed\n");
+      exit(1);
+    }
+    // XPutImage converts to the server's byte order when needed
+    img->byte_order = host_byte_order();
+    img->data = new char[img->bytes_per_line * h];
   }
   
-  img->data = new char[img->bytes_per_line * height * zoom];
-  
+  // convert row by row and repeat each row 'zoom' times
+  //-----------------------------------------------------
+  vector<TRGB24> indexed;
+  if (index)
+    indexed.resize(width);
   for(int y=0; y<height; y++) {
-    for(int x=0; x<width; x++) {
-      XPutPixel(img,x,y,TColor::_getPixel(pGetColor(x,y)));
+    char *row = img->data + (size_t)img->bytes_per_line * y * zoom;
+    const TRGB24 *src = color + y*width;
+    if (index) {
+      for(int x=0; x<width; x++)
+        indexed[x] = pGetColor(x,y);
+      src = &indexed[0];
+    }
+    if (img->byte_order!=host_byte_order() ||
+        !TColor::_getPixels(src, width, zoom, row, img->bits_per_pixel))
+    {
+      for(int x=0; x<w; x++)
+        XPutPixel(img, x, y*zoom, TColor::_getPixel(src[x/zoom]));
     }
+    for(int z=1; z<zoom; z++)
+      memcpy(row + z*img->bytes_per_line, row, img->bytes_per_line);
   }
 
-  XPutImage(x11display,pixmap,DefaultGC(x11display, DefaultScreen(x11display)),img,
-    0,0,
-    0,0,
-    (int)width*zoom,(int)height*zoom);
+  GC gc = DefaultGC(x11display, DefaultScreen(x11display));
+#ifdef HAVE_XSHM
+  if (img->obdata) {
+    XShmPutImage(x11display, pixmap, gc, img, 0,0, 0,0, w,h, False);
+    destroy_shm_image(img, &shminfo);
+    img = 0;
+  } else
+#endif
+  XPutImage(x11display, pixmap, gc, img, 0,0, 0,0, w,h);
 #endif
   // free memory
   //-------------
@@ -425,9 +749,11 @@ void TBitmap::copy_bitmap_to_pixmap_and_delete_it()
   }
 
 #ifdef __X11__
-  delete[] img->data;
-  img->data=NULL;
-  XFree(img); 
+  if (img) {
+    delete[] img->data;
+    img->data=NULL;
+    XFree(img); 
+  }
 #endif
 }
 
@@ -449,6 +775,7 @@ void TBitmap::drawBitmap(const TPen *pen, int x, int y, int ax, int ay, int aw,
       if (pixmap) {
         if (mask) {
           XSetClipMask(x11display, pen->o_gc, mask);
+          TPen::_invalidateGCClip(pen->o_gc);
           XSetClipOrigin(x11display, pen->o_gc, x-ax,y);
         }
         XCopyArea(
@@ -460,7 +787,7 @@ void TBitmap::drawBitmap(const TPen *pen, int x, int y, int ax, int ay, int aw,
           x,y
         );
         if (mask) {
-          XSetClipMask(x11display, pen->o_gc, None);
+          TPen::_setGCClip(pen->o_gc, 0);
         }
       }
       break;
@@ -489,6 +816,7 @@ void TBitmap::drawBitmap(const TPen *pen, int x,int y) const
       if (pixmap) {
         if (mask) {
           XSetClipMask(x11display, pen->o_gc, mask);
+          TPen::_invalidateGCClip(pen->o_gc);
           XSetClipOrigin(x11display, pen->o_gc, x,y);
         }
         XCopyArea(
@@ -500,7 +828,7 @@ void TBitmap::drawBitmap(const TPen *pen, int x,int y) const
           x,y
         );
         if (mask) {
-          XSetClipMask(x11display, pen->o_gc, None);
+          TPen::_setGCClip(pen->o_gc, 0);
         }
       }
       break;
@@ -665,13 +993,6 @@ bool TBitmap::getPixel(int x,int y,TRGB *c)
 // Load
 //----------------------------------------------------------------------------
 
-struct TFree
-{
-  char *b;
-  TFree(char *p) { b = p; }
-  ~TFree() { free(b); }
-};
-
 /**
  * Load a bitmap file.<BR>
  */
@@ -684,33 +1005,24 @@ TBitmap::load(const string& url)
     return false;
   }
   
-  // read file into istrstream
-  //----------------------------
+  // files and memory files are read in place, only streams which
+  // can't seek (http, ftp, pipes) need to be buffered first
+  //----------------------------------------------------------------
   iurlstream is(url);
   if (!is) {
     cerr << "toad: failed to load bitmap \"" << url << "\".\n";
     return false;
   }
-  char* buffer = NULL;
-  unsigned size = 0;
-  while(is) {
-    unsigned pos = size;
-    size += 8192;
-    buffer = (char*) realloc(buffer, size);
-    is.read(buffer+pos, 8192);
-  }
-  size-=8192;
-  size+=is.gcount();
-  TFree free_buffer(buffer);
   try {
-#if 1
-    #warning "use string in code above"
-    string s(buffer, size);
-    istringstream ds(s);
-#else
-    istrstream ds(buffer, size);
-#endif
-    load(ds);
+    if (is.tellg()==streampos(0)) {
+      return load(is);
+    }
+    is.clear();
+    stringstream ds;
+    char buffer[8192];
+    while(is.read(buffer, sizeof(buffer)) || is.gcount()>0)
+      ds.write(buffer, is.gcount());
+    return load(ds);
   }
   catch (exception &e) {
     cerr << "warning: caught exception in bitmap filter "
@@ -741,13 +1053,17 @@ TBitmap::load(const string& url)
 #endif
 }
 
+/**
+ * Decode 'ds' with the first matching filter from the list 'filters'.
+ *
+ * This doesn't touch any TBitmap and is also called from the loader
+ * threads, each with its own filter list.
+ */
 bool
-TBitmap::load(istream &ds)
+TBitmap::decode(istream &ds, TBitmapFilter *filters,
+                int *w, int *h, TRGB24 **color, unsigned char **index)
 {
-#ifdef __X11__
-  TBitmapFilter *filter, *last_filter;
-  filter = filter_list;
-    
+  TBitmapFilter *filter = filters;
   TBitmapFilter::EResult result;
   
   if (!ds) {
@@ -755,7 +1071,17 @@ TBitmap::load(istream &ds)
     return false;
   }
 
+  // detect the format by the first bytes of the file
+  //---------------------------------------------------
+  unsigned char header[16];
+  ds.read((char*)header, sizeof(header));
+  size_t hsize = ds.gcount();
+
   while(filter) {
+    if (!filter->probe(header, hsize)) {
+      filter = filter->next;
+      continue;
+    }
     filter->deleteBuffer();
     try {
       ds.clear();     // clear old state
@@ -767,46 +1093,61 @@ TBitmap::load(istream &ds)
       result = TBitmapFilter::WRONG;
     }
     if (result==TBitmapFilter::OK) {
-      // success: remove old bitmap
-      //----------------------------
-      if (color) delete[] color;
-      if (index) delete[] index;
-      color = NULL;
-      index = NULL;
-
-      // get size, color and index buffer from filter
-      //----------------------------------------------
-      filter->getBuffer(&width, &height, &color, &index);
+      filter->getBuffer(w, h, color, index);
       filter->deleteBuffer();
-      modified = true;
-
-// cout << __FILE__ << ":" << __LINE__ << " color=" << color << endl;
-
-      if (mode==TBITMAP_EDIT && index) {
-        unsigned size=width*height;
-        TRGB24 *tc, *p;
-        tc = p = new TRGB24[size];
-        unsigned char *ic = index;
-        for(unsigned i=0; i<size; i++)
-          *(tc++)=color[*(ic++)];
-        delete[] index;
-        delete[] color;
-        index = NULL;
-        color = p;
-      }
       return true;
-    } else {
-      filter->deleteBuffer();
-      if (result==TBitmapFilter::ERROR) {
-        cerr << "toad: " << filter->errortxt << endl;
-        return false;
-      }
     }
-    last_filter = filter;
+    filter->deleteBuffer();
+    if (result==TBitmapFilter::ERROR) {
+      cerr << "toad: " << filter->errortxt << endl;
+      return false;
+    }
     filter = filter->next;
   }
   cerr << "toad: No filter available for bitmap graphic.\n";
   return false;
+}
+
+/**
+ * Replace the bitmap's image with 'c' and 'i' and take ownership
+ * of them.
+ */
+void
+TBitmap::setBuffer(int w, int h, TRGB24 *c, unsigned char *i)
+{
+  if (color) delete[] color;
+  if (index) delete[] index;
+  width = w;
+  height = h;
+  color = c;
+  index = i;
+  modified = true;
+
+  if (mode==TBITMAP_EDIT && index) {
+    unsigned size=width*height;
+    TRGB24 *tc, *p;
+    tc = p = new TRGB24[size];
+    unsigned char *ic = index;
+    for(unsigned i=0; i<size; i++)
+      *(tc++)=color[*(ic++)];
+    delete[] index;
+    delete[] color;
+    index = NULL;
+    color = p;
+  }
+}
+
+bool
+TBitmap::load(istream &ds)
+{
+#ifdef __X11__
+  int w, h;
+  TRGB24 *c;
+  unsigned char *i;
+  if (!decode(ds, filter_list, &w, &h, &c, &i))
+    return false;
+  setBuffer(w, h, c, i);
+  return true;
 #endif
 
 #ifdef __COCOA__
@@ -29,18 +29,21 @@
 
 #include <toad/toadbase.hh>
 #include <toad/pointer.hh>
+#include <toad/connect.hh>
 
 namespace toad {
 
 class TPen;
 class TBitmapFilter;
+class TBitmapLoad;
 class TFileDialog;
 
 enum EBitmapType
 {
   TBITMAP_INDEXED,
   TBITMAP_TRUECOLOR,
-  TBITMAP_SERVER
+  TBITMAP_SERVER,
+  TBITMAP_BACKBUFFER  // server side, taken from and returned to a pool
 };
 
 // beware, this class is pure alpha code:
@@ -87,6 +90,12 @@ class TBitmap:
 
     static void initialize();
     static void terminate();
+
+    // pool for TBITMAP_BACKBUFFER
+    static void setBackBufferLimit(size_t bytes);
+    static size_t getBackBufferLimit();
+    static void invalidateBackBuffers(const void *owner, int w=-1, int h=-1);
+    void setBackBufferOwner(const void *owner) { backbuffer_owner = owner; }
     
     void setZoom(int z);
     void setPixel(int x,int y,TCoord r, TCoord g, TCoord b);
@@ -94,6 +103,14 @@ class TBitmap:
     bool getPixel(int x,int y,TRGB*);
     bool load(const string &url);
     bool load(istream&);
+
+    // asynchronous loading, see bitmaploader.cc
+    bool loadAsync(const string &url, int reduce=1);
+    bool isLoading() const { return loading!=0; }
+    void cancelLoad();
+    static void setLoaderThreads(unsigned n);
+    TSignal sigLoaded;
+
     bool save(const string &url, void* xtra=NULL);
     bool save(ostream&, void *xtra=NULL);
     void update();
@@ -122,6 +139,8 @@ class TBitmap:
   protected:
     unsigned long mask;     // server side mask
     int pix_width, pix_height;
+    bool backbuffer;
+    const void *backbuffer_owner;
     void pCopyToLine(int x1,int x2,int y,int *line);
     void copy_bitmap_to_pixmap_and_delete_it();
 
@@ -131,6 +150,12 @@ class TBitmap:
     TRGB24& pGetColor(int);
     
     bool modified;
+
+    friend class TBitmapLoad;
+    TBitmapLoad *loading;
+    void setBuffer(int w, int h, TRGB24 *color, unsigned char *index);
+    static bool decode(istream&, TBitmapFilter *filters, 
+                       int *w, int *h, TRGB24 **color, unsigned char **index);
 };
 
 typedef GSmartPointer<TBitmap> PBitmap;
@@ -42,6 +42,29 @@ TBitmapFilter::TBitmapFilter()
   index = NULL;
   next = NULL;
   mycolor=myindex=false;
+  progress = NULL;
+  reduce = reduced = 1;
+}
+
+/**
+ * Return a copy of the buffer, which is still being filled by the filter.
+ */
+void
+TBitmapFilter::copyBuffer(int *width, int *height, TRGB24 **c, unsigned char **i) const
+{
+  *width = w;
+  *height = h;
+  *c = NULL;
+  *i = NULL;
+  if (index) {
+    *c = new TRGB24[256];
+    memcpy(*c, color, sizeof(TRGB24)*256);
+    *i = new unsigned char[w*h];
+    memcpy(*i, index, w*h);
+  } else if (color) {
+    *c = new TRGB24[w*h];
+    memcpy(*c, color, sizeof(TRGB24)*w*h);
+  }
 }
 
 bool TBitmapFilter::isIndex()
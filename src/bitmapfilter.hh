@@ -26,6 +26,7 @@
 
 #include <toad/config.h>
 #include <toad/bitmap.hh>
+#include <cstring>
 
 namespace toad {
 
@@ -54,6 +55,13 @@ class TBitmapFilter
     virtual bool save(ostream&)=0;
     virtual EResult load(istream&)=0;
 
+    /**
+     * Returns 'false' when 'header', the first 'size' bytes of a file,
+     * can't belong to this format. Filters which don't know better keep
+     * the default and are tried in turn.
+     */
+    virtual bool probe(const unsigned char *header, size_t size) { return true; }
+
     void deleteBuffer();
     void createBuffer(int w,int h,EBitmapType);
     void setBuffer(int w,int h,TRGB24*,unsigned char*);
@@ -77,6 +85,22 @@ class TBitmapFilter
     void setError(const char *txt);
     const char *errortxt;
 
+    // used by the asynchronous loader
+    //---------------------------------
+    class TProgress {
+      public:
+        virtual ~TProgress() {}
+        //! called with the partially decoded image in the filter's buffer
+        virtual void progress(TBitmapFilter*) = 0;
+    };
+    TProgress *progress;
+    int reduce;   // the image may be decoded at 1/reduce of its size
+    int reduced;  // the factor the filter did apply
+    void copyBuffer(int *w, int *h, TRGB24 **color, unsigned char **index) const;
+  protected:
+    void notifyProgress() { if (progress) progress->progress(this); }
+  public:
+
   protected:
     int w,h;
 
@@ -0,0 +1,404 @@
+/*
+ * TOAD -- A Simple and Powerful C++ GUI Toolkit for the X Window System
+ * Copyright (C) 1996-2007 by Mark-André Hopf <mhopf@mark13.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA  02111-1307,  USA
+ */
+
+#include <toad/os.hh>
+#include <toad/config.h>
+
+#define _TOAD_PRIVATE
+#include <toad/toad.hh>
+#include <toad/command.hh>
+#include <toad/workerpool.hh>
+#include <toad/io/urlstream.hh>
+#include <toad/bitmapfilter.hh>
+#include <toad/filter_bmp.hh>
+#include <toad/filter_png.hh>
+#include <toad/filter_gif.hh>
+#include <toad/filter_jpeg.hh>
+
+#include <sstream>
+#include <pthread.h>
+#include <time.h>
+
+using namespace toad;
+
+/*
+ * Asynchronous loading of bitmaps
+ *
+ * TBitmap::loadAsync() queues a TBitmapLoad for the TWorkerPool. Each
+ * worker thread has its own set of the builtin filters, decodes the
+ * image into the TBitmapLoad and posts it back to the message loop with
+ * sendMessage().
+ *
+ * While a filter is decoding, it reports the partially decoded image
+ * (the scans of progressive JPEGs, the passes of interlaced PNGs, or
+ * just the rows done so far). At most every 100ms a copy is posted to
+ * the message loop, where it replaces the bitmap's image and triggers
+ * TBitmap::sigLoaded.
+ *
+ * Images which none of the builtin filters recognizes are loaded with
+ * TBitmap::load() in the message loop, so filters added with
+ * TBitmap::addFilter() still work.
+ */
+
+namespace toad {
+
+class TBitmapLoad:
+  public TBitmapFilter::TProgress, public TWorkerJob
+{
+  public:
+    TBitmapLoad(TBitmap *target, const string &url, int reduce) {
+      this->target = target;
+      this->url = url;
+      this->reduce = reduce;
+      cancelled = false;
+      progress_pending = false;
+      last_progress = 0;
+      ok = known = false;
+      w = h = 0;
+      color = 0;
+      index = 0;
+    }
+    ~TBitmapLoad() {
+      delete[] color;
+      delete[] index;
+    }
+
+    // owned by the message loop
+    TBitmap *target;
+
+    // set by the message loop, read by the loader thread
+    string url;
+    int reduce;
+    bool cancelled;
+    bool progress_pending;
+
+    // the result
+    bool ok;    // image was decoded
+    bool known; // one of the builtin filters claimed the image
+    int w, h;
+    TRGB24 *color;
+    unsigned char *index;
+
+    void run();
+    void discard();
+    void decode(TBitmapFilter *filters);
+    void progress(TBitmapFilter *filter);
+    void step(int w, int h, TRGB24 *color, unsigned char *index);
+    void done();
+
+  private:
+    long long last_progress;
+};
+
+} // namespace toad
+
+namespace {
+
+// the builtin filters of each worker thread
+pthread_key_t filters_key;
+pthread_once_t filters_once = PTHREAD_ONCE_INIT;
+
+long long
+now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+// reduce the image by taking every f-th pixel
+void
+shrink(int f, int *w, int *h, TRGB24 **color, unsigned char **index)
+{
+  if (f<=1 || (*w<f && *h<f))
+    return;
+  int nw = (*w+f-1)/f;
+  int nh = (*h+f-1)/f;
+  if (*index) {
+    unsigned char *ni = new unsigned char[nw*nh];
+    for(int y=0; y<nh; ++y)
+      for(int x=0; x<nw; ++x)
+        ni[x+y*nw] = (*index)[x*f + y*f * *w];
+    delete[] *index;
+    *index = ni;
+  } else if (*color) {
+    TRGB24 *nc = new TRGB24[nw*nh];
+    for(int y=0; y<nh; ++y)
+      for(int x=0; x<nw; ++x)
+        nc[x+y*nw] = (*color)[x*f + y*f * *w];
+    delete[] *color;
+    *color = nc;
+  }
+  *w = nw;
+  *h = nh;
+}
+
+/**
+ * Posts the partially decoded image to the message loop.
+ */
+class TLoadStep:
+  public TCommand
+{
+    TBitmapLoad *job;
+    int w, h;
+    TRGB24 *color;
+    unsigned char *index;
+  public:
+    TLoadStep(TBitmapLoad *job, int w, int h, TRGB24 *c, unsigned char *i) {
+      this->job = job;
+      this->w = w;
+      this->h = h;
+      color = c;
+      index = i;
+    }
+    ~TLoadStep() {
+      delete[] color;
+      delete[] index;
+    }
+    void execute() {
+      job->step(w, h, color, index);
+      color = 0;
+      index = 0;
+    }
+};
+
+/**
+ * Posts the finished TBitmapLoad to the message loop.
+ */
+class TLoadDone:
+  public TCommand
+{
+    TBitmapLoad *job;
+  public:
+    TLoadDone(TBitmapLoad *job) { this->job = job; }
+    void execute() {
+      job->done();
+      delete job;
+    }
+};
+
+void
+deleteFilters(void *list)
+{
+  TBitmapFilter *filters = (TBitmapFilter*)list;
+  while(filters) {
+    TBitmapFilter *next = filters->next;
+    delete filters;
+    filters = next;
+  }
+}
+
+void
+createFiltersKey()
+{
+  pthread_key_create(&filters_key, deleteFilters);
+}
+
+TBitmapFilter*
+threadFilters()
+{
+  pthread_once(&filters_once, createFiltersKey);
+  TBitmapFilter *list = (TBitmapFilter*)pthread_getspecific(filters_key);
+  if (list)
+    return list;
+  TBitmapFilter *f;
+#ifdef HAVE_LIBPNG
+  f = new TFilterPNG; f->next = list; list = f;
+#endif
+  f = new TFilterBMP; f->next = list; list = f;
+#ifdef HAVE_LIBJPEG
+  f = new TFilterJPEG; f->next = list; list = f;
+#endif
+  f = new TFilterGIF; f->next = list; list = f;
+  pthread_setspecific(filters_key, list);
+  return list;
+}
+
+} // namespace
+
+void
+TBitmapLoad::run()
+{
+  if (!__atomic_load_n(&cancelled, __ATOMIC_ACQUIRE))
+    decode(threadFilters());
+  sendMessage(new TLoadDone(this));
+}
+
+void
+TBitmapLoad::discard()
+{
+  if (target)
+    target->loading = 0;
+  delete this;
+}
+
+void
+TBitmapLoad::decode(TBitmapFilter *filters)
+{
+  iurlstream is(url);
+  if (!is)
+    return;
+
+  // files and memory files are read in place, other streams are
+  // buffered first as the filters need to seek
+  stringstream buffered;
+  istream *in = &is;
+  if (is.tellg()!=streampos(0)) {
+    is.clear();
+    char buffer[8192];
+    while(is.read(buffer, sizeof(buffer)) || is.gcount()>0)
+      buffered.write(buffer, is.gcount());
+    in = &buffered;
+  }
+
+  unsigned char header[16];
+  in->read((char*)header, sizeof(header));
+  size_t hsize = in->gcount();
+  in->clear();
+  in->seekg(0);
+  for(TBitmapFilter *f = filters; f; f=f->next) {
+    if (f->probe(header, hsize)) {
+      known = true;
+      break;
+    }
+  }
+  if (!known)
+    return;
+
+  for(TBitmapFilter *f = filters; f; f=f->next) {
+    f->progress = this;
+    f->reduce = reduce;
+    f->reduced = 1;
+  }
+  last_progress = now_ms();
+  ok = TBitmap::decode(*in, filters, &w, &h, &color, &index);
+  if (ok) {
+    // filters which can't decode at a reduced size
+    int f = 1;
+    for(TBitmapFilter *p = filters; p; p=p->next)
+      f = max(f, p->reduced);
+    shrink(reduce/f, &w, &h, &color, &index);
+  }
+}
+
+void
+TBitmapLoad::progress(TBitmapFilter *filter)
+{
+  if (__atomic_load_n(&cancelled, __ATOMIC_ACQUIRE) ||
+      __atomic_load_n(&progress_pending, __ATOMIC_ACQUIRE))
+    return;
+  long long t = now_ms();
+  if (t - last_progress < 100)
+    return;
+  last_progress = t;
+
+  int w, h;
+  TRGB24 *c;
+  unsigned char *i;
+  filter->copyBuffer(&w, &h, &c, &i);
+  shrink(reduce/filter->reduced, &w, &h, &c, &i);
+  __atomic_store_n(&progress_pending, true, __ATOMIC_RELEASE);
+  sendMessage(new TLoadStep(this, w, h, c, i));
+}
+
+void
+TBitmapLoad::step(int w, int h, TRGB24 *color, unsigned char *index)
+{
+  if (target) {
+    target->setBuffer(w, h, color, index);
+    target->sigLoaded();
+  } else {
+    delete[] color;
+    delete[] index;
+  }
+  __atomic_store_n(&progress_pending, false, __ATOMIC_RELEASE);
+}
+
+void
+TBitmapLoad::done()
+{
+  if (!target)
+    return;
+  target->loading = 0;
+  if (ok) {
+    target->setBuffer(w, h, color, index);
+    color = 0;
+    index = 0;
+  } else if (!known) {
+    target->load(url);
+  }
+  target->sigLoaded();
+}
+
+/**
+ * Load the bitmap in the background.
+ *
+ * The bitmap keeps its current image until the loader delivers the
+ * first part of the new one. 'sigLoaded' is triggered each time the
+ * image was updated and a last time after loading has finished, when
+ * isLoading() returns 'false' again.
+ *
+ * \param url
+ *   The image to load.
+ * \param reduce
+ *   Load the image at 1/reduce of its size. JPEG images are scaled
+ *   down while decoding and interlaced PNG images skip the passes not
+ *   needed, making them faster to load.
+ */
+bool
+TBitmap::loadAsync(const string &url, int reduce)
+{
+  cancelLoad();
+  if (reduce<1)
+    reduce = 1;
+  loading = new TBitmapLoad(this, url, reduce);
+  if (!TWorkerPool::submit(loading)) {
+    // no thread, no background
+    delete loading;
+    loading = 0;
+    bool result = load(url);
+    sigLoaded();
+    return result;
+  }
+  return true;
+}
+
+/**
+ * Stop the asynchronous loading of this bitmap. The parts already loaded
+ * are kept.
+ */
+void
+TBitmap::cancelLoad()
+{
+  if (!loading)
+    return;
+  loading->target = 0;
+  __atomic_store_n(&loading->cancelled, true, __ATOMIC_RELEASE);
+  loading = 0;
+}
+
+/**
+ * Set the maximal number of loader threads, see TWorkerPool::setThreads.
+ */
+void
+TBitmap::setLoaderThreads(unsigned n)
+{
+  TWorkerPool::setThreads(n);
+}
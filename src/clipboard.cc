@@ -0,0 +1,734 @@
+/*
+ * TOAD -- A Simple and Powerful C++ GUI Toolkit for the X Window System
+ * Copyright (C) 1996-2007 by Mark-André Hopf <mhopf@mark13.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, 
+ * MA  02111-1307,  USA
+ */
+
+#define _TOAD_PRIVATE
+
+#include <toad/clipboard.hh>
+#include <toad/window.hh>
+#include <toad/command.hh>
+#include <toad/simpletimer.hh>
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+
+#include <map>
+#include <list>
+#include <climits>
+#include <time.h>
+
+using namespace toad;
+
+/*
+ * Selections are transferred as described in the ICCCM, section 2:
+ *
+ * The requestor asks with XConvertSelection to store the data in a
+ * property of its window and the owner answers with a SelectionNotify
+ * event. Data larger than 'chunksize' is sent with the INCR protocol:
+ * the owner stores an INCR property with the total size and then
+ * writes the next chunk each time the requestor deleted the property,
+ * a zero length chunk marks the end.
+ *
+ * Both sides are driven by events from the message loop only, a timer
+ * removes transfers which made no progress for a while.
+ */
+
+#ifdef __X11__
+
+namespace {
+
+Atom xaSelection[2];
+Atom xaTARGETS, xaMULTIPLE, xaINCR, xaATOM_PAIR, xaUTF8_STRING, xaTEXT;
+
+// largest property written at once, also the INCR threshold
+size_t chunksize = 0;
+
+const time_t REQUEST_TIMEOUT = 5;
+const time_t TRANSFER_TIMEOUT = 30;
+
+PClipboardSource sources[2];
+
+// INCR transfers to other clients
+struct TOutgoing {
+  Window requestor;
+  Atom property, type;
+  string data;
+  size_t offset;
+  time_t touched;
+};
+typedef list<TOutgoing> TOutgoings;
+TOutgoings outgoing;
+
+// our requests, by the property the data is stored in
+typedef map<Atom, PClipboardRequest> TIncomings;
+TIncomings incoming;
+vector<Atom> freeproperties;
+unsigned nproperties = 0;
+
+class TClipboardTimer:
+  public TSimpleTimer
+{
+  public:
+    void tick();
+};
+TClipboardTimer *timer = 0;
+
+class TClipboardLocalReply:
+  public TCommand
+{
+    PClipboardRequest request;
+    PClipboardSource source;
+  public:
+    TClipboardLocalReply(TClipboardRequest *r, TClipboardSource *s):
+      request(r), source(s) {}
+    void execute();
+};
+
+string
+atomName(Atom atom)
+{
+  string result;
+  if (atom) {
+    char *name = XGetAtomName(x11display, atom);
+    if (name) {
+      result = name;
+      XFree(name);
+    }
+  }
+  return result;
+}
+
+int
+selectionIndex(Atom selection)
+{
+  for(int i=0; i<2; ++i) {
+    if (xaSelection[i]==selection)
+      return i;
+  }
+  return -1;
+}
+
+bool timerRunning = false;
+
+void
+startTimer()
+{
+  if (timer && !timerRunning) {
+    timer->startTimer(1, 0);
+    timerRunning = true;
+  }
+}
+
+Atom
+allocProperty()
+{
+  if (!freeproperties.empty()) {
+    Atom a = freeproperties.back();
+    freeproperties.pop_back();
+    return a;
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "TOAD_SELECTION_%u", nproperties++);
+  return XInternAtom(x11display, name, False);
+}
+
+// requests to other clients may fail when the requestor window is gone
+bool x11error;
+
+int
+errorHandler(Display*, XErrorEvent*)
+{
+  x11error = true;
+  return 0;
+}
+
+/**
+ * Read and delete 'property' of 'window'. Items of format 32 are stored
+ * as long like Xlib returns them.
+ */
+bool
+readProperty(Window window, Atom property, Atom *type, int *format, string *data)
+{
+  long offset = 0;
+  data->erase();
+  *type = None;
+  *format = 8;
+  while(true) {
+    unsigned char *buffer;
+    unsigned long received, remaining;
+    if (XGetWindowProperty(x11display, window, property,
+                           offset, LONG_MAX/4, True, AnyPropertyType,
+                           type, format, &received, &remaining,
+                           &buffer)!=Success)
+      return false;
+    if (*type==None) {
+      XFree(buffer);
+      return false;
+    }
+    size_t itemsize = *format==32 ? sizeof(long) : *format/8;
+    data->append((char*)buffer, received * itemsize);
+    offset += received * (*format/8) / 4;
+    XFree(buffer);
+    if (remaining==0)
+      break;
+  }
+  return true;
+}
+
+/**
+ * Store 'source' converted into 'target' in 'property' of 'requestor'.
+ */
+bool
+reply(Window requestor, Atom target, Atom property, TClipboardSource *source)
+{
+  if (target==xaTARGETS) {
+    vector<string> names;
+    source->getTargets(&names);
+    vector<Atom> atoms;
+    atoms.push_back(xaTARGETS);
+    atoms.push_back(xaMULTIPLE);
+    for(size_t i=0; i<names.size(); ++i)
+      atoms.push_back(XInternAtom(x11display, names[i].c_str(), False));
+    XChangeProperty(x11display, requestor, property, XA_ATOM, 32,
+                    PropModeReplace, (unsigned char*)&atoms[0], atoms.size());
+    return true;
+  }
+
+  TOutgoing t;
+  if (!source->convert(atomName(target), &t.data))
+    return false;
+  t.type = target==xaTEXT ? xaUTF8_STRING : target;
+
+  if (t.data.size() <= chunksize) {
+    XChangeProperty(x11display, requestor, property, t.type, 8,
+                    PropModeReplace, (unsigned char*)t.data.data(),
+                    t.data.size());
+    return true;
+  }
+
+  // INCR: the chunks follow when the requestor deletes the property
+  XSelectInput(x11display, requestor, PropertyChangeMask);
+  long size = t.data.size();
+  XChangeProperty(x11display, requestor, property, xaINCR, 32,
+                  PropModeReplace, (unsigned char*)&size, 1);
+  t.requestor = requestor;
+  t.property = property;
+  t.offset = 0;
+  t.touched = time(0);
+  outgoing.push_back(t);
+  startTimer();
+  return true;
+}
+
+/**
+ * Handle a MULTIPLE request: 'property' holds pairs of targets and
+ * properties, targets which could not be converted are replaced by None.
+ */
+bool
+replyMultiple(Window requestor, Atom property, TClipboardSource *source)
+{
+  Atom type;
+  int format;
+  string pairs;
+  if (!readProperty(requestor, property, &type, &format, &pairs) || format!=32)
+    return false;
+  long *p = (long*)pairs.data();
+  size_t n = pairs.size() / sizeof(long) / 2;
+  for(size_t i=0; i<n; ++i) {
+    if (p[i*2]==(long)xaMULTIPLE ||
+        !reply(requestor, p[i*2], p[i*2+1], source))
+      p[i*2] = None;
+  }
+  XChangeProperty(x11display, requestor, property, xaATOM_PAIR, 32,
+                  PropModeReplace, (unsigned char*)p, n*2);
+  return true;
+}
+
+void
+dropOutgoing(TOutgoings::iterator p)
+{
+  Window requestor = p->requestor;
+  outgoing.erase(p);
+  for(p=outgoing.begin(); p!=outgoing.end(); ++p) {
+    if (p->requestor==requestor)
+      return;
+  }
+  XSelectInput(x11display, requestor, NoEventMask);
+}
+
+bool
+selectionRequest(XSelectionRequestEvent &req)
+{
+  int idx = selectionIndex(req.selection);
+  if (idx<0)
+    return false;
+
+  XErrorHandler oldhandler = XSetErrorHandler(errorHandler);
+  x11error = false;
+
+  // obsolete clients may pass None as property
+  Atom property = req.property!=None ? req.property : req.target;
+  bool ok = false;
+  TClipboardSource *source = sources[idx];
+  if (source) {
+    if (req.target==xaMULTIPLE)
+      ok = replyMultiple(req.requestor, property, source);
+    else
+      ok = reply(req.requestor, req.target, property, source);
+  }
+
+  XEvent sevent;
+  sevent.xselection.type      = SelectionNotify;
+  sevent.xselection.serial    = 0;
+  sevent.xselection.send_event= True;
+  sevent.xselection.display   = x11display;
+  sevent.xselection.requestor = req.requestor;
+  sevent.xselection.selection = req.selection;
+  sevent.xselection.target    = req.target;
+  sevent.xselection.property  = ok ? property : None;
+  sevent.xselection.time      = req.time;
+  XSendEvent(x11display, req.requestor, False, NoEventMask, &sevent);
+  XSync(x11display, False);
+  XSetErrorHandler(oldhandler);
+
+  if (x11error) {
+    cerr << "toad: selection requestor vanished" << endl;
+    TOutgoings::iterator p = outgoing.begin();
+    while(p!=outgoing.end()) {
+      TOutgoings::iterator q = p++;
+      if (q->requestor==req.requestor)
+        dropOutgoing(q);
+    }
+  }
+  return true;
+}
+
+/**
+ * The requestor deleted the property, write the next INCR chunk.
+ */
+bool
+propertyDeleted(XPropertyEvent &ev)
+{
+  TOutgoings::iterator p;
+  for(p=outgoing.begin(); p!=outgoing.end(); ++p) {
+    if (p->requestor==ev.window && p->property==ev.atom)
+      break;
+  }
+  if (p==outgoing.end())
+    return false;
+
+  size_t n = min(chunksize, p->data.size() - p->offset);
+  XErrorHandler oldhandler = XSetErrorHandler(errorHandler);
+  x11error = false;
+  XChangeProperty(x11display, p->requestor, p->property, p->type, 8,
+                  PropModeReplace,
+                  (unsigned char*)p->data.data() + p->offset, n);
+  XSync(x11display, False);
+  XSetErrorHandler(oldhandler);
+
+  p->offset += n;
+  p->touched = time(0);
+  // the zero length chunk which ends the transfer was written
+  if (n==0 || x11error)
+    dropOutgoing(p);
+  return true;
+}
+
+bool
+selectionNotify(XSelectionEvent &ev)
+{
+  TIncomings::iterator p;
+  if (ev.property==None) {
+    // the owner refused to convert, find the request by its target
+    for(p=incoming.begin(); p!=incoming.end(); ++p) {
+      if (p->second->window==ev.requestor &&
+          p->second->selection==ev.selection &&
+          !p->second->incr &&
+          p->second->target==atomName(ev.target))
+        break;
+    }
+  } else {
+    p = incoming.find(ev.property);
+  }
+  if (p==incoming.end() || p->second->window!=ev.requestor)
+    return false;
+
+  PClipboardRequest r = p->second;
+  if (ev.property==None) {
+    r->finish(false);
+    return true;
+  }
+
+  Atom type;
+  if (!readProperty(ev.requestor, ev.property, &type, &r->format, &r->data)) {
+    r->finish(false);
+    return true;
+  }
+  if (type==xaINCR) {
+    // reading deleted the property, which starts the transfer
+    r->incr = true;
+    r->data.erase();
+    r->touched = time(0);
+    return true;
+  }
+  r->type = atomName(type);
+  r->finish(true);
+  return true;
+}
+
+bool
+propertyNewValue(XPropertyEvent &ev)
+{
+  TIncomings::iterator p = incoming.find(ev.atom);
+  if (p==incoming.end() || p->second->window!=ev.window || !p->second->incr)
+    return false;
+
+  PClipboardRequest r = p->second;
+  Atom type;
+  string chunk;
+  if (!readProperty(ev.window, ev.atom, &type, &r->format, &chunk)) {
+    r->finish(false);
+    return true;
+  }
+  if (chunk.empty()) {
+    r->finish(true);
+    return true;
+  }
+  r->type = atomName(type);
+  r->data.append(chunk);
+  r->touched = time(0);
+  return true;
+}
+
+void
+TClipboardTimer::tick()
+{
+  time_t now = time(0);
+
+  TOutgoings::iterator p = outgoing.begin();
+  while(p!=outgoing.end()) {
+    TOutgoings::iterator q = p++;
+    if (now - q->touched > TRANSFER_TIMEOUT) {
+      cerr << "toad: selection transfer timed out" << endl;
+      dropOutgoing(q);
+    }
+  }
+
+  vector<PClipboardRequest> expired;
+  for(TIncomings::iterator q=incoming.begin(); q!=incoming.end(); ++q) {
+    if (now - q->second->touched > REQUEST_TIMEOUT)
+      expired.push_back(q->second);
+  }
+  for(size_t i=0; i<expired.size(); ++i)
+    expired[i]->finish(false);
+
+  if (outgoing.empty() && incoming.empty()) {
+    stopTimer();
+    timerRunning = false;
+  }
+}
+
+void
+TClipboardLocalReply::execute()
+{
+  if (request->isDone())
+    return;
+  if (!source) {
+    request->finish(false);
+    return;
+  }
+  if (request->target=="TARGETS") {
+    vector<string> names;
+    source->getTargets(&names);
+    names.insert(names.begin(), "MULTIPLE");
+    names.insert(names.begin(), "TARGETS");
+    request->type = "ATOM";
+    request->format = 32;
+    for(size_t i=0; i<names.size(); ++i) {
+      long atom = XInternAtom(x11display, names[i].c_str(), False);
+      request->data.append((char*)&atom, sizeof(atom));
+    }
+    request->finish(true);
+    return;
+  }
+  if (!source->convert(request->target, &request->data)) {
+    request->finish(false);
+    return;
+  }
+  request->type = request->target=="TEXT" ? "UTF8_STRING" : request->target;
+  request->finish(true);
+}
+
+} // namespace
+
+#endif
+
+TClipboardSource::~TClipboardSource()
+{
+}
+
+void
+TClipboardText::getTargets(vector<string> *targets) const
+{
+  targets->push_back("UTF8_STRING");
+  targets->push_back("STRING");
+  targets->push_back("TEXT");
+  targets->push_back("text/plain;charset=utf-8");
+  targets->push_back("text/plain");
+}
+
+bool
+TClipboardText::convert(const string &target, string *data) const
+{
+  if (target=="STRING") {
+    // ISO 8859-1
+    data->erase();
+    data->reserve(text.size());
+    for(size_t i=0; i<text.size(); ) {
+      unsigned char c = text[i];
+      if (c<0x80) {
+        *data += c;
+        ++i;
+      } else if ((c&0xe0)==0xc0 && i+1<text.size()) {
+        unsigned u = ((c&0x1f)<<6) | (text[i+1]&0x3f);
+        *data += u<256 ? (char)u : '?';
+        i+=2;
+      } else {
+        *data += '?';
+        ++i;
+        while(i<text.size() && (text[i]&0xc0)==0x80)
+          ++i;
+      }
+    }
+    return true;
+  }
+  if (target=="UTF8_STRING" ||
+      target=="TEXT" ||
+      target=="text/plain;charset=utf-8" ||
+      target=="text/plain")
+  {
+    *data = text;
+    return true;
+  }
+  return false;
+}
+
+TClipboardRequest::TClipboardRequest()
+{
+  format = 8;
+  done = failed = incr = false;
+  window = selection = property = 0;
+  touched = 0;
+}
+
+TClipboardRequest::~TClipboardRequest()
+{
+}
+
+/**
+ * Stop waiting for the data, sigDone won't be triggered.
+ */
+void
+TClipboardRequest::cancel()
+{
+  if (done)
+    return;
+  done = failed = true;
+#ifdef __X11__
+  // the property isn't reused as the owner might still write into it
+  if (property)
+    incoming.erase(property);
+#endif
+}
+
+void
+TClipboardRequest::finish(bool ok)
+{
+  if (done)
+    return;
+  done = true;
+  failed = !ok;
+  PClipboardRequest keep = this;
+#ifdef __X11__
+  if (property) {
+    incoming.erase(property);
+    if (!incr || ok)
+      freeproperties.push_back(property);
+  }
+#endif
+  sigDone();
+}
+
+void
+TClipboardRequest::getTargets(vector<string> *targets) const
+{
+#ifdef __X11__
+  if (format!=32)
+    return;
+  const long *p = (const long*)data.data();
+  size_t n = data.size() / sizeof(long);
+  for(size_t i=0; i<n; ++i)
+    targets->push_back(atomName(p[i]));
+#endif
+}
+
+void
+TClipboard::initialize()
+{
+#ifdef __X11__
+  xaSelection[PRIMARY]   = XA_PRIMARY;
+  xaSelection[CLIPBOARD] = XInternAtom(x11display, "CLIPBOARD", False);
+  xaTARGETS     = XInternAtom(x11display, "TARGETS", False);
+  xaMULTIPLE    = XInternAtom(x11display, "MULTIPLE", False);
+  xaINCR        = XInternAtom(x11display, "INCR", False);
+  xaATOM_PAIR   = XInternAtom(x11display, "ATOM_PAIR", False);
+  xaUTF8_STRING = XInternAtom(x11display, "UTF8_STRING", False);
+  xaTEXT        = XInternAtom(x11display, "TEXT", False);
+
+  long max = XExtendedMaxRequestSize(x11display);
+  if (max==0)
+    max = XMaxRequestSize(x11display);
+  // request size is in 4 byte units, keep room for the request header
+  // and don't block the server for too long with a single chunk
+  chunksize = max*4 - 1024;
+  if (chunksize > 256*1024)
+    chunksize = 256*1024;
+
+  timer = new TClipboardTimer();
+#endif
+}
+
+void
+TClipboard::terminate()
+{
+#ifdef __X11__
+  sources[PRIMARY] = 0;
+  sources[CLIPBOARD] = 0;
+  outgoing.clear();
+  incoming.clear();
+  freeproperties.clear();
+  delete timer;
+  timer = 0;
+  timerRunning = false;
+#endif
+}
+
+/**
+ * Offer 'source' as the content of 'selection' to all clients. 0 gives
+ * up the ownership.
+ */
+void
+TClipboard::setSource(TClipboardSource *source, ESelection selection)
+{
+#ifdef __X11__
+  sources[selection] = source;
+  TWindow *wnd = TWindow::getParentless(0);
+  if (!wnd || !wnd->x11window) {
+    cerr << "toad: can't own the selection without a window" << endl;
+    return;
+  }
+  Window owner = source ? wnd->x11window : None;
+  XSetSelectionOwner(x11display, xaSelection[selection], owner, CurrentTime);
+  if (source && XGetSelectionOwner(x11display, xaSelection[selection])!=owner) {
+    cerr << "toad: failed to become the selection owner" << endl;
+    sources[selection] = 0;
+  }
+#endif
+}
+
+void
+TClipboard::setText(const string &text, ESelection selection)
+{
+  setSource(new TClipboardText(text), selection);
+}
+
+/**
+ * Returns the source when this client owns 'selection' or 0.
+ */
+TClipboardSource*
+TClipboard::getSource(ESelection selection)
+{
+#ifdef __X11__
+  return sources[selection];
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Ask the owner of 'selection' to convert it into 'target'. The data
+ * is available once the returned request triggers sigDone.
+ */
+TClipboardRequest*
+TClipboard::request(const string &target, ESelection selection)
+{
+  TClipboardRequest *r = new TClipboardRequest();
+  r->target = target;
+#ifdef __X11__
+  if (sources[selection]) {
+    sendMessage(new TClipboardLocalReply(r, sources[selection]));
+    return r;
+  }
+  TWindow *wnd = TWindow::getParentless(0);
+  if (!wnd || !wnd->x11window) {
+    cerr << "toad: can't request the selection without a window" << endl;
+    sendMessage(new TClipboardLocalReply(r, 0));
+    return r;
+  }
+  r->window = wnd->x11window;
+  r->selection = xaSelection[selection];
+  r->property = allocProperty();
+  r->touched = time(0);
+  incoming[r->property] = r;
+  XConvertSelection(x11display, r->selection,
+                    XInternAtom(x11display, target.c_str(), False),
+                    r->property, r->window, CurrentTime);
+  startTimer();
+#endif
+  return r;
+}
+
+#ifdef __X11__
+/**
+ * Called by TOADBase::handleMessage for the selection events and
+ * PropertyNotify. Returns 'true' when the event was consumed.
+ */
+bool
+TClipboard::_handleEvent(XEvent &event)
+{
+  switch(event.type) {
+    case SelectionClear: {
+      int idx = selectionIndex(event.xselectionclear.selection);
+      if (idx<0)
+        return false;
+      sources[idx] = 0;
+      return true;
+    }
+    case SelectionRequest:
+      return selectionRequest(event.xselectionrequest);
+    case SelectionNotify:
+      return selectionNotify(event.xselection);
+    case PropertyNotify:
+      if (event.xproperty.state==PropertyDelete)
+        return propertyDeleted(event.xproperty);
+      return propertyNewValue(event.xproperty);
+  }
+  return false;
+}
+#endif
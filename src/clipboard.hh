@@ -0,0 +1,133 @@
+/*
+ * TOAD -- A Simple and Powerful C++ GUI Toolkit for the X Window System
+ * Copyright (C) 1996-2007 by Mark-André Hopf <mhopf@mark13.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, 
+ * MA  02111-1307,  USA
+ */
+
+#ifndef __TOAD_CLIPBOARD_HH
+#define __TOAD_CLIPBOARD_HH 1
+
+#include <toad/toadbase.hh>
+#include <toad/pointer.hh>
+#include <toad/connect.hh>
+#include <vector>
+
+namespace toad {
+
+/**
+ * Data offered to other clients via TClipboard::setSource.
+ *
+ * The data is converted lazily: convert() is called each time a client
+ * asks for one of the targets returned by getTargets().
+ */
+class TClipboardSource:
+  public TSmartObject
+{
+  public:
+    virtual ~TClipboardSource();
+    //! names of the targets (types) offered, ie. "UTF8_STRING", "text/html"
+    virtual void getTargets(vector<string> *targets) const = 0;
+    //! convert the data into 'target', return 'false' when not possible
+    virtual bool convert(const string &target, string *data) const = 0;
+};
+
+typedef GSmartPointer<TClipboardSource> PClipboardSource;
+
+/**
+ * A clipboard source for UTF-8 text.
+ */
+class TClipboardText:
+  public TClipboardSource
+{
+  public:
+    TClipboardText(const string &text):text(text) {}
+    void getTargets(vector<string> *targets) const;
+    bool convert(const string &target, string *data) const;
+    string text;
+};
+
+/**
+ * A pending request for the content of a selection created by
+ * TClipboard::request. sigDone is triggered once from the message loop
+ * when the transfer is finished, failed or timed out.
+ */
+class TClipboardRequest:
+  public TSmartObject
+{
+  public:
+    TClipboardRequest();
+    ~TClipboardRequest();
+
+    TSignal sigDone;
+
+    bool isDone() const { return done; }
+    bool isFailed() const { return failed; }
+    void cancel();
+
+    //! the requested target
+    const string& getTarget() const { return target; }
+    //! the type of the data as reported by the selection owner
+    const string& getType() const { return type; }
+    const string& getData() const { return data; }
+    //! decode the data of a "TARGETS" request
+    void getTargets(vector<string> *targets) const;
+
+    // state of the transfer, used by the implementation only
+    string target, type, data;
+    int format;
+    bool done:1;
+    bool failed:1;
+    bool incr:1;
+    unsigned long window, selection, property;
+    long long touched;    // time of the last progress for the timeout
+    void finish(bool ok);
+};
+
+typedef GSmartPointer<TClipboardRequest> PClipboardRequest;
+
+/**
+ * Access to the X11 selections with the ICCCM INCR protocol for large
+ * transfers in both directions.
+ *
+ * Neither setting nor requesting a selection blocks the message loop.
+ */
+class TClipboard
+{
+  public:
+    enum ESelection {
+      PRIMARY,
+      CLIPBOARD
+    };
+
+    static void setSource(TClipboardSource *source, ESelection selection=PRIMARY);
+    static void setText(const string &text, ESelection selection=PRIMARY);
+    static TClipboardSource* getSource(ESelection selection=PRIMARY);
+    static TClipboardRequest* request(const string &target="UTF8_STRING", ESelection selection=PRIMARY);
+
+    static void initialize();
+    static void terminate();
+
+#ifdef _TOAD_PRIVATE
+#ifdef __X11__
+    static bool _handleEvent(XEvent &event);
+#endif
+#endif
+};
+
+} // namespace toad
+
+#endif
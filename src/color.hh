@@ -211,6 +211,7 @@ class TColor:
     void _setPen(TPen*, _TOAD_GC &gc);
     static ulong _getPixel(const TRGB&);
     static ulong _getPixel(const TRGB24&);
+    static bool _getPixels(const TRGB24 *in, int n, int zoom, void *out, int bpp);
     ulong _getPixel() { return _getPixel(*this); }
 #endif
 
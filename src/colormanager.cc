@@ -27,6 +27,12 @@
 #endif
 
 #include <cstring>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_PACK32_SSSE3
+#include <tmmintrin.h>
+#endif
 
 #define _TOAD_PRIVATE
 
@@ -70,9 +76,8 @@ void
 TColor::_setPen(TPen *pen, _TOAD_GC &gc)
 {
   if (!gc) {
-    gc = XCreateGC(x11display, pen->x11drawable, 0, 0);
-    if (pen->region)
-      XSetRegion(x11display, gc, pen->region->x11region);
+    gc = TPen::_acquireGC(pen->x11drawable);
+    TPen::_setGCClip(gc, pen->region);
   }
   XSetForeground(x11display, gc, _getPixel(*this));
 }
@@ -105,6 +110,98 @@ TColor::_getPixel(const TRGB24 &rgb)
     ((rgb.b>>direct_pixel.blue_max)<<direct_pixel.blue_base);
 }
 
+// row conversion for TBitmap
+//---------------------------------------------------------------------------
+
+#ifdef HAVE_PACK32_SSSE3
+// when each channel is a whole byte of a 32bit pixel, a row is converted
+// with SSSE3 by shuffling 4 RGB triplets at once into 4 pixels
+__attribute__((target("ssse3")))
+static int
+pack32_ssse3(const TRGB24 *in, int n, uint32_t *out, const char *shuffle)
+{
+  const __m128i mask = _mm_loadu_si128((const __m128i*)shuffle);
+  const unsigned char *src = (const unsigned char*)in;
+  int i = 0;
+  // each load reads 16 bytes of which 12 are used, stop early enough
+  // not to read beyond the end of 'in'
+  for(; i+6<=n; i+=4) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(src+i*3));
+    _mm_storeu_si128((__m128i*)(out+i), _mm_shuffle_epi8(v, mask));
+  }
+  return i;
+}
+
+static bool
+have_ssse3()
+{
+  static int result = -1;
+  if (result<0) {
+    __builtin_cpu_init();
+    result = __builtin_cpu_supports("ssse3") ? 1 : 0;
+  }
+  return result;
+}
+#endif
+
+/**
+ * Convert 'n' pixels into the pixel format of the default visual and
+ * store each of them 'zoom' times in 'out', which must use the host's
+ * byte order and 'bpp' bits per pixel.
+ *
+ * Returns 'false' when 'bpp' isn't supported.
+ */
+bool
+TColor::_getPixels(const TRGB24 *in, int n, int zoom, void *out, int bpp)
+{
+  const TDirectPixel &dp = direct_pixel;
+  if (bpp==32) {
+    uint32_t *dst = (uint32_t*)out;
+    int i = 0;
+#ifdef HAVE_PACK32_SSSE3
+    if (zoom==1 &&
+        dp.red_max==0 && dp.green_max==0 && dp.blue_max==0 &&
+        dp.red_base%8==0 && dp.green_base%8==0 && dp.blue_base%8==0 &&
+        dp.red_base<32 && dp.green_base<32 && dp.blue_base<32 &&
+        have_ssse3())
+    {
+      char shuffle[16];
+      for(int p=0; p<4; ++p) {
+        for(int b=0; b<4; ++b)
+          shuffle[p*4+b] = (char)0x80;
+        shuffle[p*4+dp.red_base/8]   = p*3;
+        shuffle[p*4+dp.green_base/8] = p*3+1;
+        shuffle[p*4+dp.blue_base/8]  = p*3+2;
+      }
+      i = pack32_ssse3(in, n, dst, shuffle);
+      dst += i;
+    }
+#endif
+    for(; i<n; ++i) {
+      uint32_t pixel = 
+        ((in[i].r>>dp.red_max)<<dp.red_base) |
+        ((in[i].g>>dp.green_max)<<dp.green_base) |
+        ((in[i].b>>dp.blue_max)<<dp.blue_base);
+      for(int z=0; z<zoom; ++z)
+        *dst++ = pixel;
+    }
+    return true;
+  }
+  if (bpp==16) {
+    uint16_t *dst = (uint16_t*)out;
+    for(int i=0; i<n; ++i) {
+      uint16_t pixel = 
+        ((in[i].r>>dp.red_max)<<dp.red_base) |
+        ((in[i].g>>dp.green_max)<<dp.green_base) |
+        ((in[i].b>>dp.blue_max)<<dp.blue_base);
+      for(int z=0; z<zoom; ++z)
+        *dst++ = pixel;
+    }
+    return true;
+  }
+  return false;
+}
+
 void PrintVisualInfo(const XVisualInfo &xvi)
 {
 #if 1
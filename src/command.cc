@@ -18,48 +18,230 @@
  * MA  02111-1307,  USA
  */
 
+/**
+ * \file command.cc
+ *
+ * The message queue for TCommand.
+ *
+ * sendMessage may be called from any thread. New messages are pushed
+ * onto a lock-free stack ('inbox') with a compare-and-swap. The GUI
+ * thread takes the whole stack with a single atomic exchange, reverses
+ * it into the FIFO 'head'/'tail' and executes it from there without
+ * copying the queue.
+ *
+ * When another thread pushes onto an empty inbox, it writes to an
+ * eventfd (or a pipe) watched by the message loop, so the GUI thread
+ * wakes up.
+ */
+
+#include <toad/os.hh>
+#include <toad/config.h>
 #include <toad/command.hh>
 #include <toad/window.hh>
+#include <toad/ioobserver.hh>
 #include <iostream>
-#include <deque>
+
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 
 using namespace std; 
 using namespace toad;
 
-TCommand::TCommand() {}
+TCommand::TCommand() { _qnext = 0; }
 TCommand::~TCommand() {}
 
-typedef std::deque<PCommand> TMessageQueue;
-static TMessageQueue cmds;
+// grants the queue code below access to TCommand::_qnext
+namespace toad {
+class TMessageQueue
+{
+  public:
+    static TCommand*& next(TCommand *cmd) { return cmd->_qnext; }
+};
+} // namespace toad
+
+namespace {
+
+// commands sent since the last drain, most recent first
+TCommand *inbox = 0;
+
+// commands to be executed, oldest first (GUI thread only)
+TCommand *head = 0, *tail = 0;
+
+// number of commands in 'inbox' and 'head'
+size_t queued = 0;
+
+__thread bool gui_thread = false;
+
+class TMessageWakeup:
+  public TIOObserver
+{
+    int _wfd;
+  public:
+    TMessageWakeup(int rfd, int wfd):TIOObserver(rfd) { _wfd = wfd; }
+    ~TMessageWakeup();
+    void wakeup();
+  protected:
+    void canRead();
+};
+
+TMessageWakeup *wakeup = 0;
+
+TMessageWakeup::~TMessageWakeup()
+{
+  int rfd = fd();
+  setFD(-1);
+  if (_wfd!=rfd)
+    close(_wfd);
+  close(rfd);
+}
+
+void
+TMessageWakeup::wakeup()
+{
+#ifdef HAVE_SYS_EVENTFD_H
+  uint64_t one = 1;
+  ssize_t n = write(_wfd, &one, sizeof(one));
+#else
+  ssize_t n = write(_wfd, "", 1);
+#endif
+  (void)n; // EAGAIN: the message loop will wake up anyway
+}
+
+void
+TMessageWakeup::canRead()
+{
+  // the message loop checks countAllIntMsg() itself, just reset the fd
+  char buffer[64];
+  while(read(fd(), buffer, sizeof(buffer))>0)
+    ;
+}
+
+// move the inbox into the FIFO
+void
+drain()
+{
+  TCommand *p = __atomic_exchange_n(&inbox, (TCommand*)0, __ATOMIC_ACQUIRE);
+  if (!p)
+    return;
+  TCommand *first = 0, *last = p;
+  while(p) {
+    TCommand *next = TMessageQueue::next(p);
+    TMessageQueue::next(p) = first;
+    first = p;
+    p = next;
+  }
+  if (tail)
+    TMessageQueue::next(tail) = first;
+  else
+    head = first;
+  tail = last;
+}
 
+// execute the command and drop the reference taken by sendMessage
+void
+execute(TCommand *cmd)
+{
+  __atomic_sub_fetch(&queued, 1, __ATOMIC_RELAXED);
+  TMessageQueue::next(cmd) = 0;
+  PCommand p(cmd);
+  if (cmd->_toad_ref_cntr!=(unsigned)-1)
+    --cmd->_toad_ref_cntr;
+  p->execute();
+}
+
+} // namespace
+
+/**
+ * Set up the wakeup of the message loop for messages sent from other
+ * threads. Called by TOADBase::initialize from the GUI thread.
+ */
+void
+TCommand::initialize()
+{
+  gui_thread = true;
+  if (wakeup)
+    return;
+#ifdef HAVE_SYS_EVENTFD_H
+  int fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  if (fd>=0)
+    wakeup = new TMessageWakeup(fd, fd);
+#else
+  int fd[2];
+  if (pipe(fd)==0) {
+    fcntl(fd[1], F_SETFL, O_NONBLOCK);
+    wakeup = new TMessageWakeup(fd[0], fd[1]);
+  }
+#endif
+  if (!wakeup)
+    cerr << "toad: failed to create message queue wakeup, sendMessage from other threads won't wake up the GUI" << endl;
+}
+
+void
+TCommand::terminate()
+{
+  delete wakeup;
+  wakeup = 0;
+}
+
+/**
+ * Queue a command to be executed by the message loop.
+ *
+ * This function is lock-free and may be called from any thread. As
+ * TSmartObject isn't thread safe, a thread other than the GUI thread
+ * must hand over a command it has created on its own and must not keep
+ * a reference to it.
+ */
 void
 toad::sendMessage(TCommand *cmd)
 {
-  cmds.push_back(cmd);
+  if (cmd->_toad_ref_cntr!=(unsigned)-1)
+    ++cmd->_toad_ref_cntr;
+  __atomic_add_fetch(&queued, 1, __ATOMIC_RELAXED);
+  TCommand *old = __atomic_load_n(&inbox, __ATOMIC_RELAXED);
+  do {
+    TMessageQueue::next(cmd) = old;
+  } while(!__atomic_compare_exchange_n(&inbox, &old, cmd, true,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  if (!old && !gui_thread && wakeup)
+    wakeup->wakeup();
 }
 
+/**
+ * Execute all messages queued so far. Messages sent meanwhile are
+ * left for the next call.
+ */
 void
 toad::executeMessages()
 {
-  TMessageQueue oldcmds(cmds);
-  cmds.erase(cmds.begin(), cmds.end());
-
-  for(TMessageQueue::iterator p = oldscmds.begin();
-      p != oldcmds.end();
-      ++p)
-  {
-    (*p)->execute();
+  drain();
+  TCommand *last = tail;
+  while(head) {
+    TCommand *cmd = head;
+    head = TMessageQueue::next(cmd);
+    if (!head)
+      tail = 0;
+    bool done = cmd==last;
+    execute(cmd);
+    if (done)
+      break;
   }
 }
 
 void
 toad::executeMessage()
 {
-  if (cmds.begin() == cmds.end())
+  if (!head)
+    drain();
+  if (!head)
     return;
-  PCommand cmd = cmds.front();
-  cmds.erase(cmds.begin());
-  cmd->execute();
+  TCommand *cmd = head;
+  head = TMessageQueue::next(cmd);
+  if (!head)
+    tail = 0;
+  execute(cmd);
 }
 
 void
@@ -97,11 +279,22 @@ toad::removeMessage(void *obj)
 void
 toad::removeAllIntMsg()
 {
-  cmds.erase(cmds.begin(), cmds.end());
+  drain();
+  TCommand *p = head;
+  head = tail = 0;
+  while(p) {
+    TCommand *next = TMessageQueue::next(p);
+    __atomic_sub_fetch(&queued, 1, __ATOMIC_RELAXED);
+    TMessageQueue::next(p) = 0;
+    PCommand cmd(p);
+    if (p->_toad_ref_cntr!=(unsigned)-1)
+      --p->_toad_ref_cntr;
+    p = next;
+  }
 }
 
 size_t
 toad::countAllIntMsg()
 {
-  return cmds.size();
+  return __atomic_load_n(&queued, __ATOMIC_RELAXED);
 }
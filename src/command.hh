@@ -35,6 +35,13 @@ class TCommand:
     TCommand();
     virtual ~TCommand();
     virtual void execute() = 0;
+
+    static void initialize();
+    static void terminate();
+
+  private:
+    friend class TMessageQueue;
+    TCommand *_qnext; // link within the message queue
 };
 typedef GSmartPointer<TCommand> PCommand;
 
@@ -359,7 +359,19 @@ class TFBezierline:
 {
   protected:
     void paintSelectionLines(TPenBase &pen);
+
+    // the flattened curve and its bounding box, computed from 'flat_src'
+    // with the flatness 'flat_weight' (see TPenBase::poly2Bezier)
+    TPolygon flat, flat_src;
+    TCoord flat_weight;
+    TRectangle flat_bounds;
+    const TPolygon& getFlattened(TCoord weight, bool any=false);
+    static TCoord getWeight(const TMatrix2D *m);
+    void invalidateCurve() { flat_src.clear(); }
   public:
+    TFBezierline() { flat_weight = 0; }
+    void getCurveBounds(TRectangle *r);
+    void setAttributes(const TFigureAttributes*);
     unsigned mouseLDown(TFigureEditor*, const TMouseEvent&);
     unsigned mouseLUp(TFigureEditor*, const TMouseEvent&);
     unsigned mouseMove(TFigureEditor*, const TMouseEvent&);
@@ -581,9 +593,12 @@ class TFImage:
     string filename;
     PBitmap bitmap;
     int x, y;
+    TFigureModel *model; // to notify when the bitmap was loaded
   public:
     TFImage();
     TFImage(const string &filename);
+    TFImage(const TFImage&);
+    ~TFImage();
 
     void paint(TPenBase &, EPaintType);
     void getShape(TRectangle*);
@@ -594,6 +609,10 @@ class TFImage:
     const char * getClassName() const { return "toad::TFImage"; } 
     void store(TOutObjectStream&) const;
     bool restore(TInObjectStream&);
+
+  protected:
+    void load();
+    void loaded();
 };
 
 } // namespace toad
@@ -23,9 +23,148 @@
 
 #include <toad/action.hh>
 #include <toad/popupmenu.hh>
+#include <cmath>
 
 using namespace toad;
 
+namespace {
+
+bool
+samePolygon(const TPolygon &a, const TPolygon &b)
+{
+  if (a.size()!=b.size())
+    return false;
+  for(size_t i=0; i<a.size(); ++i) {
+    if (a[i].x!=b[i].x || a[i].y!=b[i].y)
+      return false;
+  }
+  return true;
+}
+
+// extend [*min, *max] by the extrema of the cubic bezier function with
+// the coefficients p0..p3 within 0 < t < 1
+void
+bezierExtrema(TCoord p0, TCoord p1, TCoord p2, TCoord p3, TCoord *min, TCoord *max)
+{
+  // roots of the derivative a*t^2 + b*t + c
+  TCoord a = -p0 + 3.0*p1 - 3.0*p2 + p3;
+  TCoord b = 2.0*(p0 - 2.0*p1 + p2);
+  TCoord c = p1 - p0;
+  TCoord t[2];
+  int n = 0;
+  if (fabs(a) < 1e-12) {
+    if (fabs(b) > 1e-12)
+      t[n++] = -c/b;
+  } else {
+    TCoord d = b*b - 4.0*a*c;
+    if (d>=0) {
+      d = sqrt(d);
+      t[n++] = (-b + d) / (2.0*a);
+      t[n++] = (-b - d) / (2.0*a);
+    }
+  }
+  for(int i=0; i<n; ++i) {
+    if (t[i]<=0.0 || t[i]>=1.0)
+      continue;
+    TCoord u = 1.0 - t[i];
+    TCoord v = u*u*u*p0 + 3.0*u*u*t[i]*p1 + 3.0*u*t[i]*t[i]*p2 + t[i]*t[i]*t[i]*p3;
+    if (v<*min) *min = v;
+    if (v>*max) *max = v;
+  }
+}
+
+} // namespace
+
+/**
+ * Return the flatness for TPenBase::poly2Bezier which gives about the
+ * same precision as TPen::drawBezier when drawn with matrix 'm'.
+ *
+ * The result is rounded down to a power of 2 so that small changes of
+ * the zoom factor don't discard the cached curve.
+ */
+TCoord
+TFBezierline::getWeight(const TMatrix2D *m)
+{
+  TCoord det = m ? fabs(m->a11*m->a22 - m->a12*m->a21) : 1.0;
+  if (det==0.0)
+    det = 1.0;
+  int e;
+  frexp(4.0 / det, &e);
+  if (e < -12)
+    e = -12;
+  return ldexp(1.0, e-1);
+}
+
+/**
+ * Return the flattened curve, which is only recalculated when the
+ * control points or the flatness have changed since the last call.
+ *
+ * \param weight
+ *   flatness, see getWeight
+ * \param any
+ *   when true, a cached curve of any flatness is good enough
+ */
+const TPolygon&
+TFBezierline::getFlattened(TCoord weight, bool any)
+{
+  // 'polygon' is public and modified directly in many places, so compare
+  // the control points in addition to the explicit invalidateCurve()
+  if (!flat_src.empty() &&
+      (any || flat_weight==weight) &&
+      samePolygon(flat_src, polygon))
+  {
+    return flat;
+  }
+  
+  TPenBase::poly2Bezier(polygon, flat, weight);
+  flat_src = polygon;
+  flat_weight = weight;
+  
+  if (polygon.empty()) {
+    flat_bounds.set(0,0,0,0);
+    return flat;
+  }
+  TCoord x1, y1, x2, y2;
+  x1 = x2 = polygon[0].x;
+  y1 = y2 = polygon[0].y;
+  size_t i;
+  for(i=0; i+3<polygon.size(); i+=3) {
+    const TPoint &p3 = polygon[i+3];
+    if (p3.x<x1) x1 = p3.x;
+    if (p3.x>x2) x2 = p3.x;
+    if (p3.y<y1) y1 = p3.y;
+    if (p3.y>y2) y2 = p3.y;
+    bezierExtrema(polygon[i].x, polygon[i+1].x, polygon[i+2].x, polygon[i+3].x, &x1, &x2);
+    bezierExtrema(polygon[i].y, polygon[i+1].y, polygon[i+2].y, polygon[i+3].y, &y1, &y2);
+  }
+  for(; i<polygon.size(); ++i) {
+    if (polygon[i].x<x1) x1 = polygon[i].x;
+    if (polygon[i].x>x2) x2 = polygon[i].x;
+    if (polygon[i].y<y1) y1 = polygon[i].y;
+    if (polygon[i].y>y2) y2 = polygon[i].y;
+  }
+  flat_bounds.set(x1, y1, x2-x1, y2-y1);
+  return flat;
+}
+
+/**
+ * Get the bounding box of the curve itself, which is usually smaller
+ * than that of the control points returned by getShape.
+ */
+void
+TFBezierline::getCurveBounds(TRectangle *r)
+{
+  getFlattened(4.0, true);
+  *r = flat_bounds;
+}
+
+void
+TFBezierline::setAttributes(const TFigureAttributes *attr)
+{
+  TFLine::setAttributes(attr);
+  invalidateCurve();
+}
+
 void
 TFBezierline::paintSelectionLines(TPenBase &pen)
 {
@@ -87,7 +226,8 @@ TFBezierline::paint(TPenBase &pen, EPaintType type)
   pen.setColor(line_color);
   pen.setLineStyle(line_style);
   pen.setLineWidth(line_width);
-  pen.drawBezier(polygon);
+  if (polygon.size()>=4)
+    pen.drawLines(getFlattened(getWeight(pen.getMatrix())));
 
   if (arrowmode == NONE) {
     pen.setAlpha(255);
@@ -184,29 +324,16 @@ TFBezierline::_paintSelection(TPenBase &pen, int handle, bool filled)
 double
 TFBezierline::_distance(TFigureEditor *fe, TCoord x, TCoord y)
 {
-  if (!polygon.isInside(x, y)) {
-    TCoord x1,y1,x2,y2;
-    double min = OUT_OF_RANGE;
-    TPolygon::const_iterator p(polygon.begin());
-    x2=p->x;
-    y2=p->y;
-    ++p;
-    while(p!=polygon.end()) {
-      x1=x2;
-      y1=y2;
-      x2=p->x;
-      y2=p->y;
-      double d = distance2Line(x,y, x1,y1, x2,y2);
-      if (d<min)
-        min = d;
-      ++p;
-    }
-    if (min > 0.5*fe->fuzziness*TFigure::RANGE)
-      return OUT_OF_RANGE;
-  }
+  if (polygon.size()<4)
+    return OUT_OF_RANGE;
+
+  // use the curve from the last paint when available
+  const TPolygon &p2 = getFlattened(getWeight(fe->getMatrix()), true);
 
-  TPolygon p2;
-  TPenBase::poly2Bezier(polygon, p2);
+  TCoord range = 0.5*fe->fuzziness*TFigure::RANGE;
+  if (x < flat_bounds.x - range || x > flat_bounds.x + flat_bounds.w + range ||
+      y < flat_bounds.y - range || y > flat_bounds.y + flat_bounds.h + range)
+    return OUT_OF_RANGE;
   
   TPolygon::const_iterator p(p2.begin()), e(p2.end());
   TCoord x1,y1,x2,y2;
@@ -319,6 +446,7 @@ TFBezier::translateHandle(unsigned handle, TCoord x, TCoord y, unsigned m)
 void 
 TFBezierline::_translateHandle(unsigned h0, TCoord x, TCoord y, unsigned m, bool filled)
 {
+  invalidateCurve();
   if ((h0%3)==0) {
     TCoord dx = x - polygon[h0].x;
     TCoord dy = y - polygon[h0].y;
@@ -634,6 +762,7 @@ TFBezierline::insertPointNear(TCoord x, TCoord y)
   polygon.insert(polygon.begin()+i+3, TPoint(x5,y5));
   polygon.insert(polygon.begin()+i+4, TPoint(x4,y4));
   polygon[i+5].set(x2,y2);
+  invalidateCurve();
 }
 
 void
@@ -653,6 +782,7 @@ TFBezierline::deletePoint(unsigned i)
   } else {
     polygon.erase(polygon.begin()+i-1, polygon.begin()+i+2);
   }
+  invalidateCurve();
 }
 
 /*
@@ -673,6 +803,7 @@ TFBezier::setAttributes(const TFigureAttributes *attr)
   // skip the line super classes TFBezierLine -> TFLine -> TFPolygon -> ...
   // with their different handling of the 'filled' flag
   TFPolygon::setAttributes(attr);
+  invalidateCurve();
 }
 
 void
@@ -683,11 +814,14 @@ TFBezier::paint(TPenBase &pen, EPaintType type)
   pen.setLineStyle(line_style);
   pen.setLineWidth(line_width);
   
-  if (!filled) {
-    pen.drawBezier(polygon);
-  } else {
-    pen.setFillColor(fill_color);
-    pen.fillBezier(polygon);
+  if (polygon.size()>=4) {
+    const TPolygon &p2 = getFlattened(getWeight(pen.getMatrix()));
+    if (!filled) {
+      pen.drawLines(p2);
+    } else {
+      pen.setFillColor(fill_color);
+      pen.fillPolygon(p2);
+    }
   }
 
   pen.setAlpha(255);  
@@ -722,11 +856,16 @@ TFBezier::paint(TPenBase &pen, EPaintType type)
 double
 TFBezier::_distance(TFigureEditor *fe, TCoord x, TCoord y)
 {
-  if (!polygon.isInside(x, y))
+  if (polygon.size()<4)
+    return OUT_OF_RANGE;
+
+  const TPolygon &p2 = getFlattened(getWeight(fe->getMatrix()), true);
+
+  TCoord range = 0.5*fe->fuzziness*TFigure::RANGE;
+  if (x < flat_bounds.x - range || x > flat_bounds.x + flat_bounds.w + range ||
+      y < flat_bounds.y - range || y > flat_bounds.y + flat_bounds.h + range)
     return OUT_OF_RANGE;
 
-  TPolygon p2;
-  TPenBase::poly2Bezier(polygon, p2);
   if (filled && p2.isInside(x, y))
     return INSIDE;
   
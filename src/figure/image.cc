@@ -27,20 +27,62 @@ using namespace toad;
 TFImage::TFImage()
 {
   x = y = 0;
+  model = 0;
 }
 
 TFImage::TFImage(const string &filename)
 {
   x = y = 0;
+  model = 0;
   this->filename = filename;
+  load();
+}
+
+TFImage::TFImage(const TFImage &f):
+  TFigure(f)
+{
+  filename = f.filename;
+  bitmap = f.bitmap;
+  x = f.x;
+  y = f.y;
+  model = 0;
+  if (bitmap)
+    connect(bitmap->sigLoaded, this, &TFImage::loaded);
+}
+
+TFImage::~TFImage()
+{
+  if (bitmap)
+    disconnect(bitmap->sigLoaded, this);
+}
+
+/**
+ * Load the image in the background, the figure is painted as a gray
+ * rectangle until the first part of it arrives.
+ */
+void
+TFImage::load()
+{
+  if (bitmap)
+    disconnect(bitmap->sigLoaded, this);
   bitmap = new TBitmap();
-  bitmap->load(filename);
+  connect(bitmap->sigLoaded, this, &TFImage::loaded);
+  bitmap->loadAsync(filename);
+}
+
+void
+TFImage::loaded()
+{
+  if (!bitmap->isLoading() && bitmap->getWidth()==0)
+    cout << "failed to load bitmap " << filename << endl;
+  if (model)
+    model->notifyModified(this);
 }
 
 void 
 TFImage::paint(TPenBase &pen, EPaintType)
 {
-  if (bitmap) {
+  if (bitmap && bitmap->getWidth()>0) {
     pen.drawBitmap(x, y, bitmap);
   } else {
     pen.setColor(191, 191, 191);
@@ -67,7 +109,7 @@ TFImage::getShape(TRectangle *r)
 {
   r->x = x;
   r->y = y;
-  if (bitmap) {
+  if (bitmap && bitmap->getWidth()>0) {
     r->w = bitmap->getWidth();
     r->h = bitmap->getHeight();
   } else {
@@ -84,9 +126,17 @@ TFImage::editEvent(TFigureEditEvent &ee)
       x+=ee.x;
       y+=ee.y;
       break;
+    case TFigureEditEvent::ADDED:
+      model = ee.model;
+      break;
+    case TFigureEditEvent::REMOVED:
+      if (model==ee.model)
+        model = 0;
+      break;
     default:
       ;
   }
+  return true;
 }
 
 void
@@ -102,10 +152,7 @@ bool
 TFImage::restore(TInObjectStream &in)
 {
   if (in.what == ATV_FINISHED) {
-    bitmap = new TBitmap();
-    if (!bitmap->load(filename)) {
-      cout << "failed to load bitmap" << endl;
-    }
+    load();
   }
   if (
     ::restore(in, "filename", &filename) ||
@@ -488,7 +488,8 @@ TFigureEditor::paint()
   scr.identity();
   TRectangle r;
   scr.getClipBox(&r);
-  TBitmap bmp(r.w, r.h, TBITMAP_SERVER);
+  TBitmap bmp(r.w, r.h, TBITMAP_BACKBUFFER);
+  bmp.setBackBufferOwner(window);
   TPen pen(&bmp);
 
   pen.setColor(window->getBackground());
@@ -750,8 +751,32 @@ TFigureEditor::print(TPenBase &pen, TFigureModel *model, bool withSelection, boo
   TRectangle cb, r;
   cb.set(0,0,getWidth(),getHeight());
   pen.getClipBox(&cb);
-  for(TFigureModel::iterator p = model->begin();
-      p != model->end();
+
+  // ask the model's spatial index for the candidates by mapping the clip
+  // box (plus the margin added by getFigureShape) back into model space
+  TFigureVector candidates;
+  const TMatrix2D *pm = pen.getMatrix();
+  TMatrix2D m;
+  if (pm)
+    m = *pm;
+  if (m.a11*m.a22 - m.a12*m.a21 != 0.0) {
+    m.invert();
+    TCoord x1, y1, x2, y2, x, y;
+    for(int i=0; i<4; ++i) {
+      m.map(cb.x - 3 + ((i==1||i==2) ? cb.w + 6 : 0),
+            cb.y - 3 + ((i==2||i==3) ? cb.h + 6 : 0), &x, &y);
+      if (i==0 || x<x1) x1=x;
+      if (i==0 || x>x2) x2=x;
+      if (i==0 || y<y1) y1=y;
+      if (i==0 || y>y2) y2=y;
+    }
+    model->findFigures(TRectangle(TPoint(x1,y1), TPoint(x2,y2)), &candidates);
+  } else {
+    candidates.assign(model->begin(), model->end());
+  }
+
+  for(TFigureVector::iterator p = candidates.begin();
+      p != candidates.end();
       ++p)
   {
     TRectangle r;
@@ -2007,20 +2032,10 @@ redo:
           selecting = false;
       }
       if (selecting) {
-        TFigureModel::iterator p, e;
-        p = model->begin();
-        e = model->end();
         TRectangle r1(TPoint(down_x,down_y), TPoint(x,y));
-        TRectangle r2;
-        while(p!=e) {
-          (*p)->getShape(&r2);
-          if (r1.isInside( r2.x, r2.y ) &&
-              r1.isInside( r2.x+r2.w, r2.y+r2.h ) )
-          {
-            selection.insert(*p);
-          }
-          p++;
-        }
+        TFigureVector found;
+        model->findFiguresInside(r1, &found);
+        selection.insert(found.begin(), found.end());
         #if VERBOSE
           cout << selection.size() << " objects selected, STATE_NONE" << endl;
         #endif
@@ -2039,6 +2054,7 @@ redo:
         delete gadget->mat;
       }
       gadget->mat = m;
+      model->updateIndex(gadget);
 #else
       if (!gadget->mat)
         gadget->mat = new TMatrix2D();
@@ -2094,6 +2110,10 @@ TFigureEditor::mouseRDown(const TMouseEvent &me)
 void
 TFigureEditor::invalidateFigure(TFigure* figure)
 {
+  // figures call this during editing, thus it's also the place to
+  // keep the model's spatial index up to date
+  if (model)
+    model->updateIndex(figure);
   if (!window)
     return;
   TRectangle r;
@@ -2198,12 +2218,16 @@ TFigureEditor::findFigureAt(TCoord mx, TCoord my)
   cerr << "TFigureEditor::findFigureAt(" << mx << ", " << my << ")\n";
 #endif
   double distance = INFINITY;
-  TFigureModel::iterator p,b,found;
-  p = found = model->end();
-  b = model->begin();
+  TFigureVector candidates;
+  TFigureVector::iterator p,b,found;
   TMatrix2D stack;
 
   double inside = 0.4 * fuzziness * TFigure::RANGE;
+  
+  // figures farther away than the threshold below can't be found anyway
+  model->findFiguresNear(mx, my, 0.5*fuzziness*TFigure::RANGE, &candidates);
+  p = found = candidates.end();
+  b = candidates.begin();
 
   bool stop = false;
   while(p!=b && !stop) {
@@ -2236,7 +2260,7 @@ TFigureEditor::findFigureAt(TCoord mx, TCoord my)
     }
   }
 
-  if (found == model->end())
+  if (found == candidates.end())
     return NULL;
 
 //  if (distance > TFigure::RANGE)
@@ -24,6 +24,8 @@
 #include <toad/undo.hh>
 #include <toad/undomanager.hh>
 #include <toad/io/binstream.hh>
+#include <algorithm>
+#include <cmath>
 
 /**
  * \ingroup figure
@@ -36,19 +38,118 @@
 
 using namespace toad;
 
+namespace {
+
+// tell 'figure' that it was added to or removed from 'model'
+void
+sendEditEvent(TFigureModel *model, TFigure *figure, TFigureEditEvent::EType type)
+{
+  TFigureEditEvent ee;
+  ee.model = model;
+  ee.type = type;
+  figure->editEvent(ee);
+}
+
+} // namespace
+
+namespace toad {
+
+/**
+ * \ingroup figure
+ *
+ * R-tree over the bounding boxes of the figures in a TFigureModel, used
+ * to avoid testing every figure when painting or hit-testing.
+ *
+ * The tree is packed with the sort-tile-recursive algorithm on the first
+ * query after structural changes (group, ungroup, inserts at a given
+ * depth, ...). Figures added or modified afterwards are kept in a small
+ * unsorted overflow list and figures removed leave a tombstone in the
+ * tree, until both together grow large enough to repack the tree.
+ */
+class TFigureIndex
+{
+  public:
+    TFigureIndex() { valid = false; }
+
+    bool valid;
+
+    void build(TFigureModel::iterator begin, TFigureModel::iterator end);
+    void add(TFigure*);
+    void remove(TFigure*);
+    void update(TFigure*);
+
+    enum EMode { INTERSECT, INSIDE, NEAR };
+    void find(EMode mode, TCoord x1, TCoord y1, TCoord x2, TCoord y2,
+              TCoord range, TFigureVector *result);
+
+  protected:
+    static const size_t FANOUT = 16;
+
+    struct TBox {
+      TCoord x1, y1, x2, y2;
+      TCoord reach;       // upper bound of the scaling done by mat and cmat
+    };
+    struct TItem: public TBox {
+      TFigure *figure;    // NULL when the figure was removed
+      size_t order;       // depth within the model
+    };
+    struct TSlot {
+      bool extra;
+      size_t pos;
+    };
+    
+    vector<TItem> items;          // leaves in packing order
+    vector<vector<TBox> > levels; // levels[0] covers FANOUT items each
+    vector<TItem> extra;          // figures added or modified after packing
+    map<TFigure*, TSlot> slots;
+    size_t next;                  // order for the next figure added
+    size_t dead;                  // number of tombstones in 'items'
+    
+    void set(TItem *item, TFigure *figure);
+    void put(TItem &item);
+    void checkSize();
+    bool match(EMode mode, const TBox &b, TCoord x1, TCoord y1, TCoord x2, TCoord y2, TCoord range) const;
+    void find(size_t level, size_t i, EMode mode, TCoord x1, TCoord y1, TCoord x2, TCoord y2,
+              TCoord range, vector<pair<size_t, TFigure*> > *found) const;
+};
+
+} // namespace toad
+
+namespace {
+
+struct TItemLessX {
+  template <class T>
+  bool operator()(const T &a, const T &b) const {
+    return a.x1+a.x2 < b.x1+b.x2;
+  }
+};
+
+struct TItemLessY {
+  template <class T>
+  bool operator()(const T &a, const T &b) const {
+    return a.y1+a.y2 < b.y1+b.y2;
+  }
+};
+
+} // namespace
+
+
 TFigureModel::TFigureModel()
 {
 //  cerr << "new TFigureModel " << this << endl;
+  index = 0;
 }
 
 TFigureModel::TFigureModel(const TFigureModel &m)
 {
+  index = 0;
 //  cerr << "copy constructed TFigureModel " << this << " from " << &m << endl;
   for(TStorage::const_iterator p = m.storage.begin();
       p != m.storage.end();
       ++p)
   {
     storage.push_back( static_cast<TFigure*>( (*p)->clone() ) );
+    sendEditEvent(this, storage.back(), TFigureEditEvent::ADDED);
   }
 }
 
@@ -57,6 +158,24 @@ TFigureModel::~TFigureModel()
   type = DELETE;
   sigChanged();
   clear();
+  delete index;
+}
+
+/**
+ * Tell the model that figure 'f' has changed on its own, ie. an image
+ * which finished loading in the background.
+ *
+ * Figures learn the model they belong to from the ADDED and REMOVED
+ * edit events.
+ */
+void
+TFigureModel::notifyModified(TFigure *f)
+{
+  updateIndex(f);
+  type = MODIFIED;
+  figures.clear();
+  figures.insert(f);
+  sigChanged();
 }
 
 class TUndoInsert:
@@ -201,6 +320,8 @@ TFigureModel::add(TFigure *figure) {
   TUndoManager::registerUndo(this, undo);
 
   storage.push_back(figure);
+  if (index)
+    index->add(figure);
 
   type = ADD;
   figures.clear();
@@ -232,6 +353,8 @@ TFigureModel::add(TFigureVector &newfigures) {
       ++p)
   {
     storage.push_back(*p);
+    if (index)
+      index->add(*p);
     figures.insert(*p);
     undo->insert(*p);
     (*p)->editEvent(ee);
@@ -257,9 +380,11 @@ TFigureModel::insert(TFigureAtDepthList &store)
       p->figure);
     figures.insert(p->figure);
     undo->insert(p->figure);
+    sendEditEvent(this, p->figure, TFigureEditEvent::ADDED);
   }
   TUndoManager::registerUndo(this, undo);
   store.drop();
+  invalidateIndex();
   sigChanged();
 }
 
@@ -319,6 +444,8 @@ TFigureModel::erase(TFigureSet &set)
 //      cerr << "  erase found figure at depth " << depth << endl;
       undo->insert(*p, depth);
       (*p)->editEvent(ee);
+      if (index)
+        index->remove(*p);
       TStorage::iterator tmp = p;
       --tmp;
       storage.erase(p);
@@ -377,6 +504,7 @@ TFigureModel::transform(const TFigureSet &set, const TMatrix2D &m)
       // *(*p)->cmat *= m;
       *(*p)->cmat = m * *(*p)->cmat;
     }
+    updateIndex(*p);
   }
 
   type = MODIFIED;
@@ -499,6 +627,7 @@ TFigureModel::translate(const TFigureSet &set, TCoord dx, TCoord dy)
       ee.y = dy;
       (*p)->editEvent(ee);
     }
+    updateIndex(*p);
   }
   type = MODIFIED;
   sigChanged();
@@ -539,6 +668,7 @@ TFigureModel::translateHandle(TFigure *figure, unsigned handle, TCoord x, TCoord
   figure->getHandle(handle, &p);
   
   figure->translateHandle(handle, x, y, m);
+  updateIndex(figure);
   
   type = MODIFIED;
   sigChanged();
@@ -620,6 +750,7 @@ TFigureModel::group(TFigureSet &set)
   
   group->calcSize();
   storage.insert(last, group);
+  invalidateIndex();
   
   type = GROUP;
   figures.clear();
@@ -672,6 +803,10 @@ TFigureModel::ungroup(TFigureSet &grouped, TFigureSet *ungrouped)
         p = storage.begin() + pi;
 
         storage.insert(p, group->gadgets.storage.begin(), group->gadgets.storage.end());
+        for(TFigureModel::iterator vp = group->gadgets.begin();
+            vp != group->gadgets.end();
+            ++vp)
+          sendEditEvent(this, *vp, TFigureEditEvent::ADDED);
         p = storage.begin() + pi + group->gadgets.storage.size()-1;
         memo.insert(group->gadgets.begin(), group->gadgets.end());
         group->gadgets.erase(group->gadgets.begin(),group->gadgets.end());
@@ -681,6 +816,7 @@ TFigureModel::ungroup(TFigureSet &grouped, TFigureSet *ungrouped)
       }
     }
   }
+  invalidateIndex();
   ungrouped->clear();
   ungrouped->insert(memo.begin(), memo.end());
   
@@ -737,6 +873,7 @@ class TUndoAttributes:
       while(node) {
         undo->insert(node->figure);
         node->figure->setAttributes(&node->attributes);
+        model->updateIndex(node->figure);
         node = node->next;
       }
       TUndoManager::registerUndo(model, undo);
@@ -774,6 +911,7 @@ TFigureModel::setAttributes(TFigureSet &set, const TFigureAttributes *attributes
   {
     undo->insert(*p);
     (*p)->setAttributes(attributes);
+    updateIndex(*p);
   }
   
   TUndoManager::registerUndo(this, undo);
@@ -803,7 +941,9 @@ TFigureModel::_undoGroup(TFGroup *group, TFigureAtDepthList &store)
       p->figure);
     figures.insert(p->figure);
     undo->insert(p->figure);
+    sendEditEvent(this, p->figure, TFigureEditEvent::ADDED);
   }
+  invalidateIndex();
   sigChanged();
 
   for(TStorage::iterator p=storage.begin();
@@ -824,7 +964,9 @@ TFigureModel::erase(const iterator &p)
 {
   type = MODIFIED;
   sigChanged();
+  sendEditEvent(this, *p, TFigureEditEvent::REMOVED);
   storage.erase(p);
+  invalidateIndex();
 }
 
 void
@@ -832,7 +974,10 @@ TFigureModel::erase(const iterator &p, const iterator &e)
 {
   type = MODIFIED;
   sigChanged();
+  for(iterator q = p; q != e; ++q)
+    sendEditEvent(this, *q, TFigureEditEvent::REMOVED);
   storage.erase(p, e);
+  invalidateIndex();
 }
 
 void
@@ -841,6 +986,8 @@ TFigureModel::insert(const iterator &p, TFigure *g)
   type = MODIFIED;
   sigChanged();
   storage.insert(p, g);
+  invalidateIndex();
+  sendEditEvent(this, g, TFigureEditEvent::ADDED);
 }
 
 void
@@ -848,7 +995,19 @@ TFigureModel::insert(const iterator &at, const iterator &from, const iterator &t
 {
   type = MODIFIED;
   sigChanged();
+  for(iterator p = from; p != to; ++p)
+    sendEditEvent(this, *p, TFigureEditEvent::ADDED);
   storage.insert(at, from, to);
+  invalidateIndex();
+}
+
+void
+TFigureModel::drop()
+{
+  for(iterator p = storage.begin(); p != storage.end(); ++p)
+    sendEditEvent(this, *p, TFigureEditEvent::REMOVED);
+  storage.clear();
+  invalidateIndex();
 }
 
 /**
@@ -870,6 +1029,7 @@ TFigureModel::clear()
     ++p;
   }
   storage.erase(storage.begin(), storage.end());
+  invalidateIndex();
 }
 
 void
@@ -904,6 +1064,8 @@ TFigureModel::restore(TInObjectStream &in)
         }
 //        cerr << "adding new gadget to TFigureModel " << this << endl;
         storage.push_back(g);
+        invalidateIndex();
+        sendEditEvent(this, g, TFigureEditEvent::ADDED);
 //        cerr << "new storage size is " << storage.size() << endl;
         in.setInterpreter(s);
         return true;
@@ -917,3 +1079,324 @@ TFigureModel::restore(TInObjectStream &in)
   }
   return false;
 }
+
+/**
+ * Get the bounding box of a figure after applying its 'mat' and 'cmat'.
+ */
+void
+TFigureModel::getFigureBounds(TFigure *figure, TRectangle *r)
+{
+  figure->getShape(r);
+  if (!figure->mat && !figure->cmat)
+    return;
+
+  TMatrix2D m;
+  if (figure->mat)
+    m.multiply(figure->mat);
+  if (figure->cmat)
+    m.multiply(figure->cmat);
+
+  TCoord x1, y1, x2, y2, x, y;
+  m.map(r->x, r->y, &x1, &y1);
+  x2 = x1;
+  y2 = y1;
+  for(int i=1; i<4; ++i) {
+    m.map(r->x + ((i==1||i==2) ? r->w : 0),
+          r->y + ((i==2||i==3) ? r->h : 0), &x, &y);
+    if (x1>x) x1=x;
+    if (x2<x) x2=x;
+    if (y1>y) y1=y;
+    if (y2<y) y2=y;
+  }
+  r->set(TPoint(x1, y1), TPoint(x2, y2));
+}
+
+TFigureIndex*
+TFigureModel::getIndex()
+{
+  if (!index)
+    index = new TFigureIndex();
+  if (!index->valid)
+    index->build(storage.begin(), storage.end());
+  return index;
+}
+
+void
+TFigureModel::invalidateIndex()
+{
+  if (index)
+    index->valid = false;
+}
+
+/**
+ * Tell the spatial index that the figure's shape or transformation has
+ * been modified without using one of the models methods, ie. while
+ * being edited by a TFigureEditor.
+ */
+void
+TFigureModel::updateIndex(TFigure *figure)
+{
+  if (index)
+    index->update(figure);
+}
+
+/**
+ * Find all figures whose bounding box intersects with 'r'.
+ *
+ * The figures are returned in the order they are painted.
+ */
+void
+TFigureModel::findFigures(const TRectangle &r, TFigureVector *result)
+{
+  getIndex()->find(TFigureIndex::INTERSECT, r.x, r.y, r.x+r.w, r.y+r.h, 0, result);
+}
+
+/**
+ * Find all figures whose bounding box lies completely within 'r'.
+ */
+void
+TFigureModel::findFiguresInside(const TRectangle &r, TFigureVector *result)
+{
+  getIndex()->find(TFigureIndex::INSIDE, r.x, r.y, r.x+r.w, r.y+r.h, 0, result);
+}
+
+/**
+ * Find all figures which may be within 'range' of point (x, y), where
+ * 'range' is measured in the figures own coordinate system, ie. before
+ * 'mat' and 'cmat' are applied. This is a superset of the figures whose
+ * TFigure::_distance is less or equal 'range'.
+ *
+ * The figures are returned in the order they are painted.
+ */
+void
+TFigureModel::findFiguresNear(TCoord x, TCoord y, TCoord range, TFigureVector *result)
+{
+  getIndex()->find(TFigureIndex::NEAR, x, y, x, y, range, result);
+}
+
+void
+TFigureIndex::set(TItem *item, TFigure *figure)
+{
+  TRectangle r;
+  TFigureModel::getFigureBounds(figure, &r);
+  item->x1 = r.x;
+  item->y1 = r.y;
+  item->x2 = r.x + r.w;
+  item->y2 = r.y + r.h;
+  item->reach = 1.0;
+  if (figure->mat || figure->cmat) {
+    TMatrix2D m;
+    if (figure->mat)
+      m.multiply(figure->mat);
+    if (figure->cmat)
+      m.multiply(figure->cmat);
+    // the frobenius norm is an upper bound for the spectral norm
+    item->reach = sqrt(m.a11*m.a11 + m.a12*m.a12 + m.a21*m.a21 + m.a22*m.a22);
+  }
+  item->figure = figure;
+}
+
+void
+TFigureIndex::build(TFigureModel::iterator begin, TFigureModel::iterator end)
+{
+  items.clear();
+  levels.clear();
+  extra.clear();
+  slots.clear();
+  dead = 0;
+  next = 0;
+
+  for(TFigureModel::iterator p = begin; p != end; ++p) {
+    items.push_back(TItem());
+    set(&items.back(), *p);
+    items.back().order = next++;
+  }
+  
+  // sort-tile-recursive: sort by x, cut into vertical slices and sort
+  // each slice by y so that consecutive runs of FANOUT items are compact
+  size_t n = items.size();
+  size_t leaves = (n + FANOUT - 1) / FANOUT;
+  size_t slices = static_cast<size_t>(ceil(sqrt(static_cast<double>(leaves))));
+  if (slices==0)
+    slices = 1;
+  size_t slice = ((leaves + slices - 1) / slices) * FANOUT;
+  sort(items.begin(), items.end(), TItemLessX());
+  for(size_t i=0; i<n; i+=slice) {
+    sort(items.begin() + i, 
+         items.begin() + min(i+slice, n),
+         TItemLessY());
+  }
+  for(size_t i=0; i<n; ++i) {
+    TSlot &slot = slots[items[i].figure];
+    slot.extra = false;
+    slot.pos = i;
+  }
+  
+  size_t count = n;
+  while(count>1 || levels.empty()) {
+    if (count==0)
+      break;
+    levels.push_back(vector<TBox>());
+    vector<TBox> &level = levels.back();
+    for(size_t i=0; i<count; i+=FANOUT) {
+      TBox box;
+      for(size_t j=i; j<min(i+FANOUT, count); ++j) {
+        const TBox &b = levels.size()==1 
+          ? static_cast<const TBox&>(items[j])
+          : levels[levels.size()-2][j];
+        if (j==i) {
+          box = b;
+        } else {
+          box.x1 = min(box.x1, b.x1);
+          box.y1 = min(box.y1, b.y1);
+          box.x2 = max(box.x2, b.x2);
+          box.y2 = max(box.y2, b.y2);
+          box.reach = max(box.reach, b.reach);
+        }
+      }
+      level.push_back(box);
+    }
+    count = level.size();
+  }
+  valid = true;
+}
+
+void
+TFigureIndex::put(TItem &item)
+{
+  TSlot &slot = slots[item.figure];
+  slot.extra = true;
+  slot.pos = extra.size();
+  extra.push_back(item);
+}
+
+void
+TFigureIndex::add(TFigure *figure)
+{
+  if (!valid)
+    return;
+  TItem item;
+  set(&item, figure);
+  item.order = next++;
+  put(item);
+  checkSize();
+}
+
+void
+TFigureIndex::remove(TFigure *figure)
+{
+  if (!valid)
+    return;
+  map<TFigure*, TSlot>::iterator p = slots.find(figure);
+  if (p==slots.end())
+    return;
+  if (p->second.extra) {
+    size_t pos = p->second.pos;
+    if (pos+1 != extra.size()) {
+      extra[pos] = extra.back();
+      slots[extra[pos].figure].pos = pos;
+    }
+    extra.pop_back();
+  } else {
+    items[p->second.pos].figure = 0;
+    ++dead;
+  }
+  slots.erase(p);
+  checkSize();
+}
+
+/**
+ * Refresh the bounding box of a figure. Items in the packed tree are
+ * never modified in place but moved into the overflow list, so that
+ * the node boxes always enclose their items.
+ */
+void
+TFigureIndex::update(TFigure *figure)
+{
+  if (!valid)
+    return;
+  map<TFigure*, TSlot>::iterator p = slots.find(figure);
+  if (p==slots.end())
+    return;
+  if (p->second.extra) {
+    TItem &item = extra[p->second.pos];
+    set(&item, figure);
+  } else {
+    TItem item = items[p->second.pos];
+    items[p->second.pos].figure = 0;
+    ++dead;
+    set(&item, figure);
+    put(item);
+    checkSize();
+  }
+}
+
+void
+TFigureIndex::checkSize()
+{
+  if (extra.size() + dead > max(static_cast<size_t>(64), items.size()/8))
+    valid = false;
+}
+
+inline bool
+TFigureIndex::match(EMode mode, const TBox &b, TCoord x1, TCoord y1, TCoord x2, TCoord y2, TCoord range) const
+{
+  switch(mode) {
+    case INSIDE:
+      return x1<=b.x1 && b.x2<=x2 && y1<=b.y1 && b.y2<=y2;
+    case NEAR:
+      range *= b.reach;
+      break;
+    default:
+      break;
+  }
+  return b.x1-range<=x2 && x1<=b.x2+range && b.y1-range<=y2 && y1<=b.y2+range;
+}
+
+void
+TFigureIndex::find(size_t level, size_t i, EMode mode, TCoord x1, TCoord y1, TCoord x2, TCoord y2,
+                   TCoord range, vector<pair<size_t, TFigure*> > *found) const
+{
+  // nodes only need to intersect, even when looking for enclosed items
+  EMode nmode = mode==INSIDE ? INTERSECT : mode;
+  size_t e;
+  if (level==0) {
+    e = min((i+1)*FANOUT, items.size());
+    for(size_t j=i*FANOUT; j<e; ++j) {
+      const TItem &item = items[j];
+      if (item.figure && match(mode, item, x1, y1, x2, y2, range))
+        found->push_back(make_pair(item.order, item.figure));
+    }
+  } else {
+    const vector<TBox> &children = levels[level-1];
+    e = min((i+1)*FANOUT, children.size());
+    for(size_t j=i*FANOUT; j<e; ++j) {
+      if (match(nmode, children[j], x1, y1, x2, y2, range))
+        find(level-1, j, mode, x1, y1, x2, y2, range, found);
+    }
+  }
+}
+
+void
+TFigureIndex::find(EMode mode, TCoord x1, TCoord y1, TCoord x2, TCoord y2,
+                   TCoord range, TFigureVector *result)
+{
+  vector<pair<size_t, TFigure*> > found;
+  if (!levels.empty()) {
+    size_t top = levels.size()-1;
+    EMode nmode = mode==INSIDE ? INTERSECT : mode;
+    for(size_t i=0; i<levels[top].size(); ++i) {
+      if (match(nmode, levels[top][i], x1, y1, x2, y2, range))
+        find(top, i, mode, x1, y1, x2, y2, range, &found);
+    }
+  }
+  for(vector<TItem>::const_iterator p = extra.begin(); p != extra.end(); ++p) {
+    if (match(mode, *p, x1, y1, x2, y2, range))
+      found.push_back(make_pair(p->order, p->figure));
+  }
+  sort(found.begin(), found.end());
+  result->clear();
+  result->reserve(found.size());
+  for(vector<pair<size_t, TFigure*> >::const_iterator p = found.begin(); p != found.end(); ++p)
+    result->push_back(p->second);
+}
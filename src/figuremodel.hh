@@ -41,6 +41,7 @@ typedef vector<TFigure*> TFigureVector;
 
 class TFigureAtDepthList;
 class TFigureAttributes;
+class TFigureIndex;
 
 /**
  * \ingroup figure
@@ -108,6 +109,8 @@ class TFigureModel:
     void ungroup(TFigureSet &grouped, TFigureSet *ungrouped);
     
     void setAttributes(TFigureSet &set, const TFigureAttributes *attributes);
+
+    void notifyModified(TFigure*);
     
     void erase(const iterator&);
     void erase(const iterator&, const iterator&);
@@ -119,13 +122,20 @@ class TFigureModel:
     void clear();
     
     //! remove all figures but don't delete them
-    void drop() {
-      storage.clear();
-    }
+    void drop();
+
+    void findFigures(const TRectangle &r, TFigureVector *result);
+    void findFiguresInside(const TRectangle &r, TFigureVector *result);
+    void findFiguresNear(TCoord x, TCoord y, TCoord range, TFigureVector *result);
+    void updateIndex(TFigure*);
+    static void getFigureBounds(TFigure*, TRectangle*);
 
     SERIALIZABLE_INTERFACE_PUBLIC(toad::, TFigureModel)
   protected:
     TStorage storage;
+    TFigureIndex *index;
+    TFigureIndex* getIndex();
+    void invalidateIndex();
 };
 
 /**
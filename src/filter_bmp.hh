@@ -33,6 +33,9 @@ class TFilterBMP: public TBitmapFilter
     EResult load(istream&);
     const char* getName(){return "PC-DOS Bitmap";}
     const char* getExt(){return "*.bmp";}
+    bool probe(const unsigned char *header, size_t size) {
+      return size>=2 && header[0]=='B' && header[1]=='M';
+    }
   private:
     struct TBMPFileInfo
     {
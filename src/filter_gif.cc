@@ -74,6 +74,7 @@
 #include <cstdio>
 #include <cstring>
 #include <stdexcept>
+#include <pthread.h>
 
 #include <toad/toad.hh>
 #include <toad/bitmap.hh>
@@ -139,8 +140,22 @@ int TFilterGIF::editSpecific()
 
 // Load GIF Picture
 //---------------------------------------------------------------------------
+/**
+ * The LZW decoder below keeps its state in static variables, so only one
+ * GIF is decoded at a time, even with the loader threads.
+ */
 TFilterGIF::EResult 
 TFilterGIF::load(istream &stream)
+{
+  static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_mutex_lock(&mutex);
+  EResult result = decode(stream);
+  pthread_mutex_unlock(&mutex);
+  return result;
+}
+
+TFilterGIF::EResult 
+TFilterGIF::decode(istream &stream)
 {
   bool bLoop;
   
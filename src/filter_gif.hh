@@ -34,6 +34,9 @@ class TFilterGIF:
 
     const char* getName(){return "CompuServe GIF";}
     const char* getExt(){return "*.gif";}
+    bool probe(const unsigned char *header, size_t size) {
+      return size>=3 && memcmp(header, "GIF", 3)==0;
+    }
     int editSpecific();
 
     struct TColormap;
@@ -54,6 +57,8 @@ class TFilterGIF:
     unsigned image_count;
 
     bool has_global_colormap;
+
+    EResult decode(istream&);
 };
 
 } // namespace toad
@@ -41,17 +41,23 @@ int TFilterJPEG::editSpecific()
   return TMessageBox::OK;
 }
 
-static jmp_buf setjmp_buffer;
+// the filter is used by the loader threads also, so the jump buffer
+// is kept along with the decompressor
+struct toad_error_mgr {
+  struct jpeg_error_mgr jlib;
+  jmp_buf setjmp_buffer;
+};
 
 // Load Picture
 //---------------------------------------------------------------------------
-static void 
-read_image(TFilterJPEG *fltr, struct jpeg_decompress_struct* cinfo)
+void 
+TFilterJPEG::read_image(struct jpeg_decompress_struct* cinfo, bool progressive)
 {
   TRGB24 rgb;
   int row_stride = cinfo->output_width * cinfo->output_components;
   JSAMPARRAY buffer = (*cinfo->mem->alloc_sarray) ((j_common_ptr) cinfo, JPOOL_IMAGE, row_stride, 1);
   while (cinfo->output_scanline < cinfo->output_height) {
+    int y = cinfo->output_scanline;
     (void) jpeg_read_scanlines(cinfo, buffer, 1);
     JSAMPROW row = buffer[0];
     for (unsigned int x = 0; x < cinfo->output_width; x++) {
@@ -72,14 +78,16 @@ read_image(TFilterJPEG *fltr, struct jpeg_decompress_struct* cinfo)
           rgb.b = *row++;
           break;
       }
-      fltr->setColorPixel(x, cinfo->output_scanline, rgb);
+      setColorPixel(x, y, rgb);
     }
+    if (!progressive && (y&63)==63)
+      notifyProgress();
   }
 }
 
 static void 
 my_error_exit(j_common_ptr cinfo) {
-  longjmp(setjmp_buffer, 1);
+  longjmp(((toad_error_mgr*)cinfo->err)->setjmp_buffer, 1);
 }
 
 // jdatasrc.c
@@ -160,11 +168,11 @@ TFilterJPEG::load(istream &stream)
 {
   struct jpeg_decompress_struct* cinfo = new jpeg_decompress_struct;
 
-  jpeg_error_mgr em;
-  cinfo->err = jpeg_std_error(&em);
-  em.error_exit = my_error_exit;
+  toad_error_mgr em;
+  cinfo->err = jpeg_std_error(&em.jlib);
+  em.jlib.error_exit = my_error_exit;
 
-  if (setjmp(setjmp_buffer)) {
+  if (setjmp(em.setjmp_buffer)) {
     jpeg_destroy_decompress(cinfo);
     delete cinfo;
     setError("Error while loading JPEG file");
@@ -179,6 +187,14 @@ TFilterJPEG::load(istream &stream)
   if (jpeg_has_multiple_scans(cinfo)) {
     cinfo->buffered_image = TRUE;
   }
+
+  // let the IDCT scale the image down
+  reduced = 1;
+  while(reduced<8 && reduced*2<=reduce)
+    reduced*=2;
+  cinfo->scale_num = 1;
+  cinfo->scale_denom = reduced;
+
   jpeg_start_decompress(cinfo);
   
   createBuffer(cinfo->output_width, cinfo->output_height, TBITMAP_TRUECOLOR);
@@ -186,11 +202,12 @@ TFilterJPEG::load(istream &stream)
   if (jpeg_has_multiple_scans(cinfo)) {
     while (! jpeg_input_complete(cinfo)) {
       jpeg_start_output(cinfo, cinfo->input_scan_number);
-      read_image(this, cinfo);
+      read_image(cinfo, true);
       jpeg_finish_output(cinfo);
+      notifyProgress();
     }
   } else {
-    read_image(this, cinfo);
+    read_image(cinfo, false);
   }
 
   jpeg_finish_decompress(cinfo);
@@ -26,6 +26,8 @@
 
 #ifdef HAVE_LIBJPEG
 
+struct jpeg_decompress_struct;
+
 namespace toad {
 
 class TFilterJPEG:
@@ -36,7 +38,12 @@ class TFilterJPEG:
     EResult load(istream&);
     const char* getName(){return "JPEG";}
     const char* getExt(){return "*.jpg";}
+    bool probe(const unsigned char *header, size_t size) {
+      return size>=3 && header[0]==0xFF && header[1]==0xD8 && header[2]==0xFF;
+    }
     int editSpecific();
+  protected:
+    void read_image(struct jpeg_decompress_struct*, bool progressive);
 };
 
 } // namespace toad
@@ -146,39 +146,79 @@ TFilterPNG::load(istream &stream)
   printf("color type: %s\n",str);
 #endif
   bool ok = false;
+  bool complete = true;
 
   if (png_get_bit_depth(png_ptr, info_ptr) <= 8) {
     png_set_expand(png_ptr);  // expand to 8 bit per pixel
+    png_set_gray_to_rgb(png_ptr);
+    int passes = png_set_interlace_handling(png_ptr);
     
     png_read_update_info(png_ptr, info_ptr);
     
     png_uint_32 png_width = png_get_image_width(png_ptr, info_ptr);
     png_uint_32 png_height = png_get_image_height(png_ptr, info_ptr);
-    
-    createBuffer(png_width, png_height, TBITMAP_TRUECOLOR);
-    png_bytep row_pointers[png_height];
-    for (unsigned row = 0; row < png_height; row++)
-      row_pointers[row] = (png_bytep)malloc(png_get_rowbytes(png_ptr, info_ptr));
-    png_read_image(png_ptr, row_pointers);
-    
-    unsigned x,y;
+    unsigned channels = 
+      (png_get_color_type(png_ptr, info_ptr) & PNG_COLOR_MASK_ALPHA) ? 4 : 3;
+
+    // reduced images take every n-th pixel, interlaced images provide
+    // these after the 1st (1/8), 3rd (1/4) and 5th (1/2) of 7 passes
+    reduced = 1;
+    while(reduced<8 && reduced*2<=reduce)
+      reduced*=2;
+    int needed = passes;
+    if (passes==7 && reduced>1)
+      needed = reduced==8 ? 1 : reduced==4 ? 3 : 5;
+    complete = needed==passes;
+    unsigned w = (png_width+reduced-1)/reduced;
+    unsigned h = (png_height+reduced-1)/reduced;
+
+    createBuffer(w, h, TBITMAP_TRUECOLOR);
+    size_t rowbytes = png_get_rowbytes(png_ptr, info_ptr);
     TRGB24 c;
-    unsigned char *ptr;
-    for(y=0; y<png_height; y++) {
-      ptr = row_pointers[y];
-      for(x=0; x<png_width; x++) {
-        c.r = *(ptr++);
-        c.g = *(ptr++);
-        c.b = *(ptr++);
-        if (png_get_color_type(png_ptr, info_ptr) & PNG_COLOR_MASK_ALPHA)
-          ptr++;
-        setColorPixel(x,y,c);
+    
+    if (passes==1) {
+      png_bytep row = (png_bytep)malloc(rowbytes);
+      for(unsigned y=0; y<png_height; y++) {
+        png_read_row(png_ptr, row, NULL);
+        if (y%reduced==0) {
+          for(unsigned x=0; x<w; x++) {
+            unsigned char *ptr = row + x*reduced*channels;
+            c.r = ptr[0];
+            c.g = ptr[1];
+            c.b = ptr[2];
+            setColorPixel(x, y/reduced, c);
+          }
+        }
+        if ((y&63)==63)
+          notifyProgress();
       }
+      free(row);
+    } else {
+      // the rows are filled in 'rectangle' mode, so after each pass
+      // there's a blocky but complete image to show
+      png_bytep *row_pointers = (png_bytep*)malloc(sizeof(png_bytep)*png_height);
+      for (unsigned row = 0; row < png_height; row++)
+        row_pointers[row] = (png_bytep)calloc(rowbytes, 1);
+      for(int pass=0; pass<needed; pass++) {
+        for(unsigned y=0; y<png_height; y++)
+          png_read_row(png_ptr, NULL, row_pointers[y]);
+        for(unsigned y=0; y<h; y++) {
+          for(unsigned x=0; x<w; x++) {
+            unsigned char *ptr = row_pointers[y*reduced] + x*reduced*channels;
+            c.r = ptr[0];
+            c.g = ptr[1];
+            c.b = ptr[2];
+            setColorPixel(x, y, c);
+          }
+        }
+        if (pass+1<needed)
+          notifyProgress();
+      }
+      for (unsigned row = 0; row < png_height; row++)
+        free(row_pointers[row]);
+      free(row_pointers);
     }
     ok = true;
-    
-    for (unsigned row = 0; row < png_height; row++)
-      free(row_pointers[row]);
   }
   
   if (!ok) {
@@ -187,7 +227,9 @@ TFilterPNG::load(istream &stream)
     return ERROR;
   }
 
-  png_read_end(png_ptr, end_info);
+  // the remaining passes of a reduced interlaced image are skipped
+  if (complete)
+    png_read_end(png_ptr, end_info);
   png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
 
   return OK;
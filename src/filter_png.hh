@@ -39,6 +39,9 @@ class TFilterPNG:
     EResult load(istream&);
     const char* getName(){return "PNG";}
     const char* getExt(){return "*.png";}
+    bool probe(const unsigned char *header, size_t size) {
+      return size>=8 && memcmp(header, "\x89PNG\r\n\x1a\n", 8)==0;
+    }
     int editSpecific();
 };
 
@@ -86,7 +86,7 @@ DBM(cerr << "  locked => return\n";)
         return;
       }
 DBM(cerr << "  not locked => setValue\n";)
-      double a = atof(_data.c_str());
+      double a = atof(c_str());
       lock = true;
       model->setValue(a);
       lock = false;
@@ -95,16 +95,24 @@ struct TFTFont {
   XftFont *xftfont, *xftfont_r;
   double x11scale;
   string id;
+  
+  // glyph advances of xftfont, so that getTextWidth doesn't need to ask
+  // Xft each time: a table for ASCII and a map for all other characters
+  TCoord ascii[128];
+  map<FcChar32, TCoord> advances;
 
   TFTFont() {
     x11scale = 1.0;
     xftfont = 0;
     xftfont_r = 0;
+    for(unsigned i=0; i<128; ++i)
+      ascii[i] = -1;
   }
   ~TFTFont() {
     clear();
   }
   void clear();
+  TCoord advance(FcChar32 c);
 };
 
 void
@@ -118,6 +126,29 @@ TFTFont::clear()
     XftFontClose(toad::x11display, xftfont_r);
     xftfont_r = 0;
   }
+  for(unsigned i=0; i<128; ++i)
+    ascii[i] = -1;
+  advances.clear();
+}
+
+TCoord
+TFTFont::advance(FcChar32 c)
+{
+  if (c<128) {
+    if (ascii[c]<0) {
+      XGlyphInfo gi;
+      XftTextExtents32(toad::x11display, xftfont, &c, 1, &gi);
+      ascii[c] = gi.xOff;
+    }
+    return ascii[c];
+  }
+  map<FcChar32, TCoord>::iterator p = advances.find(c);
+  if (p!=advances.end())
+    return p->second;
+  XGlyphInfo gi;
+  XftTextExtents32(toad::x11display, xftfont, &c, 1, &gi);
+  advances[c] = gi.xOff;
+  return gi.xOff;
 }
 
 void
@@ -168,6 +199,9 @@ TFontManagerFT::allocate(TFont *font, const TMatrix2D *mat)
       if (ft->xftfont) {
         XftFontClose(toad::x11display, ft->xftfont);
         ft->xftfont = 0;
+        ft->advances.clear();
+        for(unsigned i=0; i<128; ++i)
+          ft->ascii[i] = -1;
       }
       ft->id = newid;
     } else {
@@ -277,16 +311,15 @@ TFontManagerFT::drawString(TPenBase *penbase, TCoord x, TCoord y, const char *st
   color.color.blue  = pen->o_color.b * 0xFFFF;
   color.color.alpha = 0xffff;
 
-  if (!pen->xftdraw) {
-    pen->xftdraw = XftDrawCreate(toad::x11display, 
-                                 pen->x11drawable, 
-                                 toad::x11visual, 
-                                 toad::x11colormap);
-  }   
+  if (!pen->xftdraw)
+    pen->xftdraw = TPen::_lookupXftDraw(pen->x11drawable);
+  // the XftDraw is shared with other pens, Xft ignores unchanged clips
   if (pen->region)
     XftDrawSetClip(pen->xftdraw, pen->region->x11region);
   else if (pen->wnd && pen->wnd->getUpdateRegion())
     XftDrawSetClip(pen->xftdraw, pen->wnd->getUpdateRegion()->x11region);
+  else
+    XftDrawSetClip(pen->xftdraw, 0);
 
  if (!pen->mat || pen->mat->isIdentity()) {
     if (pen->mat)
@@ -369,18 +402,25 @@ TFontManagerFT::getTextWidth(TFont *font, const char *str, size_t len)
     return 0;
   TFTFont *ft = static_cast<TFTFont*>(font->corefont);
   if (ft->xftfont) {
-    XGlyphInfo gi;
-    if (ft->xftfont->ascent + ft->xftfont->descent<=64) {
-      XftTextExtentsUtf8(toad::x11display, ft->xftfont, (XftChar8*)str, len, &gi);
-      return gi.xOff;
-    }
-    int w = 0;
-    for(int i=0; i<len;) {
-      XGlyphInfo gi;
-      int n = utf8bytecount(str, i, 1);
-      XftTextExtentsUtf8(toad::x11display, ft->xftfont, (XftChar8*)str+i, n, &gi);
-      w+=gi.xOff;
-      i+=n;
+    // Xft doesn't kern, so the width is the sum of the glyph advances
+    const unsigned char *p = (const unsigned char*)str;
+    const unsigned char *e = p + len;
+    TCoord w = 0;
+    while(p<e) {
+      FcChar32 c = *p;
+      if (c<0x80) {
+        w += ft->ascii[c]>=0 ? ft->ascii[c] : ft->advance(c);
+        ++p;
+        continue;
+      }
+      int n = FcUtf8ToUcs4(p, &c, e-p);
+      if (n<=0) {
+        // not UTF-8, take the byte as is
+        c = *p;
+        n = 1;
+      }
+      w += ft->advance(c);
+      p += n;
     }
     return w;
   }
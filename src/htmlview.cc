@@ -31,6 +31,7 @@
 #include <string>
 #include <map>
 #include <stack>
+#include <algorithm>
 
 // test only:
 //#include <fstream>
@@ -59,8 +60,6 @@ using namespace toad;
  *     TScrollPane misses to invalidate some screen regions
  */
 
-#define SPEEDUP_KLUDGE
-
 namespace {
 
 struct TState;
@@ -82,6 +81,11 @@ class THTMLView::TAnchorStorage:
 {
 };
 
+namespace {
+  // elements between two restart points in THTMLView::TLayout
+  const size_t checkpoint_distance = 64;
+}
+
 namespace {
 
 typedef THTMLView::TElementStorage TElementStorage;
@@ -172,6 +176,10 @@ class TParser
 
     TElementStorage* pout;
     TAnchorStorage* aout;
+
+  public:
+    //! the view the elements are parsed for, used by images loaded later
+    THTMLView *view;
 };
 
 /**
@@ -243,6 +251,9 @@ pen = 0;
       
       lmin = lmax = lmax_per_line = 0;
       blank = false;
+
+      clip_top = INT_MIN;
+      clip_bottom = INT_MAX;
     }
   
     bool blank;
@@ -416,29 +427,28 @@ if (pen) {
       TRGB color;
       EAlignment align;
     };
-    std::stack<state_t*> stack;
+    std::stack<state_t> stack;
     
     void pushState() {
-      state_t *s = new state_t;
+      state_t s;
+      s.left  = left;
+      s.size  = size;
+      s.face  = face;
+      s.color = color;
+      s.align = align;
       stack.push(s);
-      s->left  = left;
-      s->size  = size;
-      s->face  = face;
-      s->color = color;
-      s->align = align;
     }
     
     void popState() {
       if (stack.empty())
         return;
-      state_t *s = stack.top();
+      const state_t &s = stack.top();
+      left  = s.left;
+      size  = s.size;
+      face  = s.face;
+      color = s.color;
+      align = s.align;
       stack.pop();
-      left  = s->left;
-      size  = s->size;
-      face  = s->face;
-      color = s->color;
-      align = s->align;
-      delete s;
     }
     
   protected:
@@ -460,6 +470,10 @@ if (pen) {
     int lastlineright;
     bool newline;
     int linewidth;
+
+    // the vertical range to be painted, elements may skip the parts
+    // outside of it
+    int clip_top, clip_bottom;
   
     EAlignment align;
   
@@ -722,12 +736,12 @@ struct TEAnchor:
   }
   void render(TPen &pen, TState &s) {
     s.pushState();
-    if (!s.output) {
+    if (!s.output)
       s.beginAnchor(this);
-    } else {
-      if (!href.empty())
-        s.color.set(0, 0, 232);
-    }
+    // set during layout also, so THTMLView::paint can start inside
+    // an anchor
+    if (!href.empty())
+      s.color.set(0, 0, 232);
   }
 };
 
@@ -747,12 +761,17 @@ struct TEImage:
   TEImage(TParser &parser);
   ~TEImage();
   void render(TPen &pen, TState &s);
+  void loaded();
+  void scale();
   
   string src;
   string alt;
   int width, height;
+  bool sized; // width & height were given by the document
   int border;
   TBitmap bitmap;
+  PBitmap scaled; // 'bitmap' scaled to width x height
+  THTMLView *view;
 };
 
 void
@@ -794,6 +813,7 @@ TEImage::TEImage(TParser &parser)
   parser.getParameter(&border, "border", 1);
   parser.getParameter(&src, "src", "");
   parser.getParameter(&alt, "alt", src);
+  view = parser.view;
 
 //cerr << "got image path '" << src << "'\n";
   src = parser.relative(src);
@@ -801,17 +821,57 @@ TEImage::TEImage(TParser &parser)
   if (src.empty())
     return;
 
-  try {
-    bitmap.load(src);
-  } catch (...) {
+  // reserve the space given by the document or a placeholder until
+  // the image has been loaded in the background
+  sized = parser.getParameter(&width, "width", 32);
+  sized = parser.getParameter(&height, "height", 32) && sized;
+  connect(bitmap.sigLoaded, this, &TEImage::loaded);
+  bitmap.loadAsync(src);
+}
+
+TEImage::~TEImage()
+{
+}
+
+void
+TEImage::loaded()
+{
+  if (!bitmap.isLoading() && bitmap.getWidth()==0)
     bitmap.load("memory://toad/broken.png");
+  scale();
+  if (!view)
+    return;
+  if (!sized &&
+      (width!=bitmap.getWidth() || height!=bitmap.getHeight()))
+  {
+    width = bitmap.getWidth();
+    height = bitmap.getHeight();
+    view->invalidateLayout();
+  } else {
+    view->invalidateWindow();
   }
-  width = bitmap.getWidth();
-  height = bitmap.getHeight();
 }
 
-TEImage::~TEImage()
+/**
+ * Scale the bitmap to the size given by the document.
+ */
+void
+TEImage::scale()
 {
+  int w = bitmap.getWidth(), h = bitmap.getHeight();
+  if (!sized || w==0 || (w==width && h==height) || width<=0 || height<=0) {
+    scaled = 0;
+    return;
+  }
+  scaled = new TBitmap(width, height);
+  for(int y=0; y<height; ++y) {
+    int sy = y * h / height;
+    for(int x=0; x<width; ++x) {
+      TCoord r, g, b;
+      if (bitmap.getPixel(x * w / width, sy, &r, &g, &b))
+        scaled->setPixel(x, y, r, g, b);
+    }
+  }
 }
 
 void
@@ -822,7 +882,14 @@ TEImage::render(TPen &pen, TState &s)
     
   s.spaceForWidth(pen, width+border*2);
   if (s.output) {
-    pen.drawBitmap(s.X()+border, s.Y()+border, bitmap);
+    if (bitmap.getWidth()>0) {
+      TBitmap *b = scaled;
+      pen.drawBitmap(s.X()+border, s.Y()+border, b ? *b : bitmap);
+    } else {
+      pen.setColor(191, 191, 191);
+      pen.fillRectangle(s.X()+border, s.Y()+border, width, height);
+      pen.setColor(0, 0, 0);
+    }
     for(int i=0; i<border; ++i)
       pen.drawRectanglePC(s.X()+i, s.Y()+i, 
                           width+border*2-i*2, 
@@ -870,6 +937,7 @@ struct TETable:
   struct TRow {
     TRGB background;
     vector<TField> fields;
+    int top;    // relative to the table's top
     int height;
     int lmin, lmax;
   };
@@ -890,6 +958,34 @@ struct TETable:
 
 } // namespace
 
+/**
+ * The layout of the parsed document for the current width, so that
+ * paint() only needs to handle the elements within the clip region.
+ *
+ * The state before every 'checkpoint_distance'th element is stored,
+ * along with the first element of the line it's in. 'bottom' holds the
+ * state's bottom after each element, which never decreases, so the
+ * first visible element can be found with a binary search.
+ */
+class THTMLView::TLayout
+{
+  public:
+    struct TCheckpoint {
+      TCheckpoint(size_t element, const TState &state, TElement *bol):
+        element(element), state(state), bol(bol) {}
+      size_t element;
+      TState state;
+      TElement *bol;
+    };
+    vector<TCheckpoint> checkpoints;
+    vector<int> bottom;
+    
+    void clear() {
+      checkpoints.clear();
+      bottom.clear();
+    }
+};
+
 TETable::TETable(TParser &parser)
 {
   parser.getParameter(&border, "border", 0);
@@ -1073,14 +1169,35 @@ TETable::render(TPen &pen, TState &s) {
 //      pen.drawLine(s.X(), y, s.X()+width, y);
     }
     height = y+border-s.Y();
+
+    // row positions as used for output
+    y = border + cellspacing;
+    for(pr = rows.begin(); pr!=er; ++pr) {
+      pr->top = y;
+      if (border)
+        y+=2;
+      y+=pr->height + cellpadding * 2 + cellspacing;
+    }
   } else {
     // s.output
     
     int x, y;
     
-    vector<TRow>::iterator pr(rows.begin()), er(rows.end());
-    y = s.Y() + border + cellspacing;
+    // skip the rows above the clip region
+    int extra = cellpadding * 2 + (border ? 2 : 0);
+    size_t lo = 0, hi = rows.size();
+    while(lo<hi) {
+      size_t m = (lo+hi)/2;
+      if (s.Y() + rows[m].top + rows[m].height + extra <= s.clip_top)
+        lo = m+1;
+      else
+        hi = m;
+    }
+    vector<TRow>::iterator pr(rows.begin()+lo), er(rows.end());
     while(pr!=er) {
+      y = s.Y() + pr->top;
+      if (y >= s.clip_bottom)
+        break;
       vector<TColumn>::iterator pc(columns.begin()), ec(columns.end());
       vector<TField>::iterator pf(pr->fields.begin()), ef(pr->fields.end());
       x = s.X() + border + cellspacing;
@@ -1113,9 +1230,11 @@ TETable::render(TPen &pen, TState &s) {
         if (border)
           ++x;
         TState state(x, x+pc->width, y+cellpadding+(border?1:0));
+        state.clip_top = s.clip_top;
+        state.clip_bottom = s.clip_bottom;
         TElementStorage::iterator p(pf->parsed.begin()),
                                   e(pf->parsed.end());
-        while(p!=e) {
+        while(p!=e && state.Y() < state.clip_bottom) {
           state.handle(pen, *p);
           ++p;
         }
@@ -1125,9 +1244,6 @@ TETable::render(TPen &pen, TState &s) {
         pc += pf->colspan;
         ++pf;
       }
-      if (border)
-        y+=2;
-      y+=pr->height + cellpadding * 2 + cellspacing;
       ++pr;
     }
   }
@@ -1216,6 +1332,7 @@ TParser::TParser()
 {
   pout = 0;
   table = 0;
+  view = 0;
 }
 
 TParser::~TParser()
@@ -1830,6 +1947,7 @@ THTMLView::THTMLView(TWindow *parent, const string &title):
 {
   parsed = 0;
   anchors = 0;
+  layout = 0;
   stage1 = false;
   setSize(540,680);
   setAllMouseMoveEvents(true);
@@ -1849,6 +1967,7 @@ THTMLView::~THTMLView()
   }
   if (anchors)
     delete anchors;
+  delete layout;
 }
 
 /**
@@ -1896,7 +2015,11 @@ THTMLView::parse(istream &in)
   else
     anchors->erase(anchors->begin(), anchors->end());
 
+  if (layout)
+    layout->clear();
+
   TParser parser;
+  parser.view = this;
   parser.parse(parsed, anchors, in, url);
   width = 0;
   if (isRealized()) {
@@ -1906,6 +2029,20 @@ THTMLView::parse(istream &in)
   }
 }
 
+/**
+ * Recalculate the layout, ie. after an image loaded in the background
+ * got its size.
+ */
+void
+THTMLView::invalidateLayout()
+{
+  width = 0;
+  if (isRealized()) {
+    doLayout();
+    invalidateWindow();
+  }
+}
+
 void
 THTMLView::adjustPane()
 {
@@ -1917,45 +2054,44 @@ THTMLView::adjustPane()
   stage1 = true;
 
   if (width!=getWidth()) {
-    TElementStorage::iterator p, e;
     TPen pen(this);
     int bottom, w;
     w = width = getWidth();
-    {
-      TState state(width);
-      state.output = false;
-      // state.pen = &pen;
-
-      p = parsed->begin();
-      e = parsed->end();
-      while(p!=e) {
-        state.handle(pen, *p);
-        ++p;
-      }
-      state.done();
-      bottom = state.getBottom();
-    }
-    
+    bottom = layoutElements(pen, w);
     if (bottom > getHeight()) {
       w -= TScrollBar::getFixedSize();
-      TState state(w);
-      state.output = false;
-      // state.pen = &pen;
-
-      p = parsed->begin();
-      e = parsed->end();
-      while(p!=e) {
-        state.handle(pen, *p);
-        ++p;
-      }
-      state.done();
-      bottom = state.getBottom();
+      bottom = layoutElements(pen, w);
     }
-
     pane.set(0,0, w, bottom);
   }
 }
 
+/**
+ * Calculate the layout of the document for the given width and store
+ * the information needed by paint() in 'layout'.
+ *
+ * \return the bottom of the document
+ */
+int
+THTMLView::layoutElements(TPen &pen, int width)
+{
+  if (!layout)
+    layout = new TLayout();
+  layout->clear();
+  layout->bottom.reserve(parsed->size());
+
+  TState state(width);
+  state.output = false;
+  for(size_t i=0; i<parsed->size(); ++i) {
+    if (i % checkpoint_distance == 0)
+      layout->checkpoints.push_back(TLayout::TCheckpoint(i, state, state.bol));
+    state.handle(pen, (*parsed)[i]);
+    layout->bottom.push_back(state.getBottom());
+  }
+  state.done();
+  return state.getBottom();
+}
+
 void
 THTMLView::paint()
 {
@@ -1970,37 +2106,41 @@ THTMLView::paint()
 
   TPen pen(this);
 
-  TElementStorage::iterator p, e;
-
-#ifdef SPEEDUP_KLUDGE
-TCoord x, y, h;
-getPanePos(&x, &y);
-h = getHeight() + y;
-int flag=0;
-#endif
-
+  // the part of the pane to be painted
+  TRectangle clip;
+  pen.getClipBox(&clip);
+  TCoord px, py;
+  getPanePos(&px, &py);
+  int top = clip.y + py;
+  int bottom = clip.y + clip.h + py;
+
+  // start at the last checkpoint before the first element reaching
+  // into the clip region
+  size_t i = 0;
   TState state(pane.w);
+  if (layout && layout->bottom.size()==parsed->size() &&
+      !layout->checkpoints.empty())
+  {
+    size_t first = upper_bound(layout->bottom.begin(),
+                               layout->bottom.end(),
+                               top) - layout->bottom.begin();
+    const TLayout::TCheckpoint &cp(
+      layout->checkpoints[min(first / checkpoint_distance,
+                              layout->checkpoints.size()-1)]);
+    i = cp.element;
+    state = cp.state;
+    state.fontname.clear();
+    state.current_color.set(0,0,0);
+    if (cp.bol)
+      state.lineindent = cp.bol->indent;
+  }
   state.output = true;
-  p = parsed->begin();
-  e = parsed->end();
-  while(p!=e) {
-
-#ifdef SPEEDUP_KLUDGE
-state.newline = false;
-#endif
-
-    state.handle(pen, *p);
+  state.clip_top = top;
+  state.clip_bottom = bottom;
+  state.applyAttributes(pen);
 
-#ifdef SPEEDUP_KLUDGE
-if (state.newline && state.getBottom() > h) {
-  flag++;
-  if (flag>1)
-    break;
-}
-#endif
-
-    ++p;
-  }
+  for(; i<parsed->size() && state.Y() < bottom; ++i)
+    state.handle(pen, (*parsed)[i]);
   
   paintCorner(pen);
 }
@@ -33,19 +33,23 @@ class THTMLView:
     ~THTMLView();
     bool open(const string &url);
     const string& getURL() const { return url; }
+    void invalidateLayout();
 
     class TElementStorage;
     class TAnchorStorage;
+    class TLayout;
 
   protected:
     TElementStorage* parsed;
     TAnchorStorage* anchors;
+    TLayout *layout;
     int width;
     string url;
     
     bool stage1;
     
     void adjustPane();
+    int layoutElements(TPen &pen, int width);
     void paint();
     void parse(istream &in);
     void mouseLDown(const TMouseEvent&);
@@ -85,7 +85,7 @@ DBM(cerr << "  locked => return\n";)
         return;
       }
 DBM(cerr << "  not locked => setValue\n";)
-      int a = atoi(_data.c_str());
+      int a = atoi(c_str());
       lock = true;
       model->setValue(a);
       lock = false;
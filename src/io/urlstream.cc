@@ -19,6 +19,7 @@
  */
 
 #include <toad/io/urlstream.hh>
+#include <toad/config.h>
 
 #include <cstdio>
 #include <cstdlib>
@@ -46,6 +47,10 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include <errno.h>
 
@@ -109,8 +114,63 @@ class fdbuf:
     streamsize xsputn(const char_type* s, streamsize n);
 };
 
+/**
+ * A read only streambuf on a memory area without copying it.
+ *
+ * Used for memory files and for files mapped with mmap(2), in which case
+ * the mapping is released along with the buffer.
+ */
+class membuf:
+  public std::streambuf
+{
+  public:
+    membuf(const char *data, size_t size, bool mapped=false) {
+      this->data = const_cast<char*>(data);
+      this->size = size;
+      this->mapped = mapped;
+      setg(this->data, this->data, this->data+size);
+    }
+    ~membuf() {
+#ifdef HAVE_SYS_MMAN_H
+      if (mapped)
+        munmap(data, size);
+#endif
+    }
+  protected:
+    char *data;
+    size_t size;
+    bool mapped;
+
+    pos_type seekoff(off_type off, ios_base::seekdir way,
+       ios_base::openmode mode = ios_base::in | ios_base::out);
+    pos_type seekpos(pos_type pos,
+       ios_base::openmode mode = ios_base::in | ios_base::out);
+};
+
 } // namespace
 
+membuf::pos_type
+membuf::seekoff(off_type off, ios_base::seekdir way, ios_base::openmode mode)
+{
+  off_type pos;
+  if (way==ios_base::beg)
+    pos = off;
+  else if (way==ios_base::cur)
+    pos = gptr() - eback() + off;
+  else
+    pos = size + off;
+  if (pos<0 || pos>(off_type)size)
+    return pos_type(off_type(-1));
+  setg(data, data+pos, data+size);
+  return pos_type(pos);
+}
+
+membuf::pos_type
+membuf::seekpos(pos_type pos, ios_base::openmode mode)
+{
+  return seekoff(off_type(pos), ios_base::beg, mode);
+}
+
 fdbuf::fdbuf(int fd, ios_base::openmode om)
 {
   if (om==ios::out) {
@@ -467,6 +527,18 @@ urlstreambase::iopen_file()
     // error = "failed to open `"+url+"': "+ strerror(errno);
     return false;
   }
+#ifdef HAVE_SYS_MMAN_H
+  // map regular files instead of reading them through stdio
+  struct stat st;
+  if (fstat(fd, &st)==0 && S_ISREG(st.st_mode) && st.st_size>0) {
+    void *data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data!=MAP_FAILED) {
+      ::close(fd);
+      set_buffer(new membuf((const char*)data, st.st_size, true));
+      return true;
+    }
+  }
+#endif
   set_buffer(fd, ios::in);
   return true;
 }
@@ -503,7 +575,7 @@ urlstreambase::iopen_memory()
   if (p==memory_file_system.end()) {
     return false;
   }
-  set_buffer(new stringbuf(p->second));
+  set_buffer(new membuf(p->second.data(), p->second.size()));
   return true;
 }
 
@@ -26,21 +26,25 @@
 namespace toad {
 
 class TOADBase;
+class TIOBackend;
 
 class TIOObserver
 {
     friend class TOADBase;
+    friend class TIOBackend;
     
     int _fd;
     int _type;
+  public:
     static const unsigned READ=1;
     static const unsigned WRITE=2;
     static const unsigned EXCEPTION=4;
-  public:
+
     TIOObserver();
     TIOObserver(int fd);
     virtual ~TIOObserver();
     void setFD(int fd);
+    void setType(int type);
     int FD() { return _fd; }
     int fd() { return _fd; }
   protected:
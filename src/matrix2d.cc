@@ -21,6 +21,10 @@
 #include <toad/matrix2d.hh>
 #include <cmath>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 // missing in mingw
 #ifndef M_PI
 #define M_PI 3.14159265358979323846  /* pi */
@@ -275,6 +279,55 @@ TMatrix2D::map(double inX, double inY, double *outX, double *outY) const
   *outY = a21 * x + a22 * y + ty;
 }
 
+/**
+ * Map 'n' points at once, ie. for drawing polygons.
+ *
+ * The result is the same as calling map(int, int, short*, short*) for
+ * each point: 'out' receives n pairs of x and y, which is the layout of
+ * X11's XPoint.
+ */
+void
+TMatrix2D::map(const TPoint *in, size_t n, short int *out) const
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  // two points per iteration; the input is truncated to int and the
+  // result rounded half away from zero like lround(3) does
+  const __m128d c1 = _mm_set_pd(a21, a11);
+  const __m128d c2 = _mm_set_pd(a22, a12);
+  const __m128d t  = _mm_set_pd(ty, tx);
+  const __m128d half = _mm_set1_pd(0.5);
+  const __m128d one  = _mm_set1_pd(1.0);
+  int r[4];
+  for(; i+2<=n; i+=2) {
+    __m128d v[2];
+    for(int j=0; j<2; ++j) {
+      __m128d p = _mm_loadu_pd(&in[i+j].x);
+      p = _mm_cvtepi32_pd(_mm_cvttpd_epi32(p));
+      __m128d x = _mm_unpacklo_pd(p, p);
+      __m128d y = _mm_unpackhi_pd(p, p);
+      __m128d q = _mm_add_pd(_mm_add_pd(_mm_mul_pd(c1, x), _mm_mul_pd(c2, y)), t);
+      __m128d f = _mm_cvtepi32_pd(_mm_cvttpd_epi32(q));
+      __m128d d = _mm_sub_pd(q, f);
+      f = _mm_add_pd(f, _mm_and_pd(_mm_cmpge_pd(d, half), one));
+      f = _mm_sub_pd(f, _mm_and_pd(_mm_cmple_pd(d, _mm_sub_pd(_mm_setzero_pd(), half)), one));
+      v[j] = f;
+    }
+    __m128i q = _mm_unpacklo_epi64(_mm_cvttpd_epi32(v[0]), _mm_cvttpd_epi32(v[1]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(r), q);
+    out[0] = static_cast<short int>(r[0]);
+    out[1] = static_cast<short int>(r[1]);
+    out[2] = static_cast<short int>(r[2]);
+    out[3] = static_cast<short int>(r[3]);
+    out += 4;
+  }
+#endif
+  for(; i<n; ++i) {
+    map(static_cast<int>(in[i].x), static_cast<int>(in[i].y), out, out+1);
+    out += 2;
+  }
+}
+
 /**
  * Invert the matrix.
  *
@@ -71,6 +71,7 @@ class TMatrix2D:
     void map(int inX, int inY, long *outX, long *outY) const;
     void map(int inX, int inY, double *outX, double *outY) const;
     void map(double inX, double inY, double *outX, double *outY) const;
+    void map(const TPoint *in, size_t n, short int *out) const;
  
     TMatrix2D *next;
     
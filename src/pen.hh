@@ -180,9 +180,18 @@ public:
     
     #ifdef HAVE_LIBXFT
     XftDraw *xftdraw;
+    static XftDraw* _lookupXftDraw(_TOAD_DRAWABLE);
     #endif
     
     void _setLineAttributes();
+
+    // GC cache
+    static _TOAD_GC _acquireGC(_TOAD_DRAWABLE);
+    static void _releaseGC(_TOAD_GC);
+    static void _setGCClip(_TOAD_GC, TRegion*);
+    static void _invalidateGCClip(_TOAD_GC);
+    static void _setGCDashes(_TOAD_GC, const char *dash, int n);
+    static void _forgetDrawable(_TOAD_DRAWABLE);
     #endif
     
     #ifdef __WIN32__
@@ -140,32 +140,100 @@ tpoint2xpoint(const TPoint *in, XPoint *out, int n, const TMatrix2D *mat) {
       ++sp;
     }
   } else {
-    while(sp!=se) {
-      mat->map(sp->x, sp->y, &dp->x, &dp->y);
-      ++dp;
-      ++sp;
-    }
+    mat->map(in, n, &out->x);
   }
 }
 
 inline void
 polygon2xpoint(const TPolygon &in, XPoint *out, const TMatrix2D *mat) {
-  TPolygon::const_iterator sp(in.begin()), se(in.end());
-  XPoint *dp = out;
-  if (!mat) {
-    while(sp!=se) {
-      dp->x = sp->x;
-      dp->y = sp->y;
-      ++dp;
-      ++sp;
+  if (!in.empty())
+    tpoint2xpoint(&in[0], out, in.size(), mat);
+}
+
+/**
+ * Scratch buffer for the converted points of polylines and polygons.
+ * (The former variable length arrays on the stack overflowed with large
+ * polygons.)
+ */
+class TXPointBuffer
+{
+    XPoint *p;
+    size_t a;
+  public:
+    TXPointBuffer() {
+      p = 0;
+      a = 0;
     }
-  } else {
-    while(sp!=se) {
-      mat->map(sp->x, sp->y, &dp->x, &dp->y);
-      ++dp;
-      ++sp;
+    XPoint* get(size_t n) {
+      if (n>a) {
+        XPoint *np = (XPoint*)realloc(p, (n+1024)*sizeof(XPoint));
+        if (!np) {
+          cerr << "toad: out of memory for " << n << " points, not drawn" << endl;
+          return 0;
+        }
+        p = np;
+        a = n + 1024;
+      }
+      return p;
+    }
+};
+TXPointBuffer xpbuffer;
+
+/**
+ * Maximal number of points in a single request with 'header' units of
+ * 4 bytes before the point list, one XPoint being one unit. Requests
+ * using BIG-REQUESTS carry an additional length unit.
+ */
+size_t
+maxRequestPoints(size_t header)
+{
+  long n = XExtendedMaxRequestSize(x11display);
+  if (n!=0)
+    return n - header - 1;
+  return XMaxRequestSize(x11display) - header;
+}
+
+/**
+ * XDrawLines split into multiple requests when the polyline exceeds the
+ * maximal request size, each request starting at the last point of the
+ * previous one.
+ */
+void
+xdrawLines(Drawable drawable, GC gc, XPoint *p, size_t n)
+{
+  size_t m = maxRequestPoints(3);
+  while(n>m) {
+    XDrawLines(x11display, drawable, gc, p, m, CoordModeOrigin);
+    p += m-1;
+    n -= m-1;
+  }
+  XDrawLines(x11display, drawable, gc, p, n, CoordModeOrigin);
+}
+
+/**
+ * XFillPolygon for polygons which might exceed the maximal request size.
+ * Consecutive points mapped to the same pixel are removed first, which
+ * is usually enough for data with more points than the screen has
+ * pixels. Returns the new number of points in 'p'.
+ */
+size_t
+xfillPolygon(Drawable drawable, GC gc, XPoint *p, size_t n)
+{
+  size_t m = maxRequestPoints(4);
+  if (n>m) {
+    size_t j = 0;
+    for(size_t i=1; i<n; ++i) {
+      if (p[i].x!=p[j].x || p[i].y!=p[j].y)
+        p[++j] = p[i];
     }
+    n = j+1;
+  }
+  if (n>m) {
+    cerr << "toad: polygon with " << n << " points exceeds the maximal X11 request size, not filled" << endl;
+    return n;
   }
+  XFillPolygon(x11display, drawable, gc, p, n, Nonconvex, CoordModeOrigin);
+  return n;
 }
 #endif
 
@@ -444,10 +512,14 @@ void
 TPen::drawLines(const TPoint *s, size_t n)
 {
 #ifdef __X11__
-  XPoint xp[n];
+  if (n==0)
+    return;
+  XPoint *xp = xpbuffer.get(n);
+  if (!xp)
+    return;
   tpoint2xpoint(s, xp, n, mat);
   PIXMAP_FIX_001(xp, n)
-  XDrawLines(x11display, x11drawable, o_gc, xp, n, CoordModeOrigin);
+  xdrawLines(x11drawable, o_gc, xp, n);
 #endif
 
 #ifdef __COCOA__
@@ -482,10 +554,14 @@ TPen::drawLines(const TPolygon &polygon)
 {
 #ifdef __X11__
   size_t n = polygon.size();
-  XPoint xp[n];
+  if (n==0)
+    return;
+  XPoint *xp = xpbuffer.get(n);
+  if (!xp)
+    return;
   polygon2xpoint(polygon, xp, mat);
   PIXMAP_FIX_001(xp, n)
-  XDrawLines(x11display, x11drawable, o_gc, xp, n, CoordModeOrigin);
+  xdrawLines(x11drawable, o_gc, xp, n);
 #endif
 
 #ifdef __COCOA__
@@ -736,7 +812,9 @@ TPen::vdrawCircle(TCoord x, TCoord y, TCoord w, TCoord h)
     if (m<3) m = 3;
     if (m>14) m = 14; // maximum will be 4*102948 points
     unsigned long n = ( ((PIV2<<m) >> 16)+1 )*4;
-    XPoint pts[n];
+    XPoint *pts = xpbuffer.get(n);
+    if (!pts)
+      return;
     XPoint *p = pts;
   
     p = qtr_elips(this, p,  x+w/2, y     ,  x+w  , y+h/2,  x+w, y  ,  m);
@@ -744,7 +822,7 @@ TPen::vdrawCircle(TCoord x, TCoord y, TCoord w, TCoord h)
     p = qtr_elips(this, p,  x+w/2, y+h   ,  x    , y+h/2,  x  , y+h,  m);
     p = qtr_elips(this, p,  x    , y+h/2 ,  x+w/2, y    ,  x  , y  ,  m);
     PIXMAP_FIX_001(pts, n)
-    XDrawLines(x11display, x11drawable, o_gc, pts, n, CoordModeOrigin);
+    xdrawLines(x11drawable, o_gc, pts, n);
   }
 #endif
 
@@ -771,7 +849,9 @@ TPen::vfillCircle(TCoord x, TCoord y, TCoord w, TCoord h)
     if (m>14) m = 14; // maximum will be 4*102948 points
   
     int n = ( ((PIV2<<m) >> 16)+1 )*4;
-    XPoint pts[n];
+    XPoint *pts = xpbuffer.get(n);
+    if (!pts)
+      return;
     XPoint *p = pts;
   
     p = qtr_elips(this, p,  x+w/2, y     ,  x+w  , y+h/2,  x+w, y  ,  m);
@@ -779,11 +859,10 @@ TPen::vfillCircle(TCoord x, TCoord y, TCoord w, TCoord h)
     p = qtr_elips(this, p,  x+w/2, y+h   ,  x    , y+h/2,  x  , y+h,  m);
     p = qtr_elips(this, p,  x    , y+h/2 ,  x+w/2, y    ,  x  , y  ,  m);
     if (!outline) {
-      XFillPolygon(x11display, x11drawable, two_colors? f_gc : o_gc, 
-                   pts, n, Nonconvex, CoordModeOrigin);
+      n = xfillPolygon(x11drawable, two_colors? f_gc : o_gc, pts, n);
     }
     PIXMAP_FIX_001(pts, n)
-    XDrawLines(x11display, x11drawable, o_gc, pts, n, CoordModeOrigin);
+    xdrawLines(x11drawable, o_gc, pts, n);
   }
 #endif
 
@@ -850,12 +929,16 @@ void
 TPen::drawPolygon(const TPoint points[], size_t n)
 {
 #ifdef __X11__
-  XPoint pts[n+1];
+  if (n==0)
+    return;
+  XPoint *pts = xpbuffer.get(n+1);
+  if (!pts)
+    return;
   tpoint2xpoint(points, pts, n, mat);
   pts[n].x=pts[0].x;
   pts[n].y=pts[0].y;
   PIXMAP_FIX_001(pts, n+1)
-  XDrawLines(x11display, x11drawable, o_gc, pts, n+1, CoordModeOrigin);
+  xdrawLines(x11drawable, o_gc, pts, n+1);
 #endif
 
 #ifdef __COCOA__
@@ -886,20 +969,20 @@ void
 TPen::fillPolygon(const TPoint s[], size_t n)
 {
 #ifdef __X11__
-  XPoint d[n];
+  if (n==0)
+    return;
+  XPoint *d = xpbuffer.get(n);
+  if (!d)
+    return;
   tpoint2xpoint(s, d, n, mat);
   if (!outline) {
-    XFillPolygon(x11display, x11drawable, two_colors? f_gc : o_gc, 
-      d, n, Nonconvex, CoordModeOrigin);
+    n = xfillPolygon(x11drawable, two_colors? f_gc : o_gc, d, n);
   }
-  XDrawLines(x11display, x11drawable, o_gc, 
-      d, n, CoordModeOrigin);
   XDrawLine(x11display, x11drawable, o_gc,
      d[0].x,d[0].y,
      d[n-1].x,d[n-1].y);
   PIXMAP_FIX_001(d, n)
-  XDrawLines(x11display, x11drawable, o_gc, 
-      d, n, CoordModeOrigin);
+  xdrawLines(x11drawable, o_gc, d, n);
 #endif
 
 #ifdef __COCOA__
@@ -925,14 +1008,17 @@ TPen::drawPolygon(const TPolygon &polygon)
 {
 #ifdef __X11__
   size_t n = polygon.size();
-  XPoint d[n];
+  if (n==0)
+    return;
+  XPoint *d = xpbuffer.get(n);
+  if (!d)
+    return;
   polygon2xpoint(polygon, d, mat);
   XDrawLine(x11display, x11drawable, o_gc,
     d[0].x, d[0].y,
     d[n-1].x, d[n-1].y);
   PIXMAP_FIX_001(d, n)
-  XDrawLines(x11display, x11drawable, o_gc, 
-    d, n, CoordModeOrigin);
+  xdrawLines(x11drawable, o_gc, d, n);
 #endif
 
 #ifdef __COCOA__
@@ -972,19 +1058,21 @@ TPen::fillPolygon(const TPolygon &polygon)
 {
 #ifdef __X11__
   size_t n = polygon.size();
-  XPoint d[n];
+  if (n==0)
+    return;
+  XPoint *d = xpbuffer.get(n);
+  if (!d)
+    return;
   polygon2xpoint(polygon, d, mat);
 
   if (!outline) {
-    XFillPolygon(x11display, x11drawable, two_colors? f_gc : o_gc, 
-      d, n, Nonconvex, CoordModeOrigin);
+    n = xfillPolygon(x11drawable, two_colors? f_gc : o_gc, d, n);
   }
   XDrawLine(x11display, x11drawable, o_gc,
     d[0].x, d[0].y,
     d[n-1].x, d[n-1].y);
   PIXMAP_FIX_001(d, n)
-  XDrawLines(x11display, x11drawable, o_gc, 
-    d, n, CoordModeOrigin);
+  xdrawLines(x11drawable, o_gc, d, n);
 #endif
 
 #ifdef __COCOA__
@@ -40,6 +40,7 @@
 
 #include <iostream>
 #include <map>
+#include <vector>
 
 #ifdef __X11__
 #ifdef HAVE_LIBXFT
@@ -59,6 +60,178 @@
 
 using namespace toad;
 
+#ifdef __X11__
+
+// GC and XftDraw cache
+//---------------------------------------------------------------------------
+
+/*
+ * Widgets create a TPen in every paint() and used to pay with a
+ * XCreateGC/XFreeGC pair and, for text, XftDrawCreate/XftDrawDestroy.
+ *
+ * All drawables created by TOAD share the same root and depth, so
+ * released GCs are kept in a free list and handed to the next pen after
+ * resetting them to the defaults. Xlib's own GC cache only sends
+ * attributes which really changed (foreground, line width, ...) but
+ * clip regions and dash lists are always sent, so these are tracked here
+ * as well.
+ *
+ * XftDraw objects are bound to a drawable and are kept until the drawable
+ * is destroyed, which TWindow and TBitmap report via _forgetDrawable().
+ */
+
+namespace {
+
+struct TGCState {
+  TGCState() { clip = 0; clip_known = true; ndash = 0; }
+  Region clip;      // 0 when no clip mask is set
+  bool clip_known;  // false after clip was modified behind our back
+  char dash[6];
+  int ndash;
+};
+
+typedef map<GC, TGCState> TGCStates;
+TGCStates gc_states;
+vector<GC> gc_free;
+
+#ifdef HAVE_LIBXFT
+typedef map<Drawable, XftDraw*> TXftDraws;
+TXftDraws xftdraws;
+#endif
+
+void
+resetClip(TGCState &st)
+{
+  if (st.clip) {
+    XDestroyRegion(st.clip);
+    st.clip = 0;
+  }
+}
+
+} // namespace
+
+_TOAD_GC
+TPen::_acquireGC(_TOAD_DRAWABLE drawable)
+{
+  if (gc_free.empty()) {
+    GC gc = XCreateGC(x11display, drawable, 0, 0);
+    gc_states[gc];
+    return gc;
+  }
+  GC gc = gc_free.back();
+  gc_free.pop_back();
+
+  // back to the defaults of XCreateGC, Xlib only sends what differs
+  XGCValues v;
+  v.function = GXcopy;
+  v.foreground = 0;
+  v.background = 1;
+  v.line_width = 0;
+  v.line_style = LineSolid;
+  v.cap_style = CapButt;
+  v.join_style = JoinMiter;
+  v.fill_style = FillSolid;
+  v.subwindow_mode = ClipByChildren;
+  v.clip_x_origin = 0;
+  v.clip_y_origin = 0;
+  XChangeGC(x11display, gc, 
+            GCFunction|GCForeground|GCBackground|
+            GCLineWidth|GCLineStyle|GCCapStyle|GCJoinStyle|GCFillStyle|
+            GCSubwindowMode|GCClipXOrigin|GCClipYOrigin,
+            &v);
+  // the clip is left as it is because the new pen is likely to set the
+  // same region again, the pen constructors call _setGCClip() to settle it
+  return gc;
+}
+
+void
+TPen::_releaseGC(_TOAD_GC gc)
+{
+  if (gc)
+    gc_free.push_back(gc);
+}
+
+/**
+ * Set the clip region of 'gc' or remove it when 'rgn' is NULL, unless
+ * the GC already has this clip.
+ */
+void
+TPen::_setGCClip(_TOAD_GC gc, TRegion *rgn)
+{
+  TGCState &st = gc_states[gc];
+  if (!rgn) {
+    if (st.clip || !st.clip_known) {
+      XSetClipMask(x11display, gc, None);
+      resetClip(st);
+      st.clip_known = true;
+    }
+    return;
+  }
+  if (st.clip_known && st.clip && XEqualRegion(st.clip, rgn->x11region))
+    return;
+  XSetRegion(x11display, gc, rgn->x11region);
+  if (!st.clip)
+    st.clip = XCreateRegion();
+  else
+    XSubtractRegion(st.clip, st.clip, st.clip);
+  XUnionRegion(st.clip, rgn->x11region, st.clip);
+  st.clip_known = true;
+}
+
+/**
+ * Must be called after the clip mask of 'gc' was modified without
+ * _setGCClip.
+ */
+void
+TPen::_invalidateGCClip(_TOAD_GC gc)
+{
+  TGCState &st = gc_states[gc];
+  resetClip(st);
+  st.clip_known = false;
+}
+
+void
+TPen::_setGCDashes(_TOAD_GC gc, const char *dash, int n)
+{
+  TGCState &st = gc_states[gc];
+  if (st.ndash==n && memcmp(st.dash, dash, n)==0)
+    return;
+  XSetDashes(x11display, gc, 0, dash, n);
+  memcpy(st.dash, dash, n);
+  st.ndash = n;
+}
+
+#ifdef HAVE_LIBXFT
+XftDraw*
+TPen::_lookupXftDraw(_TOAD_DRAWABLE drawable)
+{
+  TXftDraws::iterator p = xftdraws.find(drawable);
+  if (p!=xftdraws.end())
+    return p->second;
+  XftDraw *draw = XftDrawCreate(x11display, drawable, x11visual, x11colormap);
+  xftdraws[drawable] = draw;
+  return draw;
+}
+#endif
+
+/**
+ * Drop everything cached for 'drawable'. Must be called before the
+ * drawable is destroyed.
+ */
+void
+TPen::_forgetDrawable(_TOAD_DRAWABLE drawable)
+{
+#ifdef HAVE_LIBXFT
+  TXftDraws::iterator p = xftdraws.find(drawable);
+  if (p!=xftdraws.end()) {
+    XftDrawDestroy(p->second);
+    xftdraws.erase(p);
+  }
+#endif
+}
+
+#endif
+
 TPenBase::TPenBase()
 {
   keepcolor = false;
@@ -105,6 +278,7 @@ TPen::TPen(TBitmap *bmp)
   wnd = 0;
   x11drawable = bmp->pixmap;
   _init();
+  _setGCClip(o_gc, 0);
 //  XCopyGC(x11display, TOADBase::x11gc, GCFont, o_gc);
   setFont(&getDefaultFont());
 #endif
@@ -128,7 +302,8 @@ TPen::TPen(TWindow *wnd)
   assert(wnd->x11window!=0);
   
   if (wnd->bDoubleBuffer) {
-    bmp = new TBitmap(wnd->getWidth(), wnd->getHeight(), TBITMAP_SERVER);
+    bmp = new TBitmap(wnd->getWidth(), wnd->getHeight(), TBITMAP_BACKBUFFER);
+    bmp->setBackBufferOwner(wnd);
     x11drawable = bmp->pixmap;
   } else {
     bmp = 0;
@@ -175,6 +350,8 @@ TPen::TPen(TWindow *wnd)
       setClipRegion(new TRegion(*static_cast<TRegion*>(wnd->paint_rgn)));
       bDeleteRegion = true;
     }
+  } else {
+    _setGCClip(o_gc, 0);
   }
 #endif
 }
@@ -189,7 +366,7 @@ TPen::_init()
 #ifdef __X11__
   // create X graphic context
   //--------------------------
-  o_gc = XCreateGC(x11display, x11drawable,0,0);
+  o_gc = _acquireGC(x11drawable);
   f_gc = 0;
   two_colors = false;
  
@@ -239,24 +416,16 @@ TPen::~TPen()
     x11drawable = wnd->x11window;
     if (wnd->paint_rgn)
       setClipRegion(static_cast<TRegion*>(wnd->paint_rgn));
-    XFreeGC(x11display, o_gc);
-    o_gc = XCreateGC(x11display, x11drawable,0,0);
-    if (wnd->paint_rgn)
-      setClipRegion(static_cast<TRegion*>(wnd->paint_rgn));
+    _releaseGC(o_gc);
+    o_gc = _acquireGC(x11drawable);
+    _setGCClip(o_gc, wnd->paint_rgn ? region : 0);
     bmp->drawBitmap(this, 0, 0);
     delete bmp;
   }
-  XFreeGC(x11display, o_gc);
-  if (f_gc)
-    XFreeGC(x11display, f_gc);
+  _releaseGC(o_gc);
+  _releaseGC(f_gc);
   if (region && bDeleteRegion )
     delete region;
-#ifdef HAVE_LIBXFT
-  if (xftdraw) {
-    XftDrawDestroy(xftdraw);
-    xftdraw = 0;
-  }
-#endif
 #endif
 
 #ifdef __COCOA__
@@ -318,6 +487,19 @@ void
 TPen::terminate()
 {
   fontmap.clear();
+#ifdef __X11__
+#ifdef HAVE_LIBXFT
+  for(TXftDraws::iterator p = xftdraws.begin(); p!=xftdraws.end(); ++p)
+    XftDrawDestroy(p->second);
+  xftdraws.clear();
+#endif
+  for(TGCStates::iterator p = gc_states.begin(); p!=gc_states.end(); ++p) {
+    resetClip(p->second);
+    XFreeGC(x11display, p->first);
+  }
+  gc_states.clear();
+  gc_free.clear();
+#endif
 }
 
 TFont *
@@ -372,9 +554,9 @@ TPen::setClipRegion(TRegion *rgn)
     region = rgn;
   }
   if (region) {
-    XSetRegion(x11display,o_gc,region->x11region);
+    _setGCClip(o_gc, region);
     if (f_gc)
-      XSetRegion(x11display,f_gc,region->x11region);
+      _setGCClip(f_gc, region);
   }
 #endif
 }
@@ -395,6 +577,7 @@ TPen::setClipRect(const TRectangle &r)
   xr.width = r.w;
   xr.height = r.h;
   ::XSetClipRectangles(x11display, o_gc, 0,0, &xr, 1, Unsorted);
+  _invalidateGCClip(o_gc);
 #endif
 }
 
@@ -413,9 +596,9 @@ TPen::operator&=(const TRectangle &rect)
 #ifdef __X11__
   if (!region) return;
   *region&=rect;
-  XSetRegion(x11display, o_gc, region->x11region);
+  _setGCClip(o_gc, region);
   if (f_gc)
-    XSetRegion(x11display, f_gc, region->x11region);
+    _setGCClip(f_gc, region);
 #endif
 }
 
@@ -425,9 +608,9 @@ TPen::operator&=(const TRegion &rect)
 #ifdef __X11__
   if (!region) return;
   *region&=rect;
-  XSetRegion(x11display, o_gc, region->x11region);
+  _setGCClip(o_gc, region);
   if (f_gc)
-    XSetRegion(x11display, f_gc, region->x11region);
+    _setGCClip(f_gc, region);
 #endif
 }
 
@@ -446,9 +629,9 @@ TPen::operator|=(const TRectangle &rect)
 #ifdef __X11__
   if (!region) return;
   *region|=rect;
-  XSetRegion(x11display, o_gc, region->x11region);
+  _setGCClip(o_gc, region);
   if (f_gc)
-    XSetRegion(x11display, f_gc, region->x11region);
+    _setGCClip(f_gc, region);
 #endif
 }
 
@@ -458,9 +641,9 @@ TPen::operator|=(const TRegion &rect)
 #ifdef __X11__
   if (!region) return;
   *region|=rect;
-  XSetRegion(x11display, o_gc, region->x11region);
+  _setGCClip(o_gc, region);
   if (f_gc)
-    XSetRegion(x11display, f_gc, region->x11region);
+    _setGCClip(f_gc, region);
 #endif
 }
 
@@ -476,9 +659,9 @@ void TPen::clrClipBox()
   if (!region)
     return;
   region->clear();
-  XSetClipMask(x11display,o_gc,None);
+  _setGCClip(o_gc, 0);
   if (f_gc)
-    XSetClipMask(x11display,f_gc,None);
+    _setGCClip(f_gc, 0);
 #endif
 }
 
@@ -608,19 +791,19 @@ void TPen::_setLineAttributes()
     break;
   case DASH:
     dash[0]=w<<1;
-    XSetDashes(x11display,o_gc,0, dash,2);
+    _setGCDashes(o_gc, dash, 2);
     break;
   case DOT:
     dash[0]=w;
-    XSetDashes(x11display,o_gc,0, dash,2);
+    _setGCDashes(o_gc, dash, 2);
     break;
   case DASHDOT:
     dash[0]=(w<<1)+w;
-    XSetDashes(x11display,o_gc,0, dash,4);
+    _setGCDashes(o_gc, dash, 4);
     break;
   case DASHDOTDOT:
     dash[0]=(w<<1)+w;
-    XSetDashes(x11display,o_gc,0, dash,6);
+    _setGCDashes(o_gc, dash, 6);
     break;
   }
   XSetLineAttributes(x11display,o_gc,pw,
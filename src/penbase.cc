@@ -269,7 +269,9 @@ TPenBase::textRatio(TCoord x,TCoord y,const string &str, unsigned width, TFont *
 
 
 
-static void curve(TPolygon&,TCoord,TCoord,TCoord,TCoord,TCoord,TCoord,TCoord,TCoord);
+#define WEIGHT 4.0
+
+static void curve(TPolygon&,TCoord,bool,TCoord,TCoord,TCoord,TCoord,TCoord,TCoord,TCoord,TCoord);
 
 void 
 TPenBase::poly2Bezier(const TPoint* src, size_t n, TPolygon &dst)
@@ -279,7 +281,7 @@ TPenBase::poly2Bezier(const TPoint* src, size_t n, TPolygon &dst)
   n-=3;
   size_t i=0;
   while(i<=n) {
-    curve(dst,
+    curve(dst, WEIGHT, true,
           src[i].x,   src[i].y,
           src[i+1].x, src[i+1].y,
           src[i+2].x, src[i+2].y,
@@ -297,7 +299,35 @@ TPenBase::poly2Bezier(const TPolygon &src, TPolygon &dst)
   n-=3;
   size_t i=0;
   while(i<=n) {
-    curve(dst,
+    curve(dst, WEIGHT, true,
+          src[i].x,   src[i].y,
+          src[i+1].x, src[i+1].y,
+          src[i+2].x, src[i+2].y,
+          src[i+3].x, src[i+3].y);
+    i+=3;
+  }
+}
+
+/**
+ * Like poly2Bezier but without rounding the points and with the
+ * flatness given by 'weight', ie. 4.0 divided by the square of the
+ * scaling applied when drawing the resulting polygon gives about the
+ * same precision as drawBezier.
+ */
+void 
+TPenBase::poly2Bezier(const TPolygon &src, TPolygon &dst, TCoord weight)
+{
+  dst.erase(dst.begin(), dst.end());
+  if (src.size()<4) {
+    dst.insert(dst.end(), src.begin(), src.end());
+    return;
+  }
+  dst.addPoint(src[0]);
+  size_t n = src.size();
+  n-=3;
+  size_t i=0;
+  while(i<=n) {
+    curve(dst, weight, false,
           src[i].x,   src[i].y,
           src[i+1].x, src[i+1].y,
           src[i+2].x, src[i+2].y,
@@ -312,10 +342,9 @@ mid(double a, double b)
   return (a + b) / 2.0;
 }
 
-#define WEIGHT 4.0
-
 static void curve(
   TPolygon &poly,
+  TCoord weight, bool round,
   TCoord x0, TCoord y0, 
   TCoord x1, TCoord y1,
   TCoord x2, TCoord y2,
@@ -337,11 +366,17 @@ static void curve(
   TCoord w2 = vx3 * vy4 - vy3 * vx4;
   TCoord w3 = vx0 * vy4 - vy0 * vx4;
 
-  if (fabs(w0)+fabs(w1)+fabs(w2)+fabs(w3)<WEIGHT) {
-    poly.push_back(TPoint(lround(x0), lround(y0)));
-    poly.push_back(TPoint(lround(x1), lround(y1)));
-    poly.push_back(TPoint(lround(x2), lround(y2)));
-    poly.push_back(TPoint(lround(x3), lround(y3)));
+  if (fabs(w0)+fabs(w1)+fabs(w2)+fabs(w3)<weight) {
+    if (round) {
+      poly.push_back(TPoint(lround(x0), lround(y0)));
+      poly.push_back(TPoint(lround(x1), lround(y1)));
+      poly.push_back(TPoint(lround(x2), lround(y2)));
+      poly.push_back(TPoint(lround(x3), lround(y3)));
+    } else {
+      poly.push_back(TPoint(x1, y1));
+      poly.push_back(TPoint(x2, y2));
+      poly.push_back(TPoint(x3, y3));
+    }
   } else {
     TCoord xx  = mid(x1, x2);
     TCoord yy  = mid(y1, y2);
@@ -355,8 +390,8 @@ static void curve(
     TCoord y21 = mid(yy, y22);
     TCoord cx  = mid(x12, x21);
     TCoord cy  = mid(y12, y21);
-    curve(poly, x0, y0, x11, y11, x12, y12, cx, cy);
-    curve(poly, cx, cy, x21, y21, x22, y22, x3, y3);
+    curve(poly, weight, round, x0, y0, x11, y11, x12, y12, cx, cy);
+    curve(poly, weight, round, cx, cy, x21, y21, x22, y22, x3, y3);
   }
 }
 
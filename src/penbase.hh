@@ -228,6 +228,7 @@ class TPenBase
 
     static void poly2Bezier(const TPoint *src, size_t n, TPolygon &dst);
     static void poly2Bezier(const TPolygon &p, TPolygon &d);
+    static void poly2Bezier(const TPolygon &p, TPolygon &d, TCoord weight);
 
     virtual void showPage();
 };
@@ -35,8 +35,9 @@ struct THeapTrack
   void *end;
 };
 
-THeapTrack heap[heaptrack_size];
-unsigned heapidx = 0;
+// thread local, so that smart objects can be created in other threads
+__thread THeapTrack heap[heaptrack_size];
+__thread unsigned heapidx = 0;
 
 } // namespace
 
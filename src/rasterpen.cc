@@ -0,0 +1,1459 @@
+/*
+ * TOAD -- A Simple and Powerful C++ GUI Toolkit for the X Window System
+ * Copyright (C) 1996-2007 by Mark-André Hopf <mhopf@mark13.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, 
+ * MA  02111-1307,  USA
+ */
+
+#include <toad/rasterpen.hh>
+#include <toad/pen.hh>
+#include <toad/bitmap.hh>
+#include <toad/region.hh>
+
+#include <algorithm>
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <map>
+
+#if defined(HAVE_FREETYPE) || defined(HAVE_LIBXFT)
+#define HAVE_RASTER_TEXT 1
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#endif
+
+using namespace toad;
+
+/**
+ * \class toad::TRasterPen
+ *
+ * The buffer holds premultiplied RGBA and starts as an opaque white
+ * sheet. When created for a TBitmap, the bitmap is copied into the
+ * buffer and written back by flush() or the destructor.
+ *
+ * Coordinates follow TPen: integer coordinates address pixel centres,
+ * fillRectangle(x,y,w,h) covers w+1 by h+1 pixels and line width 0 is
+ * a one pixel wide line. Polygons are filled with the even-odd rule
+ * like XFillPolygon does, the outline is painted on top with the line
+ * color unless 'outline' is set, in which case only the outline is
+ * painted.
+ *
+ * Edges are antialiased with 4 sub-scanlines per pixel and exact
+ * horizontal coverage.
+ */
+
+namespace {
+
+const int SUBSAMPLES = 4;
+
+inline unsigned char
+clamp8(TCoord v)
+{
+  if (v<=0.0)
+    return 0;
+  if (v>=1.0)
+    return 255;
+  return (unsigned char)(v*255.0+0.5);
+}
+
+// (a*b)/255 with rounding
+inline int
+mul255(int a, int b)
+{
+  int t = a*b + 128;
+  return (t + (t>>8)) >> 8;
+}
+
+inline void
+blendPixel(unsigned char *p, const unsigned char *c, int a, TPenBase::EMode mode)
+{
+  switch(mode) {
+    case TPenBase::NORMAL:
+      p[0] = mul255(c[0], a) + mul255(p[0], 255-a);
+      p[1] = mul255(c[1], a) + mul255(p[1], 255-a);
+      p[2] = mul255(c[2], a) + mul255(p[2], 255-a);
+      p[3] = a + mul255(p[3], 255-a);
+      break;
+    case TPenBase::XOR:
+      if (a>=128) {
+        p[0] ^= c[0];
+        p[1] ^= c[1];
+        p[2] ^= c[2];
+      }
+      break;
+    case TPenBase::INVERT:
+      if (a>=128) {
+        p[0] = p[3]-p[0];
+        p[1] = p[3]-p[1];
+        p[2] = p[3]-p[2];
+      }
+      break;
+  }
+}
+
+bool
+edgeLess(const TRasterPen::TEdge &a, const TRasterPen::TEdge &b)
+{
+  return a.y0 < b.y0;
+}
+
+struct TCrossing {
+  TCoord x;
+  int dir;
+  bool operator<(const TCrossing &c) const { return x < c.x; }
+};
+
+std::vector<TCrossing> crossings;
+
+} // namespace
+
+TRasterPen::TRasterPen(int w, int h)
+{
+  _init(w, h);
+  clear();
+}
+
+TRasterPen::TRasterPen(TBitmap *bmp)
+{
+  _init(bmp->width, bmp->height);
+  bitmap = bmp;
+  unsigned char *p = data;
+  for(int y=0; y<height; ++y) {
+    for(int x=0; x<width; ++x) {
+      TCoord r, g, b;
+      if (!bmp->getPixel(x, y, &r, &g, &b))
+        r = g = b = 1.0;
+      p[0] = clamp8(r);
+      p[1] = clamp8(g);
+      p[2] = clamp8(b);
+      p[3] = 255;
+      p+=4;
+    }
+  }
+}
+
+void
+TRasterPen::_init(int w, int h)
+{
+  width = w>0 ? w : 0;
+  height = h>0 ? h : 0;
+  data = new unsigned char[width*height*4];
+  bitmap = 0;
+  mat = 0;
+  region = 0;
+  mode = NORMAL;
+  lw = 0;
+  style = SOLID;
+  alpha = 1.0;
+  stroke.r = stroke.g = stroke.b = 0.0;
+  fill = stroke;
+  if (!font)
+    setFont("arial,helvetica,sans-serif:size=12");
+}
+
+TRasterPen::~TRasterPen()
+{
+  flush();
+  while(mat) {
+    TMatrix2D *m = mat;
+    mat = mat->next;
+    delete m;
+  }
+  delete region;
+  delete[] data;
+}
+
+/**
+ * Fill the whole buffer with the given color, ignoring the clipping
+ * region.
+ */
+void
+TRasterPen::clear(TCoord r, TCoord g, TCoord b, TCoord a)
+{
+  unsigned char c[4];
+  c[3] = clamp8(a);
+  c[0] = clamp8(r*a);
+  c[1] = clamp8(g*a);
+  c[2] = clamp8(b*a);
+  unsigned char *p = data, *e = data + width*height*4;
+  while(p<e) {
+    p[0]=c[0]; p[1]=c[1]; p[2]=c[2]; p[3]=c[3];
+    p+=4;
+  }
+}
+
+/**
+ * Copy the buffer into 'bmp', composed on black as TBitmap has no alpha
+ * channel.
+ */
+void
+TRasterPen::copyTo(TBitmap *bmp) const
+{
+  int w = std::min(width, bmp->width);
+  int h = std::min(height, bmp->height);
+  for(int y=0; y<h; ++y) {
+    const unsigned char *p = data + y*width*4;
+    for(int x=0; x<w; ++x) {
+      bmp->setPixel(x, y, p[0]/255.0, p[1]/255.0, p[2]/255.0);
+      p+=4;
+    }
+  }
+}
+
+/**
+ * Write the buffer back into the bitmap given to the constructor.
+ */
+void
+TRasterPen::flush()
+{
+  if (bitmap)
+    copyTo(bitmap);
+}
+
+void
+TRasterPen::setFont(const string &fontname)
+{
+  setFont(TPen::lookupFont(fontname));
+}
+
+void
+TRasterPen::setFont(TFont *newfont)
+{
+  font = newfont;
+}
+
+// matrix
+//---------------------------------------------------------------------------
+void
+TRasterPen::identity()
+{
+  if (mat)
+    mat->identity();
+}
+
+void
+TRasterPen::translate(TCoord dx, TCoord dy)
+{
+  if (!mat) {
+    if (dx==0.0 && dy==0.0)
+      return;
+    mat = new TMatrix2D();
+  }
+  mat->translate(dx, dy);
+}
+
+void
+TRasterPen::scale(TCoord sx, TCoord sy)
+{
+  if (!mat)
+    mat = new TMatrix2D();
+  mat->scale(sx, sy);
+}
+
+void
+TRasterPen::rotate(TCoord radiants)
+{
+  if (!mat)
+    mat = new TMatrix2D();
+  mat->rotate(radiants);
+}
+
+void
+TRasterPen::multiply(const TMatrix2D *m)
+{
+  if (!mat) {
+    mat = new TMatrix2D(*m);
+  } else {
+    mat->multiply(m);
+  }
+}
+
+void
+TRasterPen::setMatrix(TCoord a11, TCoord a21, TCoord a12, TCoord a22, TCoord tx, TCoord ty)
+{
+  if (!mat)
+    mat = new TMatrix2D();
+  mat->set(a11, a21, a12, a22, tx, ty);
+}
+
+void
+TRasterPen::push()
+{
+  TMatrix2D *mnew = mat ? new TMatrix2D(*mat) : new TMatrix2D();
+  mnew->next = mat;
+  mat = mnew;
+}
+
+void
+TRasterPen::pop()
+{
+  if (mat) {
+    TMatrix2D *mold = mat;
+    mat = mat->next;
+    delete mold;
+  }
+}
+
+void
+TRasterPen::popAll()
+{
+  while(mat) {
+    TMatrix2D *mold = mat;
+    mat = mat->next;
+    delete mold;
+  }
+}
+
+// clipping, in device coordinates like TPen
+//---------------------------------------------------------------------------
+void
+TRasterPen::setClipRegion(TRegion *rgn)
+{
+  if (!region)
+    region = new TRegion();
+  *region = *rgn;
+}
+
+void
+TRasterPen::setClipRect(const TRectangle &r)
+{
+  if (!region)
+    region = new TRegion();
+  region->clear();
+  *region |= r;
+}
+
+void
+TRasterPen::clrClipBox()
+{
+  delete region;
+  region = 0;
+}
+
+void
+TRasterPen::getClipBox(TRectangle *r) const
+{
+  if (!region) {
+    r->set(0, 0, width, height);
+  } else {
+    region->getBoundary(r);
+  }
+}
+
+/**
+ * Intersect the clipping region with 'rect'. Unlike TPen this also
+ * works when the pen has no clipping region yet.
+ */
+void
+TRasterPen::operator&=(const TRectangle &rect)
+{
+  if (!region) {
+    region = new TRegion();
+    region->addRect(0, 0, width, height);
+  }
+  *region &= rect;
+}
+
+void
+TRasterPen::operator&=(const TRegion &rgn)
+{
+  if (!region) {
+    region = new TRegion();
+    region->addRect(0, 0, width, height);
+  }
+  *region &= rgn;
+}
+
+void
+TRasterPen::operator|=(const TRectangle &rect)
+{
+  if (!region)
+    return;
+  *region |= rect;
+}
+
+void
+TRasterPen::operator|=(const TRegion &rgn)
+{
+  if (!region)
+    return;
+  *region |= rgn;
+}
+
+/**
+ * Bounding box of the area which can be painted, 'x1' and 'y1' are
+ * exclusive. Returns 'false' when nothing can be painted.
+ */
+bool
+TRasterPen::_getClip(int *x0, int *y0, int *x1, int *y1) const
+{
+  *x0 = 0;
+  *y0 = 0;
+  *x1 = width;
+  *y1 = height;
+  if (region) {
+    TRectangle r;
+    region->getBoundary(&r);
+    *x0 = std::max(*x0, (int)r.x);
+    *y0 = std::max(*y0, (int)r.y);
+    *x1 = std::min(*x1, (int)(r.x+r.w));
+    *y1 = std::min(*y1, (int)(r.y+r.h));
+  }
+  return *x0<*x1 && *y0<*y1;
+}
+
+// attributes
+//---------------------------------------------------------------------------
+void
+TRasterPen::setMode(EMode m)
+{
+  mode = m;
+}
+
+void
+TRasterPen::setLineWidth(TCoord n)
+{
+  lw = n<0 ? 0 : n;
+}
+
+void
+TRasterPen::setLineStyle(ELineStyle n)
+{
+  style = n;
+}
+
+void
+TRasterPen::vsetColor(TCoord r, TCoord g, TCoord b)
+{
+  if (keepcolor)
+    return;
+  stroke.r = fill.r = r;
+  stroke.g = fill.g = g;
+  stroke.b = fill.b = b;
+}
+
+void
+TRasterPen::vsetLineColor(TCoord r, TCoord g, TCoord b)
+{
+  if (keepcolor)
+    return;
+  stroke.r = r;
+  stroke.g = g;
+  stroke.b = b;
+}
+
+void
+TRasterPen::vsetFillColor(TCoord r, TCoord g, TCoord b)
+{
+  if (keepcolor)
+    return;
+  fill.r = r;
+  fill.g = g;
+  fill.b = b;
+}
+
+/**
+ * Set the opacity for the following operations. Accepts 0.0 to 1.0 like
+ * TCairo and also 0 to 255 as used by the figures.
+ */
+void
+TRasterPen::setAlpha(TCoord a)
+{
+  if (a>1.0)
+    a/=255.0;
+  if (a<0.0)
+    a=0.0;
+  alpha = a;
+}
+
+// geometry
+//---------------------------------------------------------------------------
+
+/**
+ * Map 'n' points into 'dev', shifted by half a pixel so that integer
+ * coordinates hit the pixel centres.
+ */
+void
+TRasterPen::_toDevice(const TPoint *p, size_t n)
+{
+  dev.resize(n);
+  for(size_t i=0; i<n; ++i) {
+    TCoord x = p[i].x, y = p[i].y;
+    if (mat)
+      mat->map(x, y, &x, &y);
+    dev[i].set(x+0.5, y+0.5);
+  }
+}
+
+TCoord
+TRasterPen::_getDeviceLineWidth() const
+{
+  TCoord w = lw;
+  if (mat)
+    w *= sqrt(fabs(mat->a11*mat->a22 - mat->a12*mat->a21));
+  return w<1.0 ? 1.0 : w;
+}
+
+/**
+ * Fill and/or outline the polygon in 'p', which is given in device
+ * coordinates.
+ */
+void
+TRasterPen::_shape(const TPoint *p, size_t n, bool closed, bool filled)
+{
+  if (n==0)
+    return;
+  if (filled && !outline && n>2) {
+    edges.clear();
+    _addEdges(p, n, false);
+    _rasterize(false, fill);
+  }
+  _stroke(p, n, closed);
+}
+
+/**
+ * Flatten the ellipse inside the raster rectangle (x,y,w,h) into 'dev',
+ * from angle 'r1' to 'r1+r2' in degree, counter clockwise like X11.
+ */
+void
+TRasterPen::_ellipse(TCoord x, TCoord y, TCoord w, TCoord h, TCoord r1, TCoord r2, bool pie)
+{
+  if (w<0) { w=-w; x-=w; }
+  if (h<0) { h=-h; y-=h; }
+  TCoord rx = w/2.0, ry = h/2.0;
+  TCoord cx = x + rx, cy = y + ry;
+
+  TCoord r = std::max(rx, ry);
+  if (mat)
+    r *= sqrt(fabs(mat->a11*mat->a22 - mat->a12*mat->a21));
+  // segments for a maximal error of 1/8 pixel on the full circle
+  int full = 8;
+  if (r>0.125)
+    full = std::max(full, (int)ceil(M_PI / acos(1.0 - 0.125/r)));
+  if (r2>360.0)
+    r2 = 360.0;
+  if (r2<-360.0)
+    r2 = -360.0;
+  int n = std::max(2, (int)ceil(full * fabs(r2) / 360.0));
+
+  TPolygon &poly = flat;
+  poly.clear();
+  TCoord a0 = r1 * M_PI / 180.0;
+  TCoord da = r2 * M_PI / 180.0 / n;
+  for(int i=0; i<=n; ++i) {
+    TCoord a = a0 + da * i;
+    poly.addPoint(cx + rx * cos(a), cy - ry * sin(a));
+  }
+  if (pie)
+    poly.addPoint(cx, cy);
+  _toDevice(&poly[0], poly.size());
+}
+
+/**
+ * Add the edges of the closed polygon 'p' to 'edges'. With 'orient'
+ * the polygon's winding is made positive so that the union of several
+ * polygons can be filled with the nonzero rule.
+ */
+void
+TRasterPen::_addEdges(const TPoint *p, size_t n, bool orient)
+{
+  int sign = 1;
+  if (orient) {
+    TCoord area = 0.0;
+    for(size_t i=0; i<n; ++i) {
+      const TPoint &a = p[i], &b = p[(i+1)%n];
+      area += a.x*b.y - b.x*a.y;
+    }
+    if (area<0)
+      sign = -1;
+  }
+  for(size_t i=0; i<n; ++i) {
+    const TPoint &a = p[i], &b = p[(i+1)%n];
+    if (a.y==b.y)
+      continue;
+    TEdge e;
+    if (a.y<b.y) {
+      e.x0 = a.x; e.y0 = a.y;
+      e.x1 = b.x; e.y1 = b.y;
+      e.dir = sign;
+    } else {
+      e.x0 = b.x; e.y0 = b.y;
+      e.x1 = a.x; e.y1 = a.y;
+      e.dir = -sign;
+    }
+    e.dxdy = (e.x1-e.x0)/(e.y1-e.y0);
+    edges.push_back(e);
+  }
+}
+
+/**
+ * Add the outline of a polyline with device width 'w' to 'edges' as a
+ * set of positively oriented polygons: one quad for each segment and a
+ * miter or bevel join between them. Thin lines get square caps so that
+ * both end points are painted like X11 does for zero width lines.
+ */
+void
+TRasterPen::_addStroke(const TPoint *p, size_t n, bool closed, TCoord w)
+{
+  TCoord hw = w/2.0;
+  bool thin = w<=1.0;
+  size_t m = closed ? n : n-1;
+  bool havePrev = false, haveFirst = false;
+  TCoord pux=0, puy=0, fux=0, fuy=0;
+  TPoint q[4];
+
+  for(size_t i=0; i<m; ++i) {
+    const TPoint &a = p[i], &b = p[(i+1)%n];
+    TCoord dx = b.x-a.x, dy = b.y-a.y;
+    TCoord len = sqrt(dx*dx+dy*dy);
+    if (len<1e-9)
+      continue;
+    TCoord ux = dx/len, uy = dy/len;
+    TCoord nx = -uy*hw, ny = ux*hw;
+    TCoord ex = thin ? ux*hw : 0.0, ey = thin ? uy*hw : 0.0;
+
+    q[0].set(a.x+nx-ex, a.y+ny-ey);
+    q[1].set(b.x+nx+ex, b.y+ny+ey);
+    q[2].set(b.x-nx+ex, b.y-ny+ey);
+    q[3].set(a.x-nx-ex, a.y-ny-ey);
+    _addEdges(q, 4, true);
+
+    if (!thin && havePrev) {
+      TCoord cr = pux*uy - puy*ux;
+      TCoord dt = pux*ux + puy*uy;
+      if (fabs(cr)>1e-9) {
+        TCoord s = cr>0 ? -hw : hw;
+        TCoord n0x = -puy*s, n0y = pux*s;
+        TCoord n1x = -uy*s,  n1y = ux*s;
+        size_t k = 0;
+        q[k++] = a;
+        q[k++].set(a.x+n0x, a.y+n0y);
+        if (1.0+dt >= 0.02) { // miter limit 10 like X11's default
+          q[k++].set(a.x+(n0x+n1x)/(1.0+dt), a.y+(n0y+n1y)/(1.0+dt));
+        }
+        q[k++].set(a.x+n1x, a.y+n1y);
+        _addEdges(q, k, true);
+      }
+    }
+    if (!haveFirst) {
+      haveFirst = true;
+      fux = ux; fuy = uy;
+    }
+    havePrev = true;
+    pux = ux; puy = uy;
+  }
+
+  if (!haveFirst) {
+    // all points are equal, paint a dot
+    q[0].set(p[0].x-hw, p[0].y-hw);
+    q[1].set(p[0].x+hw, p[0].y-hw);
+    q[2].set(p[0].x+hw, p[0].y+hw);
+    q[3].set(p[0].x-hw, p[0].y+hw);
+    _addEdges(q, 4, true);
+    return;
+  }
+
+  if (closed && !thin) {
+    // join the last with the first segment
+    TPoint a = p[0];
+    TCoord cr = pux*fuy - puy*fux;
+    TCoord dt = pux*fux + puy*fuy;
+    if (fabs(cr)>1e-9) {
+      TCoord s = cr>0 ? -hw : hw;
+      TCoord n0x = -puy*s, n0y = pux*s;
+      TCoord n1x = -fuy*s, n1y = fux*s;
+      size_t k = 0;
+      q[k++] = a;
+      q[k++].set(a.x+n0x, a.y+n0y);
+      if (1.0+dt >= 0.02)
+        q[k++].set(a.x+(n0x+n1x)/(1.0+dt), a.y+(n0y+n1y)/(1.0+dt));
+      q[k++].set(a.x+n1x, a.y+n1y);
+      _addEdges(q, k, true);
+    }
+  }
+}
+
+/**
+ * Stroke the polyline 'p' given in device coordinates with the line
+ * color, width and style.
+ */
+void
+TRasterPen::_stroke(const TPoint *p, size_t n, bool closed)
+{
+  if (n==0)
+    return;
+  TCoord w = _getDeviceLineWidth();
+  edges.clear();
+
+  if (style==SOLID || n<2) {
+    _addStroke(p, n, closed, w);
+    _rasterize(true, stroke);
+    return;
+  }
+
+  // same dash patterns as TPen::_setLineAttributes
+  TCoord u = std::max(1.0, (TCoord)lround(w));
+  TCoord dash[6];
+  size_t ndash;
+  for(int i=1; i<6; ++i)
+    dash[i] = u;
+  switch(style) {
+    case DASH:
+      dash[0] = 2*u;
+      ndash = 2;
+      break;
+    case DOT:
+      dash[0] = u;
+      ndash = 2;
+      break;
+    case DASHDOT:
+      dash[0] = 3*u;
+      ndash = 4;
+      break;
+    default:
+      dash[0] = 3*u;
+      ndash = 6;
+      break;
+  }
+
+  TPolygon piece;
+  size_t di = 0;
+  TCoord left = dash[0];
+  piece.addPoint(p[0]);
+  size_t m = closed ? n : n-1;
+  for(size_t i=0; i<m; ++i) {
+    TPoint a = p[i];
+    const TPoint &b = p[(i+1)%n];
+    TCoord dx = b.x-a.x, dy = b.y-a.y;
+    TCoord len = sqrt(dx*dx+dy*dy);
+    while(len>=left) {
+      a.set(a.x + dx*left/len, a.y + dy*left/len);
+      dx = b.x-a.x;
+      dy = b.y-a.y;
+      len -= left;
+      if ((di&1)==0) {
+        piece.addPoint(a);
+        _addStroke(&piece[0], piece.size(), false, w);
+      }
+      piece.clear();
+      di = (di+1) % ndash;
+      left = dash[di];
+      if ((di&1)==0)
+        piece.addPoint(a);
+    }
+    left -= len;
+    if ((di&1)==0)
+      piece.addPoint(b);
+  }
+  if ((di&1)==0 && piece.size()>1)
+    _addStroke(&piece[0], piece.size(), false, w);
+  _rasterize(true, stroke);
+}
+
+// scanline conversion
+//---------------------------------------------------------------------------
+
+/**
+ * Add a span from 'xa' to 'xb' on the current sub-scanline to the
+ * coverage of the row starting at 'x0' with 'rw' pixels.
+ * 'cover' receives the partial pixels at both ends, 'accum' the
+ * differences of the fully covered run in between.
+ */
+inline void
+TRasterPen::_span(TCoord xa, TCoord xb, int x0, int rw, float weight)
+{
+  xa -= x0;
+  xb -= x0;
+  if (xa<0)
+    xa = 0;
+  if (xb>rw)
+    xb = rw;
+  if (xb<=xa)
+    return;
+  int ia = (int)xa, ib = (int)xb;
+  if (ia==ib) {
+    cover[ia] += (xb-xa)*weight;
+  } else {
+    cover[ia] += (ia+1-xa)*weight;
+    accum[ia+1] += weight;
+    accum[ib] -= weight;
+    cover[ib] += (xb-ib)*weight;
+  }
+}
+
+/**
+ * Fill the polygons in 'edges' with 'color' using the nonzero or the
+ * even-odd rule.
+ */
+void
+TRasterPen::_rasterize(bool nonzero, const TRGB &color)
+{
+  if (edges.empty())
+    return;
+  int cx0, cy0, cx1, cy1;
+  if (!_getClip(&cx0, &cy0, &cx1, &cy1))
+    return;
+
+  TCoord xmin = edges[0].x0, xmax = xmin;
+  TCoord ymin = edges[0].y0, ymax = edges[0].y1;
+  for(std::vector<TEdge>::const_iterator e = edges.begin(); e!=edges.end(); ++e) {
+    xmin = std::min(xmin, std::min(e->x0, e->x1));
+    xmax = std::max(xmax, std::max(e->x0, e->x1));
+    ymin = std::min(ymin, e->y0);
+    ymax = std::max(ymax, e->y1);
+  }
+  int x0 = std::max(cx0, (int)floor(xmin));
+  int x1 = std::min(cx1, (int)ceil(xmax));
+  int y0 = std::max(cy0, (int)floor(ymin));
+  int y1 = std::min(cy1, (int)ceil(ymax));
+  if (x0>=x1 || y0>=y1)
+    return;
+  int rw = x1-x0;
+
+  std::sort(edges.begin(), edges.end(), edgeLess);
+  cover.resize(rw+2);
+  accum.resize(rw+2);
+
+  std::vector<size_t> active;
+  size_t next = 0;
+  const float weight = 1.0f / SUBSAMPLES;
+
+  for(int y=y0; y<y1; ++y) {
+    while(next<edges.size() && edges[next].y0<y+1) {
+      if (edges[next].y1>y)
+        active.push_back(next);
+      ++next;
+    }
+    size_t j = 0;
+    for(size_t i=0; i<active.size(); ++i) {
+      if (edges[active[i]].y1>y)
+        active[j++] = active[i];
+    }
+    active.resize(j);
+    if (active.empty()) {
+      if (next>=edges.size())
+        break;
+      continue;
+    }
+
+    std::fill(cover.begin(), cover.end(), 0.0f);
+    std::fill(accum.begin(), accum.end(), 0.0f);
+    for(int s=0; s<SUBSAMPLES; ++s) {
+      TCoord sy = y + (s+0.5)/SUBSAMPLES;
+      crossings.clear();
+      for(size_t i=0; i<active.size(); ++i) {
+        const TEdge &e = edges[active[i]];
+        if (e.y0<=sy && sy<e.y1) {
+          TCrossing c;
+          c.x = e.x0 + (sy-e.y0)*e.dxdy;
+          c.dir = e.dir;
+          crossings.push_back(c);
+        }
+      }
+      if (crossings.size()<2)
+        continue;
+      std::sort(crossings.begin(), crossings.end());
+      int wind = 0;
+      TCoord start = 0;
+      for(size_t i=0; i<crossings.size(); ++i) {
+        bool was = nonzero ? wind!=0 : (wind&1);
+        wind += nonzero ? crossings[i].dir : 1;
+        bool is = nonzero ? wind!=0 : (wind&1);
+        if (!was && is)
+          start = crossings[i].x;
+        else if (was && !is)
+          _span(start, crossings[i].x, x0, rw, weight);
+      }
+    }
+
+    float run = 0.0f;
+    for(int i=0; i<rw; ++i) {
+      run += accum[i];
+      cover[i] += run;
+    }
+    _blendRow(y, x0, x1, &cover[0], color);
+  }
+}
+
+/**
+ * Blend 'color' into row 'y' from 'x0' to 'x1' (exclusive) with the
+ * given coverage, which starts at 'x0'. Honours the clip region.
+ */
+void
+TRasterPen::_blendRow(int y, int x0, int x1, const float *coverage, const TRGB &color)
+{
+  unsigned char c[3];
+  c[0] = clamp8(color.r);
+  c[1] = clamp8(color.g);
+  c[2] = clamp8(color.b);
+  float scale = alpha * 255.0f;
+
+  long nrects = region ? region->getNumRects() : 1;
+  for(long k=0; k<nrects; ++k) {
+    int xa = x0, xb = x1;
+    if (region) {
+      TRectangle r;
+      region->getRect(k, &r);
+      if (y<r.y || y>=r.y+r.h)
+        continue;
+      xa = std::max(xa, (int)r.x);
+      xb = std::min(xb, (int)(r.x+r.w));
+    }
+    unsigned char *p = data + (y*width + xa)*4;
+    for(int x=xa; x<xb; ++x, p+=4) {
+      float v = coverage[x-x0];
+      if (v<=0.0f)
+        continue;
+      if (v>1.0f)
+        v = 1.0f;
+      int a = (int)(v*scale+0.5f);
+      if (a)
+        blendPixel(p, c, a, mode);
+    }
+  }
+}
+
+// primitives
+//---------------------------------------------------------------------------
+void
+TRasterPen::drawPoint(TCoord x, TCoord y)
+{
+  if (mat)
+    mat->map(x, y, &x, &y);
+  x = floor(x+0.5);
+  y = floor(y+0.5);
+  TPoint q[4];
+  q[0].set(x, y);
+  q[1].set(x+1, y);
+  q[2].set(x+1, y+1);
+  q[3].set(x, y+1);
+  edges.clear();
+  _addEdges(q, 4, false);
+  _rasterize(true, stroke);
+}
+
+void
+TRasterPen::vdrawRectangle(TCoord x, TCoord y, TCoord w, TCoord h)
+{
+  TPoint p[4];
+  p[0].set(x, y);
+  p[1].set(x+w, y);
+  p[2].set(x+w, y+h);
+  p[3].set(x, y+h);
+  _toDevice(p, 4);
+  _shape(&dev[0], 4, true, false);
+}
+
+void
+TRasterPen::vfillRectangle(TCoord x, TCoord y, TCoord w, TCoord h)
+{
+  TPoint p[4];
+  p[0].set(x, y);
+  p[1].set(x+w, y);
+  p[2].set(x+w, y+h);
+  p[3].set(x, y+h);
+  _toDevice(p, 4);
+  _shape(&dev[0], 4, true, true);
+}
+
+void
+TRasterPen::vdrawCircle(TCoord x, TCoord y, TCoord w, TCoord h)
+{
+  _ellipse(x, y, w, h, 0, 360, false);
+  _shape(&dev[0], dev.size()-1, true, false);
+}
+
+void
+TRasterPen::vfillCircle(TCoord x, TCoord y, TCoord w, TCoord h)
+{
+  _ellipse(x, y, w, h, 0, 360, false);
+  _shape(&dev[0], dev.size()-1, true, true);
+}
+
+void
+TRasterPen::vdrawArc(TCoord x, TCoord y, TCoord w, TCoord h, TCoord r1, TCoord r2)
+{
+  _ellipse(x, y, w, h, r1, r2, false);
+  _shape(&dev[0], dev.size(), false, false);
+}
+
+void
+TRasterPen::vfillArc(TCoord x, TCoord y, TCoord w, TCoord h, TCoord r1, TCoord r2)
+{
+  // pie slice like XFillArc, the outline is the arc only like XDrawArc
+  _ellipse(x, y, w, h, r1, r2, true);
+  if (!outline) {
+    edges.clear();
+    _addEdges(&dev[0], dev.size(), false);
+    _rasterize(false, fill);
+  }
+  _stroke(&dev[0], dev.size()-1, false);
+}
+
+void
+TRasterPen::drawLines(const TPoint *points, size_t n)
+{
+  if (n==0)
+    return;
+  _toDevice(points, n);
+  _shape(&dev[0], n, false, false);
+}
+
+void
+TRasterPen::drawLines(const TPolygon &p)
+{
+  if (!p.empty())
+    drawLines(&p[0], p.size());
+}
+
+void
+TRasterPen::drawPolygon(const TPoint *points, size_t n)
+{
+  if (n==0)
+    return;
+  _toDevice(points, n);
+  _shape(&dev[0], n, true, false);
+}
+
+void
+TRasterPen::drawPolygon(const TPolygon &p)
+{
+  if (!p.empty())
+    drawPolygon(&p[0], p.size());
+}
+
+void
+TRasterPen::fillPolygon(const TPoint *points, size_t n)
+{
+  if (n==0)
+    return;
+  _toDevice(points, n);
+  _shape(&dev[0], n, true, true);
+}
+
+void
+TRasterPen::fillPolygon(const TPolygon &p)
+{
+  if (!p.empty())
+    fillPolygon(&p[0], p.size());
+}
+
+void
+TRasterPen::drawBezier(TCoord x0, TCoord y0, TCoord x1, TCoord y1, TCoord x2, TCoord y2, TCoord x3, TCoord y3)
+{
+  TPoint p[4];
+  p[0].set(x0, y0);
+  p[1].set(x1, y1);
+  p[2].set(x2, y2);
+  p[3].set(x3, y3);
+  drawBezier(p, 4);
+}
+
+// the curves are flattened in device space, a weight of 1.0 keeps the
+// error well below the antialiasing resolution
+void
+TRasterPen::drawBezier(const TPoint *points, size_t n)
+{
+  if (n==0)
+    return;
+  _toDevice(points, n);
+  poly2Bezier(dev, flat, 1.0);
+  _shape(&flat[0], flat.size(), false, false);
+}
+
+void
+TRasterPen::drawBezier(const TPolygon &p)
+{
+  if (!p.empty())
+    drawBezier(&p[0], p.size());
+}
+
+void
+TRasterPen::fillBezier(const TPoint *points, size_t n)
+{
+  if (n==0)
+    return;
+  _toDevice(points, n);
+  poly2Bezier(dev, flat, 1.0);
+  _shape(&flat[0], flat.size(), true, true);
+}
+
+void
+TRasterPen::fillBezier(const TPolygon &p)
+{
+  if (!p.empty())
+    fillBezier(&p[0], p.size());
+}
+
+/**
+ * Draw 'bmp' with nearest neighbour sampling, which also works with
+ * rotated and scaled matrices.
+ */
+void
+TRasterPen::vdrawBitmap(TCoord x, TCoord y, const TBitmap &cbmp)
+{
+  TBitmap &bmp = const_cast<TBitmap&>(cbmp);
+  int cx0, cy0, cx1, cy1;
+  if (bmp.width<=0 || bmp.height<=0 || !_getClip(&cx0, &cy0, &cx1, &cy1))
+    return;
+
+  TMatrix2D m;
+  if (mat)
+    m = *mat;
+  m.translate(x, y);
+  TCoord xmin=0, xmax=0, ymin=0, ymax=0;
+  for(int i=0; i<4; ++i) {
+    TCoord dx, dy;
+    m.map((TCoord)((i&1) ? bmp.width : 0), (TCoord)((i&2) ? bmp.height : 0), &dx, &dy);
+    if (i==0) {
+      xmin = xmax = dx;
+      ymin = ymax = dy;
+    } else {
+      xmin = std::min(xmin, dx); xmax = std::max(xmax, dx);
+      ymin = std::min(ymin, dy); ymax = std::max(ymax, dy);
+    }
+  }
+  int x0 = std::max(cx0, (int)floor(xmin));
+  int x1 = std::min(cx1, (int)ceil(xmax));
+  int y0 = std::max(cy0, (int)floor(ymin));
+  int y1 = std::min(cy1, (int)ceil(ymax));
+  if (fabs(m.a11*m.a22 - m.a12*m.a21)<1e-12)
+    return;
+  m.invert();
+
+  int a = (int)(alpha*255.0+0.5);
+  unsigned char c[3];
+  for(int py=y0; py<y1; ++py) {
+    unsigned char *p = data + (py*width + x0)*4;
+    for(int px=x0; px<x1; ++px, p+=4) {
+      if (region && !region->isInside(px, py))
+        continue;
+      TCoord bx, by;
+      m.map(px+0.5, py+0.5, &bx, &by);
+      int ix = (int)floor(bx), iy = (int)floor(by);
+      if (ix<0 || iy<0 || ix>=bmp.width || iy>=bmp.height)
+        continue;
+      TCoord r, g, b;
+      if (!bmp.getPixel(ix, iy, &r, &g, &b))
+        continue;
+      c[0] = clamp8(r);
+      c[1] = clamp8(g);
+      c[2] = clamp8(b);
+      blendPixel(p, c, a, mode);
+    }
+  }
+}
+
+// text
+//---------------------------------------------------------------------------
+
+#ifdef HAVE_RASTER_TEXT
+
+namespace {
+
+struct TRasterFace {
+  FT_Face face;
+  TCoord ascent, descent;
+  std::map<unsigned, TCoord> advances;
+};
+
+typedef std::map<string, TRasterFace*> TRasterFaces;
+TRasterFaces faces;
+FT_Library ftlib = 0;
+bool ftfailed = false;
+
+/**
+ * Open the face fontconfig chooses for 'font' in the size TFontManagerFT
+ * uses, ie. at 75 dpi.
+ */
+TRasterFace*
+lookupFace(TFont *font)
+{
+  if (!font || !font->font || ftfailed)
+    return 0;
+  char *name = (char*)FcNameUnparse(font->font);
+  string id(name ? name : "");
+  free(name);
+  TRasterFaces::iterator p = faces.find(id);
+  if (p!=faces.end())
+    return p->second;
+
+  faces[id] = 0;
+  if (!ftlib && FT_Init_FreeType(&ftlib)) {
+    cerr << "toad: TRasterPen failed to initialize FreeType" << endl;
+    ftfailed = true;
+    return 0;
+  }
+
+  FcPattern *pattern = FcPatternDuplicate(font->font);
+  double dpi;
+  if (FcPatternGetDouble(pattern, FC_DPI, 0, &dpi)!=FcResultMatch)
+    FcPatternAddDouble(pattern, FC_DPI, 75.0);
+  FcConfigSubstitute(0, pattern, FcMatchPattern);
+  FcDefaultSubstitute(pattern);
+  FcResult result;
+  FcPattern *found = FcFontMatch(0, pattern, &result);
+  FcPatternDestroy(pattern);
+  if (!found) {
+    cerr << "toad: TRasterPen found no font for '" << id << "'" << endl;
+    return 0;
+  }
+
+  FcChar8 *file = 0;
+  int index = 0;
+  double size = 12.0;
+  FcPatternGetString(found, FC_FILE, 0, &file);
+  FcPatternGetInteger(found, FC_INDEX, 0, &index);
+  FcPatternGetDouble(found, FC_PIXEL_SIZE, 0, &size);
+
+  FT_Face face;
+  if (!file || FT_New_Face(ftlib, (const char*)file, index, &face)) {
+    cerr << "toad: TRasterPen failed to open font file for '" << id << "'" << endl;
+    FcPatternDestroy(found);
+    return 0;
+  }
+  FcPatternDestroy(found);
+
+  if (FT_IS_SCALABLE(face)) {
+    FT_Set_Pixel_Sizes(face, 0, (FT_UInt)(size+0.5));
+  } else if (face->num_fixed_sizes>0) {
+    FT_Select_Size(face, 0);
+  }
+
+  TRasterFace *rf = new TRasterFace;
+  rf->face = face;
+  rf->ascent = ceil(face->size->metrics.ascender / 64.0);
+  rf->descent = ceil(-face->size->metrics.descender / 64.0);
+  faces[id] = rf;
+  return rf;
+}
+
+// decode one UTF-8 character, invalid bytes are taken as Latin-1
+unsigned
+nextChar(const char **str, const char *end)
+{
+  const unsigned char *s = (const unsigned char*)*str;
+  unsigned c = *s++;
+  int n = 0;
+  if (c>=0xf0 && c<0xf8) {
+    c &= 0x07; n = 3;
+  } else if (c>=0xe0) {
+    c &= 0x0f; n = 2;
+  } else if (c>=0xc0) {
+    c &= 0x1f; n = 1;
+  }
+  if (n && (const char*)s+n<=end) {
+    unsigned u = c;
+    int i;
+    for(i=0; i<n && (s[i]&0xc0)==0x80; ++i)
+      u = (u<<6) | (s[i]&0x3f);
+    if (i==n) {
+      *str = (const char*)s+n;
+      return u;
+    }
+  }
+  c = *(const unsigned char*)*str;
+  ++*str;
+  return c;
+}
+
+TCoord
+getAdvance(TRasterFace *rf, unsigned c)
+{
+  std::map<unsigned, TCoord>::iterator p = rf->advances.find(c);
+  if (p!=rf->advances.end())
+    return p->second;
+  TCoord a = 0;
+  FT_Set_Transform(rf->face, 0, 0);
+  if (!FT_Load_Char(rf->face, c, FT_LOAD_DEFAULT))
+    a = rf->face->glyph->advance.x / 64.0;
+  rf->advances[c] = a;
+  return a;
+}
+
+} // namespace
+
+void
+TRasterPen::terminate()
+{
+  for(TRasterFaces::iterator p = faces.begin(); p!=faces.end(); ++p) {
+    if (p->second) {
+      FT_Done_Face(p->second->face);
+      delete p->second;
+    }
+  }
+  faces.clear();
+  if (ftlib) {
+    FT_Done_FreeType(ftlib);
+    ftlib = 0;
+  }
+}
+
+TCoord
+TRasterPen::vgetTextWidth(const char *text, size_t len) const
+{
+  TRasterFace *rf = lookupFace(font);
+  if (!rf)
+    return 0;
+  TCoord w = 0;
+  const char *end = text + len;
+  while(text<end)
+    w += getAdvance(rf, nextChar(&text, end));
+  return w;
+}
+
+TCoord
+TRasterPen::getAscent() const
+{
+  TRasterFace *rf = lookupFace(font);
+  return rf ? rf->ascent : 0;
+}
+
+TCoord
+TRasterPen::getDescent() const
+{
+  TRasterFace *rf = lookupFace(font);
+  return rf ? rf->descent : 0;
+}
+
+TCoord
+TRasterPen::getHeight() const
+{
+  TRasterFace *rf = lookupFace(font);
+  return rf ? rf->ascent + rf->descent : 0;
+}
+
+void
+TRasterPen::vdrawString(TCoord x, TCoord y, const char *str, size_t len, bool transparent)
+{
+  TRasterFace *rf = lookupFace(font);
+  if (!rf)
+    return;
+
+  if (!transparent) {
+    TRGB s = stroke;
+    bool o = outline;
+    stroke = fill;
+    outline = false;
+    fillRectanglePC(x, y, vgetTextWidth(str, len), getHeight());
+    stroke = s;
+    outline = o;
+  }
+
+  int cx0, cy0, cx1, cy1;
+  if (!_getClip(&cx0, &cy0, &cx1, &cy1))
+    return;
+
+  // the glyph outlines have y pointing upwards
+  FT_Matrix fm;
+  TCoord a11 = 1, a12 = 0, a21 = 0, a22 = 1;
+  if (mat) {
+    a11 = mat->a11; a12 = mat->a12;
+    a21 = mat->a21; a22 = mat->a22;
+  }
+  fm.xx = (FT_Fixed)( a11 * 0x10000);
+  fm.xy = (FT_Fixed)(-a12 * 0x10000);
+  fm.yx = (FT_Fixed)(-a21 * 0x10000);
+  fm.yy = (FT_Fixed)( a22 * 0x10000);
+
+  FT_Face face = rf->face;
+  TCoord ux = x, uy = y + rf->ascent;
+  const char *end = str + len;
+  while(str<end) {
+    unsigned c = nextChar(&str, end);
+    TCoord advance = getAdvance(rf, c);
+    TCoord dx = ux, dy = uy;
+    if (mat)
+      mat->map(ux, uy, &dx, &dy);
+    ux += advance;
+
+    TCoord fx = floor(dx), fy = floor(dy);
+    FT_Vector delta;
+    delta.x = (FT_Pos)((dx-fx)*64.0);
+    delta.y = (FT_Pos)(-(dy-fy)*64.0);
+    FT_Set_Transform(face, &fm, &delta);
+    if (FT_Load_Char(face, c, FT_LOAD_RENDER | (mat ? FT_LOAD_NO_HINTING : 0)))
+      continue;
+    FT_GlyphSlot slot = face->glyph;
+    FT_Bitmap &gb = slot->bitmap;
+    if (gb.pixel_mode!=FT_PIXEL_MODE_GRAY && gb.pixel_mode!=FT_PIXEL_MODE_MONO)
+      continue;
+
+    int gx = (int)fx + slot->bitmap_left;
+    int gy = (int)fy - slot->bitmap_top;
+    int xa = std::max(cx0, gx);
+    int xb = std::min(cx1, gx + (int)gb.width);
+    if (xa>=xb)
+      continue;
+    cover.resize(gb.width);
+    for(int row=0; row<(int)gb.rows; ++row) {
+      int py = gy + row;
+      if (py<cy0 || py>=cy1)
+        continue;
+      const unsigned char *src = gb.buffer + row*gb.pitch;
+      for(unsigned i=0; i<gb.width; ++i) {
+        if (gb.pixel_mode==FT_PIXEL_MODE_MONO)
+          cover[i] = (src[i>>3] & (0x80>>(i&7))) ? 1.0f : 0.0f;
+        else
+          cover[i] = src[i] / 255.0f;
+      }
+      _blendRow(py, xa, xb, &cover[xa-gx], stroke);
+    }
+  }
+}
+
+#else
+
+void
+TRasterPen::terminate()
+{
+}
+
+TCoord
+TRasterPen::vgetTextWidth(const char *text, size_t len) const
+{
+  return TPenBase::vgetTextWidth(text, len);
+}
+
+TCoord
+TRasterPen::getAscent() const
+{
+  return TPenBase::getAscent();
+}
+
+TCoord
+TRasterPen::getDescent() const
+{
+  return TPenBase::getDescent();
+}
+
+TCoord
+TRasterPen::getHeight() const
+{
+  return TPenBase::getHeight();
+}
+
+void
+TRasterPen::vdrawString(TCoord, TCoord, const char*, size_t, bool)
+{
+  static bool warned = false;
+  if (!warned) {
+    cerr << "toad: TRasterPen was build without FreeType, text is not painted" << endl;
+    warned = true;
+  }
+}
+
+#endif
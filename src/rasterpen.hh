@@ -0,0 +1,158 @@
+/*
+ * TOAD -- A Simple and Powerful C++ GUI Toolkit for the X Window System
+ * Copyright (C) 1996-2007 by Mark-André Hopf <mhopf@mark13.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, 
+ * MA  02111-1307,  USA
+ */
+
+#ifndef __TOAD_RASTERPEN_HH
+#define __TOAD_RASTERPEN_HH 1
+
+#include <toad/penbase.hh>
+#include <vector>
+
+namespace toad {
+
+class TRegion;
+
+/**
+ * A pen which renders into an in-memory RGBA buffer instead of an
+ * X11 drawable. It needs no connection to the X server, which makes it
+ * usable for thumbnails, printing previews and benchmarks on machines
+ * without a display.
+ *
+ * Shapes are antialiased, text is rendered with FreeType when TOAD was
+ * build with Xft or FreeType.
+ */
+class TRasterPen:
+  public TPenBase
+{
+  public:
+    TRasterPen(int width, int height);
+    TRasterPen(TBitmap *bitmap);
+    ~TRasterPen();
+
+    static void terminate();
+
+    int width, height;
+    //! premultiplied RGBA, 4 bytes per pixel, rows from top to bottom
+    unsigned char* getData() { return data; }
+    const unsigned char* getData() const { return data; }
+    void clear(TCoord r=1.0, TCoord g=1.0, TCoord b=1.0, TCoord a=1.0);
+    void copyTo(TBitmap *bitmap) const;
+    void flush();
+
+    void setFont(const string&);
+    void setFont(TFont*);
+
+    void identity();
+    void translate(TCoord dx, TCoord dy);
+    void scale(TCoord dx, TCoord dy);
+    void rotate(TCoord radiants);
+    void push();
+    void pop();
+    void popAll();
+    void multiply(const TMatrix2D*);
+    void setMatrix(TCoord a11, TCoord a21, TCoord a12, TCoord a22, TCoord tx, TCoord ty);
+    const TMatrix2D* getMatrix() const { return mat; }
+
+    void setClipRegion(TRegion*);
+    void setClipRect(const TRectangle&);
+    void clrClipBox();
+    void getClipBox(TRectangle*) const;
+    void operator&=(const TRectangle&);
+    void operator|=(const TRectangle&);
+    void operator&=(const TRegion&);
+    void operator|=(const TRegion&);
+
+    void setMode(EMode);
+    void setLineWidth(TCoord);
+    void setLineStyle(ELineStyle);
+
+    void vsetColor(TCoord r, TCoord g, TCoord b);
+    void vsetLineColor(TCoord r, TCoord g, TCoord b);
+    void vsetFillColor(TCoord r, TCoord g, TCoord b);
+    void setAlpha(TCoord a);
+    TCoord getAlpha() const { return alpha; }
+
+    void vdrawBitmap(TCoord x, TCoord y, const TBitmap&);
+
+    void drawPoint(TCoord x, TCoord y);
+    void vdrawRectangle(TCoord x, TCoord y, TCoord w, TCoord h);
+    void vfillRectangle(TCoord x, TCoord y, TCoord w, TCoord h);
+    void vdrawCircle(TCoord x, TCoord y, TCoord w, TCoord h);
+    void vfillCircle(TCoord x, TCoord y, TCoord w, TCoord h);
+    void vdrawArc(TCoord x, TCoord y, TCoord w, TCoord h, TCoord r1, TCoord r2);
+    void vfillArc(TCoord x, TCoord y, TCoord w, TCoord h, TCoord r1, TCoord r2);
+    void vdrawString(TCoord x, TCoord y, const char *str, size_t len, bool transparent);
+
+    TCoord vgetTextWidth(const char *text, size_t len) const;
+    TCoord getAscent() const;
+    TCoord getDescent() const;
+    TCoord getHeight() const;
+
+    void drawLines(const TPoint *points, size_t n);
+    void drawLines(const TPolygon&);
+    void drawPolygon(const TPoint *points, size_t n);
+    void drawPolygon(const TPolygon&);
+    void fillPolygon(const TPoint *points, size_t n);
+    void fillPolygon(const TPolygon&);
+
+    void drawBezier(TCoord,TCoord,TCoord,TCoord,TCoord,TCoord,TCoord,TCoord);
+    void drawBezier(const TPoint *points, size_t n);
+    void drawBezier(const TPolygon&);
+    void fillBezier(const TPoint *points, size_t n);
+    void fillBezier(const TPolygon&);
+
+    struct TEdge {
+      TCoord x0, y0, x1, y1;  // y0 < y1
+      TCoord dxdy;
+      int dir;
+    };
+
+  protected:
+    unsigned char *data;
+    TBitmap *bitmap;        // written back by flush()
+
+    TMatrix2D *mat;
+    TRegion *region;        // 0 when the whole buffer can be painted
+    EMode mode;
+    TCoord lw;
+    ELineStyle style;
+    TCoord alpha;
+
+    // scratch buffers, kept to avoid reallocation for every shape
+    TPolygon dev, flat;
+    std::vector<TEdge> edges;
+    std::vector<float> cover, accum;
+
+    void _init(int w, int h);
+    void _toDevice(const TPoint *p, size_t n);
+    TCoord _getDeviceLineWidth() const;
+    void _shape(const TPoint *p, size_t n, bool closed, bool filled);
+    void _ellipse(TCoord x, TCoord y, TCoord w, TCoord h, TCoord r1, TCoord r2, bool pie);
+    void _addEdges(const TPoint *p, size_t n, bool orient);
+    void _addStroke(const TPoint *p, size_t n, bool closed, TCoord w);
+    void _stroke(const TPoint *p, size_t n, bool closed);
+    void _rasterize(bool nonzero, const TRGB &color);
+    void _span(TCoord xa, TCoord xb, int x0, int rw, float weight);
+    void _blendRow(int y, int x0, int x1, const float *coverage, const TRGB &color);
+    bool _getClip(int *x0, int *y0, int *x1, int *y1) const;
+};
+
+} // namespace toad
+
+#endif
@@ -27,28 +27,46 @@
 /**
  * \file select.cc
  *
+ * The message loop waits for X11 events, TIOObserver and TSimpleTimer
+ * through one of two I/O engines, which is choosen at initialize time
+ * (see TOADBase::setIOEngineByName):
+ *
+ * \li select: the portable engine based on the C library `select' call.
+ *     It scans all file descriptors on every wakeup and can't handle
+ *     file descriptors >= FD_SETSIZE.
+ * \li epoll: Linux epoll(7) and timerfd_create(2). Only the file
+ *     descriptors which became ready are visited and there is no limit
+ *     on the file descriptor numbers.
+ *
  *  \todo
  *    \li 
  *      synchronisation
  *    \li
- *      after StopTimer() it must be safe to call StartTimer which I suppose
- *      not being possible right now
- *    \li
- *      there's a midnight bug
- *    \li
  *      remove the X11 specific parts and let TOAD register an TIOObserver
  */
 
 #include <toad/os.hh>
+#include <toad/config.h>
 
 #include <toad/toadbase.hh>
 #include <toad/ioobserver.hh>
 #include <toad/simpletimer.hh>
+#include <toad/command.hh>
 #include <vector>
-#include <set>
 
 #include <fcntl.h>
+#include <errno.h>
+#include <string.h>
 #include <sys/time.h>
+#include <sys/select.h>
+#include <time.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
 
 #include <unistd.h>
 
@@ -56,199 +74,720 @@ using namespace toad;
 
 namespace toad {
   bool debug_select = false;
-}
+
+/**
+ * \class TIOBackend
+ * Interface of the I/O engines used by TOADBase::select.
+ *
+ * This class is internal to select.cc and a friend of TIOObserver, so
+ * that the engines can dispatch the ready observers.
+ */
+class TIOBackend
+{
+  public:
+    virtual ~TIOBackend();
+    virtual const char *getName() const = 0;
+    virtual bool init(int x11) = 0;
+    virtual void add(TIOObserver*) = 0;
+    virtual void remove(TIOObserver*) = 0;
+    /**
+     * Wait until the X11 connection or an observer becomes ready or
+     * until 'timeout' has passed, then dispatch the ready observers.
+     *
+     * \param timeout  NULL to wait forever
+     * \return         the value of the underlying system call
+     */
+    virtual int wait(struct timeval *timeout) = 0;
+
+  protected:
+    struct TReady {
+      TIOObserver *observer;
+      int events;
+    };
+    typedef vector<TReady> TReadyList;
+    TReadyList ready;
+    
+    static int getEvents(TIOObserver *o) {
+      int flag = 0;
+      o->_check(flag);
+      return flag;
+    }
+    static int getFD(TIOObserver *o) { return o->_fd; }
+    static const int READ = TIOObserver::READ;
+    static const int WRITE = TIOObserver::WRITE;
+    static const int EXCEPTION = TIOObserver::EXCEPTION;
+
+    void forget(TIOObserver*);
+    void dispatch();
+};
+
+} // namespace toad
 
 namespace {
 typedef vector<TIOObserver*> TList;
-TList fd_list;
 TList fd_new;
 
-fd_set fd_set_rd, fd_set_wr, fd_set_ex;
-int fd_x11;
-int fd_max;
+int fd_x11 = -1;
+
+TIOBackend *backend = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+string io_engine("epoll");
+#else
+string io_engine("select");
+#endif
+
+class TIOSelectBackend:
+  public TIOBackend
+{
+    TList fd_list;
+    fd_set fd_set_rd, fd_set_wr, fd_set_ex;
+    int fd_max;
+  public:
+    const char *getName() const { return "select"; }
+    bool init(int x11);
+    void add(TIOObserver*);
+    void remove(TIOObserver*);
+    int wait(struct timeval *timeout);
+};
+
+#ifdef HAVE_SYS_EPOLL_H
+class TIOEpollBackend:
+  public TIOBackend
+{
+    int epfd;
+    int tfd;
+    bool armed;
+    size_t registered;
+    vector<struct epoll_event> events;
+  public:
+    TIOEpollBackend() { epfd = tfd = -1; armed = false; registered = 0; }
+    ~TIOEpollBackend();
+    const char *getName() const { return "epoll"; }
+    bool init(int x11);
+    void add(TIOObserver*);
+    void remove(TIOObserver*);
+    int wait(struct timeval *timeout);
+};
+#endif
+
+} // namespace
 
-struct timeval crnt_time;
+TIOBackend::~TIOBackend()
+{
 }
 
-void TOADBase::initIO(int x11)
+/**
+ * Remove an observer from the list of ready observers so that it won't
+ * be dispatched after it was removed or deleted by another observer.
+ */
+void
+TIOBackend::forget(TIOObserver *o)
+{
+  for(TReadyList::iterator p = ready.begin(); p!=ready.end(); ++p) {
+    if (p->observer == o)
+      p->observer = 0;
+  }
+}
+
+void
+TIOBackend::dispatch()
+{
+  // the list may be modified by the observers through 'forget'
+  for(size_t i=0; i<ready.size(); ++i) {
+    if (ready[i].observer && (ready[i].events & READ)) {
+      if (debug_select)
+        cerr << "  rd " << ready[i].observer->fd() << endl;
+      ready[i].observer->canRead();
+    }
+    if (ready[i].observer && (ready[i].events & WRITE)) {
+      if (debug_select)
+        cerr << "  wr " << ready[i].observer->fd() << endl;
+      ready[i].observer->canWrite();
+    }
+    if (ready[i].observer && (ready[i].events & EXCEPTION)) {
+      if (debug_select)
+        cerr << "  ex " << ready[i].observer->fd() << endl;
+      ready[i].observer->gotException();
+    }
+  }
+  ready.clear();
+}
+
+bool
+TIOSelectBackend::init(int x11)
 {
-  fd_x11 = x11;
   fd_max = x11+1;
   FD_ZERO(&fd_set_rd);
   FD_ZERO(&fd_set_wr);
   FD_ZERO(&fd_set_ex);
-  FD_SET(fd_x11, &fd_set_rd);
+  FD_SET(x11, &fd_set_rd);
+  return true;
+}
+
+void
+TIOSelectBackend::add(TIOObserver *o)
+{
+  int fd = getFD(o);
+  if (fd>=FD_SETSIZE) {
+    cerr << "select: fd " << fd << " exceeds FD_SETSIZE, try the epoll engine" << endl;
+    return;
+  }
+  if (fd>=fd_max)
+    fd_max = fd+1;
+  int flag = getEvents(o);
+  if (flag&READ) {
+    if (debug_select)
+      cerr << "select: adding fd " << fd << " for read check\n";
+    FD_SET(fd, &fd_set_rd);
+  }
+  if (flag&WRITE) {
+    if (debug_select)
+      cerr << "select: adding fd " << fd << " for write check\n";
+    FD_SET(fd, &fd_set_wr);
+  }
+  if (flag&EXCEPTION) {
+    if (debug_select)
+      cerr << "select: adding fd " << fd << " for exception check\n";
+    FD_SET(fd, &fd_set_ex);
+  }
+  fd_list.push_back(o);
+}
+
+void
+TIOSelectBackend::remove(TIOObserver *o)
+{
+  int fd = getFD(o);
+  for(TList::iterator p = fd_list.begin(); p!=fd_list.end(); ++p) {
+    if (*p==o) {
+      fd_list.erase(p);
+      if (fd<FD_SETSIZE) {
+        FD_CLR(fd, &fd_set_rd);
+        FD_CLR(fd, &fd_set_wr);
+        FD_CLR(fd, &fd_set_ex);
+      }
+      break;
+    }
+  }
+  forget(o);
+}
+
+int
+TIOSelectBackend::wait(struct timeval *timeout)
+{
+  fd_set rd, wr, ex;
+  rd = fd_set_rd;
+  wr = fd_set_wr;
+  ex = fd_set_ex;
+
+  int n = ::select(fd_max, &rd, &wr, &ex, timeout);
+  if (n<=0)
+    return n;
+
+  for(TList::iterator p = fd_list.begin(); p!=fd_list.end(); ++p) {
+    int fd = getFD(*p);
+    int events = 0;
+    if (FD_ISSET(fd, &rd))
+      events |= READ;
+    if (FD_ISSET(fd, &wr))
+      events |= WRITE;
+    if (FD_ISSET(fd, &ex))
+      events |= EXCEPTION;
+    if (events) {
+      TReady r = { *p, events };
+      ready.push_back(r);
+    }
+  }
+  dispatch();
+  return n;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+
+TIOEpollBackend::~TIOEpollBackend()
+{
+  if (tfd>=0)
+    close(tfd);
+  if (epfd>=0)
+    close(epfd);
+}
+
+bool
+TIOEpollBackend::init(int x11)
+{
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd<0) {
+    cerr << "select: epoll_create1 failed: " << strerror(errno) << endl;
+    return false;
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = &fd_x11;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, x11, &ev)<0) {
+    cerr << "select: failed to add X11 connection to epoll: " << strerror(errno) << endl;
+    return false;
+  }
+
+#ifdef HAVE_SYS_TIMERFD_H
+  // the timerfd gives us microsecond timeouts where epoll_wait has
+  // only milliseconds
+  tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+  if (tfd>=0) {
+    ev.events = EPOLLIN;
+    ev.data.ptr = &tfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev)<0) {
+      close(tfd);
+      tfd = -1;
+    }
+  }
+#endif
+  return true;
+}
+
+void
+TIOEpollBackend::add(TIOObserver *o)
+{
+  int fd = getFD(o);
+  int flag = getEvents(o);
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  if (flag&READ)
+    ev.events |= EPOLLIN;
+  if (flag&WRITE)
+    ev.events |= EPOLLOUT;
+  if (flag&EXCEPTION)
+    ev.events |= EPOLLPRI;
+  ev.data.ptr = o;
+  if (debug_select)
+    cerr << "select: adding fd " << fd << " with events " << ev.events << " to epoll\n";
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)<0) {
+    cerr << "select: failed to add fd " << fd << " to epoll: " << strerror(errno) << endl;
+    return;
+  }
+  ++registered;
+}
+
+void
+TIOEpollBackend::remove(TIOObserver *o)
+{
+  // fails when the file descriptor was already closed, in which case
+  // the kernel has removed it for us
+  if (epoll_ctl(epfd, EPOLL_CTL_DEL, getFD(o), NULL)==0 || errno==EBADF) {
+    if (registered>0)
+      --registered;
+  }
+  forget(o);
+}
+
+int
+TIOEpollBackend::wait(struct timeval *timeout)
+{
+  int ms = -1;
+  if (timeout) {
+    if (timeout->tv_sec==0 && timeout->tv_usec==0) {
+      ms = 0;
+    } else if (tfd>=0) {
+      struct itimerspec its;
+      memset(&its, 0, sizeof(its));
+      its.it_value.tv_sec  = timeout->tv_sec;
+      its.it_value.tv_nsec = timeout->tv_usec * 1000L;
+      timerfd_settime(tfd, 0, &its, NULL);
+      armed = true;
+    } else {
+      // round up, otherwise we'd spin until the timer is due
+      ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+    }
+  } else if (armed) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    timerfd_settime(tfd, 0, &its, NULL);
+    armed = false;
+  }
+
+  events.resize(registered + 2);
+  int n = epoll_wait(epfd, &events[0], events.size(), ms);
+  if (n<=0)
+    return n;
+
+  for(int i=0; i<n; ++i) {
+    void *ptr = events[i].data.ptr;
+    if (ptr==&fd_x11)
+      continue;
+    if (ptr==&tfd) {
+      uint64_t expirations;
+      ssize_t r = read(tfd, &expirations, sizeof(expirations));
+      (void)r;
+      armed = false;
+      continue;
+    }
+    TIOObserver *o = static_cast<TIOObserver*>(ptr);
+    int flag = getEvents(o);
+    uint32_t e = events[i].events;
+    int got = 0;
+    if (e & (EPOLLIN|EPOLLHUP))
+      got |= READ;
+    if (e & EPOLLOUT)
+      got |= WRITE;
+    if (e & EPOLLPRI)
+      got |= EXCEPTION;
+    if (e & EPOLLERR)
+      got |= (flag & EXCEPTION) ? EXCEPTION : READ;
+    TReady r = { o, got & flag };
+    ready.push_back(r);
+  }
+  dispatch();
+  return n;
+}
+
+#endif
+
+/**
+ * Select the I/O engine used by the message loop.
+ *
+ * This must be called before TOADBase::initialize. Valid names are
+ * "select" and, on Linux, "epoll", which is the default there.
+ *
+ * \return false when the engine is not available
+ */
+bool
+TOADBase::setIOEngineByName(const string &name)
+{
+  if (name=="select") {
+    io_engine = name;
+    return true;
+  }
+#ifdef HAVE_SYS_EPOLL_H
+  if (name=="epoll") {
+    io_engine = name;
+    return true;
+  }
+#endif
+  return false;
+}
+
+/**
+ * Returns the name of the I/O engine used by the message loop.
+ */
+const string&
+TOADBase::getIOEngineName()
+{
+  return io_engine;
+}
+
+void TOADBase::initIO(int x11)
+{
+  fd_x11 = x11;
+  delete backend;
+  backend = 0;
+#ifdef HAVE_SYS_EPOLL_H
+  if (io_engine=="epoll") {
+    backend = new TIOEpollBackend();
+    if (!backend->init(x11)) {
+      cerr << "select: falling back to the select engine" << endl;
+      delete backend;
+      backend = 0;
+      io_engine = "select";
+    }
+  }
+#endif
+  if (!backend) {
+    backend = new TIOSelectBackend();
+    backend->init(x11);
+  }
+  if (debug_select)
+    cerr << "select: using the " << backend->getName() << " engine" << endl;
+}
+
+void TOADBase::closeIO()
+{
+  delete backend;
+  backend = 0;
+  fd_x11 = -1;
 }
 
 // TSimpleTimer stuff (Part I, see Part II below)
 //----------------------------------------------------------------
-struct TSimpleTimer::less {
-  bool operator()(const TSimpleTimer *l1, const TSimpleTimer *l2) const {
-    return l1->_next.tv_sec  < l2->_next.tv_sec ||
-         ( l1->_next.tv_sec == l2->_next.tv_sec && l1->_next.tv_usec < l2->_next.tv_usec);
-  }
+namespace toad {
+
+/**
+ * \class TTimerWheel
+ * Hierarchical timer wheel for TSimpleTimer.
+ *
+ * The timers are kept in LEVELS levels of SIZE slots. A slot on level 0
+ * covers one tick of 1ms, a slot on level k covers SIZE^k ticks and is
+ * cascaded into the lower levels when the wheel reaches it. Starting,
+ * stopping and rescheduling a timer is O(1) and all timers due in the
+ * same tick are run by a single wakeup.
+ *
+ * The time is taken from CLOCK_MONOTONIC, so changes of the wall clock
+ * won't stall the timers or make them fire in bursts.
+ *
+ * There's no constructor as zero initialisation is all we need and this
+ * way it's safe to start timers from static constructors.
+ */
+class TTimerWheel
+{
+  public:
+    static const int BITS = 6;
+    static const int SIZE = 1<<BITS;
+    static const int LEVELS = 4;
+    static const long long TICK = 1000; // microseconds per tick
+
+    static long long now();
+    void insert(TSimpleTimer*);
+    void remove(TSimpleTimer*);
+    bool empty() const { return count==0; }
+    bool run(struct timeval *wait);
+
+  private:
+    TSimpleTimer *slot[LEVELS*SIZE];
+    unsigned long long used[LEVELS]; // one bit for each non-empty slot
+    long long wheel_tick; // the next tick to be processed
+    unsigned count;
+
+    static long long due(const TSimpleTimer *t) {
+      return (t->_next + TICK - 1) / TICK;
+    }
+    void link(TSimpleTimer **head, TSimpleTimer *t, int n);
+    void unlink(TSimpleTimer *t);
+    void place(TSimpleTimer *t);
+    long long nextTick() const;
+    void process(long long tick, long long now_us);
 };
 
-typedef set<TSimpleTimer*, TSimpleTimer::less> TSortedList;
-static TSortedList _sorted_list;
+} // namespace toad
+
+static TTimerWheel wheel;
+
+long long
+TTimerWheel::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void
+TTimerWheel::link(TSimpleTimer **head, TSimpleTimer *t, int n)
+{
+  t->_wnext = *head;
+  if (*head)
+    (*head)->_wpprev = &t->_wnext;
+  *head = t;
+  t->_wpprev = head;
+  t->_wslot = n;
+  if (n>=0)
+    used[n/SIZE] |= 1ULL << (n%SIZE);
+  ++count;
+}
+
+void
+TTimerWheel::unlink(TSimpleTimer *t)
+{
+  *t->_wpprev = t->_wnext;
+  if (t->_wnext)
+    t->_wnext->_wpprev = t->_wpprev;
+  if (t->_wslot>=0 && !slot[t->_wslot])
+    used[t->_wslot/SIZE] &= ~(1ULL << (t->_wslot%SIZE));
+  t->_wnext = 0;
+  t->_wpprev = 0;
+  t->_wslot = -1;
+  --count;
+}
+
+void
+TTimerWheel::place(TSimpleTimer *t)
+{
+  long long d = due(t);
+  if (d < wheel_tick)
+    d = wheel_tick;
+  long long delta = d - wheel_tick;
+  int level, idx;
+  if (delta < (1LL << (BITS*LEVELS))) {
+    level = 0;
+    while(delta >= (1LL << (BITS*(level+1))))
+      ++level;
+    idx = (d >> (BITS*level)) & (SIZE-1);
+  } else {
+    // too far away: park it in the slot cascaded last and try again then
+    level = LEVELS-1;
+    idx = ((wheel_tick >> (BITS*level)) - 1) & (SIZE-1);
+  }
+  int n = level*SIZE + idx;
+  link(&slot[n], t, n);
+}
+
+void
+TTimerWheel::insert(TSimpleTimer *t)
+{
+  if (count==0)
+    wheel_tick = now() / TICK;
+  place(t);
+}
+
+void
+TTimerWheel::remove(TSimpleTimer *t)
+{
+  if (t->_wpprev)
+    unlink(t);
+}
+
+/**
+ * Returns the next tick at which a slot is to be expired or cascaded.
+ */
+long long
+TTimerWheel::nextTick() const
+{
+  long long result = -1;
+  for(int level=0; level<LEVELS; ++level) {
+    unsigned long long bits = used[level];
+    if (!bits)
+      continue;
+    int shift = BITS*level;
+    // first block of this level which starts at or after wheel_tick
+    long long block = (wheel_tick + (1LL<<shift) - 1) >> shift;
+    int i0 = block & (SIZE-1);
+    if (i0)
+      bits = (bits >> i0) | (bits << (SIZE-i0));
+    long long tick = (block + __builtin_ctzll(bits)) << shift;
+    if (result<0 || tick<result)
+      result = tick;
+  }
+  return result;
+}
+
+void
+TTimerWheel::process(long long tick, long long now_us)
+{
+  wheel_tick = tick;
+
+  // cascade the higher levels
+  for(int level=1; level<LEVELS; ++level) {
+    if (tick & ((1LL << (BITS*level))-1))
+      break;
+    int n = level*SIZE + ((tick >> (BITS*level)) & (SIZE-1));
+    while(slot[n]) {
+      TSimpleTimer *t = slot[n];
+      unlink(t);
+      place(t);
+    }
+  }
+
+  // move the expired timers into a list of their own so that the
+  // timers can be stopped, restarted or deleted by each other
+  wheel_tick = tick + 1;
+  TSimpleTimer *pending = 0;
+  int n = tick & (SIZE-1);
+  while(slot[n]) {
+    TSimpleTimer *t = slot[n];
+    unlink(t);
+    link(&pending, t, -1);
+  }
+  
+  while(pending) {
+    TSimpleTimer *t = pending;
+    unlink(t);
+    if (!t->_running)
+      continue;
+    t->_executing = true;
+    t->tick();
+    t->_executing = false;
+    
+    // tick() may have stopped or restarted the timer
+    if (!t->_running || t->_wpprev)
+      continue;
+
+    // set time for the next event, skipping the ones we've missed
+    if (t->_interval > 0) {
+      t->_next += t->_interval;
+      if (t->_next <= now_us)
+        t->_next += ((now_us - t->_next) / t->_interval + 1) * t->_interval;
+    } else {
+      t->_next = now_us;
+    }
+    place(t);
+  }
+}
+
+/**
+ * Run all due timers.
+ *
+ * \param wait
+ *   Is set to the time until the wheel needs to run again.
+ * \return
+ *   false when there are no timers left
+ */
+bool
+TTimerWheel::run(struct timeval *wait)
+{
+  long long now_us = now();
+  long long now_tick = now_us / TICK;
+  while(count) {
+    long long tick = nextTick();
+    if (tick > now_tick)
+      break;
+    process(tick, now_us);
+  }
+  if (wheel_tick <= now_tick)
+    wheel_tick = now_tick + 1;
+  if (!count)
+    return false;
+
+  long long us = nextTick() * TICK - now();
+  if (us<0)
+    us = 0;
+  wait->tv_sec  = us / 1000000LL;
+  wait->tv_usec = us % 1000000LL;
+  return true;
+}
 
 #define DBM(A)
 
-// wrapper for the C library `select' call
-// handles X11, TIOObserver & TSimpleTimer
+// wait for X11, TIOObserver & TSimpleTimer events
 //----------------------------------------------------------------
 void 
 TOADBase::select()
 {
 #ifdef __X11__
-  // add new io observers to the list
-  //----------------------------------
-  TList::iterator p;
-  if (fd_new.size()>0) {
-    p = fd_new.begin();
-    while(p!=fd_new.end()) {
-      int fd = (*p)->fd();
-      if (debug_select)
-        cerr << "select: adding checks for fd " << fd << endl;
-      if (fd>=fd_max)
-        fd_max = fd+1;
-      int flag = 0;
-      (*p)->_check(flag);
-      if (flag&1) {
-        if (debug_select)
-          cerr << "select: adding fd " << fd << " for read check\n";
-        FD_SET(fd, &fd_set_rd);
-      }
-      if (flag&2) {
-        if (debug_select)
-          cerr << "select: adding fd " << fd << " for write check\n";
-        FD_SET(fd, &fd_set_wr);
-      }
-      if (flag&4) {
+  while(true) {
+    // add new io observers to the engine
+    //-----------------------------------
+    if (!fd_new.empty()) {
+      for(TList::iterator p = fd_new.begin(); p!=fd_new.end(); ++p) {
         if (debug_select)
-          cerr << "select: adding fd " << fd << " for exception check\n";
-        FD_SET(fd, &fd_set_ex);
+          cerr << "select: adding checks for fd " << (*p)->fd() << endl;
+        backend->add(*p);
       }
-      p++;
+      fd_new.clear();
     }
-    fd_new.erase(fd_new.begin(), fd_new.end());
-  }
-  
-  // select loop
-  //-------------
-  fd_set rd, wr, ex;
   
-  while(true) {
-    rd = fd_set_rd;
-    wr = fd_set_wr;
-    ex = fd_set_ex;
-
-    int n;
-
-    if (_sorted_list.empty()) {
-      if (debug_select)
-        cerr << "select: waiting for fd to become ready (fd_max=" << fd_max << ")\n";
-      if (!bAppIsRunning) {
-        cerr << "unexpected end of message loop [2]" << endl;
-        return;
-      }
-      n = ::select(fd_max, &rd, &wr, &ex, NULL);
-    } else {
-      // dispatch timer events
-      gettimeofday(&crnt_time, NULL);
-      TSortedList::iterator p,e;
-      p = _sorted_list.begin();
-      e = _sorted_list.end();
-
-      while(p!=e && (
-             (*p)->_next.tv_sec  < crnt_time.tv_sec ||
-            ((*p)->_next.tv_usec < crnt_time.tv_usec && (*p)->_next.tv_sec==crnt_time.tv_sec)
-            ))
-      {
-        TSimpleTimer *t = *p;
-
-        if (t->_running) {
-          t->_executing = true;
-          t->tick();
-          t->_executing = false;
-        
-          // set time for the next event
-          while( t->_next.tv_sec  < crnt_time.tv_sec ||
-                (t->_next.tv_usec < crnt_time.tv_usec && t->_next.tv_sec == crnt_time.tv_sec))
-          {
-            t->_next.tv_sec  += t->_interval.tv_sec;
-            t->_next.tv_usec += t->_interval.tv_usec;
-            if (t->_next.tv_usec >= 1000000L) {
-              t->_next.tv_sec++;
-              t->_next.tv_usec -= 1000000L;
-            }
-          }
-        }
-
-        // replace timer in list
-        TSortedList::iterator last = p;
-        p++;
-        _sorted_list.erase(last);
-        if (t->_running)
-          _sorted_list.insert(t);
-        if (p==e)
-          break;
-      }
-      
-      // calculate time for the next event
-      TSimpleTimer *t = *_sorted_list.begin();
-      struct timeval wait_time;
-      if (_sorted_list.empty() ||
-          t->_next.tv_sec < crnt_time.tv_sec ||
-          (t->_next.tv_usec < crnt_time.tv_usec && t->_next.tv_sec == crnt_time.tv_sec))
-      {
-        wait_time.tv_sec = 0;
-        wait_time.tv_usec = 0;
-      } else {
-        wait_time.tv_sec = t->_next.tv_sec  - crnt_time.tv_sec;
-        wait_time.tv_usec= t->_next.tv_usec - crnt_time.tv_usec;
-        if (wait_time.tv_usec<0) {
-          wait_time.tv_sec--;
-          wait_time.tv_usec+=1000000;
-        }
-      }
+    // dispatch timer events
+    //-----------------------------------
+    struct timeval wait_time, *timeout = NULL;
+    if (!wheel.empty()) {
+      if (wheel.run(&wait_time))
+        timeout = &wait_time;
       flush();
-      if (debug_select)
-        cerr << "select: waiting for fd to become ready (fd_max=" << fd_max << ")\n";
-      if (!bAppIsRunning) {
-        cerr << "unexpected end of message loop [3]" << endl;
+      // a timer may have sent a message
+      if (countAllIntMsg()!=0)
         return;
-      }
-      n = ::select(fd_max, &rd, &wr, &ex, &wait_time);
     }
+
+    if (debug_select)
+      cerr << "select: waiting for fd to become ready\n";
+    if (!bAppIsRunning) {
+      cerr << "unexpected end of message loop [2]" << endl;
+      return;
+    }
+    int n = backend->wait(timeout);
     
     if (debug_select)
       cerr << "select: got " << n << " valid fd's\n";
+    if (n<0 && errno!=EINTR)
+      cerr << "select: " << backend->getName() << " failed: " << strerror(errno) << endl;
 
-    if (n>=0) {
-      p = fd_list.begin();
-      while(p!=fd_list.end()) {
-        int fd = (*p)->fd();
-        if (debug_select)
-          cerr << "select: checking fd " << fd << endl;
-        if (FD_ISSET(fd, &rd)) {
-          if (debug_select)
-            cerr << "  rd\n";
-          (*p)->canRead();
-        }
-        if (FD_ISSET(fd, &wr)) {
-          if (debug_select)
-            cerr << "  wr\n";
-          (*p)->canWrite();
-        }
-        if (FD_ISSET(fd, &ex)) {
-          if (debug_select)
-            cerr << "  ex\n";
-          (*p)->gotException();
-        }
-        p++;
-      }
-    }
     if (peekMessage()) {
       if (debug_select)
         cerr << "select: got x11 message\n";
@@ -265,12 +804,15 @@ TOADBase::select()
  *
  * Since TOAD already uses the <CODE>select</CODE> function, you
  * have to use <I>TIOObserver</I>.
+ *
+ * By default the observer checks for readability only, use setType
+ * to also receive canWrite and gotException.
  */
 
 TIOObserver::TIOObserver()
 {
   _fd = -1;
-  _type = 0;
+  _type = READ;
 }
 
 /**
@@ -278,6 +820,8 @@ TIOObserver::TIOObserver()
  */
 TIOObserver::TIOObserver(int fd)
 {
+  _fd = -1;
+  _type = READ;
 #ifdef __X11__
   setFD(fd);
 #endif
@@ -300,26 +844,16 @@ TIOObserver::setFD(int fd)
 
   // remove old FD from message loop
   if (_fd >= 0) {
-    FD_CLR(_fd, &fd_set_rd);
-    FD_CLR(_fd, &fd_set_wr);
-    FD_CLR(_fd, &fd_set_ex);
-    TList::iterator p;
-    p = fd_new.begin();
-    while(p!=fd_new.end()) {
+    bool added = true;
+    for(TList::iterator p = fd_new.begin(); p!=fd_new.end(); ++p) {
       if (*p==this) {
         fd_new.erase(p);
+        added = false;
         break;
       }
     }
-    p++;
-    p = fd_list.begin();
-    while(p!=fd_list.end()) {
-      if (*p==this) {
-        fd_list.erase(p);
-        break;
-      }
-      p++;
-    }
+    if (added && backend)
+      backend->remove(this);
   }
 
   _fd = fd;
@@ -327,12 +861,28 @@ TIOObserver::setFD(int fd)
   // add new FD to message loop
   if (_fd >= 0) {
     fcntl(fd, F_SETFL, O_NONBLOCK);
-    fd_list.push_back(this);
     fd_new.push_back(this);
   }
 #endif
 }
 
+/**
+ * Set the conditions the observer checks for.
+ *
+ * \param type
+ *   A combination of READ, WRITE and EXCEPTION.
+ */
+void
+TIOObserver::setType(int type)
+{
+  if (_type == type)
+    return;
+  int fd = _fd;
+  setFD(-1);
+  _type = type;
+  setFD(fd);
+}
+
 void TIOObserver::_check(int &r)
 {
   if (!_type)
@@ -372,7 +922,7 @@ void TIOObserver::gotException()
 //----------------------------------------------------------------
 TSimpleTimer::~TSimpleTimer()
 {
-  // i should do a check here wether the timer is active...
+  wheel.remove(this);
 }
 
 /**
@@ -383,6 +933,9 @@ TSimpleTimer::~TSimpleTimer()
  * <P>
  * When called for a timer already running, only the interval will be
  * changed at the next tick.
+ * <P>
+ * Timers have a resolution of 1ms and the interval is measured on the
+ * monotonic clock.
  */
 //-----------------------------------------------------------------------
 void TSimpleTimer::startTimer(ulong sec, 
@@ -390,32 +943,16 @@ void TSimpleTimer::startTimer(ulong sec,
                               bool skip_first)
 {
 #ifdef __X11__
-  while(usec>=(1000000UL)) {
-    sec++;
-    usec-=1000000UL;
-  }
-  
-  _interval.tv_sec = sec;
-  _interval.tv_usec= usec;
+  _interval = (long long)sec * 1000000LL + usec;
 
   if (_running)
     return;
   
-  struct timeval crnt_time;
-  gettimeofday(&crnt_time, NULL);
-  _next.tv_usec = crnt_time.tv_usec;
-  _next.tv_sec = crnt_time.tv_sec;
-  
-  if (skip_first) {
-    _next.tv_sec  += _interval.tv_sec;
-    _next.tv_usec += _interval.tv_usec;
-    if (_next.tv_usec >= 1000000L) {
-      _next.tv_sec++;
-      _next.tv_usec -= 1000000L;
-    }
-  }
+  _next = TTimerWheel::now();
+  if (skip_first)
+    _next += _interval;
 
-  _sorted_list.insert(this);
+  wheel.insert(this);
   _running = true;
 #endif
 }
@@ -423,11 +960,11 @@ void TSimpleTimer::startTimer(ulong sec,
 /**
  * Stop a running timer.
  *
- * This method has no effect when the timer isn't running.
+ * This method has no effect when the timer isn't running. It's safe to
+ * call it from within tick().
  */
 void TSimpleTimer::stopTimer()
 {
-  // we can't erase the timer here from the list because it might
-  // be referenced in `TOADBase::Select' right now
   _running = false;
+  wheel.remove(this);
 }
@@ -29,20 +29,26 @@
 namespace toad {
 
 class TOADBase;
+class TTimerWheel;
 
 class TSimpleTimer
 {
-  public:
-    struct less;
   private:
-    friend struct less;
     friend class TOADBase;
-    struct timeval _interval;
-    struct timeval _next;
+    friend class TTimerWheel;
+    // due time and interval in microseconds on CLOCK_MONOTONIC
+    long long _interval;
+    long long _next;
+    // links within the timer wheel
+    TSimpleTimer *_wnext, **_wpprev;
+    int _wslot;
     bool _running:1;
     bool _executing:1;
   public:
     TSimpleTimer() {
+      _wnext = 0;
+      _wpprev = 0;
+      _wslot = -1;
       _running = false;
       _executing = false;
     }
@@ -22,9 +22,11 @@
 #include <toad/table.hh>
 #include <toad/figure.hh>
 #include <toad/dragndrop.hh>
+#include <toad/command.hh>
 
 #include <stdio.h>
 #include <unistd.h>
+#include <algorithm>
 
 #ifdef check
 #undef check
@@ -36,8 +38,168 @@ using namespace toad;
 #define DBM2(M)
 #define DBSCROLL(M)
 
+namespace toad {
+
+/**
+ * Delivers the areas collected by TTableModel::contentChanged after the
+ * pending events were handled.
+ */
+class TCommandTableModelFlush:
+  public TCommand
+{
+  public:
+    TTableModel *model;
+    TCommandTableModelFlush(TTableModel *m):model(m) {}
+    ~TCommandTableModelFlush() {
+      if (model)
+        model->flush = 0;
+    }
+    void execute() {
+      if (!model)
+        return;
+      TTableModel *m = model;
+      m->flush = 0;
+      model = 0;
+      m->_flushAreas();
+    }
+};
+
+} // namespace toad
+
 TTableModel::~TTableModel()
 {
+  if (flush)
+    flush->model = 0;
+}
+
+/**
+ * Mark 'cols' x 'rows' fields starting at ('col', 'row') as modified.
+ *
+ * All areas marked until the message loop handles the next message are
+ * merged and delivered with a single CONTENT_AREA message, so a model
+ * may call this for every single field it modifies.
+ */
+void
+TTableModel::contentChanged(size_t col, size_t row, size_t cols, size_t rows)
+{
+  if (cols==0 || rows==0)
+    return;
+  if (!areas.empty()) {
+    TArea &b(areas.back());
+    if (b.col==col && b.cols==cols && row<=b.row+b.rows && b.row<=row+rows) {
+      size_t end = max(b.row+b.rows, row+rows);
+      b.row  = min(b.row, row);
+      b.rows = end - b.row;
+      cols = 0;
+    } else
+    if (b.row==row && b.rows==rows && col<=b.col+b.cols && b.col<=col+cols) {
+      size_t end = max(b.col+b.cols, col+cols);
+      b.col  = min(b.col, col);
+      b.cols = end - b.col;
+      cols = 0;
+    }
+  }
+  if (cols) {
+    // too many scattered fields, fall back to their bounding box
+    if (areas.size()>=4096) {
+      size_t c0=col, r0=row, c1=col+cols, r1=row+rows;
+      for(TAreas::const_iterator p=areas.begin(); p!=areas.end(); ++p) {
+        c0 = min(c0, p->col);
+        r0 = min(r0, p->row);
+        c1 = max(c1, p->col+p->cols);
+        r1 = max(r1, p->row+p->rows);
+      }
+      areas.clear();
+      col = c0; cols = c1-c0;
+      row = r0; rows = r1-r0;
+    }
+    TArea a = { col, row, cols, rows };
+    areas.push_back(a);
+  }
+  if (!flush) {
+    flush = new TCommandTableModelFlush(this);
+    sendMessage(flush);
+  }
+}
+
+namespace {
+
+bool
+lessByCol(const TTableModel::TArea &a, const TTableModel::TArea &b)
+{
+  if (a.col!=b.col)
+    return a.col<b.col;
+  if (a.cols!=b.cols)
+    return a.cols<b.cols;
+  return a.row<b.row;
+}
+
+bool
+lessByRow(const TTableModel::TArea &a, const TTableModel::TArea &b)
+{
+  if (a.row!=b.row)
+    return a.row<b.row;
+  if (a.rows!=b.rows)
+    return a.rows<b.rows;
+  return a.col<b.col;
+}
+
+// join overlapping and adjacent areas which cover the same columns
+// (vertical) or the same rows
+void
+joinAreas(TTableModel::TAreas &areas, bool vertical)
+{
+  sort(areas.begin(), areas.end(), vertical ? lessByCol : lessByRow);
+  size_t n = 0;
+  for(size_t i=1; i<areas.size(); ++i) {
+    TTableModel::TArea &b(areas[n]);
+    const TTableModel::TArea &a(areas[i]);
+    if (vertical && a.col==b.col && a.cols==b.cols && a.row<=b.row+b.rows) {
+      b.rows = max(b.row+b.rows, a.row+a.rows) - b.row;
+    } else
+    if (!vertical && a.row==b.row && a.rows==b.rows && a.col<=b.col+b.cols) {
+      b.cols = max(b.col+b.cols, a.col+a.cols) - b.col;
+    } else {
+      areas[++n] = a;
+    }
+  }
+  areas.resize(n+1);
+}
+
+} // namespace
+
+void
+TTableModel::_flushAreas()
+{
+  if (areas.empty())
+    return;
+  if (areas.size()>1) {
+    joinAreas(areas, true);
+    joinAreas(areas, false);
+    joinAreas(areas, true);
+  }
+  // drop areas within other areas (quadratic, so only for short lists)
+  if (areas.size()>1 && areas.size()<=256) {
+    TAreas kept;
+    for(size_t i=0; i<areas.size(); ++i) {
+      const TArea &a(areas[i]);
+      size_t j;
+      for(j=0; j<areas.size(); ++j) {
+        const TArea &b(areas[j]);
+        if (i!=j &&
+            b.col<=a.col && a.col+a.cols<=b.col+b.cols &&
+            b.row<=a.row && a.row+a.rows<=b.row+b.rows &&
+            (j<i || b.col!=a.col || b.cols!=a.cols || b.row!=a.row || b.rows!=a.rows))
+          break;
+      }
+      if (j==areas.size())
+        kept.push_back(a);
+    }
+    areas.swap(kept);
+  }
+  reason = CONTENT_AREA;
+  sigChanged();
+  areas.clear();
 }
 
 /**
@@ -618,7 +780,6 @@ TTable::TTable(TWindow *p, const string &t):
   ffx = ffy = 0;
   fpx = fpy = 0;
   feven = true;
-  row_info = col_info = NULL;
   rows = cols = 0;
   row_header_renderer = col_header_renderer = NULL;
   selecting = false;
@@ -627,9 +788,16 @@ TTable::TTable(TWindow *p, const string &t):
   noCursor = false;
   selectionFollowsMouse = false;
   bNoBackground = true;
+  cache_limit = 0;
+  cache_bytes = 0;
   setSelectionModel(new TSingleSelectionModel);
 }
 
+TTable::~TTable()
+{
+  invalidateCellCache();
+}
+
 #if 0
 void
 TTable::setModel(TTableModel *m) 
@@ -720,6 +888,7 @@ TTable::setSelectionModel(TAbstractSelectionModel *m)
 {
   if (selection==m)
     return;
+  invalidateCellCache();
   if (selection)
     disconnect(selection->sigChanged, this);
   selection = m;
@@ -817,40 +986,89 @@ TTable::setColHeaderRenderer(TAbstractTableHeaderRenderer *r)
 void
 TTable::scrolled(TCoord dx, TCoord dy)
 {
-  // adjust (ffx, ffy) and (fpx, fpy)
+  if (_fetchRows()) {
+    doLayout();
+    invalidateWindow();
+  }
+  _syncFirstField();
+}
 
-  fpx+=dx;
-  fpy+=dy;
+/**
+ * Set (ffx, ffy), (fpx, fpy) and feven from the pane position.
+ */
+void
+TTable::_syncFirstField()
+{
+  TCoord panex, paney;
+  getPanePos(&panex, &paney);
 
-  if (dx<0) { // right
-    while( ffx < cols && fpx+col_info[ffx].size < 0 ) {
-      fpx+=col_info[ffx].size + border;
-      ++ffx;
-    }
-  } else
-  if (dx>0) { // left
-    while( ffx > 0 && fpx > 0 ) {
-      --ffx;
-      fpx-=col_info[ffx].size + border;
-    }
-  }
+  ffx = col_info.find(panex);
+  if (ffx>=cols)
+    ffx = cols ? cols-1 : 0;
+  fpx = cols ? col_info.getPosition(ffx) - panex : 0;
 
-  if (dy<0) { // down
-    while( ffy < rows && fpy+row_info[ffy].size < 0 ) {
-      fpy+=row_info[ffy].size + border;
-      if (row_info[ffy].size)
-        feven = !feven;
-      ++ffy;
-    }
-  } else
-  if (dy>0) { // up
-    while( ffy > 0 && fpy > 0 ) {
-      --ffy;
-      if (row_info[ffy].size)
-        feven = !feven;
-      fpy-=row_info[ffy].size + border;
-    }
+  ffy = row_info.find(paney);
+  if (ffy>=rows)
+    ffy = rows ? rows-1 : 0;
+  fpy = rows ? row_info.getPosition(ffy) - paney : 0;
+  feven = rows ? row_info.countShown(ffy)%2==0 : true;
+}
+
+/**
+ * Request the sizes of the rows in the visible area which weren't
+ * requested yet from the adapter.
+ *
+ * \return 'true' when one of the sizes differed from the default size
+ */
+bool
+TTable::_fetchRows()
+{
+  if (!adapter || rows==0)
+    return false;
+  TCoord panex, paney;
+  getPanePos(&panex, &paney);
+  TCoord end = paney + visible.h;
+  bool changed = false;
+  for(size_t y = row_info.find(paney);
+      y<rows && row_info.getPosition(y)<end;
+      ++y)
+  {
+    if (_fetchRow(y))
+      changed = true;
   }
+  return changed;
+}
+
+bool
+TTable::_fetchRow(size_t row)
+{
+  if (row>=rows || row_info.isKnown(row))
+    return false;
+  TTableEvent te;
+  te.type = TTableEvent::GET_ROW_SIZE;
+  te.col  = 0;
+  te.row  = row;
+  te.h    = row_info.getSize(row);
+  row_info.setKnown(row);
+  adapter->tableEvent(te);
+  if (te.h == row_info.getSize(row))
+    return false;
+  row_info.setSize(row, te.h);
+  pane.h = row_info.getTotal();
+  return true;
+}
+
+/**
+ * Returns 'true' when 'row' has a height of 0, ie. a collapsed node in
+ * a tree. The row height is fetched first and 'changed' is set when it
+ * differed from the default.
+ */
+bool
+TTable::_isRowHidden(size_t row, bool *changed)
+{
+  if (_fetchRow(row))
+    *changed = true;
+  return row_info.getSize(row)==0;
 }
 
 void
@@ -860,29 +1078,22 @@ TTable::invalidateCursor()
     return;
 
   int xp, yp;
-  xp = fpx + visible.x;
-  yp = fpy + visible.y;
-
-  for(int x=ffx; x<cx; x++) {
-    xp += col_info[x].size;
-  }
-  for(int y=ffy; y<cy; y++) {
-    yp += row_info[y].size;
-  }
+  xp = fpx + visible.x + col_info.getPosition(cx) - col_info.getPosition(ffx);
+  yp = fpy + visible.y + row_info.getPosition(cy) - row_info.getPosition(ffy);
   
-  int size = col_info[cx].size;
+  int size = col_info.getSize(cx);
   
   if (stretchLastColumn && cx==cols-1 && xp+size<visible.x+visible.w) {
     size = visible.x+visible.w-xp;
   }
   
   if (selection && selection->perRow()) {
-    invalidateWindow(visible.x, yp, visible.w, row_info[cy].size+1);
+    invalidateWindow(visible.x, yp, visible.w, row_info.getSize(cy)+1);
   } else 
   if (selection && selection->perCol()) {
     invalidateWindow(xp, visible.y, size, visible.h);
   } else {
-    invalidateWindow(xp, yp, size, row_info[cy].size+1);
+    invalidateWindow(xp, yp, size, row_info.getSize(cy)+1);
   }
 }
 
@@ -955,15 +1166,15 @@ DBSCROLL({
     xp = fpx + visible.x;
     int h = col_header_renderer->getHeight();
     for(int x=ffx; x<cols && xp<visible.x+visible.w; x++) {
-      if (col_info[x].size==0)
+      if (col_info.getSize(x)==0)
         continue;
       pen.identity();
       pen.translate(xp,0);
-      int size = col_info[x].size;
+      int size = col_info.getSize(x);
       if (stretchLastColumn && x==cols-1 && xp+size<visible.x+visible.w)
         size = visible.x+visible.w-xp+1;
       col_header_renderer->renderItem(pen, x, size, h);
-      xp+=col_info[x].size;
+      xp+=col_info.getSize(x);
       if (border) {
         pen.setColor(0,0,0);
         pen.fillRectanglePC(size, 0, border, h);
@@ -980,15 +1191,15 @@ DBSCROLL({
     yp = fpy + visible.y;
     int w = row_header_renderer->getWidth();
     for(int y=ffy; y<rows && yp<visible.y+visible.h; y++) {
-      if (row_info[y].size==0)
+      if (row_info.getSize(y)==0)
         continue;
       pen.identity();
       pen.translate(0,yp);
-      row_header_renderer->renderItem(pen, y, w, row_info[y].size);
-      yp+=row_info[y].size;
+      row_header_renderer->renderItem(pen, y, w, row_info.getSize(y));
+      yp+=row_info.getSize(y);
       if (border) {
         pen.setColor(0,0,0);
-        pen.fillRectanglePC(0, row_info[y].size, w, border);
+        pen.fillRectanglePC(0, row_info.getSize(y), w, border);
         yp+=border;
       }
     }
@@ -1049,14 +1260,14 @@ DBSCROLL({
     
     xp = fpx + visible.x + border/2;
     for(int x=ffx; x<cols && xp<visible.x+visible.w; x++) {
-      xp += col_info[x].size;
+      xp += col_info.getSize(x);
       pen.drawLine(xp, visible.y-paney, xp, visible.y+visible.h);
       xp += border;
     }
     
     yp = fpy + visible.y + border/2;
     for(int y=ffy; y<rows && yp<visible.y+visible.h; y++) {
-      yp += row_info[y].size;
+      yp += row_info.getSize(y);
       pen.drawLine(visible.x-panex, yp, visible.x+visible.w, yp);
       yp += border;
     }
@@ -1084,8 +1295,10 @@ DBSCROLL({
 
   // draw the fields with the table adapter
   yp = fpy + visible.y;
+  size_t lasty = ffy;
   for(int y=ffy; y<rows && yp<visible.y+visible.h; y++) {
-    if (row_info[y].size==0) {
+    lasty = y;
+    if (row_info.getSize(y)==0) {
       continue;
     }
     te.even = !te.even;
@@ -1093,10 +1306,10 @@ DBSCROLL({
     te.row = y;
     for(int x=ffx; x<cols && xp<visible.x+visible.w; x++) {
 
-      TRectangle check(xp,yp,col_info[x].size, row_info[y].size);
+      TRectangle check(xp,yp,col_info.getSize(x), row_info.getSize(y));
       if (stretchLastColumn && 
           x==cols-1 && 
-          xp+col_info[x].size<visible.x+visible.w) 
+          xp+col_info.getSize(x)<visible.x+visible.w) 
       {
         check.w = visible.x+visible.w-xp;
       }
@@ -1135,7 +1348,7 @@ DBSCROLL({
 
 DBSCROLL(
   pen.setColor(255,255,255);
-  pen.fillRectanglePC(0,0,col_info[x].size, row_info[y].size);
+  pen.fillRectanglePC(0,0,col_info.getSize(x), row_info.getSize(y));
   pen.setColor(0,0,0);
 )
         bool cursor = false;
@@ -1152,11 +1365,14 @@ DBSCROLL(
         te.selected = selected;
         te.pen = &pen;
         te.type = TTableEvent::PAINT;
-        adapter->tableEvent(te);
+        if (cache_limit)
+          _paintCachedField(pen, te);
+        else
+          adapter->tableEvent(te);
       }
-      xp += col_info[x].size + border;
+      xp += col_info.getSize(x) + border;
     }
-    yp += row_info[y].size + border;
+    yp += row_info.getSize(y) + border;
   }
   
   // clear unused window region (we must do it on our own because
@@ -1177,9 +1393,140 @@ DBSCROLL(
     // yp--;
     pen.fillRectanglePC(0,yp,getWidth(),visible.y+visible.h-yp);
   }
+  if (cache_bytes > cache_limit/2)
+    _trimCellCache(ffy, lasty);
   DBM2(cerr << "leave paint" << endl << endl;)
 }
 
+/**
+ * Render field te.col, te.row into a server side tile or take it from
+ * the cell cache when it was already rendered with the same size and
+ * state. Requires 'pen' to be translated to the field's origin.
+ */
+void
+TTable::_paintCachedField(TPen &pen, TTableEvent &te)
+{
+  unsigned state = (te.cursor   ? 1 : 0) |
+                   (te.selected ? 2 : 0) |
+                   (te.focus    ? 4 : 0) |
+                   (te.even     ? 8 : 0);
+  TCellCache::iterator p = cell_cache.find(make_pair(te.row, te.col));
+  if (p!=cell_cache.end()) {
+    if (p->second.w==te.w && p->second.h==te.h && p->second.state==state) {
+      pen.drawBitmap(0, 0, p->second.bitmap);
+      return;
+    }
+    cache_bytes -= (size_t)p->second.w * p->second.h * 4;
+    delete p->second.bitmap;
+    cell_cache.erase(p);
+  }
+
+  size_t bytes = (size_t)te.w * te.h * 4;
+  if (te.w<=0 || te.h<=0 || cache_bytes+bytes > cache_limit) {
+    adapter->tableEvent(te);
+    return;
+  }
+
+  TCellTile tile;
+  tile.bitmap = new TBitmap(te.w, te.h, TBITMAP_SERVER);
+  tile.w = te.w;
+  tile.h = te.h;
+  tile.state = state;
+  {
+    TPen tpen(tile.bitmap);
+    tpen.setColor(getBackground());
+    tpen.fillRectanglePC(0, 0, te.w, te.h);
+    te.pen = &tpen;
+    adapter->tableEvent(te);
+    te.pen = &pen;
+  }
+  pen.drawBitmap(0, 0, tile.bitmap);
+  cell_cache[make_pair(te.row, te.col)] = tile;
+  cache_bytes += bytes;
+}
+
+/**
+ * Drop all tiles outside of the rows 'first' to 'last'.
+ */
+void
+TTable::_trimCellCache(size_t first, size_t last)
+{
+  TCellCache::iterator p = cell_cache.begin();
+  while(p!=cell_cache.end()) {
+    if (p->first.first>=first && p->first.first<=last) {
+      p = cell_cache.lower_bound(make_pair(last+1, (size_t)0));
+      continue;
+    }
+    cache_bytes -= (size_t)p->second.w * p->second.h * 4;
+    delete p->second.bitmap;
+    cell_cache.erase(p++);
+  }
+}
+
+/**
+ * Keep up to 'bytes' of rendered fields in server side tiles and copy
+ * them to the screen instead of calling the adapter's PAINT event again.
+ *
+ * The tiles are dropped on CONTENT, INSERT_ROW and REMOVED_ROW messages
+ * from the model and when the adapter receives a mouse or keyboard event
+ * for a row. Adapters which change their output otherwise must call
+ * invalidateCellCache().
+ *
+ * The default is 0, which disables the cache.
+ */
+void
+TTable::setCellCacheLimit(size_t bytes)
+{
+  cache_limit = bytes;
+  if (cache_bytes > cache_limit)
+    invalidateCellCache();
+}
+
+/**
+ * Drop all rendered fields.
+ */
+void
+TTable::invalidateCellCache()
+{
+  for(TCellCache::iterator p = cell_cache.begin(); p!=cell_cache.end(); ++p)
+    delete p->second.bitmap;
+  cell_cache.clear();
+  cache_bytes = 0;
+}
+
+/**
+ * Drop the rendered fields of 'cols' x 'rows' fields starting with
+ * ('col', 'row').
+ */
+void
+TTable::invalidateCellCache(size_t col, size_t row, size_t cols, size_t rows)
+{
+  TCellCache::iterator p = cell_cache.lower_bound(make_pair(row, col));
+  while(p!=cell_cache.end() && p->first.first-row < rows) {
+    if (p->first.second-col < cols) {
+      cache_bytes -= (size_t)p->second.w * p->second.h * 4;
+      delete p->second.bitmap;
+      cell_cache.erase(p++);
+    } else {
+      p = cell_cache.lower_bound(make_pair(p->first.first+1, col));
+    }
+  }
+}
+
+/**
+ * Drop the rendered fields of 'n' rows starting with 'row'.
+ */
+void
+TTable::invalidateCellCache(size_t row, size_t n)
+{
+  TCellCache::iterator p = cell_cache.lower_bound(make_pair(row, (size_t)0));
+  while(p!=cell_cache.end() && p->first.first-row < n) {
+    cache_bytes -= (size_t)p->second.w * p->second.h * 4;
+    delete p->second.bitmap;
+    cell_cache.erase(p++);
+  }
+}
+
 void
 TTable::resize()
 {
@@ -1251,7 +1598,6 @@ TTable::setColWidth(size_t col, int width)
 bool
 TTable::mouse2field(TCoord mx, TCoord my, size_t *fx, size_t *fy, TCoord *rfx, TCoord *rfy)
 {
-  TCoord pos1, pos2;
   size_t x, y;
 
   if (!visible.isInside(mx, my)) {
@@ -1260,50 +1606,23 @@ TTable::mouse2field(TCoord mx, TCoord my, size_t *fx, size_t *fy, TCoord *rfx, T
   }
 
   // transform (mx, my) from screen pixel to table pixel coordinates
-  mx -= visible.x + fpx;
-  my -= visible.y + fpy;
+  mx += col_info.getPosition(ffx) - visible.x - fpx;
+  my += row_info.getPosition(ffy) - visible.y - fpy;
 
-  pos1 = 0;
-  for(x=ffx; ; x++) {
-    if (x>=cols /* || pos1>visible.x+visible.w */) {
-//cerr << __FILE__ << ':' << __LINE__ << endl;  
+  x = col_info.find(mx);
+  if (x>=cols) {
+    if (!stretchLastColumn || cols==0)
       return false;
-    }
-    int size = col_info[x].size;
-    pos2 = pos1 + col_info[x].size;
-    if (stretchLastColumn && x==cols-1)
-      pos2 = visible.x+visible.w;
-    if (pos1 <= mx && mx < pos2) {
-      break;
-    }
-    pos1 = pos2;
+    x = cols-1;
   }
   if (rfx)
-    *rfx = mx - pos1;
+    *rfx = mx - col_info.getPosition(x);
   
-  pos1 = 0;
-  y = ffy;  // first upper left field
-  while(true) {
-    if (y>=rows /* || pos1>visible.y+visible.h */) {
-/*
-cerr << __FILE__ << ':' << __LINE__ << endl;  
-cerr << " y=" << y
-     << " rows=" << rows
-     << " pos1=" << pos1
-     << " visible.y+visible.h=" << (visible.y+visible.h)
-     << endl;
-*/
-      return false;
-    }
-    pos2 = pos1 + row_info[y].size;
-    if (pos1 <= my && my < pos2) {
-      break;
-    }
-    pos1 = pos2;
-    ++y;
-  }
+  y = row_info.find(my);
+  if (y>=rows)
+    return false;
   if (rfy)
-    *rfy = my - pos1;
+    *rfy = my - row_info.getPosition(y);
 
 /*
   if (selection&&selection->perRow())
@@ -1339,22 +1658,20 @@ TTable::mouseEvent(const TMouseEvent &me)
     te.mouse.dblClick = me.dblClick;
     // this should also contain a pointer to this adapter, in case
     // mouseEvent makes modifications?
-    int size = col_info[x].size;
+    int size = col_info.getSize(x);
     if (stretchLastColumn && x==cols-1) {
       int xp;
-      xp = fpx + visible.x;
-      for(int _x=ffx; _x<x; _x++) {
-        xp += col_info[_x].size;
-      }
+      xp = fpx + visible.x + col_info.getPosition(x) - col_info.getPosition(ffx);
       if (xp+size<visible.x+visible.w)
         size = visible.x+visible.w-xp;
     }
     te.col = x;
     te.row = y;
     te.w   = size;
-    te.h   = row_info[y].size;
+    te.h   = row_info.getSize(y);
     te.type= TTableEvent::MOUSE;
     adapter->tableEvent(te);
+    invalidateCellCache(y, 1);
   }
 
 
@@ -1368,7 +1685,6 @@ TTable::mouseEvent(const TMouseEvent &me)
   static int col;
   static int osize;
   static int mdown;
-  static int opane;
 
   switch(state) {
     case 0:
@@ -1380,7 +1696,7 @@ TTable::mouseEvent(const TMouseEvent &me)
           int xp = fpx + visible.x;
           int h = col_header_renderer->getHeight();
           for(int x=ffx; x<cols && xp<visible.x+visible.w; x++) {
-            int size = col_info[x].size;
+            int size = col_info.getSize(x);
             if (stretchLastColumn && x==cols-1 && xp+size<visible.x+visible.w)
               size = visible.x+visible.w-xp+1;
 //            cout << "xp="<<xp<<", size="<<size<<", mx="<<me.x<<endl;
@@ -1392,7 +1708,7 @@ TTable::mouseEvent(const TMouseEvent &me)
               colx = x;
               between_h = true;
             }
-            xp+=col_info[x].size;
+            xp+=col_info.getSize(x);
             if (border) {
               xp+=border;
             }
@@ -1412,8 +1728,7 @@ TTable::mouseEvent(const TMouseEvent &me)
       if (state==1 && me.type == TMouseEvent::LDOWN) {
         state = 2;
         col = colx;
-        osize = col_info[col].size;
-        opane = pane.w;
+        osize = col_info.getSize(col);
         mdown = me.x;
 //        cout << "grep between " << col << endl;
       }
@@ -1426,10 +1741,8 @@ TTable::mouseEvent(const TMouseEvent &me)
       if (me.type==TMouseEvent::MOVE) {
 //        cout << "move col "<<col<<" between" << endl;
 //        cout << "  dx=" << (osize+me.x-mdown) << endl;
-        col_info[col].size = osize+me.x-mdown;
-        if (col_info[col].size<3)
-          col_info[col].size=3;
-        pane.w = opane - osize + col_info[col].size;
+        col_info.setSize(col, max(3, (int)(osize+me.x-mdown)));
+        pane.w = col_info.getTotal();
         invalidateWindow();
         doLayout();
       }
@@ -1470,22 +1783,20 @@ TTable::mouseLDown(const TMouseEvent &me)
     te.mouse.dblClick = me.dblClick;
     // this should also contain a pointer to this adapter, in case
     // mouseEvent makes modifications?
-    int size = col_info[x].size;
+    int size = col_info.getSize(x);
     if (stretchLastColumn && x==cols-1) {
       int xp;
-      xp = fpx + visible.x;
-      for(int _x=ffx; _x<x; _x++) {
-        xp += col_info[_x].size;
-      }
+      xp = fpx + visible.x + col_info.getPosition(x) - col_info.getPosition(ffx);
       if (xp+size<visible.x+visible.w)
         size = visible.x+visible.w-xp;
     }
     te.col = x;
     te.row = y;
     te.w   = size;
-    te.h   = row_info[y].size;
+    te.h   = row_info.getSize(y);
     te.type= TTableEvent::MOUSE;
     adapter->tableEvent(te);
+    invalidateCellCache(y, 1);
   }
 
   sigPressed();
@@ -1681,19 +1992,17 @@ TTable::center(int how)
   getPanePos(&panex, &paney, false);
 
   if (paney!=-1 && how&CENTER_VERT) {
-    int yp = 0;
-    int y;
-    for(y=0; y<cy; y++) {
-      yp += row_info[y].size + border;
-    }
+    if (_fetchRow(cy))
+      doLayout();
+    TCoord yp = row_info.getPosition(cy);
     
-    int y1 = paney;
-    int y2 = y1 + visible.h;
+    TCoord y1 = paney;
+    TCoord y2 = y1 + visible.h;
     
     if (yp<=y1) {
       paney = yp;
     } else {
-      yp += row_info[y].size + border;
+      yp = row_info.getPosition(cy+1);
       if (yp>y2) {
         paney = yp-visible.h;
       }
@@ -1701,19 +2010,15 @@ TTable::center(int how)
   }
 
   if (panex!=-1 && how&CENTER_HORZ) {
-    int xp = 0;
-    int x;
-    for(x=0; x<cx; x++) {
-      xp += col_info[x].size + border;
-    }
+    TCoord xp = col_info.getPosition(cx);
     
-    int x1 = panex;
-    int x2 = x1 + visible.w;
+    TCoord x1 = panex;
+    TCoord x2 = x1 + visible.w;
       
     if (xp<=x1) {
       panex = xp;
     } else {
-      xp += col_info[x].size + border;
+      xp = col_info.getPosition(cx+1);
       if (xp>x2) {
         panex = xp-visible.w;
       }
@@ -1732,6 +2037,21 @@ TTable::setCursor(size_t col, size_t row)
     col = cols ? cols-1 : 0;
   if (row>=rows)
     row = rows ? rows-1 : 0;
+
+  // don't place the cursor on a hidden row
+  bool changed = false;
+  size_t r = row;
+  while(r<rows && _isRowHidden(r, &changed))
+    ++r;
+  if (r>=rows) {
+    r = row;
+    while(r>0 && _isRowHidden(r, &changed))
+      --r;
+  }
+  row = r;
+  if (changed)
+    doLayout();
+
   if (cx == col && cy == row)
     return;
   invalidateCursor();
@@ -1809,6 +2129,7 @@ TTable::keyEvent(const TKeyEvent &ke)
     te.row = cy;
     te.flag= false;
     adapter->tableEvent(te);
+    invalidateCellCache(cy, 1);
     if (te.flag) {
       invalidateCursor();
       return;
@@ -1823,32 +2144,66 @@ TTable::keyDown(const TKeyEvent &ke)
 //cout << "keyDown: enter: sx="<<sx<<", sy="<<sy<<endl;
   switch(ke.key()) {
     case TK_DOWN: {
-      int newcy = cy+1;
-      while(newcy<rows && row_info[newcy].size==0)
+      bool changed = false;
+      size_t newcy = cy+1;
+      while(newcy<rows && _isRowHidden(newcy, &changed))
         ++newcy;
-      _moveCursor(cx, newcy, ke.modifier());
+      if (changed)
+        doLayout();
+      if (newcy<rows)
+        _moveCursor(cx, newcy, ke.modifier());
     } break;
     case TK_UP: {
-      int newcy = cy;
-      while(newcy>0 && row_info[--newcy].size==0)
+      bool changed = false;
+      size_t newcy = cy;
+      while(newcy>0 && _isRowHidden(--newcy, &changed))
         ;
-      _moveCursor(cx, newcy, ke.modifier());
+      if (changed)
+        doLayout();
+      if (!_isRowHidden(newcy, &changed))
+        _moveCursor(cx, newcy, ke.modifier());
     } break;
-    case TK_PAGEUP:
+    case TK_PAGEUP: {
       pageUp();
-      break;
-    case TK_PAGEDOWN:
+      // move the cursor up by a page of shown rows
+      bool changed = false;
+      size_t newcy = cy;
+      TCoord h = 0;
+      while(newcy>0 && h<visible.h) {
+        if (!_isRowHidden(--newcy, &changed))
+          h += row_info.getSize(newcy);
+      }
+      while(newcy<cy && _isRowHidden(newcy, &changed))
+        ++newcy;
+      if (changed)
+        doLayout();
+      _moveCursor(cx, newcy, ke.modifier());
+    } break;
+    case TK_PAGEDOWN: {
       pageDown();
-      break;
+      // move the cursor down by a page of shown rows
+      bool changed = false;
+      size_t newcy = cy;
+      TCoord h = 0;
+      while(newcy+1<rows && h<visible.h) {
+        if (!_isRowHidden(++newcy, &changed))
+          h += row_info.getSize(newcy);
+      }
+      while(newcy>cy && _isRowHidden(newcy, &changed))
+        --newcy;
+      if (changed)
+        doLayout();
+      _moveCursor(cx, newcy, ke.modifier());
+    } break;
     case TK_RIGHT: {
       int newcx = cx+1;
-      while(newcx<cols && col_info[newcx].size==0)
+      while(newcx<cols && col_info.getSize(newcx)==0)
         ++newcx;
       _moveCursor(newcx, cy, ke.modifier());
     } break;
     case TK_LEFT: {
       int newcx = cx;
-      while(newcx>0 && col_info[--newcx].size==0)
+      while(newcx>0 && col_info.getSize(--newcx)==0)
         ;
       _moveCursor(newcx, cy, ke.modifier());
     } break;
@@ -1965,8 +2320,14 @@ TTable::adapterChanged()
     case TTableModel::CONTENT:
       if (debug_table>0)
         cout << "table: content" << endl;
+      invalidateCellCache();
       invalidateWindow();
       break;
+    case TTableModel::CONTENT_AREA:
+      if (debug_table>0)
+        cout << "table: content area" << endl;
+      _handleContentArea();
+      break;
     default:
       if (debug_table>0)
         cout << "table: new model" << endl;
@@ -1975,65 +2336,75 @@ TTable::adapterChanged()
   }
 }
 
+/**
+ * Invalidate the screen areas of the fields listed in adapter->areas.
+ */
 void
-TTable::_handleInsertRow()
+TTable::_handleContentArea()
 {
-  // allocate space for the new rows in 'row_info'
-  int new_rows = rows + adapter->size;
-  row_info = static_cast<TRCInfo*>(realloc(row_info, sizeof(TRCInfo)*new_rows));
-  memmove(
-    row_info + adapter->where + adapter->size,
-    row_info + adapter->where,
-    (rows - adapter->where) * sizeof(TRCInfo)
-  );
-
-  // initialize the new entries
-  TRCInfo *info = row_info + adapter->where;
-  TTableEvent te;
-  te.type = TTableEvent::GET_ROW_SIZE;
-  te.col  = 0;
-  for(te.row=adapter->where; te.row<adapter->where+adapter->size; ++te.row) {
-    DBM(cout << "pane.h: " << pane.h << endl;)
-    info->open = true; // getRowHeight may query this values
-    info->size = 0;    // just in case...
-//cout << "going to get height of row " << te.row << endl;
-//cout << "  open == " << (isRowOpen(i)?"open":"closed") << endl;
-    adapter->tableEvent(te);
-    info->size = te.h;
-    pane.h += te.h + border;
-    ++info;
+  if (!adapter->areas) {
+    invalidateCellCache();
+    invalidateWindow();
+    return;
+  }
+  TCoord panex, paney;
+  getPanePos(&panex, &paney);
+  for(TTableModel::TAreas::const_iterator p = adapter->areas->begin();
+      p != adapter->areas->end();
+      ++p)
+  {
+    if (p->col>=cols || p->row>=rows)
+      continue;
+    size_t c1 = min(p->col+p->cols, cols);
+    size_t r1 = min(p->row+p->rows, rows);
+    invalidateCellCache(p->col, p->row, c1-p->col, r1-p->row);
+
+    TCoord x0 = visible.x + col_info.getPosition(p->col) - panex;
+    TCoord x1 = visible.x + col_info.getPosition(c1) - panex;
+    if (stretchLastColumn && c1==cols)
+      x1 = visible.x + visible.w;
+    TCoord y0 = visible.y + row_info.getPosition(p->row) - paney;
+    TCoord y1 = visible.y + row_info.getPosition(r1) - paney;
+    x0 = max(x0, visible.x);
+    y0 = max(y0, visible.y);
+    x1 = min(x1, visible.x + visible.w);
+    y1 = min(y1, visible.y + visible.h);
+    if (x0>=x1 || y0>=y1)
+      continue;
+    invalidateWindow(x0, y0, x1-x0, y1-y0);
   }
+}
+
+void
+TTable::_handleInsertRow()
+{
+  invalidateCellCache(adapter->where, rows);
+  // the new rows get the default size until they become visible
+  TFont &font(TOADBase::getDefaultFont());
+  row_info.insert(adapter->where, adapter->size, font.getHeight()+4);
+  rows += adapter->size;
+  pane.h = row_info.getTotal();
   
-  // adjust cy, sy, feven and ffy
+  // adjust cy and sy
   if (adapter->where<cy)
     cy+=adapter->size;
   if (adapter->where<sy)
     sy+=adapter->size;
-  if (adapter->where<ffy) {
-    for(size_t y=ffy; y<ffy+adapter->size; ++y) {
-      if (row_info[y].size)
-        feven = !feven;
-    }
-    ffy+=adapter->size;
-  }
 
-  rows = new_rows;
+  // keep the rows on screen when the new rows are above them
+  TCoord panex, paney;
+  getPanePos(&panex, &paney);
+  TCoord y = row_info.getPosition(adapter->where);
+  if (y<paney)
+    paney += row_info.getPosition(adapter->where+adapter->size) - y;
   doLayout();
+  setPanePos(panex, paney);
+  _syncFirstField();
 
   // don't invalidate window in case rows where added below current
   // visible area
-  if (ffy <= adapter->where) {
-    int py = fpy;
-    for(size_t y = ffy; y<new_rows; ++y) {
-      if (py>visible.h) {
-        cout << "return" << endl;
-        return;
-      }
-      if (y==adapter->where)
-        break;
-      py += row_info[y].size + border;
-    }
-  }
+  if (y>=paney+visible.h)
+    return;
   
   // invalidate the window (can't scroll because of the different
   // color scheme for odd and even rows)
@@ -2044,6 +2415,7 @@ void
 TTable::_handleRemovedRow()
 {
 //cout << "_handleRemovedRow: where="<<adapter->where<<", size="<<adapter->size<<endl;
+  invalidateCellCache(adapter->where, rows);
   if (adapter->where + adapter->size - 1> rows) {
     cout << "_handleRemovedRow: where=" << adapter->where
          << " and size="<<adapter->size
@@ -2051,48 +2423,38 @@ TTable::_handleRemovedRow()
     return;
   }
   int new_rows = rows - adapter->size;
-  // row_info = static_cast<TRCInfo*>(realloc(row_info, sizeof(TRCInfo)*new_rows));
 
-//cout << "move from " << (adapter->where+adapter->size) << " to " << (adapter->where) << " an amount of " << (rows - adapter->where - adapter->size) << " entries" << endl;
-  TRCInfo *info = row_info + adapter->where;
-  for(int i=adapter->where; i<adapter->where+adapter->size; ++i) {
-    DBM(cout << "pane.h: " << pane.h << endl;)
-    pane.h -= info->size + border;
-    ++info;
-  }
-
-  memmove(
-    row_info + adapter->where,
-    row_info + adapter->where + adapter->size,
-    (rows - adapter->where - adapter->size) * sizeof(TRCInfo)
-  );
-
-  if (adapter->where<cy)
-    cy+=adapter->size;
-  if (adapter->where<sy)
-    sy+=adapter->size;
-  if (adapter->where<ffy) {
-    for(unsigned y=ffy; y<ffy+adapter->size; ++y) {
-      if (row_info[y].size)
-        feven = !feven;
-    }
-    ffy+=adapter->size;
-  }
+  // keep the rows on screen when the removed rows are above them
+  TCoord panex, paney;
+  getPanePos(&panex, &paney);
+  TCoord y1 = row_info.getPosition(adapter->where);
+  TCoord y2 = row_info.getPosition(adapter->where+adapter->size);
+  if (y1<paney)
+    paney -= min(y2, paney) - y1;
+
+  row_info.erase(adapter->where, adapter->size);
+  pane.h = row_info.getTotal();
+
+  if (adapter->where+adapter->size<=cy)
+    cy-=adapter->size;
+  else if (adapter->where<cy)
+    cy=adapter->where;
+  if (adapter->where+adapter->size<=sy)
+    sy-=adapter->size;
+  else if (adapter->where<sy)
+    sy=adapter->where;
 
-  // fpy ...
-    
-  // scrolling, screen update
-      
   // selection model ??? ouch ....
 
   rows = new_rows;
 //cout << "number of rows is now " << rows << endl;
 //cout << __FILE__ << ":" << __LINE__ << " rows = "<<rows<<endl;
+  doLayout();
+  setPanePos(panex, paney);
+  _syncFirstField();
   setCursor(cx, cy);
   invalidateWindow();
 
-  doLayout();
-
   if (selection) {  
     if (rows==0) {
       // the obvious check -> no rows, no selection
@@ -2126,18 +2488,17 @@ cout << "no emergency clear selection..." << endl;
 void
 TTable::_handleResizedRow()
 {
-  TRCInfo *info = row_info + adapter->where;
   TTableEvent te;
   te.type = TTableEvent::GET_ROW_SIZE;
   te.col = 0;
-  for(te.row=adapter->where; te.row<adapter->where+adapter->size; ++te.row) {
-    DBM(cout << "pane.h: " << pane.h << endl;)
-    pane.h -= info->size;
+  for(te.row=adapter->where; te.row<adapter->where+adapter->size && te.row<rows; ++te.row) {
+    te.h = row_info.getSize(te.row);
+    row_info.setKnown(te.row);
     adapter->tableEvent(te);
-    info->size = te.h;
-    pane.h += te.h;
-    ++info;
+    row_info.setSize(te.row, te.h);
   }
+  pane.h = row_info.getTotal();
+  _syncFirstField();
 #if 0    
   if (adapter->where<cy)
     cy+=adapter->size;
@@ -2165,6 +2526,7 @@ void
 TTable::handleNewModel()
 {
 // cout << "TTable::handleNewModel()" << endl;
+  invalidateCellCache();
   invalidateWindow();
 //  if (selection)
 //    selection->clearSelection();
@@ -2184,46 +2546,28 @@ TTable::handleNewModel()
   cols = adapter->getCols();
   rows = adapter->getRows();
 
-  row_info = rows ? static_cast<TRCInfo*>(realloc(row_info, sizeof(TRCInfo)*rows)) : 0;
-  col_info = cols ? static_cast<TRCInfo*>(realloc(col_info, sizeof(TRCInfo)*cols)) : 0;
-  
-  TRCInfo *info;
-
   // calculate pane.w
-  pane.w=0;
-  info = col_info;
+  col_info.setBorder(border);
+  col_info.reset(cols, 64);
   TTableEvent te;
   te.type = TTableEvent::GET_COL_SIZE;
   for(te.col=0; te.col<cols; ++te.col) {
-    DBM(cout << "pane.w: " << pane.w << endl;)
     te.w = 64;
+    col_info.setKnown(te.col);
     adapter->tableEvent(te);
-    info->size = te.w;
-    pane.w += te.w + border;
-    ++info;
+    col_info.setSize(te.col, te.w);
   }
+  pane.w = col_info.getTotal();
   DBM(cout << "pane.w: " << pane.w << endl;)
 
   // calculate pane.h
   
-  // font height seems to be a nice default;
+  // font height seems to be a nice default; the rows get their real
+  // size when they become visible
   TFont &font(TOADBase::getDefaultFont());
-  TCoord h = font.getHeight()+4;
-  
-  pane.h=0;
-  info = row_info;
-  te.type = TTableEvent::GET_ROW_SIZE;
-  te.col = 0;
-  for(te.row=0; te.row<rows; ++te.row) {
-    DBM(cout << "pane.h: " << pane.h << endl;)
-    info->open = true;
-    info->size = 0;
-    te.h = h;
-    adapter->tableEvent(te);
-    info->size = te.h;
-    pane.h += te.h + border;
-    ++info;
-  }
+  row_info.setBorder(border);
+  row_info.reset(rows, font.getHeight()+4);
+  pane.h = row_info.getTotal();
   DBM(cout << "pane.h: " << pane.h << endl;)
 //cout << __FILE__ << ":" << __LINE__ << " rows = "<<rows<<endl;
 
@@ -2241,5 +2585,172 @@ TTable::adjustPane()
     visible.y = col_header_renderer->getHeight();
     visible.h -= visible.y;
   }
+  _fetchRows();
   setUnitIncrement(cols ? pane.w/cols : 1, rows ? pane.h/rows : 1);
 }
+
+/**
+ * \class toad::TTable::TRCInfo
+ *
+ * The sizes of the rows or columns of a TTable.
+ *
+ * Each entry takes its size plus the border, except entries of size 0
+ * which are hidden. The entries are grouped into blocks of 64 and the
+ * sums of the blocks are kept in a Fenwick tree, so converting between
+ * positions and entries and resizing an entry takes O(log n).
+ */
+
+void
+TTable::TRCInfo::reset(size_t n, int size)
+{
+  sizes.assign(n, size);
+  flags.assign(n, OPEN);
+  rebuild();
+}
+
+/**
+ * Insert 'n' new entries of size 'size' at 'where'.
+ */
+void
+TTable::TRCInfo::insert(size_t where, size_t n, int size)
+{
+  if (where>sizes.size())
+    where = sizes.size();
+  sizes.insert(sizes.begin()+where, n, size);
+  flags.insert(flags.begin()+where, n, OPEN);
+  rebuild();
+}
+
+void
+TTable::TRCInfo::erase(size_t where, size_t n)
+{
+  if (where>=sizes.size())
+    return;
+  if (n>sizes.size()-where)
+    n = sizes.size()-where;
+  sizes.erase(sizes.begin()+where, sizes.begin()+where+n);
+  flags.erase(flags.begin()+where, flags.begin()+where+n);
+  rebuild();
+}
+
+void
+TTable::TRCInfo::setSize(size_t i, int size)
+{
+  int old = sizes[i];
+  if (old==size)
+    return;
+  sizes[i] = size;
+  add(i>>shift, (long long)size-old, (size!=0) - (old!=0));
+}
+
+/**
+ * Returns the position of entry 'i'.
+ */
+TCoord
+TTable::TRCInfo::getPosition(size_t i) const
+{
+  long long size;
+  size_t shown;
+  sum(i, &size, &shown);
+  return size + (long long)border * shown;
+}
+
+/**
+ * Returns the number of entries before 'i' which aren't hidden.
+ */
+size_t
+TTable::TRCInfo::countShown(size_t i) const
+{
+  long long size;
+  size_t shown;
+  sum(i, &size, &shown);
+  return shown;
+}
+
+/**
+ * Returns the entry at position 'pos' or size() when 'pos' is behind
+ * the last entry.
+ */
+size_t
+TTable::TRCInfo::find(TCoord pos) const
+{
+  if (pos<0)
+    pos = 0;
+  size_t nblocks = tree.size()-1;
+  size_t block = 0;
+  long long acc = 0;
+  size_t step = 1;
+  while(step*2<=nblocks)
+    step *= 2;
+  for(; step>0; step/=2) {
+    if (block+step>nblocks)
+      continue;
+    const TSum &t(tree[block+step]);
+    long long e = t.size + (long long)border * t.shown;
+    if (acc+e <= pos) {
+      block += step;
+      acc += e;
+    }
+  }
+  size_t i = block<<shift;
+  if (i>sizes.size())
+    i = sizes.size();
+  for(; i<sizes.size(); ++i) {
+    if (sizes[i]) {
+      acc += sizes[i] + border;
+      if (pos<acc)
+        break;
+    }
+  }
+  return i;
+}
+
+void
+TTable::TRCInfo::rebuild()
+{
+  size_t nblocks = (sizes.size() + (1<<shift) - 1) >> shift;
+  TSum zero = { 0, 0 };
+  tree.assign(nblocks+1, zero);
+  for(size_t i=0; i<sizes.size(); ++i) {
+    if (sizes[i]) {
+      tree[(i>>shift)+1].size += sizes[i];
+      tree[(i>>shift)+1].shown++;
+    }
+  }
+  for(size_t i=1; i<=nblocks; ++i) {
+    size_t j = i + (i & -i);
+    if (j<=nblocks) {
+      tree[j].size  += tree[i].size;
+      tree[j].shown += tree[i].shown;
+    }
+  }
+}
+
+void
+TTable::TRCInfo::add(size_t block, long long size, long shown)
+{
+  for(size_t i=block+1; i<tree.size(); i += i & -i) {
+    tree[i].size  += size;
+    tree[i].shown += shown;
+  }
+}
+
+// sum of the entries before 'i'
+void
+TTable::TRCInfo::sum(size_t i, long long *size, size_t *shown) const
+{
+  if (i>sizes.size())
+    i = sizes.size();
+  *size = 0;
+  *shown = 0;
+  for(size_t b=i>>shift; b>0; b -= b & -b) {
+    *size  += tree[b].size;
+    *shown += tree[b].shown;
+  }
+  for(size_t j=i & ~(size_t)((1<<shift)-1); j<i; ++j) {
+    if (sizes[j]) {
+      *size += sizes[j];
+      (*shown)++;
+    }
+  }
+}
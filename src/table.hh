@@ -23,6 +23,8 @@
 
 #include <cfloat>
 #include <climits>
+#include <vector>
+#include <map>
 
 #include <toad/scrollpane.hh>
 #include <toad/model.hh>
@@ -32,6 +34,8 @@ namespace toad {
 
 class TTable;
 class TTableAdapter;
+class TBitmap;
+class TCommandTableModelFlush;
 class TFigure;
 
 class TAbstractSelectionModel:
@@ -332,6 +336,7 @@ class TTableModel:
   public:
     TTableModel() {
       reason = CHANGED;
+      flush = 0;
     }
     ~TTableModel();
     // sigChanged protocol:
@@ -340,6 +345,7 @@ class TTableModel:
       INSERT_ROW, REMOVED_ROW,
       INSERT_COL, REMOVED_COL,
       CONTENT, // content was modified, but no row/cols added/removed
+      CONTENT_AREA, // content within getChangedAreas() was modified
       // TTableAdapter messages (not generated by models)
       RESIZED_ROW, RESIZED_COL,
       CHANGED, // new model
@@ -349,6 +355,19 @@ class TTableModel:
     bool isEmpty() const { return getRows()==0 || getCols()==0;}
     virtual size_t getRows() const = 0;
     virtual size_t getCols() const { return 1; }
+
+    struct TArea {
+      size_t col, row, cols, rows;
+    };
+    typedef vector<TArea> TAreas;
+    void contentChanged(size_t col, size_t row, size_t cols=1, size_t rows=1);
+    const TAreas& getChangedAreas() const { return areas; }
+
+  private:
+    friend class TCommandTableModelFlush;
+    TAreas areas;
+    TCommandTableModelFlush *flush;
+    void _flushAreas();
 };
 
 typedef GSmartPointer<TTableModel> PTableModel;
@@ -396,6 +415,8 @@ class TTableAdapter:
     
     TTableModel::EReason reason;
     size_t where, size;
+    //! the changed areas during CONTENT_AREA
+    const TTableModel::TAreas *areas;
 
   protected:
     void handleStringHelper(TTableEvent &te, string *s, int offx);
@@ -490,10 +511,15 @@ class TTable:
     
   public:
   
-    void setTableBorder(unsigned b) { border = b; }
+    void setTableBorder(unsigned b) {
+      border = b;
+      row_info.setBorder(b);
+      col_info.setBorder(b);
+    }
     unsigned getTableBorder() const { return border; }
   
     TTable(TWindow *p, const string &t);
+    ~TTable();
 
 //    void setModel(TTableModel *model);
 //    TTableModel *getModel() const { return model; }
@@ -542,22 +568,22 @@ class TTable:
 
     size_t getRows() const { return rows; }
     size_t getCols() const { return cols; }
-    int getRowHeight(size_t row) const { return (row<0||row>=rows) ? 0 : row_info[row].size; }
-    int getColWidth(size_t col) const { return (col<0||col>=cols) ? 0 : col_info[col].size; }
+    int getRowHeight(size_t row) const { return (row<0||row>=rows) ? 0 : row_info.getSize(row); }
+    int getColWidth(size_t col) const { return (col<0||col>=cols) ? 0 : col_info.getSize(col); }
     void setRowHeight(size_t row, int height);
     void setColWidth(size_t row, int width);
 
-    bool isRowOpen(size_t row) const { return (row<0||row>=rows) ? 0 : row_info[row].open; }
-    bool isColOpen(size_t col) const { return (col<0||col>=cols) ? 0 : col_info[col].open; }
+    bool isRowOpen(size_t row) const { return (row<0||row>=rows) ? 0 : row_info.isOpen(row); }
+    bool isColOpen(size_t col) const { return (col<0||col>=cols) ? 0 : col_info.isOpen(col); }
     void setRowOpen(size_t row, bool open) {
       if (row<0||row>=rows)
         return;
-      row_info[row].open = open;
+      row_info.setOpen(row, open);
     }
     void setColOpen(size_t col, bool open) {
       if (col<0||col>=cols)
         return;
-      col_info[col].open = open;
+      col_info.setOpen(col, open);
     }
 
     //! the cursor was moved
@@ -582,6 +608,12 @@ class TTable:
     bool selectionFollowsMouse;
     
     bool mouse2field(TCoord mx, TCoord my, size_t *fx, size_t *fy, TCoord *rfx=0, TCoord *rfy=0);
+
+    void setCellCacheLimit(size_t bytes);
+    size_t getCellCacheLimit() const { return cache_limit; }
+    void invalidateCellCache();
+    void invalidateCellCache(size_t row, size_t n);
+    void invalidateCellCache(size_t col, size_t row, size_t cols, size_t rows);
   protected:
     void _moveCursor(size_t newcx, size_t newcy, unsigned modifier);
     void _setSXSY(size_t x, size_t y);
@@ -597,6 +629,7 @@ class TTable:
     void _handleInsertRow();
     void _handleResizedRow();
     void _handleRemovedRow();
+    void _handleContentArea();
 
     void adapterChanged();
 
@@ -607,11 +640,66 @@ class TTable:
     
     // getRowHeight & getColWidth are expensive operations so call 'em
     // once and store their values in row_info and col_info
-    struct TRCInfo {    // row/column info
-      int size;
-      bool open;
+    class TRCInfo {    // row/column info
+      public:
+        TRCInfo() { border = 0; tree.resize(1); }
+        void reset(size_t n, int size);
+        void insert(size_t where, size_t n, int size);
+        void erase(size_t where, size_t n);
+        size_t size() const { return sizes.size(); }
+        int getSize(size_t i) const { return sizes[i]; }
+        void setSize(size_t i, int size);
+        bool isOpen(size_t i) const { return flags[i] & OPEN; }
+        void setOpen(size_t i, bool open) {
+          if (open)
+            flags[i] |= OPEN;
+          else
+            flags[i] &= ~OPEN;
+        }
+        //! 'false' until the size was requested from the adapter
+        bool isKnown(size_t i) const { return flags[i] & KNOWN; }
+        void setKnown(size_t i) { flags[i] |= KNOWN; }
+        void setBorder(int b) { border = b; }
+        TCoord getPosition(size_t i) const;
+        TCoord getTotal() const { return getPosition(sizes.size()); }
+        size_t find(TCoord pos) const;
+        size_t countShown(size_t i) const;
+      private:
+        enum { OPEN=1, KNOWN=2 };
+        // entries per block in the Fenwick tree
+        static const unsigned shift = 6;
+        int border;
+        std::vector<int> sizes;
+        std::vector<unsigned char> flags;
+        // sum of sizes and number of entries with a size
+        struct TSum {
+          long long size;
+          size_t shown;
+        };
+        // Fenwick tree over the blocks of entries
+        std::vector<TSum> tree;
+        void rebuild();
+        void add(size_t block, long long size, long shown);
+        void sum(size_t i, long long *size, size_t *shown) const;
+    };
+    TRCInfo row_info, col_info;
+
+    // server side copies of rendered fields, keyed by (row, col)
+    struct TCellTile {
+      TBitmap *bitmap;
+      int w, h;
+      unsigned state;
     };
-    TRCInfo *row_info, *col_info;
+    typedef std::map<std::pair<size_t, size_t>, TCellTile> TCellCache;
+    TCellCache cell_cache;
+    size_t cache_limit, cache_bytes;
+    void _paintCachedField(TPen &pen, TTableEvent &te);
+    void _trimCellCache(size_t first, size_t last);
+    
+    void _syncFirstField();
+    bool _fetchRows();
+    bool _fetchRow(size_t row);
+    bool _isRowHidden(size_t row, bool *changed);
     
     void invalidateCursor();
     void invalidateChangedArea(int sx, int sy,
@@ -42,6 +42,7 @@ TTableAdapter::TTableAdapter()
 {
   table = 0;
   reason = TTableModel::CHANGED;
+  areas = 0;
 }
 
 void
@@ -63,10 +64,12 @@ TTableAdapter::modelChanged()
     reason = model->reason;
     where  = model->where;
     size   = model->size;
+    areas  = &model->getChangedAreas();
   } else {
     reason = TTableModel::CHANGED;
     where  = 0;
     size   = 0;
+    areas  = 0;
   }
 /*
 cout << "TTableAdapter::modelChanged propagates ";
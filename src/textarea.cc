@@ -173,6 +173,10 @@ TTextArea::~TTextArea()
     disconnect(model->sigTextArea, this);
     disconnect(model->sigMeta, this);
   }
+  if (_paste) {
+    disconnect(_paste->sigDone, this);
+    _paste->cancel();
+  }
   setPreferences(0);
 }
 
@@ -361,7 +365,7 @@ DBM(cout << "ENTER keyDown '" << str << "'" << endl;
         _selection_clear();
       if (preferences->notabs) {
         unsigned m = preferences->tabwidth -
-                      (_charcount(model->getValue(), _bol, _pos-_bol)
+                      (_charcount(*model, _bol, _pos-_bol)
                       % preferences->tabwidth);
         string s;
         s.replace(0,0, m, ' ');
@@ -444,44 +448,13 @@ y-=2;
   int h = font->getHeight();
   y /= h;
 
-  setCursor(getCursorX(), y + _ty); // outch! overhead!
-
-//  string line = model->getValue().substr(_bol, _eol==string::npos ? _eol : _eol-_bol);
-  string line;
-  int sx;
-  size_t d2, d3;
-  _get_line(&line, _bol, _eol, &sx, &d2, &d3);
-//  cerr << "found line '" << line << "'\n";
-
-  int w1 = 0, w2 = 0;
-  size_t p;
-  unsigned cx;
-  for(p=0, cx=0; p<line.size(); _next_char(line, &p), cx++) {
-    w2 = font->getTextWidth(line.substr(0, p));
-    if (w2>x)
-      break;
-    w1 = w2;
-  }
-  if (p==line.size()) {
-    w2 = font->getTextWidth(line);
-    if (w2<=x)
-      w1 = w2;
-  }
-//cerr << "x-w1=" << (x-w1) << ", w2-x=" << (w2-x) << endl;
-
-  if ( x-w1 < w2-x ) {
-    _prev_char(line, &p);
-    _cxpx = w1;
-    cx--;
-  } else {
-    _cxpx = w2;
-  }
-  
-//  cerr << "w1 = " << w1 << ", w2 = " << w2 << endl;
-  
-//cerr << "position " << p << ", " << y << endl;
+  setCursor(getCursorX(), y + _ty);
 
-  setCursor(cx, y + _ty);
+  _cxpx = x;
+  _pos_from_cxpx();
+  _cxpx = -1;
+  _invalidate_line(_cy);
+  _catch_cursor();
 }
 
 void
@@ -513,6 +486,7 @@ TTextArea::_set_model(TTextModel *m)
     TUndoManager::unregisterModel(this, model);
   }
   model = m;
+  layout.clear();
   _cx = 0;
   _cxpx = -1;
   _cy = 0;
@@ -616,6 +590,20 @@ checkCursor3(TTextArea *ta, size_t offset, size_t size)
 void
 TTextArea::modelChanged()
 {
+  switch(model->type) {
+    case TTextModel::CHANGE:
+      layout.clear();
+      break;
+    case TTextModel::INSERT: {
+      unsigned line = model->lineOf(model->offset);
+      _layout_edit(line, line, model->lines);
+    } break;
+    case TTextModel::REMOVE: {
+      unsigned line = model->lineOf(model->offset);
+      _layout_edit(line, line+model->lines, -(int)model->lines);
+    } break;
+  }
+
   if (!isRealized())
     return;
 /*
@@ -693,7 +681,7 @@ if (opcount==591) {
         }
         
         if (inside_current_line) {
-          const string &s = model->getValue();
+          const TTextModel &s(*model);
 
           if (_pos > 0) {
           _bol = s.rfind('\n', _pos-1);
@@ -721,7 +709,7 @@ if (opcount==591) {
     // removed from the model
     case TTextModel::REMOVE:
       {
-        const string s(model->getValue());
+        const TTextModel &s(*model);
         _bos = _eos = 0;
         size_t m1 = model->offset;
         size_t m2 = model->offset+model->length;
@@ -738,11 +726,7 @@ if (opcount==591) {
           n = model->lines;
         } else
         if (m1 < _bol && _bol < m2) {
-          n = 0;
-          for(size_t i=m1; i<=_bol; ++i) {
-            if (s[i] == '\n')
-              n++;
-          }
+          n = s.lineOf(_bol+1) - s.lineOf(m1);
         }
         if (n>0) {
           if (n<=_ty) {
@@ -831,6 +815,7 @@ DBM(cout << "leave modelChanged (" << getTitle() << ")" << endl;
 void
 TTextArea::preferencesChanged()
 {
+  layout.clear();
   invalidateWindow();
 }
 
@@ -926,7 +911,7 @@ TTextArea::_get_line(string *line,
 {
   assert(line!=0);
   assert(sx!=0);
-  *line = model->getValue().substr(bol, eol==string::npos ? eol : eol-bol);
+  *line = model->substr(bol, eol==string::npos ? eol : eol-bol);
       
   // set *bos < *eos
   //^^^^^^^^^^^^^^^^^^
@@ -992,6 +977,88 @@ cout << "found tab:" << endl
 
 }
 
+/**
+ * Return the layout of line 'line', which starts at 'bol' and ends at
+ * 'eol'.
+ *
+ * The layout is cached until the line or the preferences are modified,
+ * so painting and moving the cursor don't need to measure the text again.
+ */
+const TTextArea::TLineLayout&
+TTextArea::_layout(unsigned line, size_t bol, size_t eol)
+{
+  TLayoutCache::iterator p = layout.find(line);
+  if (p!=layout.end())
+    return p->second;
+  if (layout.size()>=1024)
+    layout.clear();
+
+  TLineLayout &l(layout[line]);
+  TFont *font = TPen::lookupFont(preferences->getFont());
+  string raw = model->substr(bol, eol==string::npos ? eol : eol-bol);
+  l.off.resize(raw.size()+1);
+  l.x.resize(raw.size()+1);
+
+  TCoord x = 0;
+  unsigned col = 0;
+  size_t j = 0;
+  while(j<raw.size()) {
+    size_t k = j;
+    _next_char(raw, &k);
+    if (k>raw.size())
+      k = raw.size();
+    size_t t = l.text.size();
+    if (raw[j]=='\t') {
+      unsigned m = preferences->tabwidth - (col % preferences->tabwidth);
+      if (!preferences->viewtabs) {
+        l.text.append(m, ' ');
+      } else {
+        l.text += '|';
+        l.text.append(m-1, '.');
+      }
+      col += m;
+    } else {
+      l.text.append(raw, j, k-j);
+      ++col;
+    }
+    for(size_t i=j; i<k; ++i) {
+      l.off[i] = t;
+      l.x[i] = x;
+    }
+    x += font->getTextWidth(l.text.c_str()+t, l.text.size()-t);
+    j = k;
+  }
+  l.off[raw.size()] = l.text.size();
+  l.x[raw.size()] = x;
+  return l;
+}
+
+/**
+ * Drop the layouts of lines 'first' to 'last', which were modified, and
+ * move the layouts of the lines after them by 'delta' lines.
+ */
+void
+TTextArea::_layout_edit(unsigned first, unsigned last, int delta)
+{
+  TLayoutCache::iterator p = layout.lower_bound(first);
+  if (delta==0) {
+    while(p!=layout.end() && p->first<=last)
+      layout.erase(p++);
+    return;
+  }
+  TLayoutCache moved;
+  while(p!=layout.end()) {
+    if (p->first>last) {
+      TLineLayout &l(moved[p->first+delta]);
+      l.text.swap(p->second.text);
+      l.off.swap(p->second.off);
+      l.x.swap(p->second.x);
+    }
+    layout.erase(p++);
+  }
+  layout.insert(moved.begin(), moved.end());
+}
+
 #if 0
 unsigned
 TTextArea::_screenx_to_cx(const string &line, unsigned sx)
@@ -1049,25 +1116,26 @@ TTextArea::paint()
   pen.setFont(preferences->getFont());
 //cout << "paint: pen.getHeight()="<< pen.getHeight() << endl;
 
-  const string &data = model->getValue();
+  const TTextModel &data(*model);
   
   // paint the lines
   //^^^^^^^^^^^^^^^^^
-  size_t bol = 0;
+  // start with the first visible line
+  size_t bol = data.lineStart(_ty);
   size_t eol;
-  TCoord y=-(_ty * pen.getHeight());
-  int sy, sx;
-  sy = -_ty;
+  TCoord y = 0;
+  int sy;
+  sy = 0;
   
-  while(true) {
+  while(bol!=string::npos) {
     eol = data.find('\n', bol);
     size_t n = eol==string::npos ? eol : eol-bol; // n=characters in line
     if (y+pen.getHeight()>=clipbox.y) { // loop has reached the visible area
 //cerr << "line " << bol << "-" << eol << endl;
 
-      string line;
-      size_t bos, eos;
-      _get_line(&line, bol, eol, &sx, &bos, &eos);
+      const TLineLayout &lay(_layout(_ty+sy, bol, eol));
+      const string &line(lay.text);
+      size_t n = lay.x.size()-1;
 /*
 // cerr << "draw line: '" << line << "'\n";
 for(size_t i=0; i<line.size(); ++i) {
@@ -1125,31 +1193,18 @@ cerr << "  selection: " << bos << " - " << eos << endl;
             <<"eos  = "<<eos<<endl
             <<endl;
 #endif            
-        int x=0;
-        size_t pos = 0;
-        size_t len = eol-bol;
-        if (bol < bos2) { // start is inside
-//cerr << "start is inside" << endl;
-          pos = bos-bol;
-        }
-        if (eos2 < eol) { // end is inside
-//cerr << "end is inside" << endl;
-          len = eos - bol;
-        }
-        if (bol < bos2) { // start is inside
-//cerr << "start is inside" << endl;
-          pos = bos-bol;
-          len-=pos;
-        }
-        // cut pos & len to _tx
-//cerr << "pos = " << pos << endl << "_tx = " << _tx << endl;
-        x = pen.getTextWidth(line.substr(0,pos));
-//cerr << "  \"" << line.substr(_tx,pos-_tx) << "\"" << endl;
-//cerr << "x   = " << x << endl << "len = " << len << endl;
-        if (len>0 && pos<line.size()) {
+        size_t pos = bol < bos2 ? bos2-bol : 0;
+        size_t end = eos2 < eol ? eos2-bol : n;
+        if (pos>n)
+          pos = n;
+        if (end>n)
+          end = n;
+        if (pos<end) {
           pen.setLineColor(fillcolor);
           pen.setFillColor(0,0,0);
-          pen.fillString(x-_tx, y, line.c_str()+pos, len);
+          pen.fillString(lay.x[pos]-_tx, y,
+                         line.c_str()+lay.off[pos],
+                         lay.off[end]-lay.off[pos]);
         }
       }
       
@@ -1160,12 +1215,8 @@ cerr << "  selection: " << bos << " - " << eos << endl;
 //string l2 = line.substr(0, utf8bytecount(line, 0, sx));
 //cerr << "'" << l2 << "'\n";
         if (_cxpx<0) {
-#if 1
-          TFont *font = TPen::lookupFont(preferences->getFont());
-          _cxpx = font->getTextWidth(line.substr(0,_bytecount(line, 0, sx)));
-#else
-          _cxpx = pen.getTextWidth(line.substr(0, _bytecount(line, 0, sx)));
-#endif
+          size_t p = _bytecount(data, bol, _cx);
+          _cxpx = lay.x[p<n ? p : n];
         }
         pen.setMode(TPen::INVERT);
         pen.drawLine(_cxpx-_tx,y,_cxpx-_tx,y+pen.getHeight()-1);
@@ -1244,7 +1295,7 @@ TTextArea::_selection_copy()
     _bos = _eos;
     _eos = a;
   }
-  setSelection(model->getValue().substr(_bos, _eos-_bos));
+  setSelection(model->substr(_bos, _eos-_bos));
 //  cout << "'" << clipboard << "'" << endl;
 }
 
@@ -1252,7 +1303,32 @@ void
 TTextArea::_selection_paste()
 {
   MARK
-  _insert(getSelection());
+  if (_paste) {
+    disconnect(_paste->sigDone, this);
+    _paste->cancel();
+  }
+  _paste = TClipboard::request();
+  connect(_paste->sigDone, this, &TTextArea::_selection_pasted);
+}
+
+/**
+ * Called when the selection requested by _selection_paste arrived.
+ */
+void
+TTextArea::_selection_pasted()
+{
+  PClipboardRequest r = _paste;
+  _paste = 0;
+  if (r->isFailed()) {
+    // fall back to ISO 8859-1 for older clients
+    if (r->getTarget()=="UTF8_STRING") {
+      _paste = TClipboard::request("STRING");
+      connect(_paste->sigDone, this, &TTextArea::_selection_pasted);
+    }
+    return;
+  }
+  if (isEnabled())
+    _insert(r->getData());
 }
 
 void
@@ -1275,7 +1351,7 @@ TTextArea::mouseMDown(const TMouseEvent&)
 {
   if (!isEnabled())
     return;
-  _insert(getSelection());
+  _selection_paste();
 }
 
 void
@@ -1287,7 +1363,7 @@ cerr << "   _cx = " << _cx << endl;
 cerr << "  _pos = " << _pos << endl;
   for(unsigned i=0; i<n; ++i) {
     if (_pos>_bol) {
-      _prev_char(model->getValue(), &_pos);
+      _prev_char(*model, &_pos);
       if (_cx>0) {
         --_cx;
         _invalidate_line(_cy);
@@ -1315,12 +1391,12 @@ cerr << "  _pos = " << _pos << endl;
   for(unsigned i=0; i<n; ++i) {
     if (_pos<_eol) {
       ++_cx;
-      _next_char(model->getValue(), &_pos);
+      _next_char(*model, &_pos);
       _invalidate_line(_cy);
       _cxpx = -1;
       _catch_cursor();
     } else 
-    if (_eol+1<model->getValue().size()) {
+    if (_eol+1<model->size()) {
       _cursor_down();
       _cursor_home();
     }
@@ -1338,15 +1414,19 @@ TTextArea::_cursor_down(unsigned n)
     _cxpx_from_cx();
   }
   
-  for(unsigned i=0; i<n; ++i) {
-    if(_eol+1<model->getValue().size()) {
-      _bol=_eol+1;
-      _eol_from_bol();
-      _invalidate_line(_cy);
-      _cy++;
-      _invalidate_line(_cy);
-      _pos_from_cxpx();
-    }
+  // the last line can only be reached when it isn't empty
+  unsigned line = _cy + _ty;
+  unsigned last = model->nlines;
+  if (last>0 && model->lineStart(last)>=model->size())
+    --last;
+  unsigned target = line+n < last ? line+n : last;
+  if (target > line) {
+    _bol = model->lineStart(target);
+    _eol_from_bol();
+    _invalidate_line(_cy);
+    _cy += target - line;
+    _invalidate_line(_cy);
+    _pos_from_cxpx();
   }
   _catch_cursor();    
   blink.visible=true;
@@ -1357,27 +1437,25 @@ void
 TTextArea::_eol_from_bol()
 {
 #if 1
-  const string &d(model->getValue());
+  const TTextModel &d(*model);
   _eol = _bol;
   while(d[_eol]!='\n' && _eol<d.size()) {
     _next_char(d, &_eol);
   }
 #else
-  _eol = model->getValue().find('\n', _bol);
+  _eol = model->find('\n', _bol);
   if (_eol==string::npos)
-    _eol = model->getValue().size();
+    _eol = model->size();
 #endif
 }
 
 void
 TTextArea::_cxpx_from_cx()
 {
-  string line;
-  int sx;
-  size_t d2, d3;
-  _get_line(&line, _bol, _eol, &sx, &d2, &d3);
-  TFont *font = TPen::lookupFont(preferences->getFont());
-  _cxpx = font->getTextWidth(line.substr(0,_bytecount(line, 0, sx)));
+  const TLineLayout &lay(_layout(_cy+_ty, _bol, _eol));
+  size_t n = lay.x.size()-1;
+  size_t p = _bytecount(*model, _bol, _cx);
+  _cxpx = lay.x[p<n ? p : n];
 }
 
 /**
@@ -1387,28 +1465,31 @@ void
 TTextArea::_pos_from_cxpx()
 {
   assert(_cxpx != -1);
-  TFont *font = TPen::lookupFont(preferences->getFont());
-  string line = model->getValue().substr(_bol, _eol==string::npos ? _eol : _eol-_bol);
-
-  int w1 = 0, w2 = 0;
-  size_t p;
-  unsigned cx;
-  for(p=0, cx=0; p<=line.size(); _next_char(line, &p), ++cx) {
-    w2 = font->getTextWidth(line.substr(0, p));
-    if (w2>_cxpx)
+  const TLineLayout &lay(_layout(_cy+_ty, _bol, _eol));
+  size_t end = _bol + lay.x.size()-1;
+
+  // move right until the next character starts behind _cxpx
+  size_t p = _bol;
+  unsigned cx = 0;
+  while(p<end) {
+    size_t q = p;
+    _next_char(*model, &q);
+    if (q>end)
+      q = end;
+    TCoord w1 = lay.x[p-_bol];
+    TCoord w2 = lay.x[q-_bol];
+    if (w2>_cxpx) {
+      if (_cxpx-w1 >= w2-_cxpx) {
+        p = q;
+        ++cx;
+      }
       break;
-    w1 = w2;
-  }
-  if (p>=line.size()) {
-    _prev_char(line, &p);
-    --cx;
-  } else
-  if ( _cxpx-w1 < w2-_cxpx ) {
-    _prev_char(line, &p);
-    --cx;
+    }
+    p = q;
+    ++cx;
   }
 
-  _pos = _bol + p;
+  _pos = p;
   _cx  = cx;
 }
 
@@ -1421,23 +1502,15 @@ TTextArea::_cursor_up(unsigned n)
     _cxpx_from_cx();
   }
 
-  for(unsigned i=0; i<n; ++i) {
-    if (_bol>0) {
-      if (_bol>1) {
-        _bol = model->getValue().rfind('\n', _bol-2);
-        if (_bol==string::npos)
-          _bol=0;
-        else
-          _bol++;
-      } else {
-        _bol=0;
-      }
-      _eol_from_bol();
-      _invalidate_line(_cy);
-      _cy--;
-      _invalidate_line(_cy);
-      _pos_from_cxpx();
-    }
+  unsigned line = _cy + _ty;
+  unsigned target = line>n ? line-n : 0;
+  if (target < line) {
+    _bol = model->lineStart(target);
+    _eol_from_bol();
+    _invalidate_line(_cy);
+    _cy -= line - target;
+    _invalidate_line(_cy);
+    _pos_from_cxpx();
   }
   _catch_cursor();
   blink.visible=true;
@@ -1464,7 +1537,7 @@ TTextArea::_cursor_end()
   MARK
   size_t n = _eol - _pos;
   if (n!=0) {
-    _cx+=_charcount(model->getValue(), _pos, n);
+    _cx+=_charcount(*model, _pos, n);
     _pos=_eol;
   }
   _cxpx = -1;
@@ -1495,7 +1568,7 @@ TTextArea::_return()
   MARK
   string indent;
   if (preferences->autoindent) {
-    const string &s = model->getValue();
+    const TTextModel &s(*model);
     size_t i;
     for(i=_bol; i<_eol; i++) {
       if (s[i]!=' ' && s[i]!='\t')
@@ -1520,8 +1593,8 @@ TTextArea::_delete()
 {
   MARK
   DBM(cout << "_delete: _bol=" << _bol << ", _pos=" << _pos << ", _eol=" << _eol << endl;)
-  if (_pos<model->getValue().size()) {
-    model->erase(_pos, _bytecount(model->getValue(), _pos, 1));
+  if (_pos<model->size()) {
+    model->erase(_pos, _bytecount(*model, _pos, 1));
   }
 }
 
@@ -1672,6 +1745,42 @@ TTextArea::_bytecount(const string &text, size_t start, size_t charlen) const
   return utf8bytecount(text, start, charlen);
 }
 
+void
+TTextArea::_prev_char(const TTextModel &text, size_t *cx) const
+{
+  --*cx;
+  while( ((unsigned char)text[*cx] & 0xC0) == 0x80)
+    --*cx;
+}
+
+void
+TTextArea::_next_char(const TTextModel &text, size_t *cx) const
+{
+  ++*cx;
+  while( ((unsigned char)text[*cx] & 0xC0) == 0x80)
+    ++*cx;
+}
+
+size_t
+TTextArea::_charcount(const TTextModel &text, size_t start, size_t bytelen) const
+{
+  size_t i = 0;
+  for(size_t p=start; p<start+bytelen; _next_char(text, &p))
+    ++i;
+  return i;
+}
+
+size_t
+TTextArea::_bytecount(const TTextModel &text, size_t start, size_t charlen) const
+{
+  size_t p = start;
+  while(charlen>0) {
+    _next_char(text, &p);
+    --charlen;
+  }
+  return p-start;
+}
+
 void 
 TTextArea::setModified(bool m)
 {
@@ -1726,23 +1835,13 @@ TTextArea::setCursor(unsigned cx, unsigned cy)
   // we need to calculate:
   // _ty, _cx, _cy, _bol, _eol, _pos
   
-  const string &data = model->getValue();
+  const TTextModel &data(*model);
   size_t i;
   unsigned j, y;
   
   // calculate _bol and _eol
-  i = 0;
-  y = 0;
-  _bol = 0;
-  while(cy!=y && i<data.size()) {
-    if (data[i]=='\n') {
-      ++y;
-      _next_char(data, &i);
-      _bol = i;
-    } else {
-      _next_char(data, &i);
-    }
-  }
+  y = cy < model->nlines ? cy : model->nlines;
+  _bol = data.lineStart(y);
   _eol_from_bol();
   
   string line = data.substr(_bol, _eol-_bol);
@@ -25,6 +25,9 @@
 #include <toad/control.hh>
 #include <toad/textmodel.hh>
 #include <toad/scrollbar.hh>
+#include <toad/clipboard.hh>
+#include <map>
+#include <vector>
 
 namespace toad {
 
@@ -158,6 +161,18 @@ class TTextArea:
     
     void _invalidate_line(unsigned line, bool statusChanged=true);
 
+    //! a line with its tabulators expanded and its pixel positions
+    struct TLineLayout {
+      string text;          // the line as displayed
+      vector<size_t> off;   // byte in line -> byte in text
+      vector<TCoord> x;     // byte in line -> pixel position
+    };
+    typedef map<unsigned, TLineLayout> TLayoutCache;
+    //! layout of the lines painted recently, by line number
+    TLayoutCache layout;
+    const TLineLayout& _layout(unsigned line, size_t bol, size_t eol);
+    void _layout_edit(unsigned first, unsigned last, int delta);
+
     //! position of the window's upper left char inside data
     unsigned _ty;
     
@@ -195,7 +210,10 @@ class TTextArea:
     void _selection_cut();
     void _selection_copy();
     void _selection_paste();
+    void _selection_pasted();
     void _selection_clear();
+    //! pending request for the selection to be pasted
+    PClipboardRequest _paste;
     void _delete_current_line();
     
     // methods to handle screen
@@ -220,6 +238,10 @@ class TTextArea:
     virtual void _next_char(const string &text, size_t *cx) const;
     virtual size_t _charcount(const string &text, size_t start, size_t bytelen) const;
     virtual size_t _bytecount(const string &text, size_t start, size_t charlen) const;
+    virtual void _prev_char(const TTextModel &text, size_t *cx) const;
+    virtual void _next_char(const TTextModel &text, size_t *cx) const;
+    virtual size_t _charcount(const TTextModel &text, size_t start, size_t bytelen) const;
+    virtual size_t _bytecount(const TTextModel &text, size_t start, size_t charlen) const;
 
   public:
     void setModel(int) {
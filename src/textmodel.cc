@@ -17,103 +17,684 @@
  * Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, 
  * MA  02111-1307,  USA
  */
-
 #include <toad/textmodel.hh>
 #include <toad/undomanager.hh>
+#include <toad/config.h>
+
+#include <stdexcept>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 using namespace toad;
 
+/*
+ * The piece table
+ *
+ * The pieces are kept in a treap ordered by their position in the text.
+ * Each node knows the number of bytes and lines in its subtree, which
+ * is used to find the piece containing an offset in O(log n).
+ *
+ * Pieces are at most 'piece_limit' bytes long, so that splitting one
+ * only needs to count the lines of a small part of it.
+ */
+
+namespace {
+
+const size_t piece_limit = 65536;
+
+size_t
+count_lines(const char *data, size_t length)
+{
+  size_t n = 0;
+  const char *end = data + length;
+  while(true) {
+    data = (const char*)memchr(data, '\n', end-data);
+    if (!data)
+      break;
+    ++n;
+    ++data;
+  }
+  return n;
+}
+
+// compare the text at 'p' with 's', which may span several pieces
+bool
+match(const TTextModel &m, size_t p, const char *s, size_t n)
+{
+  while(n>0) {
+    const char *d;
+    size_t l = m.chunk(p, &d);
+    if (l==0)
+      return false;
+    if (l>n)
+      l = n;
+    if (memcmp(d, s, l)!=0)
+      return false;
+    p += l;
+    s += l;
+    n -= l;
+  }
+  return true;
+}
+
+unsigned
+random_priority()
+{
+  static unsigned seed = 2463534242U;
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+} // namespace
+
+struct TTextModel::TNode
+{
+  TNode(const TPiece &p): piece(p) {
+    left = right = 0;
+    priority = random_priority();
+    update();
+  }
+  
+  TPiece piece;
+  TNode *left, *right;
+  unsigned priority;
+  size_t size;    // bytes in this subtree
+  size_t lines;   // '\n' in this subtree
+  
+  const char* data() const {
+    return piece.buffer->data() + piece.start;
+  }
+  
+  void update() {
+    size  = piece.length;
+    lines = piece.lines;
+    if (left) {
+      size  += left->size;
+      lines += left->lines;
+    }
+    if (right) {
+      size  += right->size;
+      lines += right->lines;
+    }
+  }
+  
+  static void free(TNode *t) {
+    while(t) {
+      free(t->left);
+      TNode *r = t->right;
+      delete t;
+      t = r;
+    }
+  }
+  
+  static TNode* merge(TNode *a, TNode *b) {
+    if (!a)
+      return b;
+    if (!b)
+      return a;
+    if (a->priority > b->priority) {
+      a->right = merge(a->right, b);
+      a->update();
+      return a;
+    }
+    b->left = merge(a, b->left);
+    b->update();
+    return b;
+  }
+
+  // split 't' into the first 'pos' bytes and the rest
+  static void split(TNode *t, size_t pos, TNode **l, TNode **r) {
+    if (!t) {
+      *l = *r = 0;
+      return;
+    }
+    size_t ls = t->left ? t->left->size : 0;
+    if (pos <= ls) {
+      split(t->left, pos, l, &t->left);
+      t->update();
+      *r = t;
+    } else
+    if (pos >= ls + t->piece.length) {
+      split(t->right, pos - ls - t->piece.length, &t->right, r);
+      t->update();
+      *l = t;
+    } else {
+      // cut the piece, counting the lines in the smaller part
+      size_t k = pos - ls;
+      TPiece tail(t->piece);
+      tail.start += k;
+      tail.length -= k;
+      if (k < tail.length) {
+        size_t n = count_lines(t->data(), k);
+        tail.lines -= n;
+        t->piece.lines = n;
+      } else {
+        tail.lines = count_lines(t->data()+k, tail.length);
+        t->piece.lines -= tail.lines;
+      }
+      t->piece.length = k;
+      TNode *right = t->right;
+      t->right = 0;
+      t->update();
+      *l = t;
+      *r = merge(new TNode(tail), right);
+    }
+  }
+
+  // find the node containing 'pos', which is set relative to the node
+  static TNode* find(TNode *t, size_t *pos) {
+    while(t) {
+      size_t ls = t->left ? t->left->size : 0;
+      if (*pos < ls) {
+        t = t->left;
+      } else
+      if (*pos < ls + t->piece.length) {
+        *pos -= ls;
+        return t;
+      } else {
+        *pos -= ls + t->piece.length;
+        t = t->right;
+      }
+    }
+    return 0;
+  }
+
+  static void collect(const TNode *t, TPieces *pieces) {
+    while(t) {
+      collect(t->left, pieces);
+      pieces->push_back(t->piece);
+      t = t->right;
+    }
+  }
+};
+
+TTextModel::TBuffer::TBuffer()
+{
+  mapped = 0;
+  mapsize = 0;
+}
+
+TTextModel::TBuffer::TBuffer(const char *data, size_t size):
+  text(data, size)
+{
+  mapped = 0;
+  mapsize = 0;
+}
+
+TTextModel::TBuffer::~TBuffer()
+{
+#ifdef HAVE_SYS_MMAN_H
+  if (mapped)
+    munmap(mapped, mapsize);
+#endif
+}
+
+/**
+ * Map 'size' bytes of file 'fd' into memory.
+ */
+bool
+TTextModel::TBuffer::map(int fd, size_t size)
+{
+#ifdef HAVE_SYS_MMAN_H
+  void *p = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p==MAP_FAILED)
+    return false;
+  mapped = (char*)p;
+  mapsize = size;
+  return true;
+#else
+  return false;
+#endif
+}
+
 TTextModel::TTextModel()
 {
+  root = 0;
+  added = new TBuffer();
+  _data_valid = false;
   nlines = 0;
   _modified = false;
 }
 
-void
-TTextModel::setValue(const string &d)
+TTextModel::TTextModel(const TTextModel &model)
 {
-//cerr << "TTextModel[" << this << "]::setValue(string)\n";
-  if (_data==d) {
-//    cerr << "-> not changed\n";
-    return;
-  }
-//  DBM(cout << __PRETTY_FUNCTION__ << endl;)
+  root = 0;
+  added = new TBuffer();
+  _data_valid = false;
+  nlines = 0;
+  _modified = false;
+  
+  // the buffers are shared, only the pieces are copied
+  TPieces pieces;
+  TNode::collect(model.root, &pieces);
+  for(TPieces::const_iterator p = pieces.begin(); p!=pieces.end(); ++p)
+    root = TNode::merge(root, new TNode(*p));
+  nlines = root ? root->lines : 0;
+}
 
-  offset = 0;
-  _data = d;
-  length = _data.size();
-  lines = (size_t)-1;   // all lines have changed
+TTextModel::~TTextModel()
+{
+  TNode::free(root);
+}
 
-  nlines = 0;
-  size_t pos = 0;
+TTextModel::size_type
+TTextModel::size() const
+{
+  return root ? root->size : 0;
+}
+
+TTextModel::const_reference
+TTextModel::operator[](size_type p) const
+{
+  static const char nul = 0;
+  TNode *t = TNode::find(root, &p);
+  if (!t)
+    return nul;
+  return t->data()[p];
+}
+
+TTextModel::const_reference
+TTextModel::at(size_type p) const
+{
+  if (p>=size())
+    throw out_of_range("TTextModel::at");
+  return (*this)[p];
+}
+
+/**
+ * Return the number of bytes stored continuously at offset 'p' and set
+ * '*data' to them. Returns 0 at the end of the text.
+ */
+TTextModel::size_type
+TTextModel::chunk(size_type p, const char **data) const
+{
+  TNode *t = TNode::find(root, &p);
+  if (!t) {
+    *data = 0;
+    return 0;
+  }
+  *data = t->data() + p;
+  return t->piece.length - p;
+}
+
+/**
+ * Return the offset of the first character in line 'line', counting
+ * from 0, or npos when the text has less lines.
+ */
+TTextModel::size_type
+TTextModel::lineStart(unsigned line) const
+{
+  if (line==0)
+    return 0;
+  if (!root || line>root->lines)
+    return npos;
+  // find the piece holding the line-th '\n'
+  size_type p = 0;
+  size_t n = line;
+  TNode *t = root;
   while(true) {
-    pos = d.find('\n', pos);
-    if (pos==string::npos)
+    size_t ll = t->left ? t->left->lines : 0;
+    size_t ls = t->left ? t->left->size : 0;
+    if (n <= ll) {
+      t = t->left;
+    } else
+    if (n <= ll + t->piece.lines) {
+      n -= ll;
+      p += ls;
       break;
-    pos++;
-    nlines++;
+    } else {
+      n -= ll + t->piece.lines;
+      p += ls + t->piece.length;
+      t = t->right;
+    }
+  }
+  const char *d = t->data(), *c = d;
+  while(true) {
+    c = (const char*)memchr(c, '\n', t->piece.length - (c-d));
+    if (--n==0)
+      break;
+    ++c;
+  }
+  return p + (c-d) + 1;
+}
+
+/**
+ * Return the line containing offset 'p', counting from 0.
+ */
+unsigned
+TTextModel::lineOf(size_type p) const
+{
+  size_t n = 0;
+  TNode *t = root;
+  while(t) {
+    size_t ls = t->left ? t->left->size : 0;
+    if (p < ls) {
+      t = t->left;
+    } else
+    if (p < ls + t->piece.length) {
+      size_t o = p - ls, l = t->piece.length;
+      n += t->left ? t->left->lines : 0;
+      if (o <= l/2)
+        n += count_lines(t->data(), o);
+      else
+        n += t->piece.lines - count_lines(t->data()+o, l-o);
+      break;
+    } else {
+      n += (t->left ? t->left->lines : 0) + t->piece.lines;
+      p -= ls + t->piece.length;
+      t = t->right;
+    }
+  }
+  return n;
+}
+
+/**
+ * Return the whole text as a string.
+ *
+ * The string is put together from the pieces on the first call after
+ * the text was modified.
+ */
+const string&
+TTextModel::getValue() const
+{
+  if (!_data_valid) {
+    _data = substr();
+    _data_valid = true;
+  }
+  return _data;
+}
+
+string
+TTextModel::substr(size_type p, size_type n) const
+{
+  size_type s = size();
+  if (p>s)
+    throw out_of_range("TTextModel::substr");
+  if (n > s-p)
+    n = s-p;
+  string result;
+  result.reserve(n);
+  while(n>0) {
+    const char *d;
+    size_type l = chunk(p, &d);
+    if (l>n)
+      l = n;
+    result.append(d, l);
+    p += l;
+    n -= l;
+  }
+  return result;
+}
+
+int
+TTextModel::compare(const char *s, size_type n) const
+{
+  size_type p = 0, e = size();
+  while(p<e && p<n) {
+    const char *d;
+    size_type l = chunk(p, &d);
+    if (l > n-p)
+      l = n-p;
+    int r = memcmp(d, s+p, l);
+    if (r)
+      return r;
+    p += l;
+  }
+  if (e<n)
+    return -1;
+  if (e>n)
+    return 1;
+  return 0;
+}
+
+TTextModel::size_type
+TTextModel::find(char c, size_type p) const
+{
+  while(true) {
+    const char *d;
+    size_type l = chunk(p, &d);
+    if (l==0)
+      return npos;
+    const char *hit = (const char*)memchr(d, c, l);
+    if (hit)
+      return p + (hit-d);
+    p += l;
+  }
+}
+
+TTextModel::size_type
+TTextModel::rfind(char c, size_type p) const
+{
+  size_type s = size();
+  if (s==0)
+    return npos;
+  if (p>=s)
+    p = s-1;
+  while(true) {
+    size_type o = p;
+    TNode *t = TNode::find(root, &o);
+    const char *d = t->data();
+    for(size_type i=o+1; i>0; --i) {
+      if (d[i-1]==c)
+        return p-o+i-1;
+    }
+    if (p==o)
+      return npos;
+    p -= o+1;
+  }
+}
+
+TTextModel::size_type
+TTextModel::find(const char *s, size_type p, size_type n) const
+{
+  size_type e = size();
+  if (n==0)
+    return p<=e ? p : npos;
+  while(true) {
+    const char *d;
+    size_type l = chunk(p, &d);
+    if (l==0)
+      return npos;
+    const char *c = d, *end = d+l;
+    while((c = (const char*)memchr(c, s[0], end-c))) {
+      size_type q = p + (c-d);
+      if (n > e-q)
+        return npos;
+      if (c+n <= end ? memcmp(c, s, n)==0 : match(*this, q, s, n))
+        return q;
+      ++c;
+    }
+    p += l;
+  }
+}
+
+TTextModel::size_type
+TTextModel::rfind(const char *s, size_type p, size_type n) const
+{
+  size_type e = size();
+  if (n>e)
+    return npos;
+  if (p > e-n)
+    p = e-n;
+  if (n==0)
+    return p;
+  while(true) {
+    // the bytes of the piece up to and including p
+    size_type o = p;
+    TNode *t = TNode::find(root, &o);
+    const char *d = t->data();
+    const char *end = d + t->piece.length;
+    for(size_type i=o+1; i-->0;) {
+      const char *c = d+i;
+      if (*c!=s[0])
+        continue;
+      size_type q = p-o+i;
+      if (c+n <= end ? memcmp(c, s, n)==0 : match(*this, q, s, n))
+        return q;
+    }
+    if (p==o)
+      return npos;
+    p -= o+1;
   }
-  
-  _modified = false;
-  type = CHANGE;
-  sigTextArea();
-  sigChanged();
 }
 
+/**
+ * Replace the text with the contents of 'buffer'.
+ */
 void
-TTextModel::clear()
+TTextModel::_assign(const PBuffer &buffer)
 {
-  if (_data.empty())
-    return;
+  TNode::free(root);
+  root = 0;
+  added = new TBuffer();
+  _data_valid = false;
+  
+  TPiece piece;
+  piece.buffer = buffer;
+  const char *data = buffer->data();
+  size_t size = buffer->size();
+  for(size_t p=0; p<size; p+=piece_limit) {
+    piece.start  = p;
+    piece.length = min(piece_limit, size-p);
+    piece.lines  = count_lines(data+p, piece.length);
+    root = TNode::merge(root, new TNode(piece));
+  }
 
   offset = 0;
-  _data.clear();
-  length = 0;
+  length = size;
   lines = (size_t)-1;   // all lines have changed
-
-  nlines = 0;
-  size_t pos = 0;
+  nlines = root ? root->lines : 0;
+  
   _modified = false;
   type = CHANGE;
   sigTextArea();
   sigChanged();
 }
 
+void
+TTextModel::setValue(const string &d)
+{
+//cerr << "TTextModel[" << this << "]::setValue(string)\n";
+  setValue(d.data(), d.size());
+}
+
 void
 TTextModel::setValue(const char *d, size_t len)
 {
 //cerr << "TTextModel[" << this << "]::setValue(char*)\n";
-#ifndef OLDLIBSTD
-  if (_data.compare(0, string::npos, d, len)==0) {
+  if (compare(d, len)==0) {
 //    cerr << "-> not changed\n";
     return;
   }
-#else
-  if (_data.compare(d, len)==0) {
-//    cerr << "-> not changed\n";
-    return;
+//  DBM(cout << __PRETTY_FUNCTION__ << endl;)
+  _assign(new TBuffer(d, len));
+}
+
+/**
+ * Load the file 'filename' into the model.
+ *
+ * Regular files are mapped into memory instead of being copied.
+ */
+bool
+TTextModel::load(const string &filename)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd<0)
+    return false;
+  PBuffer buffer = new TBuffer();
+  struct stat st;
+  if (fstat(fd, &st)!=0 ||
+      !S_ISREG(st.st_mode) ||
+      st.st_size==0 ||
+      !buffer->map(fd, st.st_size))
+  {
+    char data[8192];
+    ssize_t n;
+    while((n=read(fd, data, sizeof(data)))>0)
+      buffer->text.append(data, n);
+    if (n<0) {
+      close(fd);
+      return false;
+    }
   }
-#endif
+  close(fd);
+  _assign(buffer);
+  return true;
+}
 
-  offset = 0;
-  length = len;
-  _data.assign(d, len);
-  lines = (size_t)-1;   // all lines have changed
+void
+TTextModel::clear()
+{
+  if (!root)
+    return;
+  _assign(new TBuffer());
+}
 
-  nlines = 0;
-  size_t pos = 0;
-  while(true) {
-    pos = _data.find('\n', pos);
-    if (pos==string::npos)
-      break;
-    pos++;
-    nlines++;
-  }
+/**
+ * Append 'text' to the buffer for added text and insert it at 'p'.
+ */
+void
+TTextModel::_insert(size_type p, const char *text, size_t len)
+{
+  _data_valid = false;
   
-  _modified = false;
-  type = CHANGE;
-  sigTextArea();
-  sigChanged();
+  // continue the piece ending at 'p' when it was the last one added
+  // to 'added', which is the case when typing
+  if (p>0 && len <= piece_limit) {
+    TNode *path[128];
+    unsigned depth = 0;
+    TNode *t = root;
+    size_t o = p-1;
+    while(t && depth<128) {
+      path[depth++] = t;
+      size_t ls = t->left ? t->left->size : 0;
+      if (o < ls) {
+        t = t->left;
+      } else
+      if (o < ls + t->piece.length) {
+        o -= ls;
+        break;
+      } else {
+        o -= ls + t->piece.length;
+        t = t->right;
+      }
+    }
+    if (t &&
+        o+1 == t->piece.length &&
+        t->piece.buffer == added &&
+        t->piece.start + t->piece.length == added->text.size() &&
+        t->piece.length + len <= piece_limit)
+    {
+      added->text.append(text, len);
+      t->piece.length += len;
+      t->piece.lines += count_lines(text, len);
+      while(depth>0)
+        path[--depth]->update();
+      return;
+    }
+  }
+
+  TNode *l, *r, *m = 0;
+  TNode::split(root, p, &l, &r);
+  while(len>0) {
+    TPiece piece;
+    piece.buffer = added;
+    piece.start  = added->text.size();
+    piece.length = min(len, piece_limit);
+    piece.lines  = count_lines(text, piece.length);
+    added->text.append(text, piece.length);
+    m = TNode::merge(m, new TNode(piece));
+    text += piece.length;
+    len -= piece.length;
+  }
+  root = TNode::merge(TNode::merge(l, m), r);
 }
 
 /**
@@ -137,7 +718,8 @@ TTextModel::insert(size_type p, int c)
   }
   TUndoManager::beginUndoGrouping(this);
   TUndoManager::registerUndo(this, new TUndoInsert(this, p, 1));
-  _data.insert(p, 1, c);
+  char ch = c;
+  _insert(p, &ch, 1);
   
   type = INSERT;
   offset = p;
@@ -181,16 +763,51 @@ TTextModel::insert(size_type p, const string &aString)
   TUndoManager::beginUndoGrouping(this);
   TUndoManager::registerUndo(this, new TUndoInsert(this, p, s.size()));
 
-  _data.insert(p, s);
+  _insert(p, s.data(), s.size());
   
   type = INSERT;
   offset = p;
   length = s.size();
-  lines = 0;
-  for(size_t i=0; i<length; i++) {
-    if (s[i]=='\n')
-      lines++;
+  lines = count_lines(s.data(), s.size());
+
+  nlines += lines;
+  _modified = true;
+  
+  sigTextArea();
+  sigChanged();
+  return *this;
+}
+
+/**
+ * insert pieces removed before, used to undo a removal
+ */
+TTextModel&
+TTextModel::insert(size_type p, const TPieces &pieces)
+{
+  if (pieces.empty())
+    return *this;
+    
+  TNode *m = 0;
+  size_t l = 0, n = 0;
+  for(TPieces::const_iterator pp = pieces.begin(); pp!=pieces.end(); ++pp) {
+    m = TNode::merge(m, new TNode(*pp));
+    l += pp->length;
+    n += pp->lines;
   }
+  
+  TUndoManager::endUndoGrouping();
+  TUndoManager::beginUndoGrouping(this);
+  TUndoManager::registerUndo(this, new TUndoInsert(this, p, l));
+
+  _data_valid = false;
+  TNode *left, *right;
+  TNode::split(root, p, &left, &right);
+  root = TNode::merge(TNode::merge(left, m), right);
+
+  type = INSERT;
+  offset = p;
+  length = l;
+  lines = n;
 
   nlines += lines;
   _modified = true;
@@ -210,29 +827,47 @@ TTextModel::insert(size_type p, const string &aString)
 TTextModel&
 TTextModel::erase(size_t p, size_t l)
 {
+  size_t s = size();
+  if (p>s)
+    throw out_of_range("TTextModel::erase");
+  if (l > s-p)
+    l = s-p;
   if (l==0)
     return *this;
     
   // cout << "remove at " << p << endl;
-  if (type==CHANGE || type==INSERT || p!=offset-length) {
+  // group undo events while removing in front of (backspace) or behind
+  // (delete) the previous removal
+  if (type==CHANGE || type==INSERT || (p+l!=offset && p!=offset)) {
     //cout << "* new undo group for textarea" << endl;
     TUndoManager::endUndoGrouping();
   }
+  
+  // cut out the pieces to be removed but put them back until
+  // sigTextArea was triggered
+  TNode *a, *b, *m;
+  TNode::split(root, p, &a, &b);
+  TNode::split(b, l, &m, &b);
+  TPieces pieces;
+  TNode::collect(m, &pieces);
+  lines = m->lines;
+  root = TNode::merge(TNode::merge(a, m), b);
+  
   TUndoManager::beginUndoGrouping(this);
-  TUndoManager::registerUndo(this, new TUndoRemove(this, p, _data.substr(p,l)));
+  TUndoManager::registerUndo(this, new TUndoRemove(this, p, pieces));
 
-  lines = 0;
-  for(size_t i=p; i<p+l; ++i) {
-    if (_data[i]=='\n')
-      ++lines;
-  }
   nlines -= lines;
   type   = REMOVE;
   offset = p;
   length = l;
   _modified = true;
   sigTextArea();
-  _data.erase(p, l);
+  
+  _data_valid = false;
+  TNode::split(root, p, &a, &b);
+  TNode::split(b, l, &m, &b);
+  TNode::free(m);
+  root = TNode::merge(a, b);
   sigChanged();
   return *this;
 }
@@ -262,6 +897,84 @@ TTextModel::TUndoInsert::getRedoName(string *name) const
   return true;
 }
 
+/**
+ * Merge an insertion into the text inserted before.
+ */
+bool
+TTextModel::TUndoInsert::merge(TUndo *undo)
+{
+  TUndoInsert *u = dynamic_cast<TUndoInsert*>(undo);
+  if (!u || u->model!=model)
+    return false;
+  if (u->offset < offset || offset+length < u->offset)
+    return false;
+  length += u->length;
+  return true;
+}
+
+// append piece to pieces, joining it with the last piece when both
+// are adjacent in the same buffer
+static void
+join(TTextModel::TPieces *pieces, const TTextModel::TPiece &piece)
+{
+  if (!pieces->empty()) {
+    TTextModel::TPiece &last(pieces->back());
+    if ((TTextModel::TBuffer*)last.buffer==(TTextModel::TBuffer*)piece.buffer &&
+        last.start+last.length == piece.start &&
+        last.length+piece.length <= piece_limit)
+    {
+      last.length += piece.length;
+      last.lines  += piece.lines;
+      return;
+    }
+  }
+  pieces->push_back(piece);
+}
+
+/**
+ * Merge a removal in front of (backspace) or at the position (delete) of
+ * the text removed before.
+ */
+bool
+TTextModel::TUndoRemove::merge(TUndo *undo)
+{
+  TUndoRemove *u = dynamic_cast<TUndoRemove*>(undo);
+  if (!u || u->model!=model)
+    return false;
+  size_t l = 0;
+  for(TPieces::const_iterator p=u->pieces.begin(); p!=u->pieces.end(); ++p)
+    l += p->length;
+  TPieces joined;
+  if (u->offset+l == offset) {
+    joined.reserve(u->pieces.size() + pieces.size());
+    for(TPieces::const_iterator p=u->pieces.begin(); p!=u->pieces.end(); ++p)
+      join(&joined, *p);
+    for(TPieces::const_iterator p=pieces.begin(); p!=pieces.end(); ++p)
+      join(&joined, *p);
+    offset = u->offset;
+  } else
+  if (u->offset == offset) {
+    joined.reserve(pieces.size() + u->pieces.size());
+    for(TPieces::const_iterator p=pieces.begin(); p!=pieces.end(); ++p)
+      join(&joined, *p);
+    for(TPieces::const_iterator p=u->pieces.begin(); p!=u->pieces.end(); ++p)
+      join(&joined, *p);
+  } else {
+    return false;
+  }
+  pieces.swap(joined);
+  return true;
+}
+
+size_t
+TTextModel::TUndoRemove::getMemoryUsage() const
+{
+  size_t n = sizeof(*this) + pieces.capacity() * sizeof(TPiece);
+  for(TPieces::const_iterator p=pieces.begin(); p!=pieces.end(); ++p)
+    n += p->length;
+  return n;
+}
+
 bool
 TTextModel::TUndoRemove::getUndoName(string *name) const
 {
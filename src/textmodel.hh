@@ -22,6 +22,8 @@
 #define _TOAD_TEXTMODEL_HH
 
 #include <iostream>
+#include <vector>
+#include <cstring>
 #include <toad/model.hh>
 #include <toad/undo.hh>
 #include <toad/io/serializable.hh>
@@ -32,13 +34,56 @@ namespace toad {
  * \class TTextModel
  * Data storage for TTextArea.
  *
+ * The text is stored as a piece table: a balanced tree of pieces
+ * referring to read-only buffers, which are either a file mapped into
+ * memory, a copy of the value passed to setValue() or the buffer new
+ * text is appended to. Insertions and removals take O(log n).
+ *
+ * getValue() and the other methods returning a string or a pointer to
+ * the whole text have to put it together first, so use chunk(), find(),
+ * substr() and operator[] where possible.
+ *
  * \sa TTextArea
  */
 class TTextModel:
   public TModel
 {
   public:
+    /**
+     * A buffer holding text.
+     */
+    class TBuffer:
+      public TSmartObject
+    {
+      public:
+        TBuffer();
+        TBuffer(const char *data, size_t size);
+        ~TBuffer();
+        bool map(int fd, size_t size);
+        const char *data() const { return mapped ? mapped : text.data(); }
+        size_t size() const { return mapped ? mapsize : text.size(); }
+        
+        //! text of a buffer which isn't mapped
+        string text;
+      private:
+        char *mapped;
+        size_t mapsize;
+    };
+    typedef GSmartPointer<TBuffer> PBuffer;
+
+    /**
+     * A part of the text.
+     */
+    struct TPiece {
+      PBuffer buffer;
+      size_t start;
+      size_t length;
+      size_t lines;     // number of '\n' in this piece
+    };
+    typedef std::vector<TPiece> TPieces;
+
     TTextModel();
+    ~TTextModel();
   
     /** 
      * Almost like sigChanged but in case of text removal it's triggered
@@ -75,28 +120,32 @@ class TTextModel:
     
     void setValue(const string&);
     void setValue(const char *data, size_t len);
-    const string& getValue() const { return _data; }
+    bool load(const string &filename);
+    const string& getValue() const;
     
-    TTextModel(const TTextModel &model) {
-      setValue(model._data);
-    }
+    TTextModel(const TTextModel &model);
     
-    size_type size() const { return _data.size(); }
+    size_type size() const;
     void clear();
-    bool empty() const { return _data.empty(); }
+    bool empty() const { return size()==0; }
+    
+    const_reference operator[] (size_type p) const;
+    const_reference at(size_type p) const;
+    
+    size_type chunk(size_type p, const char **data) const;
     
-    const_reference operator[] (size_type p) const { return _data[p]; }
-    const_reference at(size_type p) const { return _data.at(p); }
+    size_type lineStart(unsigned line) const;
+    unsigned lineOf(size_type p) const;
     
     TTextModel& operator+=(const TTextModel &m) { return this->append(m); }
     TTextModel& operator+=(const string &m) { return this->append(m); }
     TTextModel& operator+=(const char *m) { return this->append(m); }
     TTextModel& operator+=(char m) { return this->append(m); }
     
-    TTextModel& append(TTextModel &m) { return this->insert(_data.size(), m._data); }
-    TTextModel& append(const string &m) { return this->insert(_data.size(), m); }
-    TTextModel& append(const char *m) { return this->insert(_data.size(), m); }
-    TTextModel& append(char m) { return this->insert(_data.size(), m); }
+    TTextModel& append(TTextModel &m) { return this->insert(size(), m.getValue()); }
+    TTextModel& append(const string &m) { return this->insert(size(), m); }
+    TTextModel& append(const char *m) { return this->insert(size(), m); }
+    TTextModel& append(char m) { return this->insert(size(), m); }
     
     // assign
     
@@ -113,45 +162,36 @@ class TTextModel:
     const string& operator=(const string &s) { setValue(s); return s; }
     TTextModel& operator=(TTextModel &m) { setValue(m.getValue()); return *this; }
     const TTextModel& operator=(const TTextModel &m) { setValue(m.getValue()); return *this; }
-    operator const string&() const { return _data; }
-    const char * c_str() const { return _data.c_str(); }
-    const char * data() const { return _data.data(); }
+    operator const string&() const { return getValue(); }
+    const char * c_str() const { return getValue().c_str(); }
+    const char * data() const { return getValue().data(); }
 
-    size_type find(const char *s, size_type p, size_type n) const {
-      return _data.find(s, p, n);
-    }
+    size_type find(const char *s, size_type p, size_type n) const;
     size_type find(const string &s, size_type p=0) const {
-      return _data.find(s, p);
+      return find(s.data(), p, s.size());
     }
     size_type find(const char *s, size_type p=0) const {
-      return _data.find(s, p);
-    }
-    size_type find(char c, size_type p=0) const {
-      return _data.find(c, p);
+      return find(s, p, strlen(s));
     }
+    size_type find(char c, size_type p=0) const;
     size_type rfind(const string &s, size_type p=npos) const {
-      return _data.rfind(s, p);
-    }
-    size_type rfind(const char *s, size_type p, size_type n) const {
-      return _data.rfind(s, p, n);
+      return rfind(s.data(), p, s.size());
     }
+    size_type rfind(const char *s, size_type p, size_type n) const;
     size_type rfind(const char *s, size_type p=npos) const {
-      return _data.rfind(s, p);
-    }
-    size_type rfind(char c, size_type p=npos) const {
-      return _data.rfind(c, p);
+      return rfind(s, p, strlen(s));
     }
+    size_type rfind(char c, size_type p=npos) const;
     // find_first_of
     // find_last_of
     // find_first_not_of
     // find_last_not_of
     
-    string substr(size_type p=0, size_type n=npos) const {
-      return _data.substr(p, n);
-    }
+    string substr(size_type p=0, size_type n=npos) const;
     int compare(const string &s) const {
-      return _data.compare(s);
+      return compare(s.data(), s.size());
     }
+    int compare(const char *s, size_type n) const;
     // more compare...
     
     //! 'true' when model was modified an needs to be saved
@@ -197,6 +237,8 @@ class TTextModel:
         }
         bool getRedoName(string *name) const;
         bool getUndoName(string *name) const;
+        bool merge(TUndo *undo);
+        size_t getMemoryUsage() const { return sizeof(*this); }
         void undo() {
           model->erase(offset, length);
         }
@@ -207,22 +249,36 @@ class TTextModel:
     {
         TTextModel *model;
         size_t offset;
-        string text;
+        TPieces pieces;
       public:
-        TUndoRemove(TTextModel *m, size_t o, const string &t) {
+        TUndoRemove(TTextModel *m, size_t o, const TPieces &p) {
           model  = m;
           offset = o;
-          text   = t;
+          pieces = p;
         }
         bool getRedoName(string *name) const;
         bool getUndoName(string *name) const;
+        bool merge(TUndo *undo);
+        size_t getMemoryUsage() const;
         void undo() {
-          model->insert(offset, text);
+          model->insert(offset, pieces);
         }
     };
     
   protected:
-    string _data;
+    struct TNode;
+    TNode *root;
+    
+    //! the buffer new text is appended to
+    PBuffer added;
+    
+    //! getValue()'s copy of the text
+    mutable string _data;
+    mutable bool _data_valid;
+
+    TTextModel& insert(size_type offset, const TPieces&);
+    void _insert(size_type offset, const char *text, size_t len);
+    void _assign(const PBuffer &buffer);
 };
 
 inline ostream& operator<<(ostream &s, const TTextModel& m) {
@@ -60,11 +60,15 @@
 
 #include <toad/toadbase.hh>
 #include <toad/pen.hh>
+#include <toad/rasterpen.hh>
+#include <toad/clipboard.hh>
+#include <toad/workerpool.hh>
 #include <toad/window.hh>
 #include <toad/font.hh>
 #include <toad/region.hh>
 #include <toad/dragndrop.hh>
 #include <toad/figure.hh>
+#include <toad/treemodel.hh>
 #include <toad/dialogeditor.hh>
 
 // TMessageBox
@@ -76,7 +80,6 @@
 using namespace toad;
 
 #ifdef __X11__
-static string GetWindowProperty(Window source, Atom property, Atom type);
 static string AtomName(Atom atom) {
   string result = "(None)";
   if (atom) {
@@ -88,10 +91,6 @@ static string AtomName(Atom atom) {
 }
 #endif
 
-static string selection_kludge_data;
-static bool selection_kludge_flag;
-static bool selection_kludge_owner = false;
-
 // define this for a periodic screen update every 1/12 seconds
 #define PERIODIC_PAINT
 
@@ -120,8 +119,6 @@ Atom      toad::xaWMDeleteWindow;
 Atom      toad::xaWMMotifHints;
 
 static Atom xaWMProtocols;
-static Atom xaUTF8_STRING;
-static Atom xaTEXT;
 #endif
 
 TEventFilter * toad::global_evt_filter = 0;
@@ -262,9 +259,6 @@ TOADBase::initialize()
   xaWMDeleteWindow  = XInternAtom(x11display, "WM_DELETE_WINDOW", False);
   xaWMProtocols     = XInternAtom(x11display, "WM_PROTOCOLS", False);
   xaWMMotifHints    = XInternAtom(x11display, "_MOTIF_WM_HINTS", False);
-  
-  xaUTF8_STRING     = XInternAtom(x11display, "UTF8_STRING", False);
-  xaTEXT            = XInternAtom(x11display, "TEXT", False);
 
   if (i18n)
     initXInput();
@@ -277,6 +271,7 @@ TOADBase::initialize()
   initColor();
 
   initIO(ConnectionNumber(x11display));
+  TCommand::initialize();
 #endif
   TFigure::initialize();
 #ifdef __X11__
@@ -296,6 +291,7 @@ TOADBase::initialize()
 
   TBitmap::initialize();
   TPen::initialize();
+  TClipboard::initialize();
 
   return true;
 }
@@ -314,12 +310,18 @@ TOADBase::terminate()
   bold_font = 0;
 
   TFigure::terminate();
+  TWorkerPool::terminate();
   TBitmap::terminate();
+  TTreeModel::terminateLoader();
   TPen::terminate();
+  TRasterPen::terminate();
+  TClipboard::terminate();
 
 
 #ifdef __X11__
   closeXInput();
+  TCommand::terminate();
+  closeIO();
 
   //  close connection to the X11 server
   XCloseDisplay(x11display);
@@ -377,7 +379,7 @@ TOADBase::mainLoop()
   // flush paint event buffer
   //---------------------------------
   while(TWindow::_havePaintEvents())
-    TWindow::_dispatchPaintEvent();
+    TWindow::_dispatchPaintFrame();
 
   TWindow::destroyParentless();
 
@@ -521,12 +523,10 @@ TOADBase::handleMessage()
     //---------------------------------
     while (XPending(x11display)==0) {
 
-      // don't wait when we have paint events
+      // don't wait when we have paint events, the X11 queue is empty
+      // so paint a frame
       //--------------------------------------
       if(TWindow::_havePaintEvents()) {
-        XSync(x11display, False);       // wait for other events
-        if (XPending(x11display)!=0)
-          break;
         dispatch_paint_event = true;
         goto handle_event;
       }
@@ -583,8 +583,7 @@ TOADBase::handleMessage()
           );
 #ifdef PERIODIC_PAINT         
           if (dispatch_all_paint_events) {
-            while(TWindow::_havePaintEvents())
-              TWindow::_dispatchPaintEvent();
+            TWindow::_dispatchPaintFrame();
           }
 #endif
         }
@@ -618,16 +617,15 @@ handle_event:
     if ( (ulong)(crnt_time.tv_sec -first_paint_event_age.tv_sec)*1000000UL
         +(ulong)(crnt_time.tv_usec-first_paint_event_age.tv_usec) 
         >= 1000000UL / 12UL ) {
-      while(TWindow::_havePaintEvents())
-        TWindow::_dispatchPaintEvent();
+      TWindow::_dispatchPaintFrame();
     }
   }
 #endif
 
-  // no other event, dispatch a single paint event
+  // no other event, paint a frame
   //-----------------------------------------------
   if (dispatch_paint_event) {
-    TWindow::_dispatchPaintEvent();
+    TWindow::_dispatchPaintFrame();
     return bAppIsRunning;
   }
 
@@ -651,95 +649,30 @@ handle_event:
       break;
       
     case SelectionClear:
-//      cout << "SelectionClear" << endl;
-      selection_kludge_owner = false;
-      if (DnDSelectionClear(x11event));
+      if (DnDSelectionClear(x11event))
+        return bAppIsRunning;
+      if (TClipboard::_handleEvent(x11event))
         return bAppIsRunning;
-      if (x11event.xselectionclear.selection==XA_PRIMARY) {
-//cout << "XA_PRIMARY clear" << endl;
-        selection_kludge_owner = false;
-      }
       break;
 
-    case SelectionNotify: {
-//      cout << "SelectionNotify" << endl;
+    case SelectionNotify:
       if (DnDSelectionNotify(x11event))
         return bAppIsRunning;
-// start of hack
-#if 0
-      cout << "got SelectionNotify" << endl;
-      cout << "  requestor: " << x11event.xselection.requestor << endl;
-      cout << "  selection: " << AtomName(x11event.xselection.selection) << endl;
-      cout << "  target   : " << AtomName(x11event.xselection.target) << endl;
-      cout << "  property : " << AtomName(x11event.xselection.property) << endl;
-      cout << "  time     : " << x11event.xselection.time << endl;
-#endif
-      if (x11event.xselection.selection==XA_PRIMARY) {
-        cout << "XA_PRIMARY notify" << endl;
-        if ( x11event.xselection.target==XA_STRING)
-        {
-          selection_kludge_data = GetWindowProperty(
-            x11event.xselection.requestor,
-            XA_PRIMARY,
-            XA_STRING
-          );
-        }
-        selection_kludge_flag = false;
-      }
-// end of hack
-    } break;
+      if (TClipboard::_handleEvent(x11event))
+        return bAppIsRunning;
+      break;
 
     case SelectionRequest:
-//      cout << "SelectionRequest" << endl;
       if (DnDSelectionRequest(x11event))
         return bAppIsRunning;
-#if 0
-      cout << "got SelectionRequest" << endl;
-      cout << "  requestor: " << x11event.xselection.requestor << endl;
-      cout << "  selection: " << AtomName(x11event.xselectionrequest.selection) << endl;
-      cout << "  target   : " << AtomName(x11event.xselectionrequest.target) << endl;
-      cout << "  property : " << AtomName(x11event.xselectionrequest.property) << endl;
-      cout << "  time     : " << x11event.xselectionrequest.time << endl;
-#endif
-      if (x11event.xselectionrequest.selection==XA_PRIMARY) {
-//        cout << "XA_PRIMARY request" << endl;
-        if (x11event.xselectionrequest.target==XA_STRING ||
-            x11event.xselectionrequest.target==xaUTF8_STRING ||
-            x11event.xselectionrequest.target==xaTEXT /* ||
-            x11event.xselectionrequest.target==xa_COMPOUND_TEXT */
-           ) 
-        {
-//cout << "change property..." << endl;
-          XChangeProperty(x11display,
-            x11event.xselectionrequest.requestor,
-            x11event.xselectionrequest.property,
-            x11event.xselectionrequest.target, 8,
-            PropModeReplace,
-            (ubyte*)selection_kludge_data.c_str(),
-            selection_kludge_data.size());
-//cout << "send selection notify..." << endl;        
-          XEvent sevent;
-          sevent.xselection.type      = SelectionNotify;
-          sevent.xselection.serial    = 0;
-          sevent.xselection.send_event= True;
-          sevent.xselection.display   = x11display;
-          sevent.xselection.requestor = x11event.xselectionrequest.requestor;
-          sevent.xselection.selection = x11event.xselectionrequest.selection;
-          sevent.xselection.target    = x11event.xselectionrequest.target;
-          sevent.xselection.property  = x11event.xselectionrequest.property;
-          sevent.xselection.time      = x11event.xselectionrequest.time;
-          if (XSendEvent(x11display, 
-                         x11event.xselectionrequest.requestor,
-                         False,
-                         NoEventMask,
-                         &sevent)==0)
-          {
-             cerr << __FILE__ << ":" << __LINE__ << ": XSendEvent failed\n";
-          }
-        } else {
-          cout << "  unsupported target " << XGetAtomName(x11display, x11event.xselectionrequest.target) << endl;
-        }
-      }
+      if (TClipboard::_handleEvent(x11event))
+        return bAppIsRunning;
+      break;
+
+    case PropertyNotify:
+      // INCR selection transfers
+      if (TClipboard::_handleEvent(x11event))
+        return bAppIsRunning;
       break;
   }
 
@@ -1550,92 +1483,38 @@ TOADBase::placeWindow(TWindow *window, EWindowPlacement how, TWindow *parent)
 
 /**
  * Returns the currently selected string.
+ *
+ * This waits up to 5 seconds for the selection owner, use
+ * TClipboard::request to receive the selection without blocking.
  */
 string TOADBase::getSelection()
 {
-#ifdef __X11__
-  if (selection_kludge_owner)
-    return selection_kludge_data;
-
-  selection_kludge_data.erase();
-  selection_kludge_flag = true;
+  TClipboardSource *source = TClipboard::getSource();
+  if (source) {
+    string data;
+    source->convert("UTF8_STRING", &data);
+    return data;
+  }
 
-  // XA_PRIMARY
-  XConvertSelection(
-    x11display,
-    XA_PRIMARY,               // the primary selection
-    XA_STRING,                // type
-    XA_PRIMARY,               // destination property
-    TWindow::getParentless(0)->x11window,// destination window
-    CurrentTime);
-
-  // timeout needed!
-  time_t t = time(0);
-  do {
+  PClipboardRequest r = TClipboard::request("UTF8_STRING");
+  while(!r->isDone())
     handleMessage();
-  } while(selection_kludge_flag && time(0)-t<5);
-  selection_kludge_flag = false;
-  return selection_kludge_data;
-#endif
+  if (r->isFailed()) {
+    r = TClipboard::request("STRING");
+    while(!r->isDone())
+      handleMessage();
+  }
+  return r->getData();
 }
 
-// SetSelection
+/**
+ * Offer 'data' as the primary selection.
+ */
 void
 TOADBase::setSelection(const string &data)
 {
-  selection_kludge_owner = true;
-  selection_kludge_data = data;
-#ifdef __X11__
-  cout << "XSetSelectionOwner " <<
-  XSetSelectionOwner(
-    x11display,
-    XA_PRIMARY,
-    TWindow::getParentless(0)->x11window,
-    CurrentTime) << endl;
-#endif
-}
-
-//---------------------------------------------------------------------------
-
-#ifdef __X11__
-// duplicated from dragndrop.cc for experiments:
-//-----------------------------------------------
-string 
-GetWindowProperty(Window source, Atom property, Atom type)
-{
-  assert(source!=None);
-  assert(property!=None);
-
-  Atom out_type;
-  int format;
-  unsigned long position, received, remaining;
-  position = 0L;
-  unsigned char *buffer;
-  string data;
-  do {
-    if (XGetWindowProperty(toad::x11display,
-                           source,
-                           property,
-                           position, 1024L,
-                           False,
-                           type,
-                           &out_type,
-                           &format,
-                           &received,
-                           &remaining,
-                           &buffer) == Success )
-    {
-      unsigned long n = received * (format/8);
-      data.append((char*)buffer, n);
-      position+=n/4L;
-      XFree(buffer);
-    } else {
-      break;
-    }
-  }while(remaining!=0);
-  return data;
+  TClipboard::setText(data);
 }
-#endif
 
 // The following section is some rather ugly hack to test some new
 // design decisions for TKeyEvent (namely TKeyEvent::setModifier
@@ -213,6 +213,9 @@ class TOADBase
     static void terminate();
     static void initColor();
     static void initIO(int);
+    static void closeIO();
+    static bool setIOEngineByName(const string&);
+    static const string& getIOEngineName();
     static void initXInput();
     static void initDnD();
     static void select();
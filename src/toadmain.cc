@@ -42,6 +42,7 @@
 #include <toad/dialogeditor.hh>
 #include <toad/undomanager.hh>
 #include <toad/font.hh>
+#include <toad/bitmap.hh>
 
 using namespace toad;
 
@@ -123,6 +124,7 @@ string fontengine("x11");
 #endif
 #endif
 string fontname("arial,helvetica,sans-serif");
+string ioengine;
 
 static bool
 str2bool(const string &str) {
@@ -150,6 +152,10 @@ parseInitFile(const string &filename)
 #endif
           break;
         }
+        if (in.attribute == "ioengine" && in.type.empty()) {
+          ioengine = in.value;
+          break;
+        }
         if (in.attribute == "font" && in.type.empty()) {
           fontname = in.value;
           break;
@@ -166,6 +172,16 @@ parseInitFile(const string &filename)
 #endif
           break;
         }
+        if (in.attribute == "paint-frame-budget" && in.type.empty()) {
+          // microseconds spend on painting before other events are handled
+          TWindow::setPaintFrameBudget(atoi(in.value.c_str()));
+          break;
+        }
+        if (in.attribute == "backbuffer-limit" && in.type.empty()) {
+          // kilobytes of idle double buffer pixmaps kept in the X server
+          TBitmap::setBackBufferLimit((size_t)atol(in.value.c_str())*1024);
+          break;
+        }
         if (in.attribute == "scrollwheel-slowdown" && in.type.empty()) {
           // the Wacom mouse wheel can send multiple clicks where only
           // one is expected, this is to slow it down for TTextField
@@ -227,6 +243,13 @@ toad::initialize(int argc, char **&argv, char **envv)
       }
       fontengine = argv[++i];
     } else
+    if (strcmp(argv[i], "--io-engine")==0) {
+      if (i+1>=argc) {
+        cerr << "error: missing option for argument " << argv[i] << endl;
+        exit(1);
+      }
+      ioengine = argv[++i];
+    } else
 #endif
       cerr << "unknown option " << argv[i] << endl;
   }
@@ -236,6 +259,10 @@ toad::initialize(int argc, char **&argv, char **envv)
     cerr << "error: unknown font engine '" << fontengine << "', try x11 or freetype" << endl;
     exit(1);
   }
+  if (!ioengine.empty() && !TOADBase::setIOEngineByName(ioengine)) {
+    cerr << "error: unknown io engine '" << ioengine << "', try select or epoll" << endl;
+    exit(1);
+  }
 #endif
   
   toad::argv = argv;
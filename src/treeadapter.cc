@@ -20,6 +20,7 @@
 
 #include <toad/treeadapter.hh>
 #include <toad/dragndrop.hh>
+#include <algorithm>
 
 #define DBM(CMD)
 
@@ -37,35 +38,43 @@ DBM(cout << "TTreeAdapter::getRowHeight for row " << row << endl;)
   }
 
   int y = 17;
-  
+  if (row>=model->getRows())
+    return 0;
+
   unsigned d = model->getRowDepth(row);
-  if(d==0) {
-DBM(
-    cout << "  depth = 0, row is visible => done" << endl;
-    cout << "  btw, the row is " << (table->isRowOpen(row)?"open":"closed") << endl;
-)
-    return y;
-  }
-  while(row>0) {
-    row--;
-    if (model->getRowDepth(row) < d) {
-      if (!table->isRowOpen(row)) {
-        DBM(cout << "  parent is closed, row isn't visible => done" << endl;)
-        return 0;
+  if (model!=parents_model ||
+      model->getSerial()!=parents_serial ||
+      row!=parents_row+1)
+  {
+    parents.clear();
+    size_t r = row;
+    while(r>0 && d>0) {
+      --r;
+      if (model->getRowDepth(r) < d) {
+        parents.push_back(r);
+        d = model->getRowDepth(r);
       }
-      d = model->getRowDepth(row);
-      if (d==0)
-        break;
     }
-  }
-DBM(
-  if (table->isRowOpen(row)) {
-    cout << "  row is open and thus visible => done" << endl;
+    reverse(parents.begin(), parents.end());
+    parents_model = model;
+    parents_serial = model->getSerial();
   } else {
-    cout << "  row isn't open and thus not visible => done" << endl;
+    parents.push_back(row-1);
+    while(!parents.empty() && model->getRowDepth(parents.back()) >= d)
+      parents.pop_back();
   }
-)
-  return !table->isRowOpen(row) ? 0 : y;
+  parents_row = row;
+
+  for(vector<size_t>::const_iterator p = parents.begin();
+      p != parents.end();
+      ++p)
+  {
+    if (!table->isRowOpen(*p)) {
+      DBM(cout << "  parent is closed, row isn't visible => done" << endl;)
+      return 0;
+    }
+  }
+  return y;
 }
 
 size_t
@@ -124,13 +133,16 @@ TTreeAdapter::mouseEvent(TMouseEvent &me, int col, int row, int w, int h)
 //cout << "  TTreeAdapter::mouseEvent" << endl;
   TTreeModel *model = getModel();
 //cout << "    model="<<model<<endl;
-  if (model->_getDown(model->at(row))) {
+  if (model->hasChildren(row)) {
     TRectangle r(model->getRowDepth(row)*12+3-1, 0, 10, h);
     if (!r.isInside(me.x, me.y))
       return;
     DBM(cout << "open/close branch" << endl;)
-    table->setRowOpen(row, !table->isRowOpen(row));
+    bool open = isClosed(row);
+    table->setRowOpen(row, open);
     DBM(cout << table->isRowOpen(row) << endl;)
+    if (open)
+      model->loadChildren(row);
 
     reason = TTreeModel::RESIZED_ROW;
     where  = row+1;
@@ -204,7 +216,8 @@ TTreeAdapter::drawTree(TPen &pen, int row)
   pen.setColor(0,0,0);
 
   // draw `+' or `-' when the node has children
-  if (model->_getDown(model->at(row))) {
+  bool children = model->hasChildren(row);
+  if (children) {
     pen.drawRectangle(d*sx+dx, dy, rs, rs);
     // minus
     pen.drawLine(d*sx+dx+(rs>>2), dy+(rs>>1), d*sx+dx+rs-(rs>>2), dy+(rs>>1)); 
@@ -240,7 +253,7 @@ TTreeAdapter::drawTree(TPen &pen, int row)
           pen.drawLine(i*sx+dx+(rs>>1),0,i*sx+dx+(rs>>1),item_h);
         } else {
           // small line below box
-          if (model->_getDown(model->at(row))) {
+          if (children) {
             // has subtree => start below box
             pen.drawLine(i*sx+dx+(rs>>1),dy+rs,i*sx+dx+(rs>>1),item_h);
           } else {
@@ -257,6 +270,10 @@ TTreeAdapter::drawTree(TPen &pen, int row)
 bool
 TTreeAdapter::isClosed(size_t row)
 {
+  // children which weren't loaded yet
+  TTreeModel *model = getModel();
+  if (model && row<model->getRows() && !model->_getDown(model->at(row)))
+    return true;
   return !table->isRowOpen(row);
 }
 
@@ -30,8 +30,16 @@ class TTreeAdapter:
 {
   protected:
 //    TTreeModel *model;
+
+    // the ancestors of the row last passed to getRowHeight, which
+    // are reused when the rows are requested one after another
+    vector<size_t> parents;
+    size_t parents_row;
+    unsigned parents_serial;
+    TTreeModel *parents_model;
     
   public:
+    TTreeAdapter() { parents_model = 0; }
     virtual TTreeModel* getModel() const = 0;
 //    void setModel(TTreeModel*) = 0;
 
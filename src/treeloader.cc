@@ -0,0 +1,304 @@
+/*
+ * TOAD -- A Simple and Powerful C++ GUI Toolkit for the X Window System
+ * Copyright (C) 1996-2007 by Mark-André Hopf <mhopf@mark13.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA  02111-1307,  USA
+ */
+
+#include <toad/treemodel.hh>
+#include <toad/command.hh>
+#include <toad/workerpool.hh>
+
+#include <deque>
+#include <pthread.h>
+
+using namespace toad;
+
+/*
+ * Loading the children of tree nodes on demand
+ *
+ * TTreeModel::loadChildren() adds a placeholder node as the only child
+ * of the node and queues a TTreeLoad for the TWorkerPool, whose threads
+ * call the model's TTreeChildProvider.
+ *
+ * Finished loads are collected and handed to the message loop with a
+ * single message, which replaces each placeholder with the children
+ * loaded.
+ */
+
+namespace toad {
+
+class TTreeLoad:
+  public TWorkerJob
+{
+  public:
+    // owned by the message loop, 0 when the model was destroyed
+    TTreeModel *model;
+    PTreeChildProvider provider;
+    void *node;
+    void *placeholder;
+    // the node was removed from the model while loading
+    bool dispose;
+
+    // set by the message loop, read by the loader thread
+    bool cancelled;
+
+    // the result
+    void *children;
+
+    void run();
+    void discard();
+    void finish();
+};
+
+/**
+ * Hand the result to the model or delete it when the model is gone.
+ */
+void
+TTreeLoad::finish()
+{
+  if (model) {
+    model->_loaded(this);
+  } else if (children) {
+    provider->_deleteNodes(children);
+  }
+  delete this;
+}
+
+} // namespace toad
+
+namespace {
+
+// finished loads not yet handed to the message loop
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+deque<TTreeLoad*> done;
+
+/**
+ * Hands all finished loads to their models.
+ */
+class TTreeLoadDone:
+  public TCommand
+{
+  public:
+    void execute() {
+      deque<TTreeLoad*> jobs;
+      pthread_mutex_lock(&mutex);
+      jobs.swap(done);
+      pthread_mutex_unlock(&mutex);
+      while(!jobs.empty()) {
+        jobs.front()->finish();
+        jobs.pop_front();
+      }
+    }
+};
+
+} // namespace
+
+void
+TTreeLoad::run()
+{
+  if (!__atomic_load_n(&cancelled, __ATOMIC_ACQUIRE))
+    children = provider->_fetchChildren(node);
+
+  pthread_mutex_lock(&mutex);
+  bool first = done.empty();
+  done.push_back(this);
+  pthread_mutex_unlock(&mutex);
+  if (first)
+    sendMessage(new TTreeLoadDone());
+}
+
+/**
+ * Drop a load which wasn't handed to its model.
+ */
+void
+TTreeLoad::discard()
+{
+  if (model) {
+    model->loads.erase(node);
+    model->placeholders.erase(placeholder);
+  }
+  if (children)
+    provider->_deleteNodes(children);
+  delete this;
+}
+
+/**
+ * Called by the destructor to cancel the loads still running.
+ */
+void
+TTreeModel::_cancelLoads()
+{
+  for(map<void*, TTreeLoad*>::iterator p = loads.begin();
+      p != loads.end();
+      ++p)
+  {
+    if (p->second) {
+      p->second->model = 0;
+      __atomic_store_n(&p->second->cancelled, true, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+/**
+ * Returns 'true' when the node in 'row' has children or may have
+ * children which weren't loaded yet.
+ */
+bool
+TTreeModel::hasChildren(size_t row) const
+{
+  if (row>=rows->size())
+    return false;
+  void *node = (*rows)[row].node;
+  if (_getDown(node))
+    return true;
+  return provider &&
+         loads.find(node)==loads.end() &&
+         provider->_hasChildren(node);
+}
+
+/**
+ * Returns 'true' when 'row' is a placeholder for children which are
+ * being loaded.
+ */
+bool
+TTreeModel::isPlaceholder(size_t row) const
+{
+  if (row>=rows->size())
+    return false;
+  return placeholders.find((*rows)[row].node)!=placeholders.end();
+}
+
+/**
+ * Start to load the children of the node in 'row' with the child
+ * provider.
+ *
+ * A placeholder node is added as the node's only child until the
+ * children were loaded.
+ *
+ * \return 'true' when loading was started
+ */
+bool
+TTreeModel::loadChildren(size_t row)
+{
+  if (!provider || row>=rows->size())
+    return false;
+  void *node = (*rows)[row].node;
+  if (_getDown(node) ||
+      loads.find(node)!=loads.end() ||
+      !provider->_hasChildren(node))
+  {
+    return false;
+  }
+
+  TTreeLoad *job = new TTreeLoad;
+  job->model = this;
+  job->provider = provider;
+  job->node = node;
+  job->placeholder = _createNode();
+  job->dispose = false;
+  job->cancelled = false;
+  job->children = 0;
+  loads[node] = job;
+  placeholders.insert(job->placeholder);
+  _setDown(node, job->placeholder);
+  _insertSubtree(row+1, 0, job->placeholder, (*rows)[row].depth+1);
+
+  if (!TWorkerPool::submit(job)) {
+    // no thread, no background
+    job->children = provider->_fetchChildren(node);
+    job->finish();
+  }
+  return true;
+}
+
+/**
+ * Called by deleteRow when the node of 'job' is removed from the tree.
+ *
+ * \return 'true' when the node is still in use by a loader thread and
+ *   will be deleted afterwards
+ */
+bool
+TTreeModel::_disposeLoad(TTreeLoad *job)
+{
+  if (!job)
+    return false;
+  job->dispose = true;
+  __atomic_store_n(&job->cancelled, true, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+ * Replace the placeholder of a finished load with the children loaded.
+ */
+void
+TTreeModel::_loaded(TTreeLoad *job)
+{
+  size_t row = whereIs(job->placeholder);
+  if (row!=(size_t)-1)
+    deleteRow(row);
+  placeholders.erase(job->placeholder);
+
+  if (job->dispose) {
+    if (job->children)
+      job->provider->_deleteNodes(job->children);
+    _deleteNode(job->node);
+    return;
+  }
+  loads[job->node] = 0;
+  if (!job->children)
+    return;
+
+  row = whereIs(job->node);
+  if (row==(size_t)-1) {
+    job->provider->_deleteNodes(job->children);
+    return;
+  }
+
+  // append the children to those the node might have got meanwhile
+  void *last = _getDown(job->node);
+  if (last) {
+    while(_getNext(last))
+      last = _getNext(last);
+    _setNext(last, job->children);
+  } else {
+    _setDown(job->node, job->children);
+  }
+  _insertList(_getSubtreeEnd(row), job->children, (*rows)[row].depth+1);
+}
+
+/**
+ * Set the maximal number of loader threads, see TWorkerPool::setThreads.
+ */
+void
+TTreeModel::setLoaderThreads(unsigned n)
+{
+  TWorkerPool::setThreads(n);
+}
+
+/**
+ * Drop the loads which finished after the message loop stopped. Called
+ * by TOADBase::terminate after TWorkerPool::terminate.
+ */
+void
+TTreeModel::terminateLoader()
+{
+  while(!done.empty()) {
+    TTreeLoad *job = done.front();
+    done.pop_front();
+    job->discard();
+  }
+}
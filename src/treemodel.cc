@@ -23,9 +23,197 @@
 
 using namespace toad;
 
-#define AUTOMATIC_UPDATE
 #define DBM(CMD)
 
+namespace toad {
+
+/**
+ * The row of each node in TTreeModel::rows.
+ *
+ * The nodes are kept in row order in a treap, where each item knows
+ * the size of its subtree and its parent. The row of a node is the
+ * number of items left of it, found by walking up to the root. Rows
+ * can be inserted and removed in O(log n) without renumbering the
+ * rows below.
+ */
+class TTreeRowIndex
+{
+  public:
+    TTreeRowIndex() { root = 0; seed = 0x9e3779b9; valid = false; }
+    ~TTreeRowIndex() { clear(); }
+
+    //! when 'false', the index has to be rebuilt before the next find()
+    bool valid;
+
+    void clear();
+    void insert(size_t row, void *node);
+    void erase(void *node);
+    size_t find(void *node) const;
+
+  protected:
+    struct TItem {
+      TItem *left, *right, *parent;
+      size_t size;
+      unsigned priority;
+      void *node;
+    };
+    TItem *root;
+    map<void*, TItem*> items;
+    unsigned seed;
+
+    static size_t size(TItem *t) { return t ? t->size : 0; }
+    static void update(TItem *t);
+    static void split(TItem *t, size_t n, TItem **l, TItem **r);
+    static TItem* merge(TItem *l, TItem *r);
+    static void free(TItem *t);
+};
+
+} // namespace toad
+
+void
+TTreeRowIndex::update(TItem *t)
+{
+  t->size = 1 + size(t->left) + size(t->right);
+  if (t->left)
+    t->left->parent = t;
+  if (t->right)
+    t->right->parent = t;
+}
+
+// split 't' into the first 'n' items 'l' and the remaining items 'r'
+void
+TTreeRowIndex::split(TItem *t, size_t n, TItem **l, TItem **r)
+{
+  if (!t) {
+    *l = *r = 0;
+    return;
+  }
+  if (size(t->left) < n) {
+    split(t->right, n - size(t->left) - 1, &t->right, r);
+    update(t);
+    *l = t;
+  } else {
+    split(t->left, n, l, &t->left);
+    update(t);
+    *r = t;
+  }
+}
+
+TTreeRowIndex::TItem*
+TTreeRowIndex::merge(TItem *l, TItem *r)
+{
+  if (!l)
+    return r;
+  if (!r)
+    return l;
+  if (l->priority > r->priority) {
+    l->right = merge(l->right, r);
+    update(l);
+    return l;
+  }
+  r->left = merge(l, r->left);
+  update(r);
+  return r;
+}
+
+void
+TTreeRowIndex::free(TItem *t)
+{
+  if (!t)
+    return;
+  free(t->left);
+  free(t->right);
+  delete t;
+}
+
+void
+TTreeRowIndex::clear()
+{
+  free(root);
+  root = 0;
+  items.clear();
+}
+
+void
+TTreeRowIndex::insert(size_t row, void *node)
+{
+  if (!valid)
+    return;
+  TItem *t = new TItem;
+  t->left = t->right = t->parent = 0;
+  t->size = 1;
+  // xorshift
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  t->priority = seed;
+  t->node = node;
+  items[node] = t;
+
+  TItem *l, *r;
+  split(root, row, &l, &r);
+  root = merge(merge(l, t), r);
+  root->parent = 0;
+}
+
+void
+TTreeRowIndex::erase(void *node)
+{
+  if (!valid)
+    return;
+  map<void*, TItem*>::iterator p = items.find(node);
+  if (p==items.end())
+    return;
+  size_t row = find(node);
+  items.erase(p);
+
+  TItem *l, *m, *r;
+  split(root, row, &l, &r);
+  split(r, 1, &m, &r);
+  delete m;
+  root = merge(l, r);
+  if (root)
+    root->parent = 0;
+}
+
+size_t
+TTreeRowIndex::find(void *node) const
+{
+  map<void*, TItem*>::const_iterator p = items.find(node);
+  if (p==items.end())
+    return (size_t)-1;
+  TItem *t = p->second;
+  size_t row = size(t->left);
+  while(t->parent) {
+    if (t==t->parent->right)
+      row += size(t->parent->left) + 1;
+    t = t->parent;
+  }
+  return row;
+}
+
+TTreeModel::TTreeModel()
+{
+  rows = new vector<TRow>;
+  index = new TTreeRowIndex;
+  serial = 0;
+}
+
+TTreeModel::TTreeModel(const TTreeModel &m)
+{
+  rows = new vector<TRow>;
+  index = new TTreeRowIndex;
+  serial = 0;
+}
+
+TTreeModel::~TTreeModel()
+{
+  _cancelLoads();
+  if (rows)
+    delete rows;
+  delete index;
+}
+
 /**
  * Update the models internal data structure in case the tree was
  * modified. The method will detect simple add and remove modifications
@@ -53,6 +241,8 @@ TTreeModel::update(bool signal)
 
   vector<TRow> *orows = rows;
   rows = new vector<TRow>();
+  index->valid = false;
+  ++serial;
   // rows->clear();
   _update(0, 0);
 
@@ -279,54 +469,163 @@ TTreeModel::_update(void *ptr, unsigned depth)
   }
 }
 
+/**
+ * Return the row of node 'ptr' or (size_t)-1 when the node isn't part
+ * of the tree.
+ *
+ * The node to row index is kept up to date by the methods which insert
+ * and delete rows and rebuilt after update() and reorder().
+ */
 size_t
 TTreeModel::whereIs(void *ptr) const
 {
-  size_t i = 0;
-  for(vector<TRow>::const_iterator p = rows->begin();
-      p != rows->end();
-      ++p)
-  {
-    if (p->node == ptr)
-      return i;
-    ++i;
+  if (!index->valid) {
+    index->clear();
+    index->valid = true;
+    for(size_t i=0; i<rows->size(); ++i)
+      index->insert(i, (*rows)[i].node);
+  }
+  return index->find(ptr);
+}
+
+/**
+ * Return the first row after the subtree of 'row'.
+ */
+size_t
+TTreeModel::_getSubtreeEnd(size_t row) const
+{
+  unsigned d = (*rows)[row].depth;
+  for(++row; row<rows->size() && (*rows)[row].depth>d; ++row)
+    ;
+  return row;
+}
+
+/**
+ * Return the row of the node which links to 'row', either the previous
+ * sibling with 'next' or the parent with 'down', or (size_t)-1 for the
+ * root node.
+ */
+size_t
+TTreeModel::_findLink(size_t row) const
+{
+  unsigned d = (*rows)[row].depth;
+  while(row>0) {
+    --row;
+    if ((*rows)[row].depth<=d)
+      return row;
   }
   return (size_t)-1;
 }
 
+namespace {
+
+struct TFlatten
+{
+  TTreeModel *model;
+  vector<pair<void*, unsigned> > out;
+  void down(void *ptr, unsigned depth) {
+    while(ptr) {
+      out.push_back(make_pair(ptr, depth));
+      void *d = model->_getDown(ptr);
+      if (d)
+        down(d, depth+1);
+      ptr = model->_getNext(ptr);
+    }
+  }
+};
+
+} // namespace
+
+/**
+ * Flatten the new 'node' with its children at 'depth' into the rows.
+ *
+ * The node is inserted at 'row' while the following 'count' rows are
+ * already its children, which were moved one level down.
+ */
+void
+TTreeModel::_insertSubtree(size_t row, size_t count, void *node, unsigned depth)
+{
+  TFlatten f;
+  f.model = this;
+  f.out.push_back(make_pair(node, depth));
+  void *d = _getDown(node);
+  if (d)
+    f.down(d, depth+1);
+
+  ++serial;
+  size_t n = f.out.size() - count;
+  rows->insert(rows->begin()+row, n, TRow(0, 0));
+  for(size_t i=0; i<f.out.size(); ++i) {
+    (*rows)[row+i].node  = f.out[i].first;
+    (*rows)[row+i].depth = f.out[i].second;
+  }
+  // the following 'count' rows were already in the index
+  for(size_t i=0; i<n; ++i)
+    index->insert(row+i, f.out[i].first);
+
+  reason = INSERT_ROW;
+  where  = row;
+  size   = n;
+  sigChanged();
+  if (count) {
+    reason = RESIZED_ROW;
+    where  = row + n;
+    size   = count;
+    sigChanged();
+  }
+}
+
+/**
+ * Flatten 'first' and its siblings with their children at 'depth' into
+ * the rows at 'row'.
+ */
+void
+TTreeModel::_insertList(size_t row, void *first, unsigned depth)
+{
+  TFlatten f;
+  f.model = this;
+  f.down(first, depth);
+  if (f.out.empty())
+    return;
+
+  ++serial;
+  rows->insert(rows->begin()+row, f.out.size(), TRow(0, 0));
+  for(size_t i=0; i<f.out.size(); ++i) {
+    (*rows)[row+i].node  = f.out[i].first;
+    (*rows)[row+i].depth = f.out[i].second;
+    index->insert(row+i, f.out[i].first);
+  }
+
+  reason = INSERT_ROW;
+  where  = row;
+  size   = f.out.size();
+  sigChanged();
+}
+
 size_t
 TTreeModel::addBefore(size_t row)
 {
-// if (!getRoot()) return 0;
-
   void *nn = _createNode();
-  // nn->name = number();
+  unsigned depth = 0;
 
   if (!rows->empty()) {
+    if (row>=rows->size())
+      row = rows->size()-1;
     // find parent (either down or next)
     void *dn = (*rows)[row].node;
-    void *pn;
-    vector<TRow>::iterator p;
-    for(p = rows->begin();
-        p != rows->end();
-        ++p)
-    {
-      pn = p->node;
+    depth = (*rows)[row].depth;
+    size_t link = _findLink(row);
+    if (link!=(size_t)-1) {
+      void *pn = (*rows)[link].node;
       if (_getNext(pn) == dn) {
         DBM(cout << "before next" << endl;)
         _setNext(pn, nn);
-        _setNext(nn, dn);
-        break;
-      }
-      if (_getDown(pn) == dn) {
+      } else {
         DBM(cout << "before down" << endl;)
         _setDown(pn, nn);
-        _setNext(nn, dn);
-        break;
       }
-    }
-
-    if (p==rows->end()) {
+      _setNext(nn, dn);
+    } else {
       _setNext(nn, _getRoot());
       _setRoot(nn);
       row = 0;
@@ -337,149 +636,107 @@ TTreeModel::addBefore(size_t row)
   }
 
 DBM(cout << "insert 4: where=" << row << ", size=1" << endl;)
-#ifdef AUTOMATIC_UPDATE
-  return update();
-#else
-  update(false);
-  reason = INSERT_ROW;
-  where = row;
-  size = 1;
-  sigChanged();
+  _insertSubtree(row, 0, nn, depth);
   return row;
-#endif
 }
 
 size_t 
 TTreeModel::addBelow(size_t row)
 {
-//  if (!_root) return 0;
-//  cout << p->name << endl;
   void *np = _createNode();
+  unsigned depth = 0;
 
   if (!rows->empty()) {
-    if (row>rows->size()) {
+    if (row>=rows->size()) {
       cout << "TTreeModel::addBelow(" << row << ") is out of range" << endl;
+      _deleteNode(np);
       return rows->size();
     }
     void *p = (*rows)[row].node;
     if (!p) {
       cout << "TTreeModel::addBelow: row contains no node" << endl;
+      _deleteNode(np);
       return row;
     }
     _setNext(np, _getNext(p));
     _setNext(p, np);
+    depth = (*rows)[row].depth;
+    row = _getSubtreeEnd(row);
   } else {
     _setRoot(np);
+    row = 0;
   }
 
-DBM(cout << "model: insert 3: where=" << whereIs(np) << ", size=1" << endl;)
-#ifdef AUTOMATIC_UPDATE
-  return update();
-#else
-  update(false);
-  reason = INSERT_ROW;
-  where = whereIs(np);
-  size = 1;
-DBM(cout << "model " << this << ": trigger signal" << endl;)
-  sigChanged();
-  return where;
-#endif
+DBM(cout << "model: insert 3: where=" << row << ", size=1" << endl;)
+  _insertSubtree(row, 0, np, depth);
+  return row;
 }
 
 size_t
 TTreeModel::addTreeBelow(size_t row)
 {
-//  if (!_root) return 0;
-
-//  cout << p->name << endl;
   void *np = _createNode();
+  unsigned depth = 0;
+  size_t count = 0;
 
   if (!rows->empty()) {
-    if (row>rows->size()) {
+    if (row>=rows->size()) {
       cout << "warning: TTreeModel::addTreeBelow("<<row<<") is out of range, using end" << endl;
       row = rows->size()-1;
     }
     void *p = (*rows)[row].node;
     _setDown(np, _getDown(p));
     _setDown(p, np);
+    depth = (*rows)[row].depth + 1;
+    count = _getSubtreeEnd(row) - row - 1;
+    ++row;
   } else {
     _setRoot(np);
+    row = 0;
   }
   
-DBM(cout << "insert 1: where=" << (row+1) << ", size=1" << endl;)
-#ifdef AUTOMATIC_UPDATE
-  return update();
-#else
-  update(false);
-  type = INSERT_ROW;
-  where = row+1;
-  size = 1;
-  sigChanged();
-  return row+1;
-#endif
+DBM(cout << "insert 1: where=" << row << ", size=1" << endl;)
+  _insertSubtree(row, count, np, depth);
+  return row;
 }
 
 size_t
 TTreeModel::addTreeBefore(size_t row)
 {
-//  if (!_root) return 0;
-
-cout << __PRETTY_FUNCTION__ << endl;
   void *nn = _createNode();
-//  nn->name = number();
+  unsigned depth = 0;
+  size_t count = 0;
 
   if (!rows->empty()) {
-#if 0
-    // approach: find first and last of selection and use 'em for
-    // insert, in case there's no selection model, first & last are
-    // the same
-    void *first, *last;
-    if (sm) {
-      size_t idx;
-      idx = row;
-      while(idx>0 && sm->isSelected(0,idx-1))
-         --idx;
-      first = (*rows)[idx].node;
-      idx = row;
-      while(idx+1<rows->size() && sm->isSelected(0,idx+1))
-         ++idx;
-      last = (*rows)[idx].node;
-    } else {
-      first = last = (*rows)[row].node;
-    }
-#else
-    void *first, *last;
-    first = last = (*rows)[row].node;
-#endif
+    if (row>=rows->size())
+      row = rows->size()-1;
+    void *first = (*rows)[row].node;
+    depth = (*rows)[row].depth;
 
     // find parent (either down or next)
-    // TPlainSlide *dn = static_cast<TPlainSlide*>((*rows)[row].node);
-    void *pn;
-    vector<TRow>::iterator p;
-    for(p = rows->begin();
-        p != rows->end();
-        ++p)
-    {
-      pn = p->node;
+    size_t link = _findLink(row);
+    if (link!=(size_t)-1) {
+      void *pn = (*rows)[link].node;
       if (_getNext(pn) == first) {
         DBM(cout << "before next" << endl;)
         _setNext(pn, nn);
-        _setNext(nn, _getNext(last));
+        _setNext(nn, _getNext(first));
         _setDown(nn, first);
-        _setNext(last, 0);
-        break;
-      } else
-      if (_getDown(pn) == first) {
+        _setNext(first, 0);
+        count = _getSubtreeEnd(row) - row;
+      } else {
         DBM(cout << "before down" << endl;)
+        // 'first' and all its following siblings become children of 'nn'
         _setDown(pn, nn);
         _setDown(nn, first);
-        break;
+        count = _getSubtreeEnd(link) - row;
       }
-    }
-    if (p==rows->end()) {
+    } else {
+      // the whole tree becomes a child of 'nn'
       _setDown(nn, _getRoot());
       _setRoot(nn);
       row = 0;
+      count = rows->size();
     }
   } else {
     _setRoot(nn);
@@ -487,105 +744,92 @@ cout << __PRETTY_FUNCTION__ << endl;
   }
 
 DBM(cout << "insert 2: where=" << row << ", size=1" << endl;)
-#ifdef AUTOMATIC_UPDATE
-  return update();
-#else
-  update(false);
-  type = INSERT_ROW;
-  where = row;
-  size = 1;
-  sigChanged();
+  _insertSubtree(row, count, nn, depth);
   return row;
-#endif
 }
 
 size_t
 TTreeModel::deleteRow(size_t row)
 {
-  // if (!_root) return 0;
-
   if (row>=rows->size()) {
     DBM(cout << "nothin' to delete" << endl;)
     return row;
   }
 
   void *dn = (*rows)[row].node;
+  unsigned depth = (*rows)[row].depth;
+
+  // a node whose children are being loaded is deleted after loading
+  bool loading = false;
+  map<void*, TTreeLoad*>::iterator l = loads.find(dn);
+  if (l!=loads.end()) {
+    loading = _disposeLoad(l->second);
+    loads.erase(l);
+  }
+  placeholders.erase(dn);
+
+  // children of the removed node move up one level into its place
+  void *replacement = _getNext(dn);
+  void *down = _getDown(dn);
+  if (down) {
+    void *pn = down;
+    while(_getNext(pn))
+      pn = _getNext(pn);
+    _setNext(pn, _getNext(dn));
+    replacement = down;
+  }
 
   // find parent (either down or next)
-  void *pn;
-  vector<TRow>::iterator p;
-  for(p = rows->begin();
-      p != rows->end();
-      ++p)
-  {
-    pn = p->node;
-    // parent has us in 'next'
+  size_t link = _findLink(row);
+  if (link!=(size_t)-1) {
+    void *pn = (*rows)[link].node;
     if (_getNext(pn) == dn) {
       DBM(cout << "next" << endl;)
-      if (!_getDown(dn)) {
-        _setNext(pn, _getNext(dn));
-      } else {
-        // attention: when dn is closed, we need to resize the children!!
-        _setNext(pn, _getDown(dn));
-        pn = _getDown(dn);
-        while(_getNext(pn)) {
-          pn = _getNext(pn);
-        }
-        _setNext(pn, _getNext(dn));
-      }
-      break;
-    }
-    // parent has us in 'down'
-    if (_getDown(pn) == dn) {
+      _setNext(pn, replacement);
+    } else {
       DBM(cout << "down" << endl;)
-      if (!_getDown(dn)) {
-        _setDown(pn, _getNext(dn));
-      } else {
-        // attention: when dn is closed, we need to resize the children!!
-        _setDown(pn, _getDown(dn));
-        pn = _getDown(dn);
-        while(_getNext(pn)) {
-          pn = _getNext(pn);
-        }
-        _setNext(pn, _getNext(dn));
-      }
-      break;
+      _setDown(pn, replacement);
     }
-  }
-  if (p==rows->end()) {
+  } else {
     DBM(cout << "delete without a parent" << endl;)
-    if (_getRoot()) {
-      dn = _getRoot();
-      if (_getDown(dn)) {
-        DBM(cout << "  found a down" << endl;)
-        pn = _getDown(dn);
-        while(_getNext(pn))
-          pn = _getNext(pn);
-        _setNext(pn, _getNext(dn));
-        _setRoot(_getDown(dn));
-      } else {
-        _setRoot(_getNext(dn));
-      }
-    } else {
-      DBM(cout << "found no parent" << endl;)
-      return row;
+    _setRoot(replacement);
+  }
+
+  // place the cursor on the row above when the removed node was the
+  // last one of its parent
+  size_t cy = row;
+  if (row>0) {
+    if (row+1>=rows->size()) {
+      cy = rows->size() - 2;
+    } else
+    if (depth > (*rows)[row+1].depth) {
+      --cy;
     }
-//    exit(0);
   }
 
+  size_t end = _getSubtreeEnd(row);
+  ++serial;
+  rows->erase(rows->begin()+row);
+  --end;
+  for(size_t i=row; i<end; ++i)
+    --(*rows)[i].depth;
+  index->erase(dn);
+
   // inform listeners, that we're going to delete the entry, then delete it
   DBM(cout << "remove: where=" << row << ", size=1" << endl;)
-#ifdef AUTOMATIC_UPDATE
-  row = update();
-#else
-  update(false);
-  type = REMOVED_ROW;
-  where = row;
-  size = 1;
+  reason = REMOVED_ROW;
+  where  = row;
+  size   = 1;
   sigChanged();
-#endif
-  _deleteNode(dn);
-  return row;
+  if (end>row) {
+    reason = RESIZED_ROW;
+    where  = row;
+    size   = end - row;
+    sigChanged();
+  }
+  if (!loading)
+    _deleteNode(dn);
+  return cy;
 }
 
 /**
@@ -734,6 +978,9 @@ cout << "after: rows->size()=" << rows->size() << endl;
     cout << i << ": " << (*rows)[i].depth << " " << (*rows)[i].node << endl;
   }
 */
+  index->valid = false;
+  ++serial;
+
   // 2nd: construct a new tree based on the 'rows' table
   for(size_t i=0; i<rows->size(); ++i) {
     _setNext((*rows)[i].node, 0);
@@ -22,9 +22,33 @@
 #define _TOAD_TREEMODEL_HH 1
 
 #include <toad/table.hh>
+#include <map>
+#include <set>
 
 namespace toad {
 
+class TTreeLoad;
+class TTreeRowIndex;
+
+/**
+ * Provides the children of tree nodes which are loaded on demand.
+ *
+ * \sa TTreeModel::setChildProvider, GTreeChildProvider
+ */
+class TTreeChildProvider:
+  public TSmartObject
+{
+  public:
+    //! 'true' when 'node' may have children which weren't loaded yet
+    virtual bool _hasChildren(void *node) = 0;
+    //! called from a loader thread to create the children of 'node'
+    virtual void* _fetchChildren(void *node) = 0;
+    //! delete the list of nodes returned by _fetchChildren
+    virtual void _deleteNodes(void *first) = 0;
+};
+
+typedef GSmartPointer<TTreeChildProvider> PTreeChildProvider;
+
 class TTreeModel:
   public TTableModel
 {
@@ -39,12 +63,36 @@ class TTreeModel:
     };
     vector<TRow> *rows;
 
+    // node -> row
+    TTreeRowIndex *index;
+    unsigned serial;
+
+    size_t _getSubtreeEnd(size_t row) const;
+    size_t _findLink(size_t row) const;
+    void _insertSubtree(size_t row, size_t count, void *node, unsigned depth);
+    void _insertList(size_t row, void *first, unsigned depth);
+
+    friend class TTreeLoad;
+    PTreeChildProvider provider;
+    // nodes whose children were loaded (0) or are being loaded
+    map<void*, TTreeLoad*> loads;
+    set<void*> placeholders;
+    void _loaded(TTreeLoad*);
+    void _cancelLoads();
+    static bool _disposeLoad(TTreeLoad*);
+
   public:
-    TTreeModel() { rows = new vector<TRow>; }
-    TTreeModel(const TTreeModel &m) {
-       rows = new vector<TRow>;
-    }
-    ~TTreeModel() { if (rows) delete rows; }
+    TTreeModel();
+    TTreeModel(const TTreeModel &m);
+    ~TTreeModel();
+
+    void setChildProvider(TTreeChildProvider *p) { provider = p; }
+    TTreeChildProvider* getChildProvider() const { return provider; }
+    bool hasChildren(size_t row) const;
+    bool isPlaceholder(size_t row) const;
+    bool loadChildren(size_t row);
+    static void setLoaderThreads(unsigned n);
+    static void terminateLoader();
     
     size_t addBefore(size_t row);
     size_t addBelow(size_t row);
@@ -70,6 +118,8 @@ class TTreeModel:
     }
     size_t update(bool signal=true);
     void _update(void *ptr, unsigned depth);
+    //! incremented whenever the rows were modified
+    unsigned getSerial() const { return serial; }
 
     bool empty() const { return rows->empty(); }
     // size_t size() const { return rows->size(); }
@@ -111,6 +161,35 @@ class GTreeModel:
     void setRoot(void *n) { root = static_cast<T*>(n); }
 };
 
+/**
+ * A template child provider for GTreeModel<T>.
+ *
+ * fetchChildren is called from a loader thread and must not modify
+ * nodes which are already part of the tree.
+ */
+template <class T>
+class GTreeChildProvider:
+  public TTreeChildProvider
+{
+  public:
+    //! 'true' when 'node' may have children
+    virtual bool hasChildren(T *node) = 0;
+    //! return the first child of 'node', the others linked by 'next'
+    virtual T* fetchChildren(T *node) = 0;
+
+    bool _hasChildren(void *n) { return hasChildren(static_cast<T*>(n)); }
+    void* _fetchChildren(void *n) { return fetchChildren(static_cast<T*>(n)); }
+    void _deleteNodes(void *n) {
+      T *p = static_cast<T*>(n);
+      while(p) {
+        T *next = p->next;
+        _deleteNodes(p->down);
+        delete p;
+        p = next;
+      }
+    }
+};
+
 } // namespace toad
 
 #endif
@@ -48,3 +48,26 @@ TUndo::getRedoName(string *name) const
   return false;
 }
 
+/**
+ * Merge 'undo', which was registered for the same model right after this
+ * one, into this object, ie. to combine the undo events for each
+ * character typed into a single one.
+ *
+ * \return
+ *   'true' when 'undo' was merged and isn't needed anymore.
+ */
+bool
+TUndo::merge(TUndo *undo)
+{
+  return false;
+}
+
+/**
+ * An estimate of the memory kept by this object, used by TUndoManager
+ * to limit the size of the undo history.
+ */
+size_t
+TUndo::getMemoryUsage() const
+{
+  return sizeof(TUndo);
+}
@@ -22,6 +22,7 @@
 #define _TOAD_UNDO_HH
 
 #include <string>
+#include <cstddef>
 
 namespace toad {
 
@@ -35,6 +36,8 @@ class TUndo
     virtual void undo() = 0;
     virtual bool getUndoName(std::string *name) const;
     virtual bool getRedoName(std::string *name) const;
+    virtual bool merge(TUndo *undo);
+    virtual size_t getMemoryUsage() const;
     static unsigned counter;
     unsigned serial;
 }; 
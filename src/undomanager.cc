@@ -19,6 +19,7 @@
  */
 
 #include <vector>
+#include <deque>
 #include <toad/undomanager.hh>
 
 #define DBM(CMD)
@@ -51,8 +52,11 @@ using namespace toad;
  *   \li static methods which allow a window to call undo/redo
  *   \li static methods which allow a model to call undo/redo
  *   \li handle overflow of TUndo::serial counter
- *   \li limit number of stored undo event to a given maximum
- *       (to avoid huge memory consumption)
+ *
+ * The undo history of each undomanager is limited by setMemoryLimit,
+ * and undo events registered in a row for the same model are merged
+ * with TUndo::merge when they belong to the same undo group, ie. the
+ * characters typed into a TTextModel.
  */
 
 // How this stuff is organized:
@@ -82,16 +86,26 @@ TUndoManagerStore undomanagers;
 class toad::TModelUndoStore
 {
   public:
+    TModelUndoStore() { memory = 0; }
+  
     // undomanager for the model
     TUndoManagerStore undomanagers;
 
     // undo/redo objects for the model
-    typedef vector<TUndo*> TUndoStack;
+    typedef deque<TUndo*> TUndoStack;
     TUndoStack undostack, redostack;  
+    
+    // memory used by the undo/redo objects
+    size_t memory;
 
     void addUndo(TModel *model, TUndo *undo);
     void clearRedo();
     void clear(TModel *model);
+
+    void push(TUndoStack &stack, TUndo *undo);
+    TUndo* pop(TUndoStack &stack);
+    TUndo* popOldest();
+    void account(size_t add, size_t sub);
 };
 
 namespace {
@@ -99,6 +113,9 @@ namespace {
 typedef map<TModel*, TModelUndoStore> TModelStore;
 TModelStore models;
 
+// number of objects in all redo stacks
+size_t redoentries = 0;
+
 } // namespace
 
 /**
@@ -130,6 +147,8 @@ void
 TUndoManager::init()
 {
   undoing = redoing = false;
+  memory = 0;
+  memorylimit = 32*1024*1024;
   undomanagers.insert(this);
   
   connect(undo->sigClicked, this, &TUndoManager::doUndo);
@@ -206,7 +225,8 @@ TUndoManager::registerModel(TWindow *window, TModel *model)
     models[model].undomanagers.insert(*p);
   } else {
     DBM(cerr << "  insert to existing TModelUndoStore" << endl;)
-    q->second.undomanagers.insert(*p);
+    if (q->second.undomanagers.insert(*p).second)
+      (*p)->memory += q->second.memory;
   }
   return true;
 }
@@ -312,6 +332,7 @@ TUndoManager::unregisterModel(TWindow *window, TModel *model)
   }
   
   q->second.undomanagers.erase(s);
+  (*p)->memory -= q->second.memory;
   DBM(
     cerr << "    ok" << endl;
     cerr << "  done" << endl;)
@@ -358,6 +379,11 @@ struct TUndoGroup
   TUndoGroupVector nested;
   TModelSet models;
   
+  ~TUndoGroup() {
+    for(TUndoGroupVector::iterator p=nested.begin(); p!=nested.end(); ++p)
+      delete *p;
+  }
+  
   /**
    * \param back
    *    true=undo, false=redo
@@ -376,6 +402,7 @@ TModel *span_undogroup = 0;
 void
 TUndoManager::terminate()
 {
+  redoentries = 0;
   models.clear();
   undomanagers.clear();
   groupstack.clear();
@@ -586,6 +613,7 @@ TUndoManager::doIt(bool back)
         
         (*p)->undo(back);
         foundgroup = true;
+        delete *p;
         if (back)
           undogroups.erase(p);
         else
@@ -600,9 +628,9 @@ TUndoManager::doIt(bool back)
     if (!foundgroup) {
       // remove undo object from model
       if (back) {
-        pms->second.undostack.pop_back();
+        pms->second.pop(pms->second.undostack);
       } else {
-        pms->second.redostack.pop_back();
+        pms->second.pop(pms->second.redostack);
       }
       // execute undo
       undo->undo();
@@ -698,9 +726,9 @@ TUndoGroup::undo(bool back)
     }
     DBM(cerr << "  undo object inside group" << endl;)
     if (back)
-      pms->second.undostack.pop_back();
+      pms->second.pop(pms->second.undostack);
     else
-      pms->second.redostack.pop_back();
+      pms->second.pop(pms->second.redostack);
     undo->undo();
     delete undo;
   }
@@ -836,6 +864,85 @@ TUndoManager::canRedo() const
   return false;
 }
 
+/**
+ * Limit the memory used by the undo/redo history of the models managed
+ * by this undomanager. When the limit is exceeded, the oldest undo groups
+ * are dropped. The default is 32MB.
+ */
+void
+TUndoManager::setMemoryLimit(size_t bytes)
+{
+  memorylimit = bytes;
+  if (memory > memorylimit)
+    trim();
+}
+
+/**
+ * Drop the oldest undo events until the memory limit is met again.
+ */
+void
+TUndoManager::trim()
+{
+  while(memory > memorylimit) {
+    // find the oldest undo event
+    TModelStore::iterator pms = models.end();
+    for(TModelSet::iterator p=mmodels.begin();
+        p!=mmodels.end();
+        ++p)
+    {
+      TModelStore::iterator q = models.find(*p);
+      assert(q!=models.end());
+      if (q->second.undostack.empty())
+        continue;
+      if (pms==models.end() ||
+          q->second.undostack.front()->serial < 
+            pms->second.undostack.front()->serial)
+      {
+        pms = q;
+      }
+    }
+    if (pms==models.end())
+      break;
+    unsigned serial = pms->second.undostack.front()->serial;
+    
+    // keep the events of the group still open
+    if (!groupstack.empty() && groupstack[0]->start <= serial)
+      break;
+      
+    // drop the whole undo group the event belongs to
+    TUndoGroupVector::iterator g;
+    for(g=undogroups.begin(); g!=undogroups.end(); ++g) {
+      if ((*g)->start > serial) {
+        g = undogroups.end();
+        break;
+      }
+      if (serial < (*g)->end)
+        break;
+    }
+    if (g==undogroups.end()) {
+      delete pms->second.popOldest();
+      continue;
+    }
+    for(TModelSet::iterator p=(*g)->models.begin();
+        p!=(*g)->models.end();
+        ++p)
+    {
+      TModelStore::iterator q = models.find(*p);
+      if (q==models.end())
+        continue;
+      while(!q->second.undostack.empty() &&
+            q->second.undostack.front()->serial < (*g)->end)
+      {
+        delete q->second.popOldest();
+      }
+    }
+    delete *g;
+    undogroups.erase(g);
+  }
+  if (!canUndo())
+    undo->setEnabled(false);
+}
+
 // Redo Conflict:
 // When adding a new undo event, the redo stack of the model must
 // be cleared. The question then is what to with the redo stacks
@@ -877,7 +984,10 @@ void
 TModelUndoStore::addUndo(TModel *model, TUndo *undo)
 {
   DBM(cerr << "add undo " << undo << " to model " << model << endl;)
-  if (!TUndoManager::isUndoing() && !TUndoManager::isRedoing()) {   
+  // clearing the redo stacks is only needed when there is something to redo
+  if (!TUndoManager::isUndoing() && !TUndoManager::isRedoing() &&
+      (redoentries>0 || !redogroups.empty()))
+  {   
     DBM(cerr << "  not undoing, clear redostacks" << endl;)
     // step 1: 'undomanagers' contains a list of all undo managers which
     //         manage our current model, since we don't know for which  
@@ -929,6 +1039,7 @@ TModelUndoStore::addUndo(TModel *model, TUndo *undo)
       }
       if ((*p)->models.empty()) {
         DBM(cerr << "deleting empty redogroup" << endl;)
+        delete *p;
         int n = p - redogroups.begin();
         redogroups.erase(p);
         p = redogroups.begin() + n - 1;
@@ -938,8 +1049,24 @@ TModelUndoStore::addUndo(TModel *model, TUndo *undo)
   }  
   assert(undomanagers.begin()!=undomanagers.end());
   if (!TUndoManager::isUndoing()) {
-    DBM(cerr << "add undo to models undostack" << endl;)
-    undostack.push_back(undo);
+    // merge with the previous undo event when it belongs to the innermost
+    // open undo group
+    TUndo *last = undostack.empty() ? 0 : undostack.back();
+    if (last && !TUndoManager::isRedoing() && !groupstack.empty() &&
+        groupstack.back()->start <= last->serial)
+    {
+      size_t size = last->getMemoryUsage();
+      if (last->merge(undo)) {
+        DBM(cerr << "merged undo into " << last << endl;)
+        delete undo;
+        undo = 0;
+        account(last->getMemoryUsage(), size);
+      }
+    }
+    if (undo) {
+      DBM(cerr << "add undo to models undostack" << endl;)
+      push(undostack, undo);
+    }
     for(TUndoManagerStore::iterator p=undomanagers.begin();
         p!=undomanagers.end();
         ++p)
@@ -953,9 +1080,16 @@ TModelUndoStore::addUndo(TModel *model, TUndo *undo)
       }
       TUndoManager::redoing = memo;
     }
+    for(TUndoManagerStore::iterator p=undomanagers.begin();
+        p!=undomanagers.end();
+        ++p)
+    {
+      if ((*p)->memory > (*p)->memorylimit)
+        (*p)->trim();
+    }
   } else {
     DBM(cerr << "add undo to models redostack" << endl;)
-    redostack.push_back(undo);
+    push(redostack, undo);
     for(TUndoManagerStore::iterator p=undomanagers.begin();
         p!=undomanagers.end();
         ++p)
@@ -969,11 +1103,54 @@ TModelUndoStore::addUndo(TModel *model, TUndo *undo)
 void
 TModelUndoStore::clearRedo() {
   while(!redostack.empty()) { 
-    delete redostack.back();
-    redostack.pop_back();     
+    delete pop(redostack);
   }
 }  
 
+void
+TModelUndoStore::push(TUndoStack &stack, TUndo *undo)
+{
+  stack.push_back(undo);
+  if (&stack==&redostack)
+    ++redoentries;
+  account(undo->getMemoryUsage(), 0);
+}
+
+TUndo*
+TModelUndoStore::pop(TUndoStack &stack)
+{
+  TUndo *undo = stack.back();
+  stack.pop_back();
+  if (&stack==&redostack)
+    --redoentries;
+  account(0, undo->getMemoryUsage());
+  return undo;
+}
+
+TUndo*
+TModelUndoStore::popOldest()
+{
+  TUndo *undo = undostack.front();
+  undostack.pop_front();
+  account(0, undo->getMemoryUsage());
+  return undo;
+}
+
+/**
+ * Update the memory used by this model and its undomanagers.
+ */
+void
+TModelUndoStore::account(size_t add, size_t sub)
+{
+  memory = memory + add - sub;
+  for(TUndoManagerStore::iterator p=undomanagers.begin();
+      p!=undomanagers.end();
+      ++p)
+  {
+    (*p)->memory = (*p)->memory + add - sub;
+  }
+}
+
 /**
  * Clears the undo/redo stacks for this model and removes this model
  * from all other TUndoManager::
@@ -985,18 +1162,10 @@ TModelUndoStore::clearRedo() {
 void
 TModelUndoStore::clear(TModel *model)
 {
-  for(TUndoStack::iterator p=undostack.begin();
-      p!=undostack.end();
-      ++p)
-  {
-    delete *p;
-  }
-  for(TUndoStack::iterator p=redostack.begin();
-      p!=redostack.end();
-      ++p)
-  {
-    delete *p;
-  }
+  while(!undostack.empty())
+    delete pop(undostack);
+  while(!redostack.empty())
+    delete pop(redostack);
   for(TUndoManagerStore::iterator p=undomanagers.begin();
       p!=undomanagers.end();
       ++p)
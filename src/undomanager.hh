@@ -70,6 +70,10 @@ class TUndoManager:
     bool canRedo() const;
     void doUndo() { doIt(true); }
     void doRedo() { doIt(false); }
+    
+    void setMemoryLimit(size_t bytes);
+    size_t getMemoryLimit() const { return memorylimit; }
+    size_t getMemoryUsage() const { return memory; }
 
     static bool isUndoing();
     static bool isRedoing();
@@ -78,6 +82,12 @@ class TUndoManager:
   protected:    
     //! models managed by the undomanager
     TModelSet mmodels;
+    
+    //! memory used by the undo/redo objects of 'mmodels'
+    size_t memory;
+    //! drop the oldest undo objects when 'memory' exceeds this limit
+    size_t memorylimit;
+    void trim();
 
     void doIt(bool back);
 
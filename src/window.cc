@@ -49,6 +49,13 @@
  *   TWindow::_dispatchPaintEvent removes a paint event from the paint event
  *   queue and handles it.
  *
+ * \li
+ *   TWindow::_dispatchPaintFrame handles all paint events in the queue at
+ *   once, parents before their children, followed by a single XFlush.
+ *   When the frame takes longer than the paint frame budget, the remaining
+ *   events are left for the next frame so that other events can be handled
+ *   in between.
+ *
  * \todo
  *   \li
  *     Remove the code for X event selection based on overridden virtual
@@ -106,8 +113,11 @@
 using namespace toad;
 
 #include <vector>
-#include <queue>
+#include <deque>
+#include <algorithm>
 #include <map>
+#include <cstring>
+#include <time.h>
 
 // obsolete:
 struct TWndPtrComp
@@ -541,6 +551,8 @@ TWindow::~TWindow()
   // delete children before freeing resources which might be used be them
   deleteChildren();
 
+  TBitmap::invalidateBackBuffers(this);
+
   setToolTip("");
 
   // remove window from paint queue
@@ -566,6 +578,7 @@ TWindow::~TWindow()
   #ifdef __X11__
   if (x11window) {
     XDeleteContext(x11display, x11window, nClassContext);
+    TPen::_forgetDrawable(x11window);
     XDestroyWindow(x11display, x11window);
     x11window = 0;
   }
@@ -1228,6 +1241,7 @@ TWindow::_destroy()
 
 #ifdef __X11__
   XSaveContext(x11display, x11window, nClassContext, (XPointer)0);
+  TPen::_forgetDrawable(x11window);
   XDestroyWindow(x11display, x11window);
   x11window = 0;
 #endif
@@ -1303,7 +1317,27 @@ TWindow::lowerWindow()
 // Paint Queue
 //----------------------------------------------------------------------------
 
-static queue<TWindow::TPaintRegion*> paint_region_queue;
+static deque<TWindow::TPaintRegion*> paint_region_queue;
+static TWindow::TPaintFrameStatistics paint_frame_statistics;
+static unsigned paint_frame_budget = 0;
+
+namespace {
+
+struct TPaintFrameEntry {
+  TWindow::TPaintRegion *rgn;
+  unsigned depth;
+  bool operator<(const TPaintFrameEntry &e) const { return depth < e.depth; }
+};
+
+unsigned long
+paintClock()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+} // namespace
 
 //! Static method returning `true' when there are event in the paint queue.
 //---------------------------------------------------------------------------
@@ -1329,9 +1363,72 @@ TWindow::_dispatchPaintEvent()
   }
     
   TPaintRegion *rgn = paint_region_queue.front();
-  paint_region_queue.pop();
+  paint_region_queue.pop_front();
 //  THREAD_UNLOCK(mutexPaintQueue);
+  _dispatchPaintRegion(rgn);
+  THREAD_UNLOCK(mutexPaintQueue);
+}
+
+/**
+ * Static method to handle all paint events in the paint queue.
+ *
+ * Parent windows are painted before their children and the requests are
+ * sent to the X server with a single XFlush at the end of the frame.
+ * Paint events created while painting are left for the next frame, as
+ * are the remaining events when the frame exceeds the paint frame budget.
+ */
+void
+TWindow::_dispatchPaintFrame()
+{
+  if (paint_region_queue.empty())
+    return;
+
+  unsigned long start = paintClock();
+
+  vector<TPaintFrameEntry> frame;
+  frame.reserve(paint_region_queue.size());
+  for(deque<TPaintRegion*>::iterator p = paint_region_queue.begin();
+      p != paint_region_queue.end();
+      ++p)
+  {
+    TPaintFrameEntry e;
+    e.rgn = *p;
+    e.depth = 0;
+    if (e.rgn->wnd) {
+      for(TInteractor *i = e.rgn->wnd->TInteractor::getParent(); i; i=i->TInteractor::getParent())
+        ++e.depth;
+    }
+    frame.push_back(e);
+  }
+  paint_region_queue.clear();
+  stable_sort(frame.begin(), frame.end());
   
+  size_t i = 0;
+  while(i<frame.size()) {
+    _dispatchPaintRegion(frame[i++].rgn);
+    ++paint_frame_statistics.regions;
+    if (paint_frame_budget && paintClock() - start >= paint_frame_budget)
+      break;
+  }
+  if (i<frame.size()) {
+    paint_frame_statistics.deferred += frame.size() - i;
+    for(size_t j=frame.size(); j>i; --j)
+      paint_region_queue.push_front(frame[j-1].rgn);
+  }
+
+  XFlush(x11display);
+
+  unsigned long duration = paintClock() - start;
+  ++paint_frame_statistics.frames;
+  paint_frame_statistics.last = duration;
+  paint_frame_statistics.total += duration;
+  if (duration > paint_frame_statistics.max)
+    paint_frame_statistics.max = duration;
+}
+
+void
+TWindow::_dispatchPaintRegion(TPaintRegion *rgn)
+{
   if (rgn->wnd) { // when the region is still valid...
     if (rgn->wnd->x11window)  { // .. and the window is still valid:
       TRectangle wrect(0, 0, rgn->wnd->w, rgn->wnd->h);
@@ -1361,9 +1458,43 @@ TWindow::_dispatchPaintEvent()
     rgn->wnd->paint_rgn = NULL;
   }
   delete rgn;
-  THREAD_UNLOCK(mutexPaintQueue);
 }
 
+/**
+ * Returns the frame time statistics of the paint queue.
+ */
+const TWindow::TPaintFrameStatistics&
+TWindow::getPaintFrameStatistics()
+{
+  return paint_frame_statistics;
+}
+
+void
+TWindow::resetPaintFrameStatistics()
+{
+  memset(&paint_frame_statistics, 0, sizeof(paint_frame_statistics));
+}
+
+/**
+ * Limit the time spend on painting before other events are handled.
+ *
+ * At least one paint event is handled per frame.
+ *
+ * \param usec
+ *   The budget in microseconds or 0 to paint all queued events in one
+ *   frame, which is the default.
+ */
+void
+TWindow::setPaintFrameBudget(unsigned usec)
+{
+  paint_frame_budget = usec;
+}
+
+unsigned
+TWindow::getPaintFrameBudget()
+{
+  return paint_frame_budget;
+}
 
 /**
  * See that `TRegion *paint_rgn' contains a region.
@@ -1375,7 +1506,7 @@ TWindow::_providePaintRgn()
 //printf("TWindow: creating paint region for %lx\n",(long)this);
     paint_rgn = new TPaintRegion;
     paint_rgn->wnd = this;
-    paint_region_queue.push(paint_rgn);
+    paint_region_queue.push_back(paint_rgn);
   }
 }
 #endif
@@ -1809,6 +1940,7 @@ TWindow::doResize()
   if (flag_wm_resize)
     return;
   flag_wm_resize = true;
+  TBitmap::invalidateBackBuffers(this, w, h);
   if (layout)
     layout->arrange();
   resize();
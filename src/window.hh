@@ -438,9 +438,26 @@ class TWindow:
   public:
     TRGB _bg; // background color
     class TPaintRegion;
+
+    //! Frame time statistics of the paint queue, durations are in microseconds.
+    struct TPaintFrameStatistics {
+      unsigned long frames;   //!< number of painted frames
+      unsigned long regions;  //!< number of painted regions
+      unsigned long deferred; //!< regions postponed to the next frame by the budget
+      unsigned long last;     //!< duration of the last frame
+      unsigned long max;      //!< duration of the longest frame
+      unsigned long total;    //!< sum of all frame durations
+    };
+    static const TPaintFrameStatistics& getPaintFrameStatistics();
+    static void resetPaintFrameStatistics();
+    static void setPaintFrameBudget(unsigned usec);
+    static unsigned getPaintFrameBudget();
+
   private:
     static bool _havePaintEvents();
     static void _dispatchPaintEvent();
+    static void _dispatchPaintFrame();
+    static void _dispatchPaintRegion(TPaintRegion*);
     TPaintRegion *paint_rgn;
     
   public:
@@ -0,0 +1,140 @@
+/*
+ * TOAD -- A Simple and Powerful C++ GUI Toolkit for the X Window System
+ * Copyright (C) 1996-2007 by Mark-André Hopf <mhopf@mark13.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, 
+ * MA  02111-1307,  USA
+ */
+
+#include <toad/workerpool.hh>
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace toad;
+
+/*
+ * A small pool of threads for the jobs which TBitmap::loadAsync() and
+ * TTreeModel::loadChildren() run in the background.
+ *
+ * Threads are started on demand whenever no idle thread can take a
+ * queued job, up to one thread per processor but at most 4. They remain until terminate() is called.
+ */
+
+namespace {
+
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+deque<TWorkerJob*> queue;
+vector<pthread_t> threads;
+size_t idle = 0;
+unsigned max_threads = 0;
+bool quit = false;
+
+void*
+worker(void*)
+{
+  while(true) {
+    pthread_mutex_lock(&mutex);
+    while(queue.empty() && !quit) {
+      ++idle;
+      pthread_cond_wait(&cond, &mutex);
+      --idle;
+    }
+    if (quit) {
+      pthread_mutex_unlock(&mutex);
+      break;
+    }
+    TWorkerJob *job = queue.front();
+    queue.pop_front();
+    pthread_mutex_unlock(&mutex);
+    job->run();
+  }
+  return 0;
+}
+
+} // namespace
+
+TWorkerJob::~TWorkerJob()
+{
+}
+
+/**
+ * Queue 'job' for one of the worker threads.
+ *
+ * \return
+ *   'false' when no thread could be started, the job isn't queued then
+ *   and the caller has to do the work itself
+ */
+bool
+TWorkerPool::submit(TWorkerJob *job)
+{
+  pthread_mutex_lock(&mutex);
+  queue.push_back(job);
+  unsigned n = max_threads;
+  if (n==0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    n = cpus<1 ? 1 : cpus>4 ? 4 : cpus;
+  }
+  if (threads.size() < n && idle < queue.size()) {
+    pthread_t thread;
+    if (pthread_create(&thread, 0, worker, 0)==0)
+      threads.push_back(thread);
+  }
+  bool queued = !threads.empty();
+  if (queued)
+    pthread_cond_signal(&cond);
+  else
+    queue.pop_back();
+  pthread_mutex_unlock(&mutex);
+  return queued;
+}
+
+/**
+ * Set the maximal number of worker threads. The default 0 uses one
+ * thread per processor but at most 4.
+ */
+void
+TWorkerPool::setThreads(unsigned n)
+{
+  pthread_mutex_lock(&mutex);
+  max_threads = n;
+  pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * Stop the worker threads after their current job and discard the jobs
+ * still queued. Called by TOADBase::terminate.
+ */
+void
+TWorkerPool::terminate()
+{
+  pthread_mutex_lock(&mutex);
+  quit = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+  for(size_t i=0; i<threads.size(); ++i)
+    pthread_join(threads[i], 0);
+  threads.clear();
+  while(!queue.empty()) {
+    TWorkerJob *job = queue.front();
+    queue.pop_front();
+    job->discard();
+  }
+  quit = false;
+}
@@ -0,0 +1,53 @@
+/*
+ * TOAD -- A Simple and Powerful C++ GUI Toolkit for the X Window System
+ * Copyright (C) 1996-2007 by Mark-André Hopf <mhopf@mark13.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, 
+ * MA  02111-1307,  USA
+ */
+
+#ifndef _TOAD_WORKERPOOL_HH
+#define _TOAD_WORKERPOOL_HH 1
+
+namespace toad {
+
+/**
+ * A job for TWorkerPool.
+ */
+class TWorkerJob
+{
+  public:
+    virtual ~TWorkerJob();
+    //! called by one of the worker threads
+    virtual void run() = 0;
+    //! called by TWorkerPool::terminate for jobs which didn't run
+    virtual void discard() = 0;
+};
+
+/**
+ * The threads shared by the background loaders of TBitmap and
+ * TTreeModel.
+ */
+class TWorkerPool
+{
+  public:
+    static bool submit(TWorkerJob *job);
+    static void setThreads(unsigned n);
+    static void terminate();
+};
+
+} // namespace toad
+
+#endif
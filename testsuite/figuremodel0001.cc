@@ -0,0 +1,91 @@
+/*
+ * This program adds, erases and translates random rectangles in a
+ * figure model and compares findFigures and findFiguresInside with a
+ * linear scan of the model, including the order of the result.
+ */
+
+#include <stdlib.h>
+
+#include <toad/figuremodel.hh>
+#include <toad/figure.hh>
+#include <iostream>
+
+using namespace toad;
+
+static TCoord
+coord(int max)
+{
+  return rand() % max;
+}
+
+static bool
+intersects(const TRectangle &b, const TRectangle &r)
+{
+  return b.x<=r.x+r.w && r.x<=b.x+b.w && b.y<=r.y+r.h && r.y<=b.y+b.h;
+}
+
+static bool
+inside(const TRectangle &b, const TRectangle &r)
+{
+  return r.x<=b.x && b.x+b.w<=r.x+r.w && r.y<=b.y && b.y+b.h<=r.y+r.h;
+}
+
+static bool
+check(TFigureModel &model)
+{
+  TRectangle r(coord(1000), coord(1000), coord(300), coord(300));
+  TFigureVector expect_intersect, expect_inside, found;
+  for(TFigureModel::iterator p=model.begin(); p!=model.end(); ++p) {
+    TRectangle b;
+    TFigureModel::getFigureBounds(*p, &b);
+    if (intersects(b, r))
+      expect_intersect.push_back(*p);
+    if (inside(b, r))
+      expect_inside.push_back(*p);
+  }
+
+  model.findFigures(r, &found);
+  if (found!=expect_intersect) {
+    cout << "findFigures found " << found.size() << " figures, expected "
+         << expect_intersect.size() << " in storage order\n";
+    return false;
+  }
+  model.findFiguresInside(r, &found);
+  if (found!=expect_inside) {
+    cout << "findFiguresInside found " << found.size() << " figures, expected "
+         << expect_inside.size() << " in storage order\n";
+    return false;
+  }
+  return true;
+}
+
+int
+main()
+{
+  srand(1);
+  TFigureModel model;
+  for(unsigned i=0; i<20000; ++i) {
+    switch(model.empty() ? 0 : rand()%4) {
+      case 0:
+      case 1:
+        model.add(new TFRectangle(coord(1000), coord(1000), coord(100), coord(100)));
+        break;
+      case 2: {
+        TFigureSet set;
+        for(unsigned j=1+rand()%3; j>0; --j)
+          set.insert(*(model.begin() + rand()%model.size()));
+        model.erase(set);
+      } break;
+      case 3: {
+        TFigureSet set;
+        for(unsigned j=rand()%4; j>0; --j)
+          set.insert(*(model.begin() + rand()%model.size()));
+        model.translate(set, coord(200)-100, coord(200)-100);
+      } break;
+    }
+    if (!check(model))
+      return 1;
+  }
+  cout << "OKAY\n";
+  return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * This program paints into a TRasterPen and checks the pixel coverage
+ * of fillRectangle and drawLine at integer coordinates, the clipping
+ * region and the even-odd rule for a self-intersecting polygon.
+ */
+
+#include <toad/rasterpen.hh>
+#include <cmath>
+#include <iostream>
+
+using namespace toad;
+
+static bool failed = false;
+
+static int
+red(const TRasterPen &pen, int x, int y)
+{
+  return pen.getData()[(y*pen.width+x)*4];
+}
+
+static void
+expect(const TRasterPen &pen, const char *what, int x, int y, bool black)
+{
+  int r = red(pen, x, y);
+  if (black ? r>32 : r<223) {
+    cout << what << ": pixel (" << x << ", " << y << ") is " << r
+         << " but should be " << (black ? "black" : "white") << "\n";
+    failed = true;
+  }
+}
+
+// everything inside x0..x1, y0..y1 is black, everything else is white
+static void
+expectBox(const TRasterPen &pen, const char *what, int x0, int y0, int x1, int y1)
+{
+  for(int y=0; y<pen.height; ++y) {
+    for(int x=0; x<pen.width; ++x) {
+      expect(pen, what, x, y, x0<=x && x<=x1 && y0<=y && y<=y1);
+    }
+  }
+}
+
+int
+main()
+{
+  {
+    TRasterPen pen(16, 16);
+    pen.setColor(0, 0, 0);
+    pen.fillRectangle(2, 3, 4, 5);
+    expectBox(pen, "fillRectangle", 2, 3, 6, 8);
+  }
+
+  {
+    TRasterPen pen(16, 16);
+    pen.setColor(0, 0, 0);
+    pen.drawLine(1, 8, 10, 8);
+    expectBox(pen, "horizontal drawLine", 1, 8, 10, 8);
+  }
+
+  {
+    TRasterPen pen(16, 16);
+    pen.setColor(0, 0, 0);
+    pen.drawLine(4, 2, 4, 12);
+    expectBox(pen, "vertical drawLine", 4, 2, 4, 12);
+  }
+
+  {
+    TRasterPen pen(16, 16);
+    pen.setColor(0, 0, 0);
+    pen.setClipRect(TRectangle(3, 4, 5, 6));
+    pen.fillRectangle(0, 0, 15, 15);
+    expectBox(pen, "clipped fillRectangle", 3, 4, 7, 9);
+  }
+
+  {
+    // a pentagram: under the even-odd rule the inner pentagon stays empty
+    TRasterPen pen(64, 64);
+    pen.setColor(0, 0, 0);
+    TPoint p[5];
+    for(int i=0; i<5; ++i) {
+      double a = -M_PI/2 + i*4*M_PI/5;
+      p[i].set(32 + 30*cos(a), 32 + 30*sin(a));
+    }
+    pen.fillPolygon(p, 5);
+    expect(pen, "pentagram centre", 32, 32, false);
+    expect(pen, "pentagram top", 32, 14, true);
+    expect(pen, "pentagram bottom left", 20, 52, true);
+    expect(pen, "pentagram outside", 10, 10, false);
+
+    pen.fillPolygon(p, 0);
+    pen.drawLines(p, 0);
+    pen.drawPolygon(p, 0);
+  }
+
+  if (failed)
+    return 1;
+  cout << "OKAY\n";
+  return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * This program performs random inserts and erases on a text model and
+ * compares substr, find, rfind, lineStart and lineOf with a control
+ * string after each step.
+ */
+
+#include <stdlib.h>
+
+#include <toad/textmodel.hh>
+#include <iostream>
+
+using namespace toad;
+
+static string
+randomText(unsigned len)
+{
+  static const char chars[] = "ab\n";
+  string s;
+  for(unsigned i=0; i<len; ++i)
+    s += chars[rand()%3];
+  return s;
+}
+
+static bool
+check(const TTextModel &model, const string &str)
+{
+  if (model.size()!=str.size() || model.getValue()!=str) {
+    cout << "model = '" << model.getValue() << "'\n";
+    cout << "str   = '" << str << "'\n";
+    cout << "MISMATCH\n";
+    return false;
+  }
+
+  size_t p = str.empty() ? 0 : rand() % (str.size()+1);
+  size_t n = rand() % 20;
+  if (model.substr(p, n)!=str.substr(p, n)) {
+    cout << "substr(" << p << ", " << n << ") differs\n";
+    return false;
+  }
+
+  string pattern = randomText(1 + rand()%3);
+  if (model.find(pattern, p)!=str.find(pattern, p)) {
+    cout << "find('" << pattern << "', " << p << ") differs\n";
+    return false;
+  }
+  if (model.rfind(pattern, p)!=str.rfind(pattern, p)) {
+    cout << "rfind('" << pattern << "', " << p << ") differs\n";
+    return false;
+  }
+  if (model.find('\n', p)!=str.find('\n', p) ||
+      model.rfind('\n', p)!=str.rfind('\n', p))
+  {
+    cout << "find/rfind('\\n', " << p << ") differs\n";
+    return false;
+  }
+
+  unsigned line = 0;
+  size_t start = 0;
+  for(size_t i=0; i<=str.size(); ++i) {
+    if (model.lineOf(i)!=line) {
+      cout << "lineOf(" << i << ") = " << model.lineOf(i)
+           << " but should be " << line << "\n";
+      return false;
+    }
+    if (i==start && model.lineStart(line)!=start) {
+      cout << "lineStart(" << line << ") = " << model.lineStart(line)
+           << " but should be " << start << "\n";
+      return false;
+    }
+    if (i<str.size() && str[i]=='\n') {
+      ++line;
+      start = i+1;
+    }
+  }
+  if (model.lineStart(line+1)!=TTextModel::npos) {
+    cout << "lineStart(" << line+1 << ") should be npos\n";
+    return false;
+  }
+  return true;
+}
+
+int
+main()
+{
+  srand(1);
+  TTextModel model;
+  string str;
+  for(unsigned i=0; i<5000; ++i) {
+    size_t p = rand() % (str.size()+1);
+    if (str.size()<2000 && rand()%3!=0) {
+      string s = randomText(1 + rand() % (rand()%10==0 ? 200 : 8));
+      model.insert(p, s);
+      str.insert(p, s);
+    } else {
+      size_t n = rand() % (rand()%10==0 ? 200 : 8);
+      model.erase(p, n);
+      str.erase(p, n);
+    }
+    if (!check(model, str))
+      return 1;
+  }
+  cout << "OKAY\n";
+  return 0;
+}